@@ -2,6 +2,10 @@
 #define ACCOUNT_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROFILE_CACHE_SIZE 1024  // Profiles kept in memory (LRU beyond this)
 
 typedef struct {
     int user_id;
@@ -9,12 +13,29 @@ typedef struct {
     char email[128];
     char password_hash[65];  // SHA-256 hex
     int rating;
+    double rd;
+    double volatility;
     int wins;
     int losses;
     int draws;
     char created_at[32];
 } user_t;
 
+// Fields of a user read on the game paths. Served from an in-memory LRU
+// cache keyed by user_id; rating and stats writes go through the account
+// layer, which updates the database first and then the cached copy.
+// Event loop thread only.
+typedef struct {
+    int user_id;
+    char username[64];
+    int rating;
+    double rd;          // Glicko-2 rating deviation
+    double volatility;  // Glicko-2 volatility
+    int wins;
+    int losses;
+    int draws;
+} profile_t;
+
 // Account operations
 bool account_register(const char* username, const char* email,
                       const char* password_hash, int* out_user_id);
@@ -23,6 +44,29 @@ bool account_login(const char* username, const char* password_hash,
 bool account_get_by_id(int user_id, user_t* out_user);
 bool account_update_rating(int user_id, int new_rating);
 bool account_update_stats(int user_id, int wins, int losses, int draws);
+// A rated game's outcome: both players' new rating, deviation, volatility
+// and W/L/D (computed by the caller) are written together with the match
+// row in one database transaction; the cache and leaderboard follow once it
+// commits.
+// start_fen: NULL for the standard start.
+bool account_settle_match(const profile_t* red, const profile_t* black,
+                          const char* match_id, const char* result,
+                          const char* moves_json, const char* started_at,
+                          const char* ended_at, const char* start_fen);
+// Record a user just inserted in the database (leaderboard entry)
+void account_created(int user_id, const char* username);
+
+// Profile cache
+bool account_cache_init(void);
+void account_cache_shutdown(void);
+// Cached profile, loaded from the database on a miss
+bool account_get_profile(int user_id, profile_t* out);
+// Username and/or rating of a user (each output may be NULL)
+bool account_lookup(int user_id, char* out_username, size_t username_size,
+                    int* out_rating);
+uint64_t account_cache_hits(void);
+uint64_t account_cache_misses(void);
+int account_cache_count(void);
 
 // Validation
 bool validate_username(const char* username);
@@ -0,0 +1,77 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "match.h"
+#include "xiangqi.h"
+
+// Post-game analysis: finished games are queued, searched position by
+// position at a fixed depth on low-priority worker threads, and the
+// annotated result is handed back to the event loop (eventfd) to be stored.
+
+#define ANALYSIS_WORKERS 1
+#define ANALYSIS_QUEUE_SIZE 32          // Queued + running + undelivered games
+#define ANALYSIS_DEPTH 6                // Fixed search depth per position
+#define ANALYSIS_POSITION_TIME_MS 500   // Safety cap per position
+#define ANALYSIS_MAX_GAMES_PER_MIN 20   // Throughput cap for the whole pool
+#define ANALYSIS_NICE 10                // Worker priority below the event loop
+#define ANALYSIS_MIN_PLIES 10           // Shorter games are not worth it
+
+// Centipawn loss thresholds for annotations
+#define ANALYSIS_INACCURACY_CP 50
+#define ANALYSIS_MISTAKE_CP 100
+#define ANALYSIS_BLUNDER_CP 300
+#define ANALYSIS_MATE_CP 2000  // Mate scores are clamped to this
+
+typedef enum {
+    ANALYSIS_TAG_NONE,
+    ANALYSIS_TAG_INACCURACY,
+    ANALYSIS_TAG_MISTAKE,
+    ANALYSIS_TAG_BLUNDER
+} analysis_tag_t;
+
+typedef struct {
+    int cp_loss;          // Versus the engine's best move, >= 0
+    analysis_tag_t tag;
+    xq_move_t best_move;  // Engine's choice in the position before the move
+} analysis_ply_t;
+
+typedef struct {
+    // Input
+    char match_id[64];
+    int red_user_id;
+    int black_user_id;
+    xq_position_t start;  // Setup the game started from
+    int move_count;
+    xq_move_t moves[MAX_MOVES_PER_MATCH];
+    // Output
+    bool completed;  // false if cut short by shutdown
+    analysis_ply_t plies[MAX_MOVES_PER_MATCH];
+    int accuracy[2];  // Per side (XQ_RED, XQ_BLACK), 0..100
+    int inaccuracies[2];
+    int mistakes[2];
+    int blunders[2];
+    int elapsed_ms;
+} analysis_job_t;
+
+bool analysis_init(void);   // Needs engine_init first
+void analysis_shutdown(void);  // Call before engine_shutdown
+int analysis_get_notify_fd(void);
+
+// Queue a finished match; false if it is too short, does not replay or the
+// queue is full (counted as dropped)
+bool analysis_submit_match(const match_t* match);
+int analysis_poll_results(analysis_job_t* out, int max_count);
+
+// Metrics
+int analysis_get_backlog(void);  // Games queued or running
+uint64_t analysis_get_completed(void);
+uint64_t analysis_get_dropped(void);
+
+const char* analysis_tag_name(analysis_tag_t tag);
+// Annotations as JSON (caller frees; NULL rather than a truncated document)
+char* analysis_to_json(const analysis_job_t* job);
+
+#endif  // ANALYSIS_H
@@ -3,12 +3,19 @@
 
 #include <stdbool.h>
 
+#include "match.h"
 #include "server.h"
 
 // Broadcast to all clients in a match
 void broadcast_to_match(server_t* server, const char* match_id,
                         const char* message);
 
+// Send a match event ({"type":...} message) to the players, except
+// exclude_user_id (0 = none), and the spectators, tagged with the match's
+// next event_seq
+void broadcast_match_event(server_t* server, match_t* match,
+                           int exclude_user_id, const char* message);
+
 // Broadcast to all ready players in lobby
 void broadcast_to_lobby(server_t* server, const char* message);
 
@@ -0,0 +1,44 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DEFAULT_BASE_TIME_MS 600000  // 10 minutes
+
+// Lag compensation: refund this share of the mover's smoothed RTT per move,
+// never more than LAG_COMP_MAX_MS
+#define LAG_COMP_SHARE_PERCENT 80
+#define LAG_COMP_MAX_MS 500
+
+// Time control descriptor
+typedef struct {
+    int base_ms;        // Starting time per side
+    int increment_ms;   // Fischer increment, added after every completed move
+    int delay_ms;       // Bronstein delay, refunds min(think, delay) per move
+    int move_limit_ms;  // Hard cap on a single move (0 = no limit)
+} time_control_t;
+
+// Monotonic clock (CLOCK_MONOTONIC), unaffected by wall-clock changes
+int64_t clock_now_ms(void);
+
+time_control_t time_control_make(int base_ms, int increment_ms, int delay_ms,
+                                 int move_limit_ms);
+
+// Remaining time shown while a side is still thinking (never negative)
+int clock_project_remaining(const time_control_t* tc, int remaining_ms,
+                            int64_t think_ms);
+
+// Milliseconds until the thinking side flags (<= 0 means already flagged)
+int64_t clock_ms_until_flag(const time_control_t* tc, int remaining_ms,
+                            int64_t think_ms);
+
+// Per-move refund for a connection with the given smoothed RTT (-1 = unknown)
+int clock_lag_compensation_ms(int rtt_ms);
+
+// Charge a completed move to the mover's clock and apply delay/increment.
+// Returns false if the mover flagged before completing the move.
+bool clock_charge_move(const time_control_t* tc, int* remaining_ms,
+                       int64_t think_ms);
+
+#endif  // CLOCK_H
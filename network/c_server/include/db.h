@@ -32,24 +32,61 @@ bool db_get_user_by_username(const char* username, int* out_user_id,
                              char* out_password_hash, int* out_rating);
 bool db_get_user_by_id(int user_id, char* out_username, char* out_email,
                        int* out_rating, int* out_wins, int* out_losses,
-                       int* out_draws);
+                       int* out_draws, double* out_rd, double* out_volatility);
 bool db_update_user_rating(int user_id, int new_rating);
 bool db_update_user_stats(int user_id, int wins, int losses, int draws);
+// Write a recomputed Glicko-2 rating (rating replay)
+bool db_update_user_glicko(int user_id, int rating, double rd, double volatility);
+// Stream every user (leaderboard load). Stops early when the callback
+// returns false.
+typedef bool (*db_user_row_fn)(int user_id, const char* username, int rating, double rd,
+                               int wins, int losses, int draws, void* ctx);
+bool db_scan_users(db_user_row_fn callback, void* ctx);
 
 // Match operations
+// start_fen: NULL for the standard start
 bool db_save_match(const char* match_id, int red_user_id, int black_user_id,
                    const char* result, const char* moves_json,
-                   const char* started_at, const char* ended_at);
-bool db_get_match(const char* match_id, char* out_json, size_t json_size);
+                   const char* started_at, const char* ended_at,
+                   const char* start_fen);
+// A rated game's outcome: both players' new rows and the match row (marked
+// rated), written in one transaction sent as a single batch (one round
+// trip). Nothing is written unless all of it is.
+typedef struct {
+    int user_id;
+    int rating;
+    double rd;
+    double volatility;
+    int wins;
+    int losses;
+    int draws;
+} db_player_result_t;
+bool db_settle_match(const db_player_result_t* red, const db_player_result_t* black,
+                     const char* match_id, const char* result, const char* moves_json,
+                     const char* started_at, const char* ended_at,
+                     const char* start_fen);
+// Match as JSON, moves_json included whole (caller frees; NULL if not found)
+char* db_get_match(const char* match_id);
+bool db_save_match_analysis(const char* match_id, int red_accuracy,
+                            int black_accuracy, const char* annotations_json);
+// Stream every stored match (archive tools). start_fen is "" for the
+// standard start; moves_json is read whole, whatever its length; ratings
+// are the players' current ones (0 if unknown). Stops early when the
+// callback returns false.
+typedef bool (*db_match_row_fn)(const char* match_id, const char* result,
+                                const char* start_fen, const char* moves_json,
+                                int red_rating, int black_rating, void* ctx);
+bool db_scan_matches(db_match_row_fn callback, void* ctx);
+// Stream the outcome of every rated match, oldest first (rating replay).
+// ended_at is epoch seconds. Stops early when the callback returns false.
+typedef bool (*db_result_row_fn)(int red_user_id, int black_user_id, const char* result,
+                                 long long ended_at, void* ctx);
+bool db_scan_rated_results(db_result_row_fn callback, void* ctx);
 bool db_get_match_history(int user_id, int limit, int offset, char* out_json, size_t json_size);
 
 // Profile - get detailed user stats
 bool db_get_user_profile(int user_id, char* out_json, size_t json_size);
 
-// Leaderboard
-bool db_get_leaderboard(int limit, int offset, char* out_json,
-                        size_t json_size);
-
 // Utility
 bool db_execute(const char* sql);
 bool db_check_username_exists(const char* username);
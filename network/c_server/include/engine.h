@@ -0,0 +1,86 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "xiangqi.h"
+
+// Search engine: PVS alpha-beta with a shared transposition table,
+// quiescence search and iterative deepening, run as Lazy-SMP threads.
+// Searches run on a dedicated worker pool; finished jobs are handed back
+// to the event loop through an eventfd so the loop never blocks on them.
+
+#define ENGINE_MAX_PLY 64
+#define ENGINE_MAX_HISTORY 512   // Game positions kept for repetition checks
+#define ENGINE_WORKERS 2         // Jobs searched concurrently
+#define ENGINE_MAX_THREADS 4     // Lazy-SMP threads per job
+#define ENGINE_QUEUE_SIZE 64     // Queued + running + undelivered jobs
+#define ENGINE_TT_BITS 20        // 2^20 entries * 16 bytes = 16 MB
+
+#define ENGINE_MATE 29000
+#define ENGINE_MATE_BOUND (ENGINE_MATE - ENGINE_MAX_PLY)
+
+// Bots are matchmaking participants with reserved negative user ids
+#define BOT_LEVEL_MIN 1
+#define BOT_LEVEL_MAX 5
+#define BOT_USER_ID_BASE (-1000)  // Bot of level L has id BOT_USER_ID_BASE - L
+#define BOT_DEFAULT_LEVEL 3
+
+#define HINT_DEFAULT_TIME_MS 1000
+#define HINT_MAX_TIME_MS 3000
+
+typedef struct {
+    int time_ms;    // Hard budget for the whole search
+    int max_depth;  // Iterative deepening stops here (<= ENGINE_MAX_PLY)
+    int threads;    // Lazy-SMP threads (1..ENGINE_MAX_THREADS)
+    int noise_cp;   // Random root noise for weak bots (0 = best play)
+} engine_limits_t;
+
+typedef struct {
+    xq_move_t best_move;  // XQ_NO_MOVE if the side to move has no legal move
+    int score;            // Centipawns from the mover's view; mates near ±ENGINE_MATE
+    int depth;            // Deepest completed iteration
+    uint64_t nodes;
+    int elapsed_ms;
+} engine_result_t;
+
+typedef enum { ENGINE_JOB_BOT_MOVE, ENGINE_JOB_HINT } engine_job_kind_t;
+
+typedef struct {
+    engine_job_kind_t kind;
+    // Routing back to the requester (opaque to the engine)
+    int match_handle;
+    int move_count;  // Ply the search was started from, to detect stale results
+    int user_id;
+    int client_fd;
+    int seq;
+    // Input
+    xq_position_t position;
+    uint64_t history[ENGINE_MAX_HISTORY];  // Earlier position hashes, oldest first
+    int history_len;
+    engine_limits_t limits;
+    // Output
+    engine_result_t result;
+} engine_job_t;
+
+// Worker pool
+bool engine_init(void);
+void engine_shutdown(void);
+int engine_get_notify_fd(void);            // Readable when results are waiting
+bool engine_submit(const engine_job_t* job);  // false if the queue is full
+int engine_poll_results(engine_job_t* out, int max_count);
+int engine_get_backlog(void);              // Jobs queued or running
+
+// Synchronous search on the calling thread (plus its Lazy-SMP helpers)
+void engine_search(const xq_position_t* position, const uint64_t* history,
+                   int history_len, const engine_limits_t* limits,
+                   engine_result_t* out);
+
+// Bots
+bool engine_is_bot(int user_id);
+int engine_bot_level(int user_id);  // 0 if not a bot
+int engine_bot_user_id(int level);
+void engine_bot_limits(int level, engine_limits_t* out);
+
+#endif  // ENGINE_H
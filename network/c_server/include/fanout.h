@@ -0,0 +1,25 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+// Link between the game server and the spectator fan-out processes
+// (tools/fanout.c). The game server listens on FANOUT_SOCKET_PATH; a fanout
+// process connects once and then receives, newline-delimited, every event
+// of every match exactly as the players got it:
+//   {"type":"match_event","match_id":"...","event_seq":N,"message":{...}}
+// It asks for a match's current state with
+//   {"type":"fanout_snapshot","seq":S,"payload":{"match_id":"..."}}
+// which is answered by a normal response whose payload is
+//   {"match_id":"...","snapshot":{...}}   (match_get_snapshot_json)
+// Responses and events share one ordered stream, so a snapshot arrives
+// after every event it already includes and before every later one.
+
+#define FANOUT_SOCKET_PATH "xiangqi-fanout.sock"
+#define FANOUT_MAX_PEERS 8      // Fanout processes per game server
+#define FANOUT_DEFAULT_PORT 9001  // Spectator port of a fanout process
+// A fanout peer carries every match's events on one connection, so a burst
+// across many matches must not look like a stalled player: its send queue
+// grows well past CLIENT_OUTQ_MAX before the server gives up on it
+#define FANOUT_OUTQ_MAX 65536
+#define FANOUT_OUTQ_MAX_BYTES (64 * 1024 * 1024)
+
+#endif  // FANOUT_H
@@ -9,16 +9,23 @@ void handle_register(server_t* server, client_t* client, message_t* msg);
 void handle_login(server_t* server, client_t* client, message_t* msg);
 void handle_logout(server_t* server, client_t* client, message_t* msg);
 void handle_set_ready(server_t* server, client_t* client, message_t* msg);
+void handle_get_lobby_snapshot(server_t* server, client_t* client, message_t* msg);
 void handle_find_match(server_t* server, client_t* client, message_t* msg);
 void handle_move(server_t* server, client_t* client, message_t* msg);
+void handle_premove(server_t* server, client_t* client, message_t* msg);
+void handle_get_hint(server_t* server, client_t* client, message_t* msg);
+void handle_probe_tablebase(server_t* server, client_t* client, message_t* msg);
+void handle_opening_explorer(server_t* server, client_t* client, message_t* msg);
 void handle_resign(server_t* server, client_t* client, message_t* msg);
 void handle_draw_offer(server_t* server, client_t* client, message_t* msg);
 void handle_draw_response(server_t* server, client_t* client, message_t* msg);
 void handle_challenge(server_t* server, client_t* client, message_t* msg);
 void handle_challenge_response(server_t* server, client_t* client, message_t* msg);
+void handle_get_challenges(server_t* server, client_t* client, message_t* msg);
 void handle_get_match(server_t* server, client_t* client, message_t* msg);
 void handle_leaderboard(server_t* server, client_t* client, message_t* msg);
 void handle_heartbeat(server_t* server, client_t* client, message_t* msg);
+void handle_pong(server_t* server, client_t* client, message_t* msg);
 void handle_chat_message(server_t* server, client_t* client, message_t* msg);
 
 // Room handlers
@@ -39,6 +46,8 @@ void handle_match_history(server_t* server, client_t* client, message_t* msg);
 void handle_get_live_matches(server_t* server, client_t* client, message_t* msg);
 void handle_join_spectate(server_t* server, client_t* client, message_t* msg);
 void handle_leave_spectate(server_t* server, client_t* client, message_t* msg);
+void handle_resync_from(server_t* server, client_t* client, message_t* msg);
+void handle_fanout_snapshot(server_t* server, client_t* client, message_t* msg);
 
 // Profile handler
 void handle_get_profile(server_t* server, client_t* client, message_t* msg);
@@ -46,6 +55,20 @@ void handle_get_profile(server_t* server, client_t* client, message_t* msg);
 // Timer handler
 void handle_get_timer(server_t* server, client_t* client, message_t* msg);
 
+// Stats handler
+void handle_get_server_stats(server_t* server, client_t* client, message_t* msg);
+
+// Worker pool and matchmaking results (driven by the event loop)
+void handlers_process_engine_results(server_t* server);
+void handlers_process_analysis_results(server_t* server);
+void handlers_process_matchmaking_results(server_t* server);
+// Flagged clocks, settled (driven by the event loop every iteration)
+void handlers_process_timeouts(server_t* server);
+// Latest-state frame for a lagging spectator (pubsub_snapshot_fn)
+bool handlers_spectator_snapshot(const char* match_id, char* out, size_t size);
+// Rating shown in the live match list (live_rating_fn)
+int handlers_player_rating(int user_id);
+
 // Handler dispatcher
 void dispatch_handler(server_t* server, client_t* client, message_t* msg);
 
@@ -0,0 +1,49 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Open-addressing hash maps (linear probing, backward-shift deletion).
+// Values are plain ints - callers store slot indices into their own arrays.
+
+// int key -> int value
+typedef struct {
+    int* keys;
+    int* values;
+    bool* used;
+    size_t capacity;  // Always a power of two
+    size_t count;
+} int_map_t;
+
+// string key (copied) -> int value
+typedef struct {
+    char** keys;
+    uint32_t* hashes;
+    int* values;
+    size_t capacity;  // Always a power of two
+    size_t count;
+} str_map_t;
+
+// Hash helpers
+uint32_t hash_string(const char* str);
+uint32_t hash_int(int key);
+
+// int_map
+bool int_map_init(int_map_t* map, size_t initial_capacity);
+void int_map_free(int_map_t* map);
+void int_map_clear(int_map_t* map);
+bool int_map_put(int_map_t* map, int key, int value);
+bool int_map_get(const int_map_t* map, int key, int* out_value);
+bool int_map_remove(int_map_t* map, int key);
+
+// str_map
+bool str_map_init(str_map_t* map, size_t initial_capacity);
+void str_map_free(str_map_t* map);
+void str_map_clear(str_map_t* map);
+bool str_map_put(str_map_t* map, const char* key, int value);
+bool str_map_get(const str_map_t* map, const char* key, int* out_value);
+bool str_map_remove(str_map_t* map, const char* key);
+
+#endif  // HASHMAP_H
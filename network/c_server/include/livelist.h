@@ -0,0 +1,63 @@
+#ifndef LIVELIST_H
+#define LIVELIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "match.h"
+#include "server.h"
+
+// Directory of active matches for the spectate list. Matches are added by
+// match_create and removed when they finish, kept in creation order, so a
+// listing never scans the match slot table. Each distinct query's page is
+// serialized once into a frame and reused until the directory's version
+// changes: a repeated poll is a reference to the same frame.
+//
+// The version moves at once when a match starts or ends. Move and spectator
+// counts shown in the list are republished at most every LIVE_REFRESH_MS.
+// Event loop thread only.
+
+#define LIVE_PAGE_DEFAULT 50
+#define LIVE_PAGE_MAX 100
+#define LIVE_CACHE_ENTRIES 8   // Distinct queries kept serialized
+#define LIVE_REFRESH_MS 1000   // Staleness allowed for move/spectator counts
+
+// Rating of a player, asked once per player as the match is listed
+// (<= 0 = unknown, e.g. bots)
+typedef int (*live_rating_fn)(int user_id);
+
+// Zero fields do not filter. speed is "", "bullet", "blitz", "rapid" or
+// "classical" (see live_speed). Pages run newest first; cursor is the
+// next_cursor of the previous page (0 = first page).
+typedef struct {
+    int min_rating;  // On the mean of the known player ratings
+    int max_rating;
+    char speed[16];
+    int min_spectators;
+    int cursor;
+    int limit;
+} live_query_t;
+
+bool live_init(live_rating_fn rating);
+void live_shutdown(void);
+
+void live_add(const match_t* match);
+void live_remove(const match_t* match);
+// Something shown in the list changed (a move was played)
+void live_touch(void);
+
+// Speed category from the estimated game length (base + 40 increments);
+// NULL-safe, never NULL
+const char* live_speed(const time_control_t* tc);
+bool live_speed_valid(const char* speed);
+
+uint32_t live_version(void);
+// Page for the query: {"version","matches":[...],"total","next_cursor"},
+// followed by "}\n" so it can close a response envelope sent as a separate
+// frame just before it. The caller owns one reference. NULL on failure.
+frame_t* live_get_page(const live_query_t* query);
+
+int live_count(void);
+uint64_t live_rebuild_count(void);  // Pages serialized (cache misses)
+
+#endif  // LIVELIST_H
@@ -5,10 +5,16 @@
 #include <time.h>
 
 #include "account.h"
+#include "clock.h"
+#include "xiangqi.h"
 
 #define MAX_READY_PLAYERS 100
-#define MAX_ROOMS 50
-#define MAX_CHALLENGES 100
+#define LOBBY_ROOM_LIST_MAX 50      // Rooms in one rooms list (fits a response)
+#define LOBBY_ROOM_TTL_MS 1800000   // A room whose game never started closes after 30 min
+#define CHALLENGE_TTL_MS 60000
+#define MAX_OUTGOING_CHALLENGES 16  // Pending challenges one user may have sent
+#define CHALLENGE_LIST_MAX 20       // Newest first, per direction in one list
+#define LOBBY_PRESENCE_TICK_MS 250  // Ready-list changes are announced at most this often
 
 typedef struct {
     int user_id;
@@ -25,8 +31,9 @@ typedef struct {
     int guest_user_id;
     char password[64];
     bool rated;
-    bool occupied;
+    time_control_t time_control;
     time_t created_at;
+    int64_t expires_ms;  // clock_now_ms() deadline
 } room_t;
 
 typedef struct {
@@ -34,41 +41,77 @@ typedef struct {
     int from_user_id;
     int to_user_id;
     bool rated;
-    int status;  // 0=pending, 1=accepted, 2=declined
+    time_control_t time_control;
+    char start_fen[XQ_FEN_MAX];  // Empty = standard start
     time_t created_at;
-    time_t expires_at;
+    int64_t expires_ms;  // clock_now_ms() deadline
 } challenge_t;
 
 // Lobby functions
 bool lobby_init(void);
 void lobby_shutdown(void);
 
-// Ready list
+// Ready list (the players shown in the lobby; the matchmaking queue is
+// matchmaking.c). Removing a player also takes them out of the queue.
 void lobby_set_ready(int user_id, const char* username, int rating, bool ready);
 void lobby_remove_player(int user_id);
-char* lobby_get_ready_list_json(void);
 
-// Matchmaking
-bool lobby_find_random_match(int user_id, int* out_opponent_id);
-bool lobby_find_rated_match(int user_id, int rating, int tolerance,
-                            int* out_opponent_id);
+// Presence: ready-list changes are remembered per user and announced as one
+// diff per tick, {"type":"lobby_presence","payload":{"seq","joined","left",
+// "rating"}}, relative to what the previous diff announced. A user who
+// joins and leaves within one tick produces nothing.
+// Milliseconds until the next diff is due; -1 if nothing changed
+int64_t lobby_presence_ms_until_due(int64_t now_ms);
+// The diff as a complete message (caller frees), NULL if the changes
+// cancelled out
+char* lobby_take_presence_event(int64_t now_ms);
+// Full ready list for a client that is starting or lost its place:
+// {"seq","players":[{user_id,username,rating}]}, seq = last diff sent
+char* lobby_get_presence_snapshot_json(void);
 
-// Rooms
+// Rooms: growable, indexed by code and by host. Codes are a bijective
+// scramble of a counter, so they never collide. A host has at most one
+// room: creating another closes the old one. Rooms live LOBBY_ROOM_TTL_MS
+// and sit in deadline order like challenges. A room_t* stays valid until
+// the next room is created or closed.
 char* lobby_create_room(int host_user_id, const char* room_name,
-                        const char* password, bool rated);
+                        const char* password, bool rated,
+                        const time_control_t* time_control);
 bool lobby_join_room(const char* room_code, const char* password, int user_id,
                      int* out_host_id);
 bool lobby_close_room(const char* room_code, int user_id);
 bool lobby_leave_room(const char* room_code, int user_id);
 room_t* lobby_get_room(const char* room_code);
+// At most LOBBY_ROOM_LIST_MAX rooms, ones waiting for a guest first
 char* lobby_get_rooms_json(void);
+int lobby_room_count(void);
+// Milliseconds until the oldest room expires; -1 if none
+int64_t lobby_room_ms_until_expiry(int64_t now_ms);
+// Close expired rooms; returns how many
+int lobby_expire_rooms(int64_t now_ms);
 
-// Challenges
-char* lobby_create_challenge(int from_user_id, int to_user_id, bool rated);
+// Challenges: growable, indexed by id and by sender / recipient. Pending
+// challenges sit in one list in deadline order (they all live
+// CHALLENGE_TTL_MS), so expiry only looks at the oldest. A challenge_t*
+// stays valid until the next challenge is created.
+// A new challenge to the same opponent replaces the pending one
+char* lobby_create_challenge(int from_user_id, int to_user_id, bool rated,
+                             const time_control_t* time_control,
+                             const char* start_fen);
 challenge_t* lobby_get_challenge(const char* challenge_id);
-bool lobby_accept_challenge(const char* challenge_id, int user_id);
+// Recipient only; the challenge is copied to out and removed
+bool lobby_accept_challenge(const char* challenge_id, int user_id, challenge_t* out);
 bool lobby_decline_challenge(const char* challenge_id, int user_id);
-void lobby_cleanup_expired_challenges(void);
+// Drop everything a user sent or received (disconnect)
+void lobby_cancel_user_challenges(int user_id);
+// {"incoming":[...],"outgoing":[...]} for one user, newest first, at most
+// CHALLENGE_LIST_MAX each (caller frees)
+char* lobby_get_challenges_json(int user_id);
+// Milliseconds until the oldest pending challenge expires; -1 if none
+int64_t lobby_challenge_ms_until_expiry(int64_t now_ms);
+// Drop expired challenges; returns how many
+int lobby_expire_challenges(int64_t now_ms);
+int lobby_challenge_count(void);
 
 // Utility
 int lobby_get_ready_users(int* user_ids, int max_count);
@@ -2,11 +2,16 @@
 #define MATCH_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
-#define MAX_MATCHES 500
+#include "clock.h"
+#include "xiangqi.h"
+
+#define MAX_MATCHES 500           // Concurrent active matches
+#define MAX_FINISHED_MATCHES 200  // Finished matches kept for rematch/chat/replay
 #define MAX_MOVES_PER_MATCH 300
-#define MAX_SPECTATORS_PER_MATCH 50
+#define MATCH_SNAPSHOT_MOVES 10  // Recent moves carried in a spectator snapshot
 
 typedef struct {
     int move_id;
@@ -18,38 +23,70 @@ typedef struct {
     char capture[16];
     char notation[32];
     time_t timestamp;
-    int red_time_ms;
+    int think_time_ms;  // Exact time the mover spent on this move
+    int lag_comp_ms;    // Network latency refunded from think_time_ms
+    int red_time_ms;    // Clocks after the move (increment/delay applied)
     int black_time_ms;
 } move_t;
 
+// A conditional move queued while waiting for the opponent
+typedef struct {
+    bool queued;
+    char from_row;
+    char from_col;
+    char to_row;
+    char to_col;
+} premove_t;
+
 typedef struct {
     char match_id[32];
+    int handle;  // Compact integer id, unique for the process lifetime
     int red_user_id;
     int black_user_id;
     char current_turn[6];  // "red" or "black"
     int move_count;
     move_t moves[MAX_MOVES_PER_MATCH];
+    // Board: the setup the game started from, and the position after the
+    // last move, kept in step by match_add_move. Moves are still validated
+    // client side; position_valid drops to false if one does not replay.
+    char start_fen[XQ_FEN_MAX];
+    xq_position_t position;
+    uint64_t position_hashes[MAX_MOVES_PER_MATCH];  // Before each move
+    bool position_valid;
     bool rated;
-    int red_time_ms;
+    time_control_t time_control;
+    int red_time_ms;    // Remaining time at the start of the current turn
     int black_time_ms;
     time_t started_at;
     time_t last_move_at;
+    int64_t turn_started_ms;  // Monotonic start of the current turn
+    premove_t premoves[2];    // One per side: [0] red, [1] black
     bool active;
     char result[16];      // "red_wins", "black_wins", "draw", "ongoing"
     char end_reason[32];  // "checkmate", "resign", "timeout", etc.
-    // Spectators
-    int spectator_ids[MAX_SPECTATORS_PER_MATCH];
-    int spectator_count;
+    // Spectators are subscribers of the pubsub topic named match_id. Every
+    // event pushed to the match (moves, game end) carries the next event_seq
+    // so a client can tell when it missed one.
+    uint32_t event_seq;
 } match_t;
 
 // Match management
 bool match_init(void);
 void match_shutdown(void);
 
-char* match_create(int red_user_id, int black_user_id, bool rated, int time_ms);
+char* match_create(int red_user_id, int black_user_id, bool rated,
+                   const time_control_t* time_control);
+// Start from a custom setup (puzzles, handicaps, adjourned games); NULL if
+// the FEN is not a legal position. start_fen NULL = standard start.
+char* match_create_from_fen(int red_user_id, int black_user_id, bool rated,
+                            const time_control_t* time_control,
+                            const char* start_fen);
 match_t* match_get(const char* match_id);
+match_t* match_get_by_handle(int handle);
 match_t* match_find_by_id(const char* match_id);
 match_t* match_find_by_user(int user_id);
+int match_get_active_count(void);
+int match_get_finished_count(void);
 bool match_validate_move(const char* match_id, int user_id, int from_row,
                          int from_col, int to_row, int to_col);
 bool match_add_move(const char* match_id, const move_t* move);
@@ -63,17 +100,42 @@ bool match_is_checkmate(match_t* match);
 bool is_valid_position(int row, int col);
 bool is_correct_turn(match_t* match, int user_id);
 
-// Spectator functions
-bool match_add_spectator(const char* match_id, int user_id);
-bool match_remove_spectator(const char* match_id, int user_id);
-bool match_is_spectator(const match_t* match, int user_id);
-char* match_get_live_matches_json(void);
+// Current board. history (optional) receives the hash of every earlier
+// position, oldest first. Returns false if a stored move was not legal in
+// the position it was played from.
+bool match_replay_position(const match_t* match, xq_position_t* pos,
+                           uint64_t* history, int* history_len);
+
+// Look the current position up in the endgame tablebases. Returns true with
+// *out_result set ("red_wins", "black_wins" or "draw") when the game is
+// decided with best play; false if no table covers it.
+bool match_adjudicate(const match_t* match, const char** out_result);
+
+// Premove functions
+// Queue a move for a player while it is the opponent's turn (replaces any
+// previous premove). Returns false if the player cannot premove right now.
+bool match_set_premove(match_t* match, int user_id, int from_row, int from_col,
+                       int to_row, int to_col);
+// Pop the player's queued premove into *out; returns false if none
+bool match_take_premove(match_t* match, int user_id, premove_t* out);
+void match_clear_premove(match_t* match, int user_id);
+
+// Compact state for a joining/resyncing spectator: position, clocks, result
+// and the last MATCH_SNAPSHOT_MOVES moves, as of event_seq. Size does not
+// grow with the game. Returns false if out is too small.
+bool match_get_snapshot_json(const match_t* match, char* out, size_t size);
 
 // Timer functions
-bool match_update_timer(const char* match_id);
+// Charge the side to move for the time spent since its turn started, minus
+// lag_comp_ms of network latency, and start the opponent's clock.
+// Returns false if the mover had already flagged.
+bool match_charge_clock(match_t* match, int64_t now_ms, int lag_comp_ms,
+                        int* out_think_ms);
 bool match_check_timeout(const char* match_id);
 char* match_get_timer_json(const char* match_id);
 void match_check_all_timeouts(void);
+// Milliseconds until the earliest active clock runs out (-1 if none)
+int64_t match_ms_until_next_timeout(void);
 
 // Timeout info for broadcasting
 typedef struct {
@@ -86,9 +148,4 @@ typedef struct {
 // Get timeouts that need broadcasting (returns count, fills array)
 int match_get_pending_timeouts(timeout_info_t* timeouts, int max_count);
 
-// Spectator functions
-bool match_add_spectator(const char* match_id, int user_id);
-bool match_remove_spectator(const char* match_id, int user_id);
-int match_get_spectator_count(const char* match_id);
-
 #endif  // MATCH_H
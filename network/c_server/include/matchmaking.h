@@ -0,0 +1,81 @@
+#ifndef MATCHMAKING_H
+#define MATCHMAKING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clock.h"
+#include "xiangqi.h"
+
+// Matchmaking queues, one per (time control, rated, start position), each
+// kept sorted by rating and owned by a dedicated pairing thread. The event
+// loop only posts commands (join / leave) to it; every MM_TICK_MS the
+// thread pairs each queue in one pass and hands the pairs back through an
+// eventfd, so pairing cost never sits on the request path.
+//
+// Pairs are neighbours in rating order: as many as the tolerances allow
+// and, among those, the smallest total rating gap. A rated pair is allowed
+// when the gap is within the tolerance of the longer waiting of the two,
+// which starts at MM_BASE_TOLERANCE and widens with the wait; casual
+// queues accept any gap. Custom start positions are never rated.
+//
+// Every join gets a ticket; a result whose ticket is no longer the
+// player's current one (they left or re-joined meanwhile) is dropped by
+// mm_poll_results, and the other player of the pair is put back.
+
+#define MM_TICK_MS 500
+#define MM_BASE_TOLERANCE 100
+#define MM_WIDEN_PER_SEC 10      // Tolerance gained per second of waiting
+#define MM_MAX_TOLERANCE 600
+#define MM_GAP_SAMPLES 1024      // Recent pairings kept for gap percentiles
+#define MM_MAX_RESULTS 64        // Results handed over per poll
+#define BOT_FALLBACK_WAIT_SEC 20  // Queue time before an opted-in player gets a bot
+
+typedef struct {
+    int user_id;
+    int rating;
+    bool rated;
+    uint32_t ticket;
+    int64_t queued_ms;
+    int bot_level;                // Accept a bot of this level after waiting (0 = never)
+    time_control_t time_control;
+    char start_fen[XQ_FEN_MAX];   // Empty = standard start
+} mm_entry_t;
+
+typedef enum { MM_RESULT_PAIR, MM_RESULT_BOT } mm_result_kind_t;
+
+typedef struct {
+    mm_result_kind_t kind;
+    mm_entry_t red;    // The longer waiter; the player alone for MM_RESULT_BOT
+    mm_entry_t black;
+} mm_result_t;
+
+typedef struct {
+    int queued;
+    int queues;  // Non-empty queues
+    uint64_t pairs;
+    int64_t avg_wait_ms;  // Over every paired player
+    int gap_p50;          // Rating gap percentiles over the last MM_GAP_SAMPLES pairs
+    int gap_p90;
+    int gap_p99;
+} mm_stats_t;
+
+bool mm_init(void);
+void mm_shutdown(void);
+int mm_get_notify_fd(void);
+
+// Join a queue (again: moves the player to the new queue, keeps the wait)
+bool mm_enqueue(int user_id, int rating, bool rated, const time_control_t* time_control,
+                const char* start_fen, int bot_level);
+// Put back a paired player whose match could not start, keeping the wait
+bool mm_requeue(const mm_entry_t* entry);
+void mm_remove(int user_id);
+
+int mm_tolerance(int64_t wait_ms);
+
+// Pairs and bot fallbacks ready to start (event loop thread)
+int mm_poll_results(mm_result_t* out, int max_count);
+
+void mm_get_stats(mm_stats_t* out);
+
+#endif  // MATCHMAKING_H
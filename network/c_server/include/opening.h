@@ -0,0 +1,79 @@
+#ifndef OPENING_H
+#define OPENING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xiangqi.h"
+
+// Opening explorer: for every position in the first plies of archived games,
+// which moves were played, how those games ended and how strong the movers
+// were. The index is one file of entries sorted by (position hash, move),
+// probed straight from an mmap; games finished since the last merge sit in
+// an in-memory table and are folded into the file by a background thread
+// when it fills up.
+
+#define OPENING_INDEX_PATH "openings.xqoi"
+#define OPENING_MAX_PLY 30          // Positions indexed per game
+#define OPENING_DELTA_MAX 65536     // Pending (position, move) pairs before a merge
+#define OPENING_MAX_REPLIES 32      // Moves returned per position
+
+typedef enum { OPENING_RED_WIN, OPENING_BLACK_WIN, OPENING_DRAW } opening_result_t;
+
+// One (position, move) pair; also the on-disk record
+typedef struct {
+    uint64_t hash;        // Position the move was played from
+    uint64_t rating_sum;  // Mover's rating, over rated_games
+    uint32_t games;
+    uint32_t red_wins;
+    uint32_t black_wins;
+    uint32_t draws;
+    uint32_t rated_games;  // Games where the mover's rating was known
+    uint16_t move;
+    uint16_t reserved;
+} opening_entry_t;
+
+// Accumulator keyed by (hash, move): open addressing, grows on demand
+typedef struct {
+    opening_entry_t* slots;
+    size_t capacity;  // Power of two
+    size_t count;
+    uint64_t games;
+} opening_table_t;
+
+typedef struct {
+    xq_move_t move;
+    opening_entry_t stats;
+} opening_reply_t;
+
+// Accumulation (shared with tools/gamecheck.c)
+bool opening_table_init(opening_table_t* table, size_t capacity);
+void opening_table_free(opening_table_t* table);
+void opening_table_clear(opening_table_t* table);
+// Adds the first OPENING_MAX_PLY moves of a game from the standard start.
+// A rating <= 0 means unknown.
+bool opening_table_add_game(opening_table_t* table, const xq_move_t* moves, int move_count,
+                            opening_result_t result, int red_rating, int black_rating);
+bool opening_table_merge(opening_table_t* into, const opening_table_t* from);
+// Write base (sorted, may be empty) plus table as a new index file
+bool opening_write_file(const char* path, const opening_entry_t* base, size_t base_count,
+                        uint64_t base_games, const opening_table_t* table);
+// "red_wins"/"red_win", "black_wins"/"black_win", "draw"; false otherwise
+bool opening_result_parse(const char* result, opening_result_t* out);
+
+// Server side (event loop thread only)
+bool opening_init(const char* path);  // A missing file is an empty index
+void opening_shutdown(void);          // Merges pending games first
+bool opening_record_game(const xq_move_t* moves, int move_count, opening_result_t result,
+                         int red_rating, int black_rating);
+// Adopt a finished background merge (cheap; call every loop iteration)
+void opening_poll(void);
+// Merge everything now, waiting for a running merge (shutdown)
+bool opening_flush(void);
+// Moves played from pos, most played first; returns the count
+int opening_lookup(xq_position_t* pos, opening_reply_t* out, int max_count);
+uint64_t opening_game_count(void);
+size_t opening_entry_count(void);  // On disk plus pending (may overlap)
+
+#endif  // OPENING_H
@@ -29,6 +29,7 @@ int extract_messages(const char* buffer, size_t len, char*** out_messages,
 char* json_escape(const char* str);
 char* json_get_string(const char* json, const char* key);
 int json_get_int(const char* json, const char* key);
+long long json_get_int64(const char* json, const char* key);
 bool json_get_bool(const char* json, const char* key);
 
 #endif  // PROTOCOL_H
@@ -0,0 +1,68 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "server.h"
+
+// Topic fanout for spectators. A topic is a name (the match id) with a list
+// of subscribed connections; each subscription is one node linked into both
+// its topic's list and its client's list, so subscribe, unsubscribe and
+// disconnect cleanup never walk other subscribers. Publishing builds one
+// frame and queues a reference to it on every subscriber; sequenced frames
+// are also kept in a short per-topic history so a subscriber that missed
+// some can be sent just those again.
+//
+// Subscribers never hold up the loop or each other: once a subscriber's
+// connection has PUBSUB_LAG_BYTES queued it stops receiving individual
+// frames ("latest state" mode) and gets one snapshot of the topic when its
+// queue drains. One that stays stuck for PUBSUB_EVICT_MS is unsubscribed.
+// Players are not subscribers; their messages are never skipped.
+// Event loop thread only.
+
+#define PUBSUB_TOPIC_MAX 64             // Topic name length, including NUL
+#define PUBSUB_MAX_TOPICS_PER_CLIENT 8  // Subscriptions per connection
+#define PUBSUB_HISTORY 32               // Sequenced frames kept per topic
+#define PUBSUB_LAG_BYTES (64 * 1024)    // Queued bytes that switch to latest-state mode
+#define PUBSUB_EVICT_MS 30000           // Time in that mode before eviction
+
+// Writes the current state of a topic as one complete message (the frame a
+// lagging subscriber catches up with); false if there is none any more
+typedef bool (*pubsub_snapshot_fn)(const char* topic, char* out, size_t size);
+
+bool pubsub_init(pubsub_snapshot_fn snapshot);
+void pubsub_shutdown(void);
+
+// Idempotent; false if the client is at PUBSUB_MAX_TOPICS_PER_CLIENT
+bool pubsub_subscribe(const char* topic, client_t* client);
+// False if the client was not subscribed
+bool pubsub_unsubscribe(const char* topic, client_t* client);
+// Called on disconnect
+void pubsub_unsubscribe_all(client_t* client);
+// Deliver message to every subscriber; returns how many accepted it.
+// seq > 0 also records the frame in the topic history under that number.
+int pubsub_publish(server_t* server, const char* topic, uint32_t seq,
+                   const char* message);
+// Re-send the recorded frames numbered after after_seq to one client.
+// Returns how many were sent, or -1 if the history no longer reaches back
+// that far (the caller falls back to a snapshot).
+int pubsub_replay(server_t* server, const char* topic, client_t* client,
+                  uint32_t after_seq);
+// Drop every subscription to a topic (the match is gone)
+void pubsub_close_topic(const char* topic);
+
+// The client's queue just emptied: catch its lagging subscriptions up
+void pubsub_client_drained(server_t* server, client_t* client);
+// Unsubscribe subscribers lagging for PUBSUB_EVICT_MS (periodic)
+void pubsub_evict_stalled(server_t* server, int64_t now_ms);
+
+int pubsub_subscriber_count(const char* topic);
+int pubsub_topic_count(void);
+uint64_t pubsub_coalesced_count(void);  // Times a subscriber entered latest-state mode
+uint64_t pubsub_evicted_count(void);
+// Bumped on every subscribe and unsubscribe (spectator counts changed)
+uint64_t pubsub_membership_changes(void);
+
+#endif  // PUBSUB_H
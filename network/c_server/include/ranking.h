@@ -0,0 +1,41 @@
+#ifndef RANKING_H
+#define RANKING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "account.h"
+
+// In-memory leaderboard: every registered user ordered by conservative
+// rating, rating - 2 * RD (highest first, ties by lower user_id), so a
+// player with few games does not top the board on a lucky streak. An
+// order-statistic treap: rank of a user and the entry at a rank both take
+// O(log n), so pages, "around me" windows and a player's own rank never
+// query the database. Loaded from the Users
+// table at startup; the account layer moves players when their rating or
+// stats are written. Event loop thread only.
+
+#define RANKING_PAGE_DEFAULT 10
+#define RANKING_PAGE_MAX 50  // Keeps a page inside one response buffer
+
+bool ranking_init(void);  // Loads every user from the database
+void ranking_shutdown(void);
+
+// Insert a player or replace its entry (moves it if the rating or RD changed)
+bool ranking_put(const profile_t* profile);
+void ranking_set_rating(int user_id, int rating);
+void ranking_set_stats(int user_id, int wins, int losses, int draws);
+
+int ranking_count(void);
+// 1-based rank, 0 if the user is not ranked
+int ranking_rank_of(int user_id);
+// Entry at a 1-based rank
+bool ranking_at(int rank, profile_t* out);
+
+// JSON array of `limit` entries starting at 1-based rank `first`:
+// [{"rank","user_id","username","rating","rd","provisional","wins","losses",
+// "draws"},...]; provisional: RD above GLICKO_PROVISIONAL_RD
+// Returns the number of entries written, -1 if out_json is too small.
+int ranking_page_json(int first, int limit, char* out_json, size_t json_size);
+
+#endif  // RANKING_H
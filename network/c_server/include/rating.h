@@ -1,20 +1,67 @@
 #ifndef RATING_H
 #define RATING_H
 
-// Elo rating system
+#include <stdbool.h>
+
+// Glicko-2 rating system. A player is a rating, a rating deviation (how
+// uncertain the rating is) and a volatility (how erratic their results
+// are). Live games are rated one game per rating period, O(1) per game;
+// the batch API replays whole rating periods over struct-of-arrays data
+// (see tools/ratingreplay.c).
 #define DEFAULT_RATING 1200
-#define DEFAULT_K_FACTOR 32
+#define GLICKO_DEFAULT_RD 350.0
+#define GLICKO_DEFAULT_VOLATILITY 0.06
+#define GLICKO_TAU 0.5               // Constrains volatility changes (0.3-1.2)
+#define GLICKO_PROVISIONAL_RD 110.0  // Above this the rating is provisional
+
+typedef struct {
+    double rating;
+    double rd;
+    double volatility;
+} glicko_t;
+
+// A new player
+glicko_t rating_glicko_new(void);
+
+// Red's score for a stored result: 1, 0 or 0.5; -1 if the game was not
+// decided (aborted)
+double rating_red_score(const char* result);
+
+// Rate one game between red and black as its own rating period. Both
+// updates use the players' values from before the game.
+void rating_glicko_game(glicko_t* red, glicko_t* black, double red_score, double tau);
+
+// Rating minus two deviations, rounded: the leaderboard order. A player
+// has to prove a rating before ranking by it.
+int rating_conservative(double rating, double rd);
+
+// Expected score of a against b (0-1)
+double rating_expected_score(const glicko_t* a, const glicko_t* b);
 
+// Batch recomputation. Players live in parallel arrays indexed 0..count-1
+// so the per-player passes are plain loops over contiguous doubles that
+// the compiler can vectorize; games reference players by index.
 typedef struct {
-    int red_change;
-    int black_change;
-} rating_change_t;
+    int count;
+    double* rating;
+    double* rd;
+    double* volatility;
+    // Per-period scratch
+    double* mu;
+    double* phi;
+    double* g;          // g(phi) of each player as an opponent
+    double* v_inv;      // Sum of g^2 E (1 - E) over the period's games
+    double* score_sum;  // Sum of g (s - E)
+} rating_batch_t;
 
-// Calculate rating changes after a match
-rating_change_t rating_calculate(int red_rating, int black_rating,
-                                 const char* result, int k_factor);
+bool rating_batch_init(rating_batch_t* batch, int count, double rating, double rd,
+                       double volatility);
+void rating_batch_free(rating_batch_t* batch);
 
-// Expected score (probability of winning)
-double rating_expected_score(int rating_a, int rating_b);
+// One rating period: every game in it is rated against the opponents'
+// values from the start of the period; players without games only gain
+// deviation. red_score[i] is 1, 0 or 0.5.
+void rating_batch_period(rating_batch_t* batch, const int* red, const int* black,
+                         const double* red_score, int game_count, double tau);
 
 #endif  // RATING_H
@@ -5,23 +5,55 @@
 #include <stdint.h>
 #include <sys/epoll.h>
 
+#include "fanout.h"
+
 #define MAX_EVENTS 1024
 #define MAX_CLIENTS 1000
 #define BUFFER_SIZE 8192
 #define MAX_MESSAGE_SIZE 16384
+#define PING_INTERVAL_SEC 5
+#define RTT_SAMPLE_MAX_MS 10000
+#define CLIENT_OUTQ_MAX 256                 // Frames waiting per client (fanout: FANOUT_OUTQ_MAX)
+#define CLIENT_OUTQ_MAX_BYTES (1024 * 1024)  // Bytes waiting per client
+
+// Outgoing newline-terminated message. Immutable once built and refcounted,
+// so a broadcast shares one copy across every client it is queued on.
+typedef struct {
+    int refcount;
+    size_t len;
+    char data[];
+} frame_t;
+
+struct ps_subscription;
 
 // Client connection state
 typedef struct {
     int fd;
     char recv_buffer[MAX_MESSAGE_SIZE];
     size_t recv_len;
-    char send_buffer[MAX_MESSAGE_SIZE];
-    size_t send_len;
-    size_t send_offset;
+    // Frames the socket did not accept yet (ring; head partly sent). Starts
+    // at CLIENT_OUTQ_MAX slots; only a fanout peer's ring grows.
+    frame_t** outq;
+    int outq_capacity;
+    int outq_head;
+    int outq_count;
+    size_t outq_offset;  // Bytes of outq[outq_head] already sent
+    size_t outq_bytes;   // Unsent bytes across the queue
+    bool closing;        // Shut down after a queue overflow, awaiting EPOLLHUP
+    bool fanout;         // A spectator fan-out process (Unix socket peer)
+    struct ps_subscription* subscriptions;  // Owned by pubsub.c
+    int subscription_count;
     char* session_token;
     int user_id;
     bool authenticated;
     time_t last_heartbeat;
+    // Round-trip time, measured by server pings and heartbeat echoes
+    int ping_id;           // Id of the outstanding ping (0 = none)
+    int64_t ping_sent_ms;  // Monotonic send time of the outstanding ping
+    int rtt_ms;            // Smoothed RTT (EWMA), -1 until the first sample
+    int rtt_min_ms;
+    int rtt_last_ms;
+    int rtt_samples;
 } client_t;
 
 // Server state
@@ -30,6 +62,10 @@ typedef struct {
     int epoll_fd;
     client_t* clients[MAX_CLIENTS];
     int client_count;
+    // Spectator fan-out processes; also in clients[]
+    int fanout_listen_fd;
+    client_t* fanout_peers[FANOUT_MAX_PEERS];
+    int fanout_count;
     bool running;
 } server_t;
 
@@ -41,14 +77,34 @@ void server_shutdown(server_t* server);
 // Client management
 client_t* client_create(int fd);
 void client_destroy(client_t* client);
-int client_send(client_t* client, const char* json);
+int client_send(server_t* server, client_t* client, const char* json);
 void client_disconnect(server_t* server, client_t* client);
 client_t* server_get_client_by_user_id(server_t* server, int user_id);
 
+// Outgoing frames
+frame_t* frame_create(const char* data, size_t len);  // Adds the '\n' if missing
+// Exact bytes: one part of a message sent as consecutive frames
+frame_t* frame_create_raw(const char* data, size_t len);
+void frame_ref(frame_t* frame);
+void frame_unref(frame_t* frame);
+// Write now if nothing is queued, else (or for the rest) queue and wait for
+// EPOLLOUT. False if the socket failed or the client's queue is full; a full
+// queue also shuts the connection down so nothing is delivered out of order.
+bool client_send_frame(server_t* server, client_t* client, frame_t* frame);
+
+// Latency measurement
+void server_send_pings(server_t* server);
+void client_record_rtt(client_t* client, int64_t sample_ms);
+
+// Stats surface (JSON, caller frees); per-connection figures only for self
+char* server_get_stats_json(server_t* server, const client_t* self);
+
 // Event handling
 void handle_new_connection(server_t* server);
-void handle_client_read(server_t* server, client_t* client);
-void handle_client_write(server_t* server, client_t* client);
+void handle_fanout_connection(server_t* server);
+// Both return false if the client was disconnected (and freed)
+bool handle_client_read(server_t* server, client_t* client);
+bool handle_client_write(server_t* server, client_t* client);
 
 // Message processing
 void process_message(server_t* server, client_t* client, const char* json);
@@ -4,7 +4,8 @@
 #include <stdbool.h>
 #include <time.h>
 
-#define SESSION_TIMEOUT 86400  // 24 hours
+#define SESSION_TIMEOUT 86400            // 24 hours
+#define SESSION_INITIAL_CAPACITY 1024    // Grows by doubling, no upper limit
 
 typedef struct {
     char token[65];
@@ -13,12 +14,16 @@ typedef struct {
     time_t last_activity;
 } session_t;
 
-// Session management
+// Sessions are indexed by token in a hash table, so validation is O(1)
+// however many are live; expiry is tracked by a min-heap so cleanup only
+// looks at sessions that are due. Tokens are 32 bytes from getrandom().
+// Event loop thread only.
 char* session_create(int user_id);
 bool session_validate(const char* token, int* out_user_id);
 void session_update_activity(const char* token);
 void session_destroy(const char* token);
 void session_cleanup_expired(void);
+int session_active_count(void);
 
 // Session storage (in-memory + optional persistence)
 bool session_init(void);
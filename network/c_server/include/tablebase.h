@@ -0,0 +1,69 @@
+#ifndef TABLEBASE_H
+#define TABLEBASE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xiangqi.h"
+
+// Endgame tablebases: one file per material set ("KRKA" = red king+chariot
+// vs black king+advisor), holding the distance to mate of every position.
+// Files are block-RLE compressed and probed straight from an mmap, so a
+// probe touches one block and needs no heap memory.
+
+#define TABLEBASE_DIR "tablebases"
+#define TABLEBASE_EXT ".xqtb"
+#define TB_MAX_TABLES 64
+#define TB_MAX_EXTRA_PIECES 3         // Non-king pieces per table
+#define TB_MAX_ENTRIES (1u << 26)
+#define TB_BLOCK_SIZE 4096            // Entries per compressed block
+
+// Stored value per position (side to move's view):
+//   0        draw (or not reachable)
+//   1 + n    mate in n plies: n even = side to move loses, n odd = it wins
+//   255      illegal position
+#define TB_DRAW 0
+#define TB_ILLEGAL 255
+#define TB_MAX_DTM 253
+
+typedef struct {
+    char material[16];  // e.g. "KRKA"
+    int slot_count;     // Kings first, then red pieces, then black pieces
+    int slot_side[2 + TB_MAX_EXTRA_PIECES];
+    int slot_type[2 + TB_MAX_EXTRA_PIECES];
+    uint32_t size;      // 2 (side to move) * product of slot domains
+} tb_layout_t;
+
+typedef struct {
+    bool found;
+    int wdl;  // 1 = side to move wins, 0 = draw, -1 = side to move loses
+    int dtm;  // Plies to mate (0 when drawn)
+} tb_probe_t;
+
+// Server side
+int tablebase_init(const char* dir);  // Returns the number of tables loaded
+void tablebase_shutdown(void);
+bool tablebase_load_file(const char* path);
+int tablebase_count(void);
+bool tablebase_probe(const xq_position_t* pos, tb_probe_t* out);
+// Best move by the tables; XQ_NO_MOVE if not covered or no legal move
+xq_move_t tablebase_best_move(xq_position_t* pos, tb_probe_t* out);
+
+// Material and indexing (shared with the generator in tools/)
+bool tb_layout_from_material(const char* material, tb_layout_t* layout);
+void tb_material_of(const xq_position_t* pos, char* out, size_t size);
+// Same material with colours swapped ("KRKA" -> "KAKR")
+void tb_material_mirror(const char* material, char* out, size_t size);
+void tb_position_mirror(const xq_position_t* pos, xq_position_t* out);
+// Pieces that can deliver mate (chariot, horse, cannon, pawn)
+bool tb_material_has_attackers(const char* material);
+bool tb_decode(const tb_layout_t* layout, uint32_t index, xq_position_t* pos);
+bool tb_encode(const tb_layout_t* layout, const xq_position_t* pos,
+               uint32_t* out_index);
+
+// Write a generated table (values[layout->size]) in the compressed format
+bool tb_write_file(const char* path, const tb_layout_t* layout,
+                   const uint8_t* values);
+
+#endif  // TABLEBASE_H
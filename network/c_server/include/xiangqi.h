@@ -0,0 +1,101 @@
+#ifndef XIANGQI_H
+#define XIANGQI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Xiangqi board model: move generation, legality and Zobrist hashing.
+// Coordinates match the protocol: row 0 is black's back rank, row 9 red's.
+
+#define XQ_ROWS 10
+#define XQ_COLS 9
+#define XQ_SQUARES 90
+#define XQ_MAX_MOVES 160  // Upper bound on pseudo-legal moves in a position
+#define XQ_FEN_MAX 100    // Longest FEN we produce or accept, with the NUL
+#define XQ_START_FEN \
+    "rnbakabnr/9/1c5c1/p1p1p1p1p/9/9/P1P1P1P1P/1C5C1/9/RNBAKABNR w - - 0 1"
+
+#define XQ_RED 0
+#define XQ_BLACK 1
+
+// Piece types
+#define XQ_EMPTY 0
+#define XQ_KING 1
+#define XQ_ADVISOR 2
+#define XQ_ELEPHANT 3
+#define XQ_HORSE 4
+#define XQ_CHARIOT 5
+#define XQ_CANNON 6
+#define XQ_PAWN 7
+
+// A piece is its type, plus 8 for black
+#define XQ_PIECE(side, type) ((uint8_t)((type) | ((side) << 3)))
+#define XQ_TYPE(piece) ((piece) & 7)
+#define XQ_SIDE(piece) ((piece) >> 3)
+
+#define XQ_SQ(row, col) ((row) * XQ_COLS + (col))
+#define XQ_ROW(sq) ((sq) / XQ_COLS)
+#define XQ_COL(sq) ((sq) % XQ_COLS)
+
+// Move: from | to << 7 (0 is never a valid move)
+typedef uint16_t xq_move_t;
+#define XQ_MOVE(from, to) ((xq_move_t)((from) | ((to) << 7)))
+#define XQ_FROM(move) ((move) & 127)
+#define XQ_TO(move) ((move) >> 7)
+#define XQ_NO_MOVE 0
+
+typedef struct {
+    uint8_t board[XQ_SQUARES];
+    int side;  // Side to move
+    int king_sq[2];
+    uint64_t hash;
+} xq_position_t;
+
+// What xq_make_move needs to restore the previous position
+typedef struct {
+    xq_move_t move;
+    uint8_t captured;
+    uint64_t hash;
+} xq_undo_t;
+
+// Zobrist keys; safe to call from any thread, any number of times
+void xq_init(void);
+
+void xq_position_start(xq_position_t* pos);
+uint64_t xq_compute_hash(const xq_position_t* pos);
+
+// FEN: ranks from black's back rank (row 0) down, red in upper case
+// (K A B N R C P; E and H are accepted for elephant and horse), then the
+// side to move ("w"/"r" red, "b" black). Trailing fields are ignored on
+// input. Rejects setups no game can reach: missing or extra kings, pieces
+// off their allowed squares, more pieces than a side starts with, or the
+// side not to move in check.
+bool xq_position_from_fen(xq_position_t* pos, const char* fen);
+void xq_position_to_fen(const xq_position_t* pos, char* out, size_t size);
+
+// Whether a piece of this side and type can ever stand on sq
+bool xq_square_allowed(int side, int type, int sq);
+
+// Pseudo-legal moves (own king may be left in check); returns the count
+int xq_generate_moves(const xq_position_t* pos, xq_move_t* moves,
+                      bool captures_only);
+// Legal moves only
+int xq_generate_legal(xq_position_t* pos, xq_move_t* moves);
+
+// Make a pseudo-legal move. Returns false (position unchanged) if it would
+// leave the mover's king in check or facing the other king.
+bool xq_make_move(xq_position_t* pos, xq_move_t move, xq_undo_t* undo);
+void xq_unmake_move(xq_position_t* pos, const xq_undo_t* undo);
+
+// Pass the turn (used by null-move pruning)
+void xq_make_null(xq_position_t* pos);
+void xq_unmake_null(xq_position_t* pos);
+
+bool xq_in_check(const xq_position_t* pos, int side);
+
+// Find the legal move matching the coordinates; XQ_NO_MOVE if illegal
+xq_move_t xq_find_move(xq_position_t* pos, int from_row, int from_col,
+                       int to_row, int to_col);
+
+#endif  // XIANGQI_H
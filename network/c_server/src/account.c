@@ -11,6 +11,152 @@
 #include <string.h>
 
 #include "db.h"
+#include "hashmap.h"
+#include "ranking.h"
+#include "rating.h"
+
+// Profile cache: fixed slots indexed by user_id, most recently used first
+static profile_t profiles[PROFILE_CACHE_SIZE];
+static int lru_prev[PROFILE_CACHE_SIZE];
+static int lru_next[PROFILE_CACHE_SIZE];
+static int lru_head = -1;
+static int lru_tail = -1;
+static int profile_count = 0;
+static int_map_t profile_index;  // user_id -> slot
+static uint64_t cache_hits = 0;
+static uint64_t cache_misses = 0;
+
+bool account_cache_init(void) {
+    if (!int_map_init(&profile_index, PROFILE_CACHE_SIZE * 2)) return false;
+    lru_head = lru_tail = -1;
+    profile_count = 0;
+    cache_hits = cache_misses = 0;
+    return true;
+}
+
+void account_cache_shutdown(void) {
+    int_map_free(&profile_index);
+    lru_head = lru_tail = -1;
+    profile_count = 0;
+}
+
+static void lru_unlink(int slot) {
+    if (lru_prev[slot] >= 0) lru_next[lru_prev[slot]] = lru_next[slot];
+    else lru_head = lru_next[slot];
+    if (lru_next[slot] >= 0) lru_prev[lru_next[slot]] = lru_prev[slot];
+    else lru_tail = lru_prev[slot];
+}
+
+static void lru_push_front(int slot) {
+    lru_prev[slot] = -1;
+    lru_next[slot] = lru_head;
+    if (lru_head >= 0) lru_prev[lru_head] = slot;
+    lru_head = slot;
+    if (lru_tail < 0) lru_tail = slot;
+}
+
+// Cached slot of a user, -1 if not cached
+static int profile_slot(int user_id) {
+    int slot;
+    return int_map_get(&profile_index, user_id, &slot) ? slot : -1;
+}
+
+// Drop a profile whose database row may no longer match it
+static void profile_forget(int user_id) {
+    int slot = profile_slot(user_id);
+    if (slot < 0) return;
+
+    lru_unlink(slot);
+    int_map_remove(&profile_index, user_id);
+
+    // Keep slots dense: move the last used slot into the hole
+    int last = --profile_count;
+    if (slot != last) {
+        profiles[slot] = profiles[last];
+        int_map_put(&profile_index, profiles[slot].user_id, slot);
+        lru_prev[slot] = lru_prev[last];
+        lru_next[slot] = lru_next[last];
+        if (lru_prev[slot] >= 0) lru_next[lru_prev[slot]] = slot;
+        else lru_head = slot;
+        if (lru_next[slot] >= 0) lru_prev[lru_next[slot]] = slot;
+        else lru_tail = slot;
+    }
+}
+
+// Insert or refresh a profile, evicting the least recently used when full
+static void profile_store(const profile_t* profile) {
+    int slot = profile_slot(profile->user_id);
+    if (slot >= 0) {
+        lru_unlink(slot);
+        profiles[slot] = *profile;
+        lru_push_front(slot);
+        return;
+    }
+
+    if (profile_count == PROFILE_CACHE_SIZE) profile_forget(profiles[lru_tail].user_id);
+    slot = profile_count;
+    if (!int_map_put(&profile_index, profile->user_id, slot)) return;
+    profile_count++;
+    profiles[slot] = *profile;
+    lru_push_front(slot);
+}
+
+bool account_get_profile(int user_id, profile_t* out) {
+    if (!out) return false;
+
+    int slot = profile_slot(user_id);
+    if (slot >= 0) {
+        cache_hits++;
+        if (slot != lru_head) {
+            lru_unlink(slot);
+            lru_push_front(slot);
+        }
+        *out = profiles[slot];
+        return true;
+    }
+
+    cache_misses++;
+    profile_t profile = {.user_id = user_id};
+    if (!db_get_user_by_id(user_id, profile.username, NULL, &profile.rating,
+                           &profile.wins, &profile.losses, &profile.draws, &profile.rd,
+                           &profile.volatility)) {
+        return false;
+    }
+    profile_store(&profile);
+    *out = profile;
+    return true;
+}
+
+bool account_lookup(int user_id, char* out_username, size_t username_size,
+                    int* out_rating) {
+    profile_t profile;
+    if (!account_get_profile(user_id, &profile)) return false;
+
+    if (out_username && username_size > 0) {
+        snprintf(out_username, username_size, "%s", profile.username);
+    }
+    if (out_rating) *out_rating = profile.rating;
+    return true;
+}
+
+uint64_t account_cache_hits(void) { return cache_hits; }
+
+uint64_t account_cache_misses(void) { return cache_misses; }
+
+int account_cache_count(void) { return profile_count; }
+
+// Cache the profile part of a full user record read from the database
+static void profile_store_user(const user_t* user) {
+    profile_t profile = {.user_id = user->user_id,
+                         .rating = user->rating,
+                         .rd = user->rd,
+                         .volatility = user->volatility,
+                         .wins = user->wins,
+                         .losses = user->losses,
+                         .draws = user->draws};
+    snprintf(profile.username, sizeof(profile.username), "%s", user->username);
+    profile_store(&profile);
+}
 
 // Validate username (alphanumeric, 3-20 chars)
 bool validate_username(const char* username) {
@@ -76,7 +222,11 @@ bool account_register(const char* username, const char* email,
     }
 
     // Create user in database
-    return db_create_user(username, email, password_hash, out_user_id);
+    if (!db_create_user(username, email, password_hash, out_user_id)) {
+        return false;
+    }
+    account_created(*out_user_id, username);
+    return true;
 }
 
 // Login
@@ -100,13 +250,15 @@ bool account_login(const char* username, const char* password_hash,
 
     if (!db_get_user_by_id(user_id, out_user->username, email,
                            &out_user->rating, &out_user->wins,
-                           &out_user->losses, &out_user->draws)) {
+                           &out_user->losses, &out_user->draws, &out_user->rd,
+                           &out_user->volatility)) {
         return false;
     }
 
     out_user->user_id = user_id;
     strcpy(out_user->email, email);
     strcpy(out_user->password_hash, stored_hash);
+    profile_store_user(out_user);
 
     return true;
 }
@@ -117,22 +269,86 @@ bool account_get_by_id(int user_id, user_t* out_user) {
 
     if (!db_get_user_by_id(user_id, out_user->username, email,
                            &out_user->rating, &out_user->wins,
-                           &out_user->losses, &out_user->draws)) {
+                           &out_user->losses, &out_user->draws, &out_user->rd,
+                           &out_user->volatility)) {
         return false;
     }
 
     out_user->user_id = user_id;
     strcpy(out_user->email, email);
+    profile_store_user(out_user);
 
     return true;
 }
 
-// Update rating
+// A new user enters the leaderboard at the starting rating (and the full
+// deviation of a player nobody has seen play)
+void account_created(int user_id, const char* username) {
+    glicko_t glicko = rating_glicko_new();
+    profile_t profile = {.user_id = user_id,
+                         .rating = DEFAULT_RATING,
+                         .rd = glicko.rd,
+                         .volatility = glicko.volatility};
+    snprintf(profile.username, sizeof(profile.username), "%s", username);
+    ranking_put(&profile);
+}
+
+// Update rating (database first, then the cached profile). A failed write
+// drops the cached copy so the next read goes back to the database.
 bool account_update_rating(int user_id, int new_rating) {
-    return db_update_user_rating(user_id, new_rating);
+    if (!db_update_user_rating(user_id, new_rating)) {
+        profile_forget(user_id);
+        return false;
+    }
+    int slot = profile_slot(user_id);
+    if (slot >= 0) profiles[slot].rating = new_rating;
+    ranking_set_rating(user_id, new_rating);
+    return true;
 }
 
-// Update stats
+// Update stats (same write-through rule as the rating)
 bool account_update_stats(int user_id, int wins, int losses, int draws) {
-    return db_update_user_stats(user_id, wins, losses, draws);
+    if (!db_update_user_stats(user_id, wins, losses, draws)) {
+        profile_forget(user_id);
+        return false;
+    }
+    int slot = profile_slot(user_id);
+    if (slot >= 0) {
+        profiles[slot].wins = wins;
+        profiles[slot].losses = losses;
+        profiles[slot].draws = draws;
+    }
+    ranking_set_stats(user_id, wins, losses, draws);
+    return true;
+}
+
+static db_player_result_t player_result(const profile_t* profile) {
+    return (db_player_result_t){.user_id = profile->user_id,
+                                .rating = profile->rating,
+                                .rd = profile->rd,
+                                .volatility = profile->volatility,
+                                .wins = profile->wins,
+                                .losses = profile->losses,
+                                .draws = profile->draws};
+}
+
+// Settle a rated game (one transaction). A failed batch was rolled back,
+// so the cached profiles still match the database and stay as they are.
+bool account_settle_match(const profile_t* red, const profile_t* black,
+                          const char* match_id, const char* result,
+                          const char* moves_json, const char* started_at,
+                          const char* ended_at, const char* start_fen) {
+    db_player_result_t red_row = player_result(red);
+    db_player_result_t black_row = player_result(black);
+    if (!db_settle_match(&red_row, &black_row, match_id, result, moves_json, started_at,
+                         ended_at, start_fen)) {
+        return false;
+    }
+
+    const profile_t* players[2] = {red, black};
+    for (int i = 0; i < 2; i++) {
+        profile_store(players[i]);
+        ranking_put(players[i]);
+    }
+    return true;
 }
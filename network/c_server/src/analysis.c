@@ -0,0 +1,414 @@
+/*
+ * analysis.c - Background post-game analysis worker pool
+ */
+
+#include "analysis.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "engine.h"
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static analysis_job_t* pending[ANALYSIS_QUEUE_SIZE];
+static int pending_head = 0;
+static int pending_count = 0;
+
+static analysis_job_t* finished[ANALYSIS_QUEUE_SIZE];
+static int finished_head = 0;
+static int finished_count = 0;
+
+static int outstanding = 0;  // Submitted but not yet polled
+static int running_jobs = 0;
+static bool pool_running = false;
+static pthread_t workers[ANALYSIS_WORKERS];
+static int worker_count = 0;
+static int notify_fd = -1;
+
+// Throughput cap: earliest time the next game may start (under queue_lock)
+static int64_t next_start_ms = 0;
+
+static uint64_t completed_total = 0;
+static uint64_t dropped_total = 0;
+
+// =========================
+// Scoring
+// =========================
+
+static int clamp_cp(int score) {
+    if (score > ANALYSIS_MATE_CP) return ANALYSIS_MATE_CP;
+    if (score < -ANALYSIS_MATE_CP) return -ANALYSIS_MATE_CP;
+    return score;
+}
+
+// Expected score (0..100) of the side with a centipawn advantage
+static double win_percent(int cp) {
+    return 50.0 + 50.0 * (2.0 / (1.0 + exp(-0.00368208 * cp)) - 1.0);
+}
+
+// Per-move accuracy from the drop in winning chances
+static double move_accuracy(int cp_before, int cp_after) {
+    double drop = win_percent(cp_before) - win_percent(cp_after);
+    if (drop < 0) drop = 0;
+    double accuracy = 103.1668 * exp(-0.04354 * drop) - 3.1669;
+    if (accuracy < 0) accuracy = 0;
+    if (accuracy > 100) accuracy = 100;
+    return accuracy;
+}
+
+static analysis_tag_t classify(int cp_loss) {
+    if (cp_loss >= ANALYSIS_BLUNDER_CP) return ANALYSIS_TAG_BLUNDER;
+    if (cp_loss >= ANALYSIS_MISTAKE_CP) return ANALYSIS_TAG_MISTAKE;
+    if (cp_loss >= ANALYSIS_INACCURACY_CP) return ANALYSIS_TAG_INACCURACY;
+    return ANALYSIS_TAG_NONE;
+}
+
+const char* analysis_tag_name(analysis_tag_t tag) {
+    switch (tag) {
+        case ANALYSIS_TAG_INACCURACY: return "inaccuracy";
+        case ANALYSIS_TAG_MISTAKE: return "mistake";
+        case ANALYSIS_TAG_BLUNDER: return "blunder";
+        default: return "none";
+    }
+}
+
+// Search every position once. The score after a move is the opponent's
+// view, so the mover's loss on ply i is score[i] + score[i + 1].
+static void analyse_game(analysis_job_t* job) {
+    static _Thread_local int scores[MAX_MOVES_PER_MATCH + 1];
+    static _Thread_local xq_move_t best[MAX_MOVES_PER_MATCH + 1];
+    static _Thread_local uint64_t history[MAX_MOVES_PER_MATCH + 1];
+
+    engine_limits_t limits = {ANALYSIS_POSITION_TIME_MS, ANALYSIS_DEPTH, 1, 0};
+    xq_position_t pos = job->start;
+    int64_t start_ms = clock_now_ms();
+
+    int searched = 0;
+    for (int i = 0; i <= job->move_count; i++) {
+        pthread_mutex_lock(&queue_lock);
+        bool running = pool_running;
+        pthread_mutex_unlock(&queue_lock);
+        if (!running) break;
+
+        xq_move_t legal[XQ_MAX_MOVES];
+        if (xq_generate_legal(&pos, legal) == 0) {
+            scores[i] = -ANALYSIS_MATE_CP;
+            best[i] = XQ_NO_MOVE;
+        } else {
+            engine_result_t result;
+            engine_search(&pos, history, i, &limits, &result);
+            scores[i] = clamp_cp(result.score);
+            best[i] = result.best_move;
+        }
+        searched++;
+
+        if (i == job->move_count) break;
+        history[i] = pos.hash;
+        xq_undo_t undo;
+        xq_make_move(&pos, job->moves[i], &undo);  // Validated on submit
+    }
+
+    job->completed = searched == job->move_count + 1;
+    double accuracy_sum[2] = {0, 0};
+    int counted[2] = {0, 0};
+
+    for (int i = 0; i + 1 < searched; i++) {
+        int side = (job->start.side + i) % 2;
+        int cp_before = scores[i];
+        int cp_after = -scores[i + 1];
+        int loss = job->moves[i] == best[i] ? 0 : cp_before - cp_after;
+        if (loss < 0) loss = 0;
+
+        analysis_ply_t* ply = &job->plies[i];
+        ply->cp_loss = loss;
+        ply->tag = classify(loss);
+        ply->best_move = best[i];
+
+        if (ply->tag == ANALYSIS_TAG_INACCURACY) job->inaccuracies[side]++;
+        if (ply->tag == ANALYSIS_TAG_MISTAKE) job->mistakes[side]++;
+        if (ply->tag == ANALYSIS_TAG_BLUNDER) job->blunders[side]++;
+
+        accuracy_sum[side] += move_accuracy(cp_before, cp_before - loss);
+        counted[side]++;
+    }
+    for (int side = 0; side < 2; side++) {
+        job->accuracy[side] =
+            counted[side] ? (int)lround(accuracy_sum[side] / counted[side]) : 0;
+    }
+    job->elapsed_ms = (int)(clock_now_ms() - start_ms);
+}
+
+// =========================
+// Worker pool
+// =========================
+
+static void* worker_main(void* arg) {
+    (void)arg;
+
+    // Linux niceness is per thread: stay behind the event loop and bots
+    if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), ANALYSIS_NICE) < 0) {
+        perror("analysis setpriority");
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        for (;;) {
+            while (pool_running && pending_count == 0) {
+                pthread_cond_wait(&queue_cond, &queue_lock);
+            }
+            if (!pool_running) break;
+
+            // Throughput cap: space game starts evenly
+            int64_t now_ms = clock_now_ms();
+            if (now_ms >= next_start_ms) break;
+
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            int64_t wait_ms = next_start_ms - now_ms;
+            until.tv_sec += wait_ms / 1000;
+            until.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&queue_cond, &queue_lock, &until);
+        }
+        if (!pool_running) {
+            pthread_mutex_unlock(&queue_lock);
+            return NULL;
+        }
+
+        analysis_job_t* job = pending[pending_head];
+        pending_head = (pending_head + 1) % ANALYSIS_QUEUE_SIZE;
+        pending_count--;
+        running_jobs++;
+        int64_t now_ms = clock_now_ms();
+        if (next_start_ms < now_ms) next_start_ms = now_ms;
+        next_start_ms += 60000 / ANALYSIS_MAX_GAMES_PER_MIN;
+        pthread_mutex_unlock(&queue_lock);
+
+        analyse_game(job);
+
+        pthread_mutex_lock(&queue_lock);
+        running_jobs--;
+        finished[(finished_head + finished_count) % ANALYSIS_QUEUE_SIZE] = job;
+        finished_count++;
+        pthread_mutex_unlock(&queue_lock);
+
+        // Wake the event loop
+        uint64_t one = 1;
+        if (write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("analysis eventfd write");
+        }
+    }
+}
+
+bool analysis_init(void) {
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify_fd < 0) {
+        perror("eventfd");
+        return false;
+    }
+
+    pool_running = true;
+    for (int i = 0; i < ANALYSIS_WORKERS; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) break;
+        worker_count++;
+    }
+    if (worker_count == 0) {
+        analysis_shutdown();
+        return false;
+    }
+
+    printf("Analysis initialized (%d workers, depth %d, max %d games/min)\n",
+           worker_count, ANALYSIS_DEPTH, ANALYSIS_MAX_GAMES_PER_MIN);
+    return true;
+}
+
+void analysis_shutdown(void) {
+    pthread_mutex_lock(&queue_lock);
+    pool_running = false;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    // A running game stops at its next position
+    for (int i = 0; i < worker_count; i++) pthread_join(workers[i], NULL);
+    worker_count = 0;
+
+    while (pending_count > 0) {
+        free(pending[pending_head]);
+        pending_head = (pending_head + 1) % ANALYSIS_QUEUE_SIZE;
+        pending_count--;
+    }
+    while (finished_count > 0) {
+        free(finished[finished_head]);
+        finished_head = (finished_head + 1) % ANALYSIS_QUEUE_SIZE;
+        finished_count--;
+    }
+    outstanding = 0;
+
+    if (notify_fd >= 0) close(notify_fd);
+    notify_fd = -1;
+}
+
+int analysis_get_notify_fd(void) { return notify_fd; }
+
+bool analysis_submit_match(const match_t* match) {
+    if (match->move_count < ANALYSIS_MIN_PLIES) return false;
+
+    analysis_job_t* job = calloc(1, sizeof(analysis_job_t));
+    if (!job) return false;
+
+    snprintf(job->match_id, sizeof(job->match_id), "%s", match->match_id);
+    job->red_user_id = match->red_user_id;
+    job->black_user_id = match->black_user_id;
+
+    // Resolve the stored coordinates to legal moves now, on the loop thread
+    xq_position_t pos;
+    if (!xq_position_from_fen(&pos, match->start_fen)) {
+        free(job);
+        return false;
+    }
+    job->start = pos;
+    for (int i = 0; i < match->move_count; i++) {
+        const move_t* move = &match->moves[i];
+        xq_move_t m = xq_find_move(&pos, move->from_row, move->from_col,
+                                   move->to_row, move->to_col);
+        xq_undo_t undo;
+        if (m == XQ_NO_MOVE || !xq_make_move(&pos, m, &undo)) {
+            free(job);
+            return false;
+        }
+        job->moves[job->move_count++] = m;
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    if (!pool_running || outstanding >= ANALYSIS_QUEUE_SIZE) {
+        dropped_total++;
+        pthread_mutex_unlock(&queue_lock);
+        free(job);
+        return false;
+    }
+    pending[(pending_head + pending_count) % ANALYSIS_QUEUE_SIZE] = job;
+    pending_count++;
+    outstanding++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    return true;
+}
+
+int analysis_poll_results(analysis_job_t* out, int max_count) {
+    // Reset the eventfd counter before draining so no wakeup is lost
+    uint64_t counter;
+    if (read(notify_fd, &counter, sizeof(counter)) < 0 && errno != EAGAIN) {
+        perror("analysis eventfd read");
+    }
+
+    int count = 0;
+    pthread_mutex_lock(&queue_lock);
+    while (finished_count > 0 && count < max_count) {
+        analysis_job_t* job = finished[finished_head];
+        finished_head = (finished_head + 1) % ANALYSIS_QUEUE_SIZE;
+        finished_count--;
+        outstanding--;
+        if (job->completed) completed_total++;
+        out[count++] = *job;
+        free(job);
+    }
+    bool more = finished_count > 0;
+    pthread_mutex_unlock(&queue_lock);
+
+    // Leftovers: make sure the loop comes back for them
+    if (more) {
+        uint64_t one = 1;
+        if (write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("analysis eventfd write");
+        }
+    }
+    return count;
+}
+
+int analysis_get_backlog(void) {
+    pthread_mutex_lock(&queue_lock);
+    int backlog = pending_count + running_jobs;
+    pthread_mutex_unlock(&queue_lock);
+    return backlog;
+}
+
+uint64_t analysis_get_completed(void) {
+    pthread_mutex_lock(&queue_lock);
+    uint64_t value = completed_total;
+    pthread_mutex_unlock(&queue_lock);
+    return value;
+}
+
+uint64_t analysis_get_dropped(void) {
+    pthread_mutex_lock(&queue_lock);
+    uint64_t value = dropped_total;
+    pthread_mutex_unlock(&queue_lock);
+    return value;
+}
+
+// =========================
+// Serialisation
+// =========================
+
+// Longest a ply can get: its cp_loss entry (",-2147483648") plus a flagged
+// entry with a five-digit ply and "inaccuracy" (112 bytes)
+#define ANALYSIS_JSON_PLY_MAX 128
+
+char* analysis_to_json(const analysis_job_t* job) {
+    size_t cap = 512 + (size_t)job->move_count * ANALYSIS_JSON_PLY_MAX;
+    char* json = malloc(cap);
+    if (!json) return NULL;
+
+    size_t len = (size_t)snprintf(
+        json, cap,
+        "{\"depth\":%d,\"red\":{\"accuracy\":%d,\"inaccuracies\":%d,\"mistakes\":%d,"
+        "\"blunders\":%d},\"black\":{\"accuracy\":%d,\"inaccuracies\":%d,"
+        "\"mistakes\":%d,\"blunders\":%d},\"cp_loss\":[",
+        ANALYSIS_DEPTH, job->accuracy[XQ_RED], job->inaccuracies[XQ_RED],
+        job->mistakes[XQ_RED], job->blunders[XQ_RED], job->accuracy[XQ_BLACK],
+        job->inaccuracies[XQ_BLACK], job->mistakes[XQ_BLACK], job->blunders[XQ_BLACK]);
+
+    for (int i = 0; i < job->move_count && len < cap; i++) {
+        len += (size_t)snprintf(json + len, cap - len, "%s%d", i ? "," : "",
+                                job->plies[i].cp_loss);
+    }
+    if (len < cap) len += (size_t)snprintf(json + len, cap - len, "],\"flagged\":[");
+
+    // Only flagged plies carry the better move
+    bool first = true;
+    for (int i = 0; i < job->move_count && len < cap; i++) {
+        const analysis_ply_t* ply = &job->plies[i];
+        if (ply->tag == ANALYSIS_TAG_NONE) continue;
+        xq_move_t best = ply->best_move;
+        len += (size_t)snprintf(
+            json + len, cap - len,
+            "%s{\"ply\":%d,\"tag\":\"%s\",\"cp_loss\":%d,\"best\":{\"from_row\":%d,"
+            "\"from_col\":%d,\"to_row\":%d,\"to_col\":%d}}",
+            first ? "" : ",", i + 1, analysis_tag_name(ply->tag), ply->cp_loss,
+            XQ_ROW(XQ_FROM(best)), XQ_COL(XQ_FROM(best)), XQ_ROW(XQ_TO(best)),
+            XQ_COL(XQ_TO(best)));
+        first = false;
+    }
+    if (len < cap) len += (size_t)snprintf(json + len, cap - len, "]}");
+
+    // Never hand out a cut-off document
+    if (len >= cap) {
+        free(json);
+        return NULL;
+    }
+    return json;
+}
@@ -5,12 +5,14 @@
 #include "broadcast.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 
 #include "lobby.h"
 #include "match.h"
+#include "pubsub.h"
 #include "server.h"
 
 // Send message to specific client by fd
@@ -33,20 +35,19 @@ bool send_to_client(server_t* server, int client_fd, const char* message) {
         return false;
     }
 
-    // Add newline if not present
-    char buffer[MAX_MESSAGE_SIZE];
-    snprintf(buffer, sizeof(buffer), "%s%s", message,
-             (message[strlen(message) - 1] == '\n') ? "" : "\n");
+    // Newline added by frame_create; queued behind anything still pending
+    frame_t* frame = frame_create(message, strlen(message));
+    if (!frame) return false;
 
-    ssize_t sent = send(client_fd, buffer, strlen(buffer), MSG_NOSIGNAL);
-    if (sent < 0) {
-        perror("[Broadcast] send() failed");
-        return false;
+    bool sent = client_send_frame(server, client, frame);
+    if (sent) {
+        printf("[Broadcast] Sent to fd %d: %.*s\n", client_fd,
+               (int)(frame->len - 1), frame->data);
+    } else {
+        fprintf(stderr, "[Broadcast] Send to fd %d failed\n", client_fd);
     }
-
-    printf("[Broadcast] Sent to fd %d: %.*s\n", client_fd,
-           (int)(strlen(buffer) - 1), buffer);
-    return true;
+    frame_unref(frame);
+    return sent;
 }
 
 // Send to specific user by user_id
@@ -98,35 +99,100 @@ void broadcast_to_match(server_t* server, const char* match_id,
         return;
     }
 
-    // Send to both players
-    send_to_user(server, match->red_user_id, message);
-    send_to_user(server, match->black_user_id, message);
+    broadcast_match_event(server, match, 0, message);
+}
+
+// Hand a match event to every fanout process (one shared frame)
+static void forward_to_fanout(server_t* server, const match_t* match,
+                              uint32_t seq, const char* stamped) {
+    if (server->fanout_count == 0) return;
+
+    size_t cap = strlen(stamped) + strlen(match->match_id) + 96;
+    char* event = malloc(cap);
+    if (!event) return;
+    snprintf(event, cap,
+             "{\"type\":\"match_event\",\"match_id\":\"%s\",\"event_seq\":%u,"
+             "\"message\":%.*s}",
+             match->match_id, seq, (int)strcspn(stamped, "\n"), stamped);
+
+    frame_t* frame = frame_create(event, strlen(event));
+    free(event);
+    if (!frame) return;
+
+    // Index loop: a failed send shuts the peer down but leaves it listed
+    // until the loop sees the hangup
+    for (int i = 0; i < server->fanout_count; i++) {
+        client_send_frame(server, server->fanout_peers[i], frame);
+    }
+    frame_unref(frame);
+}
 
-    // Send to spectators
-    for (int i = 0; i < match->spectator_count; i++) {
-        send_to_user(server, match->spectator_ids[i], message);
+// Stamp the match's next event_seq into a {"type":...} message and send it
+// to the players (except exclude_user_id), the spectator topic and the
+// fanout processes
+void broadcast_match_event(server_t* server, match_t* match,
+                           int exclude_user_id, const char* message) {
+    if (!server || !match || !message || message[0] != '{') {
+        return;
     }
 
-    printf("[Broadcast] Sent to match %s (players: %d, %d, spectators: %d)\n", match_id,
-           match->red_user_id, match->black_user_id, match->spectator_count);
+    uint32_t seq = ++match->event_seq;
+
+    size_t len = strlen(message);
+    char* stamped = malloc(len + 32);
+    if (!stamped) return;
+    snprintf(stamped, len + 32, "{\"event_seq\":%u,%s", seq, message + 1);
+
+    // Send to both players
+    if (match->red_user_id != exclude_user_id) {
+        send_to_user(server, match->red_user_id, stamped);
+    }
+    if (match->black_user_id != exclude_user_id) {
+        send_to_user(server, match->black_user_id, stamped);
+    }
+
+    // Send to spectators (one shared frame for the whole topic)
+    int spectators = pubsub_publish(server, match->match_id, seq, stamped);
+    forward_to_fanout(server, match, seq, stamped);
+
+    printf("[Broadcast] Sent event %u to match %s (players: %d, %d, spectators: %d)\n",
+           seq, match->match_id, match->red_user_id, match->black_user_id,
+           spectators);
+    free(stamped);
 }
 
 // Broadcast to all ready players in lobby
+static int compare_user_ids(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
 void broadcast_to_lobby(server_t* server, const char* message) {
     if (!server || !message) {
         return;
     }
 
-    // Get all ready users
-    int ready_users[MAX_CLIENTS];
-    int count = lobby_get_ready_users(ready_users, MAX_CLIENTS);
-
-    // Send to each ready user
-    for (int i = 0; i < count; i++) {
-        send_to_user(server, ready_users[i], message);
+    // Get all ready users, sorted for lookup while walking the clients
+    int ready_users[MAX_READY_PLAYERS];
+    int count = lobby_get_ready_users(ready_users, MAX_READY_PLAYERS);
+    qsort(ready_users, count, sizeof(int), compare_user_ids);
+
+    // One shared frame for every ready connection
+    frame_t* frame = frame_create(message, strlen(message));
+    if (!frame) return;
+
+    int sent = 0;
+    for (int i = 0; i < MAX_CLIENTS && count > 0; i++) {
+        client_t* client = server->clients[i];
+        if (!client || client->user_id <= 0 ||
+            !bsearch(&client->user_id, ready_users, count, sizeof(int), compare_user_ids)) {
+            continue;
+        }
+        if (client_send_frame(server, client, frame)) sent++;
     }
+    frame_unref(frame);
 
-    printf("[Broadcast] Sent to %d ready users in lobby\n", count);
+    printf("[Broadcast] Sent to %d ready connections in lobby\n", sent);
 }
 
 // Broadcast to all connected clients
@@ -0,0 +1,68 @@
+/*
+ * clock.c - Monotonic game clocks and time controls
+ */
+
+#include "clock.h"
+
+#include <time.h>
+
+int64_t clock_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+time_control_t time_control_make(int base_ms, int increment_ms, int delay_ms,
+                                 int move_limit_ms) {
+    time_control_t tc;
+    tc.base_ms = base_ms > 0 ? base_ms : DEFAULT_BASE_TIME_MS;
+    tc.increment_ms = increment_ms > 0 ? increment_ms : 0;
+    tc.delay_ms = delay_ms > 0 ? delay_ms : 0;
+    tc.move_limit_ms = move_limit_ms > 0 ? move_limit_ms : 0;
+    return tc;
+}
+
+int clock_lag_compensation_ms(int rtt_ms) {
+    if (rtt_ms <= 0) return 0;
+    int comp = rtt_ms * LAG_COMP_SHARE_PERCENT / 100;
+    return comp < LAG_COMP_MAX_MS ? comp : LAG_COMP_MAX_MS;
+}
+
+int64_t clock_ms_until_flag(const time_control_t* tc, int remaining_ms,
+                            int64_t think_ms) {
+    if (think_ms < 0) think_ms = 0;
+
+    // Bronstein: the clock runs from the first millisecond, the delay is only
+    // refunded once the move is made - so it never postpones a flag.
+    int64_t left = (int64_t)remaining_ms - think_ms;
+
+    if (tc->move_limit_ms > 0) {
+        int64_t limit_left = (int64_t)tc->move_limit_ms - think_ms;
+        if (limit_left < left) left = limit_left;
+    }
+
+    return left;
+}
+
+int clock_project_remaining(const time_control_t* tc, int remaining_ms,
+                            int64_t think_ms) {
+    (void)tc;
+    if (think_ms < 0) think_ms = 0;
+    int64_t left = (int64_t)remaining_ms - think_ms;
+    return left > 0 ? (int)left : 0;
+}
+
+bool clock_charge_move(const time_control_t* tc, int* remaining_ms,
+                       int64_t think_ms) {
+    if (think_ms < 0) think_ms = 0;
+
+    if (clock_ms_until_flag(tc, *remaining_ms, think_ms) <= 0) {
+        int64_t left = (int64_t)*remaining_ms - think_ms;
+        *remaining_ms = left > 0 ? (int)left : 0;
+        return false;
+    }
+
+    int64_t refund = think_ms < tc->delay_ms ? think_ms : tc->delay_ms;
+    *remaining_ms = (int)(*remaining_ms - think_ms + refund + tc->increment_ms);
+    return true;
+}
@@ -236,16 +236,17 @@ bool db_get_user_by_username(const char* username, int* out_user_id,
 // Get user by ID
 bool db_get_user_by_id(int user_id, char* out_username, char* out_email,
                        int* out_rating, int* out_wins, int* out_losses,
-                       int* out_draws) {
+                       int* out_draws, double* out_rd, double* out_volatility) {
     SQLHSTMT stmt;
     SQLRETURN ret;
     SQLLEN indicator;
     char username[64], email[128];
     int rating, wins, losses, draws;
+    double rd, volatility;
 
     const char* sql =
-        "SELECT username, email, rating, wins, losses, draws FROM Users WHERE "
-        "user_id = ?";
+        "SELECT username, email, rating, wins, losses, draws, rating_rd, "
+        "rating_volatility FROM Users WHERE user_id = ?";
 
     ret = SQLAllocHandle(SQL_HANDLE_STMT, g_db_conn, &stmt);
     if (ret != SQL_SUCCESS) {
@@ -275,6 +276,8 @@ bool db_get_user_by_id(int user_id, char* out_username, char* out_email,
         SQLGetData(stmt, 4, SQL_C_SLONG, &wins, 0, &indicator);
         SQLGetData(stmt, 5, SQL_C_SLONG, &losses, 0, &indicator);
         SQLGetData(stmt, 6, SQL_C_SLONG, &draws, 0, &indicator);
+        SQLGetData(stmt, 7, SQL_C_DOUBLE, &rd, 0, &indicator);
+        SQLGetData(stmt, 8, SQL_C_DOUBLE, &volatility, 0, &indicator);
 
         if (out_username) strcpy(out_username, username);
         if (out_email) strcpy(out_email, email);
@@ -282,6 +285,8 @@ bool db_get_user_by_id(int user_id, char* out_username, char* out_email,
         if (out_wins) *out_wins = wins;
         if (out_losses) *out_losses = losses;
         if (out_draws) *out_draws = draws;
+        if (out_rd) *out_rd = rd;
+        if (out_volatility) *out_volatility = volatility;
 
         SQLFreeHandle(SQL_HANDLE_STMT, stmt);
         return true;
@@ -354,17 +359,105 @@ bool db_update_user_stats(int user_id, int wins, int losses, int draws) {
     return (ret == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO);
 }
 
+// Write a recomputed Glicko-2 rating
+bool db_update_user_glicko(int user_id, int rating, double rd, double volatility) {
+    SQLHSTMT stmt;
+    SQLRETURN ret;
+
+    const char* sql =
+        "UPDATE Users SET rating = ?, rating_rd = ?, rating_volatility = ? "
+        "WHERE user_id = ?";
+
+    ret = SQLAllocHandle(SQL_HANDLE_STMT, g_db_conn, &stmt);
+    if (ret != SQL_SUCCESS) {
+        return false;
+    }
+
+    ret = SQLPrepare(stmt, (SQLCHAR*)sql, SQL_NTS);
+    if (ret != SQL_SUCCESS) {
+        SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+        return false;
+    }
+
+    SQLBindParameter(stmt, 1, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                     &rating, 0, NULL);
+    SQLBindParameter(stmt, 2, SQL_PARAM_INPUT, SQL_C_DOUBLE, SQL_DOUBLE, 0, 0,
+                     &rd, 0, NULL);
+    SQLBindParameter(stmt, 3, SQL_PARAM_INPUT, SQL_C_DOUBLE, SQL_DOUBLE, 0, 0,
+                     &volatility, 0, NULL);
+    SQLBindParameter(stmt, 4, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                     &user_id, 0, NULL);
+
+    ret = SQLExecute(stmt);
+
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    return (ret == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO);
+}
+
+// Stream all users
+bool db_scan_users(db_user_row_fn callback, void* ctx) {
+    SQLHSTMT stmt;
+    SQLRETURN ret;
+    SQLLEN indicator;
+    char username[64];
+    int user_id, rating, wins, losses, draws;
+    double rd;
+
+    const char* sql =
+        "SELECT user_id, username, rating, wins, losses, draws, rating_rd FROM Users";
+
+    ret = SQLAllocHandle(SQL_HANDLE_STMT, g_db_conn, &stmt);
+    if (ret != SQL_SUCCESS) {
+        return false;
+    }
+
+    ret = SQLExecDirect(stmt, (SQLCHAR*)sql, SQL_NTS);
+    if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+        db_print_error(stmt, SQL_HANDLE_STMT, "Failed to scan users");
+        SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+        return false;
+    }
+
+    bool ok = true;
+    while ((ret = SQLFetch(stmt)) != SQL_NO_DATA) {
+        if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+            db_print_error(stmt, SQL_HANDLE_STMT, "Failed to fetch user");
+            ok = false;
+            break;
+        }
+        SQLGetData(stmt, 1, SQL_C_SLONG, &user_id, 0, &indicator);
+        SQLGetData(stmt, 2, SQL_C_CHAR, username, sizeof(username), &indicator);
+        if (indicator == SQL_NULL_DATA) username[0] = '\0';
+        SQLGetData(stmt, 3, SQL_C_SLONG, &rating, 0, &indicator);
+        SQLGetData(stmt, 4, SQL_C_SLONG, &wins, 0, &indicator);
+        SQLGetData(stmt, 5, SQL_C_SLONG, &losses, 0, &indicator);
+        SQLGetData(stmt, 6, SQL_C_SLONG, &draws, 0, &indicator);
+        SQLGetData(stmt, 7, SQL_C_DOUBLE, &rd, 0, &indicator);
+
+        if (!callback(user_id, username, rating, rd, wins, losses, draws, ctx)) {
+            break;
+        }
+    }
+
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    return ok;
+}
+
 // Save match
 bool db_save_match(const char* match_id, int red_user_id, int black_user_id,
                    const char* result, const char* moves_json,
-                   const char* started_at, const char* ended_at) {
+                   const char* started_at, const char* ended_at,
+                   const char* start_fen) {
     SQLHSTMT stmt;
     SQLRETURN ret;
+    SQLLEN fen_indicator = start_fen ? SQL_NTS : SQL_NULL_DATA;
+    // Long games outgrow 8000 characters; a truncated list cannot be replayed
+    SQLULEN moves_len = moves_json ? strlen(moves_json) : 0;
 
     const char* sql =
         "INSERT INTO Matches (match_id, red_user_id, black_user_id, result, "
-        "moves_json, started_at, ended_at) "
-        "VALUES (?, ?, ?, ?, ?, ?, ?)";
+        "moves_json, started_at, ended_at, start_fen) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?)";
 
     ret = SQLAllocHandle(SQL_HANDLE_STMT, g_db_conn, &stmt);
     if (ret != SQL_SUCCESS) {
@@ -385,12 +478,14 @@ bool db_save_match(const char* match_id, int red_user_id, int black_user_id,
                      &black_user_id, 0, NULL);
     SQLBindParameter(stmt, 4, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 16, 0,
                      (SQLCHAR*)result, 0, NULL);
-    SQLBindParameter(stmt, 5, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 8000, 0,
-                     (SQLCHAR*)moves_json, 0, NULL);
+    SQLBindParameter(stmt, 5, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_LONGVARCHAR,
+                     moves_len, 0, (SQLCHAR*)moves_json, 0, NULL);
     SQLBindParameter(stmt, 6, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 32, 0,
                      (SQLCHAR*)started_at, 0, NULL);
     SQLBindParameter(stmt, 7, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 32, 0,
                      (SQLCHAR*)ended_at, 0, NULL);
+    SQLBindParameter(stmt, 8, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 100, 0,
+                     (SQLCHAR*)start_fen, 0, &fen_indicator);
 
     ret = SQLExecute(stmt);
 
@@ -398,21 +493,38 @@ bool db_save_match(const char* match_id, int red_user_id, int black_user_id,
     return (ret == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO);
 }
 
-// Get match by ID
-bool db_get_match(const char* match_id, char* out_json, size_t json_size) {
+// Settle a rated match: both players' rating/stats and the match row in one
+// transaction. The batch is one round trip; a player row that is missing or
+// any failing statement rolls all of it back.
+bool db_settle_match(const db_player_result_t* red, const db_player_result_t* black,
+                     const char* match_id, const char* result, const char* moves_json,
+                     const char* started_at, const char* ended_at,
+                     const char* start_fen) {
     SQLHSTMT stmt;
     SQLRETURN ret;
-    SQLLEN indicator;
-    char red_username[64], black_username[64], result[16], moves[8000],
-        started[32], ended[32];
+    SQLLEN fen_indicator = start_fen ? SQL_NTS : SQL_NULL_DATA;
+    SQLULEN moves_len = moves_json ? strlen(moves_json) : 0;
+    db_player_result_t players[2] = {*red, *black};
 
     const char* sql =
-        "SELECT m.result, m.moves_json, m.started_at, m.ended_at, "
-        "u1.username as red_name, u2.username as black_name "
-        "FROM Matches m "
-        "JOIN Users u1 ON m.red_user_id = u1.user_id "
-        "JOIN Users u2 ON m.black_user_id = u2.user_id "
-        "WHERE m.match_id = ?";
+        "SET NOCOUNT ON; "
+        "BEGIN TRY "
+        "BEGIN TRANSACTION; "
+        "UPDATE Users SET rating = ?, rating_rd = ?, rating_volatility = ?, wins = ?, "
+        "losses = ?, draws = ? WHERE user_id = ?; "
+        "IF @@ROWCOUNT <> 1 THROW 50001, 'Unknown red player', 1; "
+        "UPDATE Users SET rating = ?, rating_rd = ?, rating_volatility = ?, wins = ?, "
+        "losses = ?, draws = ? WHERE user_id = ?; "
+        "IF @@ROWCOUNT <> 1 THROW 50002, 'Unknown black player', 1; "
+        "INSERT INTO Matches (match_id, red_user_id, black_user_id, result, "
+        "moves_json, started_at, ended_at, start_fen, rated) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, 1); "
+        "COMMIT TRANSACTION; "
+        "END TRY "
+        "BEGIN CATCH "
+        "IF @@TRANCOUNT > 0 ROLLBACK TRANSACTION; "
+        "THROW; "
+        "END CATCH";
 
     ret = SQLAllocHandle(SQL_HANDLE_STMT, g_db_conn, &stmt);
     if (ret != SQL_SUCCESS) {
@@ -421,59 +533,211 @@ bool db_get_match(const char* match_id, char* out_json, size_t json_size) {
 
     ret = SQLPrepare(stmt, (SQLCHAR*)sql, SQL_NTS);
     if (ret != SQL_SUCCESS) {
+        db_print_error(stmt, SQL_HANDLE_STMT, "Failed to prepare settlement");
         SQLFreeHandle(SQL_HANDLE_STMT, stmt);
         return false;
     }
 
-    SQLBindParameter(stmt, 1, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 64, 0,
+    SQLUSMALLINT param = 1;
+    for (int i = 0; i < 2; i++) {
+        SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                         &players[i].rating, 0, NULL);
+        SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_DOUBLE, SQL_DOUBLE, 0, 0,
+                         &players[i].rd, 0, NULL);
+        SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_DOUBLE, SQL_DOUBLE, 0, 0,
+                         &players[i].volatility, 0, NULL);
+        SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                         &players[i].wins, 0, NULL);
+        SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                         &players[i].losses, 0, NULL);
+        SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                         &players[i].draws, 0, NULL);
+        SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                         &players[i].user_id, 0, NULL);
+    }
+    SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 64, 0,
                      (SQLCHAR*)match_id, 0, NULL);
+    SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                     &players[0].user_id, 0, NULL);
+    SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                     &players[1].user_id, 0, NULL);
+    SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 16, 0,
+                     (SQLCHAR*)result, 0, NULL);
+    SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_LONGVARCHAR,
+                     moves_len, 0, (SQLCHAR*)moves_json, 0, NULL);
+    SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 32, 0,
+                     (SQLCHAR*)started_at, 0, NULL);
+    SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 32, 0,
+                     (SQLCHAR*)ended_at, 0, NULL);
+    SQLBindParameter(stmt, param++, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 100, 0,
+                     (SQLCHAR*)start_fen, 0, &fen_indicator);
 
     ret = SQLExecute(stmt);
+    bool ok = (ret == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO || ret == SQL_NO_DATA);
+    // An error raised later in the batch comes back with the next result
+    while (ok && (ret = SQLMoreResults(stmt)) != SQL_NO_DATA) {
+        if (ret == SQL_ERROR) ok = false;
+    }
+    if (!ok) {
+        db_print_error(stmt, SQL_HANDLE_STMT, "Failed to settle match");
+    }
+
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    return ok;
+}
+
+// Read a text column of any length into *buf (grown as needed). NULL reads
+// as "".
+static bool db_get_long_text(SQLHSTMT stmt, SQLUSMALLINT column, char** buf,
+                             size_t* cap) {
+    size_t len = 0;
+    (*buf)[0] = '\0';
+
+    for (;;) {
+        SQLLEN indicator;
+        SQLRETURN ret = SQLGetData(stmt, column, SQL_C_CHAR, *buf + len,
+                                   (SQLLEN)(*cap - len), &indicator);
+        if (ret == SQL_NO_DATA) return true;
+        if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) return false;
+        if (indicator == SQL_NULL_DATA) {
+            (*buf)[0] = '\0';
+            return true;
+        }
+        if (ret == SQL_SUCCESS) return true;
+
+        // Truncated: the chunk filled the buffer except its terminator
+        len = *cap - 1;
+        size_t grown = *cap * 2;
+        if (indicator != SQL_NO_TOTAL && (size_t)indicator + 1 > grown) {
+            grown = len + (size_t)indicator + 1;
+        }
+        char* bigger = realloc(*buf, grown);
+        if (!bigger) return false;
+        *buf = bigger;
+        *cap = grown;
+    }
+}
+
+// Stream all matches in storage order
+bool db_scan_matches(db_match_row_fn callback, void* ctx) {
+    SQLHSTMT stmt;
+    SQLRETURN ret;
+    SQLLEN indicator;
+    char match_id[65], result[17], start_fen[101];
+
+    int red_rating, black_rating;
+
+    // moves_json goes last: long columns must be read after the others
+    const char* sql =
+        "SELECT m.match_id, m.result, m.start_fen, "
+        "ISNULL(u1.rating, 0), ISNULL(u2.rating, 0), m.moves_json "
+        "FROM Matches m "
+        "LEFT JOIN Users u1 ON m.red_user_id = u1.user_id "
+        "LEFT JOIN Users u2 ON m.black_user_id = u2.user_id";
+
+    ret = SQLAllocHandle(SQL_HANDLE_STMT, g_db_conn, &stmt);
     if (ret != SQL_SUCCESS) {
+        return false;
+    }
+
+    ret = SQLExecDirect(stmt, (SQLCHAR*)sql, SQL_NTS);
+    if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+        db_print_error(stmt, SQL_HANDLE_STMT, "Failed to scan matches");
         SQLFreeHandle(SQL_HANDLE_STMT, stmt);
         return false;
     }
 
-    ret = SQLFetch(stmt);
-    if (ret == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO) {
-        SQLGetData(stmt, 1, SQL_C_CHAR, result, sizeof(result), &indicator);
-        SQLGetData(stmt, 2, SQL_C_CHAR, moves, sizeof(moves), &indicator);
-        SQLGetData(stmt, 3, SQL_C_CHAR, started, sizeof(started), &indicator);
-        SQLGetData(stmt, 4, SQL_C_CHAR, ended, sizeof(ended), &indicator);
-        SQLGetData(stmt, 5, SQL_C_CHAR, red_username, sizeof(red_username),
-                   &indicator);
-        SQLGetData(stmt, 6, SQL_C_CHAR, black_username, sizeof(black_username),
-                   &indicator);
+    size_t moves_cap = 16384;
+    char* moves = malloc(moves_cap);
+    bool ok = moves != NULL;
 
-        snprintf(
-            out_json, json_size,
-            "{\"match_id\":\"%s\",\"red_user\":\"%s\",\"black_user\":\"%s\","
-            "\"result\":\"%s\",\"moves\":%s,\"started_at\":\"%s\",\"ended_at\":"
-            "\"%s\"}",
-            match_id, red_username, black_username, result, moves, started,
-            ended);
+    while (ok && (ret = SQLFetch(stmt)) != SQL_NO_DATA) {
+        if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+            db_print_error(stmt, SQL_HANDLE_STMT, "Failed to fetch match");
+            ok = false;
+            break;
+        }
+        SQLGetData(stmt, 1, SQL_C_CHAR, match_id, sizeof(match_id), &indicator);
+        if (indicator == SQL_NULL_DATA) match_id[0] = '\0';
+        SQLGetData(stmt, 2, SQL_C_CHAR, result, sizeof(result), &indicator);
+        if (indicator == SQL_NULL_DATA) result[0] = '\0';
+        SQLGetData(stmt, 3, SQL_C_CHAR, start_fen, sizeof(start_fen), &indicator);
+        if (indicator == SQL_NULL_DATA) start_fen[0] = '\0';
+        SQLGetData(stmt, 4, SQL_C_SLONG, &red_rating, 0, &indicator);
+        SQLGetData(stmt, 5, SQL_C_SLONG, &black_rating, 0, &indicator);
+        if (!db_get_long_text(stmt, 6, &moves, &moves_cap)) {
+            ok = false;
+            break;
+        }
 
-        SQLFreeHandle(SQL_HANDLE_STMT, stmt);
-        return true;
+        if (!callback(match_id, result, start_fen, moves, red_rating, black_rating, ctx)) {
+            break;
+        }
     }
 
+    free(moves);
     SQLFreeHandle(SQL_HANDLE_STMT, stmt);
-    return false;
+    return ok;
 }
 
-// Get leaderboard
-bool db_get_leaderboard(int limit, int offset, char* out_json,
-                        size_t json_size) {
+// Stream rated match outcomes in the order they ended
+bool db_scan_rated_results(db_result_row_fn callback, void* ctx) {
     SQLHSTMT stmt;
     SQLRETURN ret;
     SQLLEN indicator;
-    char username[64];
-    int rating, wins, losses, draws;
-    char buffer[512];
+    char result[17];
+    int red_user_id, black_user_id;
+    SQLBIGINT ended_at;
 
     const char* sql =
-        "SELECT username, rating, wins, losses, draws FROM Users "
-        "ORDER BY rating DESC OFFSET ? ROWS FETCH NEXT ? ROWS ONLY";
+        "SELECT red_user_id, black_user_id, result, "
+        "ISNULL(TRY_CAST(ended_at AS BIGINT), 0) AS ended "
+        "FROM Matches WHERE rated = 1 "
+        "ORDER BY ended, match_id";
+
+    ret = SQLAllocHandle(SQL_HANDLE_STMT, g_db_conn, &stmt);
+    if (ret != SQL_SUCCESS) {
+        return false;
+    }
+
+    ret = SQLExecDirect(stmt, (SQLCHAR*)sql, SQL_NTS);
+    if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+        db_print_error(stmt, SQL_HANDLE_STMT, "Failed to scan results");
+        SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+        return false;
+    }
+
+    bool ok = true;
+    while ((ret = SQLFetch(stmt)) != SQL_NO_DATA) {
+        if (ret != SQL_SUCCESS && ret != SQL_SUCCESS_WITH_INFO) {
+            db_print_error(stmt, SQL_HANDLE_STMT, "Failed to fetch result");
+            ok = false;
+            break;
+        }
+        SQLGetData(stmt, 1, SQL_C_SLONG, &red_user_id, 0, &indicator);
+        SQLGetData(stmt, 2, SQL_C_SLONG, &black_user_id, 0, &indicator);
+        SQLGetData(stmt, 3, SQL_C_CHAR, result, sizeof(result), &indicator);
+        if (indicator == SQL_NULL_DATA) result[0] = '\0';
+        SQLGetData(stmt, 4, SQL_C_SBIGINT, &ended_at, 0, &indicator);
+
+        if (!callback(red_user_id, black_user_id, result, (long long)ended_at, ctx)) {
+            break;
+        }
+    }
+
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    return ok;
+}
+
+// Save post-game analysis (one row per stored match)
+bool db_save_match_analysis(const char* match_id, int red_accuracy,
+                            int black_accuracy, const char* annotations_json) {
+    SQLHSTMT stmt;
+    SQLRETURN ret;
+
+    const char* sql =
+        "INSERT INTO MatchAnalysis (match_id, red_accuracy, black_accuracy, "
+        "annotations_json) VALUES (?, ?, ?, ?)";
 
     ret = SQLAllocHandle(SQL_HANDLE_STMT, g_db_conn, &stmt);
     if (ret != SQL_SUCCESS) {
@@ -486,42 +750,92 @@ bool db_get_leaderboard(int limit, int offset, char* out_json,
         return false;
     }
 
-    SQLBindParameter(stmt, 1, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
-                     &offset, 0, NULL);
+    // Annotations can exceed 8000 bytes on long games
+    SQLULEN json_len = strlen(annotations_json);
+    SQLBindParameter(stmt, 1, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 64, 0,
+                     (SQLCHAR*)match_id, 0, NULL);
     SQLBindParameter(stmt, 2, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
-                     &limit, 0, NULL);
+                     &red_accuracy, 0, NULL);
+    SQLBindParameter(stmt, 3, SQL_PARAM_INPUT, SQL_C_SLONG, SQL_INTEGER, 0, 0,
+                     &black_accuracy, 0, NULL);
+    SQLBindParameter(stmt, 4, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_LONGVARCHAR,
+                     json_len, 0, (SQLCHAR*)annotations_json, 0, NULL);
 
     ret = SQLExecute(stmt);
+
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    return (ret == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO);
+}
+
+// Get match by ID
+char* db_get_match(const char* match_id) {
+    SQLHSTMT stmt;
+    SQLRETURN ret;
+    SQLLEN indicator;
+    char red_username[64], black_username[64], result[16], started[32], ended[32];
+
+    // moves_json goes last: long columns must be read after the others
+    const char* sql =
+        "SELECT m.result, m.started_at, m.ended_at, "
+        "u1.username as red_name, u2.username as black_name, m.moves_json "
+        "FROM Matches m "
+        "JOIN Users u1 ON m.red_user_id = u1.user_id "
+        "JOIN Users u2 ON m.black_user_id = u2.user_id "
+        "WHERE m.match_id = ?";
+
+    ret = SQLAllocHandle(SQL_HANDLE_STMT, g_db_conn, &stmt);
+    if (ret != SQL_SUCCESS) {
+        return NULL;
+    }
+
+    ret = SQLPrepare(stmt, (SQLCHAR*)sql, SQL_NTS);
     if (ret != SQL_SUCCESS) {
         SQLFreeHandle(SQL_HANDLE_STMT, stmt);
-        return false;
+        return NULL;
     }
 
-    strcpy(out_json, "[");
-    bool first = true;
+    SQLBindParameter(stmt, 1, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR, 64, 0,
+                     (SQLCHAR*)match_id, 0, NULL);
 
-    while (SQLFetch(stmt) == SQL_SUCCESS) {
-        SQLGetData(stmt, 1, SQL_C_CHAR, username, sizeof(username), &indicator);
-        SQLGetData(stmt, 2, SQL_C_SLONG, &rating, 0, &indicator);
-        SQLGetData(stmt, 3, SQL_C_SLONG, &wins, 0, &indicator);
-        SQLGetData(stmt, 4, SQL_C_SLONG, &losses, 0, &indicator);
-        SQLGetData(stmt, 5, SQL_C_SLONG, &draws, 0, &indicator);
+    ret = SQLExecute(stmt);
+    if (ret != SQL_SUCCESS) {
+        SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+        return NULL;
+    }
 
-        snprintf(buffer, sizeof(buffer),
-                 "%s{\"username\":\"%s\",\"rating\":%d,\"wins\":%d,\"losses\":%"
-                 "d,\"draws\":%d}",
-                 first ? "" : ",", username, rating, wins, losses, draws);
+    char* json = NULL;
+    ret = SQLFetch(stmt);
+    if (ret == SQL_SUCCESS || ret == SQL_SUCCESS_WITH_INFO) {
+        SQLGetData(stmt, 1, SQL_C_CHAR, result, sizeof(result), &indicator);
+        SQLGetData(stmt, 2, SQL_C_CHAR, started, sizeof(started), &indicator);
+        SQLGetData(stmt, 3, SQL_C_CHAR, ended, sizeof(ended), &indicator);
+        SQLGetData(stmt, 4, SQL_C_CHAR, red_username, sizeof(red_username),
+                   &indicator);
+        SQLGetData(stmt, 5, SQL_C_CHAR, black_username, sizeof(black_username),
+                   &indicator);
 
-        if (strlen(out_json) + strlen(buffer) + 2 < json_size) {
-            strcat(out_json, buffer);
-            first = false;
+        // Moves are read whole, however long the game
+        size_t moves_cap = 16384;
+        char* moves = malloc(moves_cap);
+        if (moves && db_get_long_text(stmt, 6, &moves, &moves_cap)) {
+            const char* format =
+                "{\"match_id\":\"%s\",\"red_user\":\"%s\",\"black_user\":\"%s\","
+                "\"result\":\"%s\",\"moves\":%s,\"started_at\":\"%s\",\"ended_at\":"
+                "\"%s\"}";
+            const char* moves_json = moves[0] ? moves : "[]";
+            int len = snprintf(NULL, 0, format, match_id, red_username, black_username,
+                               result, moves_json, started, ended);
+            json = len >= 0 ? malloc((size_t)len + 1) : NULL;
+            if (json) {
+                snprintf(json, (size_t)len + 1, format, match_id, red_username,
+                         black_username, result, moves_json, started, ended);
+            }
         }
+        free(moves);
     }
 
-    strcat(out_json, "]");
-
     SQLFreeHandle(SQL_HANDLE_STMT, stmt);
-    return true;
+    return json;
 }
 
 // Get match history for a user
@@ -0,0 +1,752 @@
+/*
+ * engine.c - Xiangqi search engine and its worker pool
+ */
+
+#include "engine.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "clock.h"
+
+#define ENGINE_INF 30000
+#define TT_SIZE (1u << ENGINE_TT_BITS)
+
+// =========================
+// Evaluation
+// =========================
+
+static const int piece_value[8] = {0, 0, 120, 120, 270, 600, 285, 30};
+
+// Positional bonus from the piece owner's point of view.
+// rank = rows advanced from the owner's back rank (0..9).
+static int piece_square_bonus(int type, int rank, int col) {
+    int centre = 4 - abs(col - 4);  // 0 on the edge, 4 on the central file
+
+    switch (type) {
+        case XQ_PAWN:
+            if (rank < 5) return rank == 4 && col % 2 == 0 ? 5 : 0;
+            // Across the river: worth more, best near the palace, weak on the last rank
+            return rank == 9 ? 30 : 40 + (rank - 5) * 8 + centre * 5;
+        case XQ_HORSE:
+            return centre * 6 + (rank >= 3 && rank <= 7 ? 12 : 0) - (rank == 0 ? 10 : 0);
+        case XQ_CANNON:
+            return (col == 4 ? 12 : 0) + (rank == 2 ? 6 : 0);
+        case XQ_CHARIOT:
+            return centre * 2 + (rank >= 5 ? 10 : 0);
+        default:
+            return 0;
+    }
+}
+
+// Static evaluation from the side to move's point of view
+static int evaluate(const xq_position_t* pos) {
+    int score[2] = {0, 0};
+
+    for (int sq = 0; sq < XQ_SQUARES; sq++) {
+        uint8_t piece = pos->board[sq];
+        if (!piece) continue;
+        int side = XQ_SIDE(piece);
+        int type = XQ_TYPE(piece);
+        int rank = side == XQ_RED ? 9 - XQ_ROW(sq) : XQ_ROW(sq);
+        score[side] += piece_value[type] + piece_square_bonus(type, rank, XQ_COL(sq));
+    }
+
+    return score[pos->side] - score[pos->side ^ 1] + 10;  // Tempo
+}
+
+// Null move is unsafe once only pawns and defenders are left (zugzwang)
+static bool has_attackers(const xq_position_t* pos, int side) {
+    for (int sq = 0; sq < XQ_SQUARES; sq++) {
+        uint8_t piece = pos->board[sq];
+        if (!piece || XQ_SIDE(piece) != side) continue;
+        int type = XQ_TYPE(piece);
+        if (type == XQ_HORSE || type == XQ_CHARIOT || type == XQ_CANNON) return true;
+    }
+    return false;
+}
+
+// =========================
+// Transposition table (shared by all threads, lockless XOR scheme)
+// =========================
+
+#define TT_EXACT 1
+#define TT_LOWER 2
+#define TT_UPPER 3
+
+typedef struct {
+    _Atomic uint64_t key;  // hash ^ data, so torn writes fail verification
+    _Atomic uint64_t data;
+} tt_entry_t;
+
+static tt_entry_t* tt = NULL;
+
+// Mate scores are stored relative to the node, not the root
+static int score_to_tt(int score, int ply) {
+    if (score >= ENGINE_MATE_BOUND) return score + ply;
+    if (score <= -ENGINE_MATE_BOUND) return score - ply;
+    return score;
+}
+
+static int score_from_tt(int score, int ply) {
+    if (score >= ENGINE_MATE_BOUND) return score - ply;
+    if (score <= -ENGINE_MATE_BOUND) return score + ply;
+    return score;
+}
+
+static void tt_store(uint64_t hash, xq_move_t move, int score, int depth,
+                     int flag, int ply) {
+    tt_entry_t* entry = &tt[hash & (TT_SIZE - 1)];
+
+    uint64_t old_data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    uint64_t old_key = atomic_load_explicit(&entry->key, memory_order_relaxed);
+    // Depth-preferred, but always replace entries of other positions
+    if ((old_key ^ old_data) == hash && (int)((old_data >> 32) & 0xFF) > depth &&
+        flag != TT_EXACT) {
+        return;
+    }
+
+    uint64_t data = (uint64_t)move |
+                    ((uint64_t)(uint16_t)(int16_t)score_to_tt(score, ply) << 16) |
+                    ((uint64_t)(uint8_t)depth << 32) | ((uint64_t)flag << 40);
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+    atomic_store_explicit(&entry->key, hash ^ data, memory_order_relaxed);
+}
+
+static bool tt_probe(uint64_t hash, int ply, xq_move_t* move, int* score,
+                     int* depth, int* flag) {
+    tt_entry_t* entry = &tt[hash & (TT_SIZE - 1)];
+    uint64_t data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    uint64_t key = atomic_load_explicit(&entry->key, memory_order_relaxed);
+    if ((key ^ data) != hash || data == 0) return false;
+
+    *move = (xq_move_t)(data & 0xFFFF);
+    *score = score_from_tt((int16_t)(uint16_t)((data >> 16) & 0xFFFF), ply);
+    *depth = (int)((data >> 32) & 0xFF);
+    *flag = (int)((data >> 40) & 0x3);
+    return true;
+}
+
+// =========================
+// Search
+// =========================
+
+typedef struct {
+    atomic_bool stop;
+    int64_t start_ms;
+    int64_t deadline_ms;
+    const engine_limits_t* limits;
+} search_shared_t;
+
+typedef struct {
+    int id;
+    search_shared_t* shared;
+    xq_position_t pos;
+    // Position hashes from the game start through the current node
+    uint64_t keys[ENGINE_MAX_HISTORY + ENGINE_MAX_PLY + 1];
+    bool irreversible[ENGINE_MAX_HISTORY + ENGINE_MAX_PLY + 1];
+    int key_count;
+    xq_move_t killers[ENGINE_MAX_PLY][2];
+    int history[XQ_SQUARES][XQ_SQUARES];
+    uint64_t nodes;
+    uint64_t rng;
+    // Result of the deepest completed iteration
+    xq_move_t best_move;
+    int best_score;
+    int depth_done;
+} search_thread_t;
+
+static atomic_bool engine_abort;
+
+static bool should_stop(search_thread_t* t) {
+    if ((++t->nodes & 1023) == 0) {
+        if (atomic_load_explicit(&engine_abort, memory_order_relaxed) ||
+            clock_now_ms() >= t->shared->deadline_ms) {
+            atomic_store(&t->shared->stop, true);
+        }
+    }
+    return atomic_load_explicit(&t->shared->stop, memory_order_relaxed);
+}
+
+static void push_key(search_thread_t* t, bool irreversible) {
+    t->keys[t->key_count] = t->pos.hash;
+    t->irreversible[t->key_count] = irreversible;
+    t->key_count++;
+}
+
+// Current position seen before since the last capture (treated as a draw)
+static bool is_repetition(const search_thread_t* t) {
+    int last = t->key_count - 1;
+    for (int i = last; i > 0 && !t->irreversible[i]; i--) {
+        if (t->keys[i - 1] == t->keys[last]) return true;
+    }
+    return false;
+}
+
+static uint64_t next_random(search_thread_t* t) {
+    t->rng ^= t->rng << 13;
+    t->rng ^= t->rng >> 7;
+    t->rng ^= t->rng << 17;
+    return t->rng;
+}
+
+// Move ordering: TT move, MVV-LVA captures, killers, history
+static void score_moves(const search_thread_t* t, const xq_move_t* moves,
+                        int* scores, int count, xq_move_t tt_move, int ply) {
+    for (int i = 0; i < count; i++) {
+        xq_move_t m = moves[i];
+        uint8_t victim = t->pos.board[XQ_TO(m)];
+        if (m == tt_move) {
+            scores[i] = 1 << 30;
+        } else if (victim) {
+            uint8_t attacker = t->pos.board[XQ_FROM(m)];
+            scores[i] = (1 << 29) + piece_value[XQ_TYPE(victim)] * 16 -
+                        piece_value[XQ_TYPE(attacker)] / 16;
+            if (XQ_TYPE(victim) == XQ_KING) scores[i] += 1 << 20;
+        } else if (ply < ENGINE_MAX_PLY && m == t->killers[ply][0]) {
+            scores[i] = (1 << 28) + 1;
+        } else if (ply < ENGINE_MAX_PLY && m == t->killers[ply][1]) {
+            scores[i] = 1 << 28;
+        } else {
+            scores[i] = t->history[XQ_FROM(m)][XQ_TO(m)];
+        }
+    }
+}
+
+// Selection sort step: bring the best remaining move to index i
+static void pick_move(xq_move_t* moves, int* scores, int count, int i) {
+    int best = i;
+    for (int j = i + 1; j < count; j++) {
+        if (scores[j] > scores[best]) best = j;
+    }
+    if (best != i) {
+        xq_move_t m = moves[i];
+        moves[i] = moves[best];
+        moves[best] = m;
+        int s = scores[i];
+        scores[i] = scores[best];
+        scores[best] = s;
+    }
+}
+
+static int quiesce(search_thread_t* t, int alpha, int beta, int ply) {
+    if (should_stop(t)) return 0;
+    if (ply >= ENGINE_MAX_PLY - 1) return evaluate(&t->pos);
+
+    bool in_check = xq_in_check(&t->pos, t->pos.side);
+    int best;
+    if (in_check) {
+        // Every evasion is searched; no legal move means mated here
+        best = -ENGINE_MATE + ply;
+    } else {
+        best = evaluate(&t->pos);
+        if (best >= beta) return best;
+        if (best > alpha) alpha = best;
+    }
+
+    xq_move_t moves[XQ_MAX_MOVES];
+    int scores[XQ_MAX_MOVES];
+    int count = xq_generate_moves(&t->pos, moves, !in_check);
+    score_moves(t, moves, scores, count, XQ_NO_MOVE, ENGINE_MAX_PLY);
+
+    for (int i = 0; i < count; i++) {
+        pick_move(moves, scores, count, i);
+        xq_undo_t undo;
+        if (!xq_make_move(&t->pos, moves[i], &undo)) continue;
+        int score = -quiesce(t, -beta, -alpha, ply + 1);
+        xq_unmake_move(&t->pos, &undo);
+
+        if (atomic_load_explicit(&t->shared->stop, memory_order_relaxed)) return 0;
+        if (score > best) {
+            best = score;
+            if (score > alpha) {
+                alpha = score;
+                if (score >= beta) break;
+            }
+        }
+    }
+
+    return best;
+}
+
+static int search(search_thread_t* t, int depth, int alpha, int beta, int ply,
+                  bool allow_null) {
+    bool pv_node = beta - alpha > 1;
+
+    if (should_stop(t)) return 0;
+    if (is_repetition(t)) return 0;
+    if (ply >= ENGINE_MAX_PLY - 1) return evaluate(&t->pos);
+
+    // Mate distance pruning
+    if (alpha < -ENGINE_MATE + ply) alpha = -ENGINE_MATE + ply;
+    if (beta > ENGINE_MATE - ply - 1) beta = ENGINE_MATE - ply - 1;
+    if (alpha >= beta) return alpha;
+
+    bool in_check = xq_in_check(&t->pos, t->pos.side);
+    if (in_check) depth++;
+    if (depth <= 0) return quiesce(t, alpha, beta, ply);
+
+    xq_move_t tt_move = XQ_NO_MOVE;
+    int tt_score, tt_depth, tt_flag;
+    if (tt_probe(t->pos.hash, ply, &tt_move, &tt_score, &tt_depth, &tt_flag) &&
+        !pv_node && tt_depth >= depth) {
+        if (tt_flag == TT_EXACT || (tt_flag == TT_LOWER && tt_score >= beta) ||
+            (tt_flag == TT_UPPER && tt_score <= alpha)) {
+            return tt_score;
+        }
+    }
+
+    // Null-move pruning
+    if (!pv_node && !in_check && allow_null && depth >= 3 &&
+        has_attackers(&t->pos, t->pos.side) && evaluate(&t->pos) >= beta) {
+        int reduction = depth > 6 ? 3 : 2;
+        xq_make_null(&t->pos);
+        push_key(t, true);
+        int score = -search(t, depth - 1 - reduction, -beta, -beta + 1, ply + 1, false);
+        t->key_count--;
+        xq_unmake_null(&t->pos);
+        if (atomic_load_explicit(&t->shared->stop, memory_order_relaxed)) return 0;
+        if (score >= beta) return score >= ENGINE_MATE_BOUND ? beta : score;
+    }
+
+    xq_move_t moves[XQ_MAX_MOVES];
+    int scores[XQ_MAX_MOVES];
+    int count = xq_generate_moves(&t->pos, moves, false);
+    score_moves(t, moves, scores, count, tt_move, ply);
+
+    int original_alpha = alpha;
+    int best = -ENGINE_INF;
+    xq_move_t best_move = XQ_NO_MOVE;
+    int legal = 0;
+
+    for (int i = 0; i < count; i++) {
+        pick_move(moves, scores, count, i);
+        xq_move_t m = moves[i];
+        bool capture = t->pos.board[XQ_TO(m)] != XQ_EMPTY;
+
+        xq_undo_t undo;
+        if (!xq_make_move(&t->pos, m, &undo)) continue;
+        push_key(t, capture);
+        legal++;
+
+        int score;
+        if (legal == 1) {
+            score = -search(t, depth - 1, -beta, -alpha, ply + 1, true);
+        } else {
+            // Late move reductions for quiet moves, then PVS re-searches
+            int reduction = 0;
+            if (depth >= 3 && legal > 4 && !capture && !in_check &&
+                m != t->killers[ply][0] && m != t->killers[ply][1]) {
+                reduction = (legal > 12 && depth >= 6) ? 2 : 1;
+            }
+            score = -search(t, depth - 1 - reduction, -alpha - 1, -alpha, ply + 1, true);
+            if (score > alpha && reduction) {
+                score = -search(t, depth - 1, -alpha - 1, -alpha, ply + 1, true);
+            }
+            if (score > alpha && score < beta) {
+                score = -search(t, depth - 1, -beta, -alpha, ply + 1, true);
+            }
+        }
+
+        t->key_count--;
+        xq_unmake_move(&t->pos, &undo);
+        if (atomic_load_explicit(&t->shared->stop, memory_order_relaxed)) return 0;
+
+        if (score > best) {
+            best = score;
+            best_move = m;
+            if (score > alpha) {
+                alpha = score;
+                if (score >= beta) {
+                    if (!capture) {
+                        if (t->killers[ply][0] != m) {
+                            t->killers[ply][1] = t->killers[ply][0];
+                            t->killers[ply][0] = m;
+                        }
+                        t->history[XQ_FROM(m)][XQ_TO(m)] += depth * depth;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // No legal move loses in xiangqi, checkmate and stalemate alike
+    if (legal == 0) return -ENGINE_MATE + ply;
+
+    int flag = best >= beta ? TT_LOWER : (best > original_alpha ? TT_EXACT : TT_UPPER);
+    tt_store(t->pos.hash, best_move, best, depth, flag, ply);
+    return best;
+}
+
+// One iteration at the root. Weak bots search every move with a full window
+// so the noise is applied to exact scores.
+static bool search_root(search_thread_t* t, xq_move_t* root_moves,
+                        int root_count, int depth) {
+    int noise = t->shared->limits->noise_cp;
+    int alpha = -ENGINE_INF;
+    int best = -ENGINE_INF;
+    int best_index = -1;
+
+    for (int i = 0; i < root_count; i++) {
+        xq_undo_t undo;
+        bool capture = t->pos.board[XQ_TO(root_moves[i])] != XQ_EMPTY;
+        xq_make_move(&t->pos, root_moves[i], &undo);
+        push_key(t, capture);
+
+        int score;
+        if (i == 0 || noise > 0) {
+            score = -search(t, depth - 1, -ENGINE_INF, noise > 0 ? ENGINE_INF : -alpha, 1, true);
+        } else {
+            score = -search(t, depth - 1, -alpha - 1, -alpha, 1, true);
+            if (score > alpha) score = -search(t, depth - 1, -ENGINE_INF, -alpha, 1, true);
+        }
+
+        t->key_count--;
+        xq_unmake_move(&t->pos, &undo);
+        if (atomic_load_explicit(&t->shared->stop, memory_order_relaxed)) break;
+
+        if (noise > 0 && score > -ENGINE_MATE_BOUND && score < ENGINE_MATE_BOUND) {
+            score += (int)(next_random(t) % (uint64_t)(2 * noise + 1)) - noise;
+        }
+        if (score > best) {
+            best = score;
+            best_index = i;
+            if (score > alpha) alpha = score;
+        }
+    }
+
+    bool completed = !atomic_load_explicit(&t->shared->stop, memory_order_relaxed);
+    // A partial iteration still counts if it already beat the previous best
+    if (best_index >= 0 && (completed || best_index > 0 || t->depth_done == 0)) {
+        t->best_move = root_moves[best_index];
+        t->best_score = best;
+        if (completed) t->depth_done = depth;
+
+        // Search the best move first next iteration
+        xq_move_t m = root_moves[best_index];
+        memmove(&root_moves[1], &root_moves[0], best_index * sizeof(xq_move_t));
+        root_moves[0] = m;
+    }
+    return completed;
+}
+
+static void* search_thread_main(void* arg) {
+    search_thread_t* t = arg;
+    const engine_limits_t* limits = t->shared->limits;
+
+    xq_move_t root_moves[XQ_MAX_MOVES];
+    int root_count = xq_generate_legal(&t->pos, root_moves);
+
+    // Helpers diversify by shuffling the root order and skipping depths
+    if (t->id > 0) {
+        for (int i = root_count - 1; i > 1; i--) {
+            int j = 1 + (int)(next_random(t) % (uint64_t)i);
+            xq_move_t m = root_moves[i];
+            root_moves[i] = root_moves[j];
+            root_moves[j] = m;
+        }
+    }
+
+    for (int depth = 1 + (t->id & 1); depth <= limits->max_depth; depth++) {
+        if (!search_root(t, root_moves, root_count, depth)) break;
+
+        if (t->id == 0) {
+            int64_t elapsed = clock_now_ms() - t->shared->start_ms;
+            // Another iteration would not finish in the remaining budget
+            if (elapsed * 2 >= limits->time_ms) break;
+            if (t->best_score >= ENGINE_MATE_BOUND || t->best_score <= -ENGINE_MATE_BOUND) {
+                break;
+            }
+        }
+    }
+
+    // The main thread's end of search ends the helpers too
+    if (t->id == 0) atomic_store(&t->shared->stop, true);
+    return NULL;
+}
+
+void engine_search(const xq_position_t* position, const uint64_t* history,
+                   int history_len, const engine_limits_t* limits,
+                   engine_result_t* out) {
+    memset(out, 0, sizeof(*out));
+
+    xq_position_t root = *position;
+    xq_move_t legal[XQ_MAX_MOVES];
+    int legal_count = xq_generate_legal(&root, legal);
+    if (legal_count == 0) {
+        out->score = -ENGINE_MATE;
+        return;
+    }
+
+    engine_limits_t effective = *limits;
+    if (effective.max_depth <= 0 || effective.max_depth > ENGINE_MAX_PLY - 1) {
+        effective.max_depth = ENGINE_MAX_PLY - 1;
+    }
+    if (effective.threads < 1) effective.threads = 1;
+    if (effective.threads > ENGINE_MAX_THREADS) effective.threads = ENGINE_MAX_THREADS;
+    if (effective.time_ms <= 0) effective.time_ms = 1000;
+
+    search_shared_t shared;
+    atomic_init(&shared.stop, false);
+    shared.start_ms = clock_now_ms();
+    shared.deadline_ms = shared.start_ms + effective.time_ms;
+    shared.limits = &effective;
+
+    if (history_len > ENGINE_MAX_HISTORY) {
+        history += history_len - ENGINE_MAX_HISTORY;
+        history_len = ENGINE_MAX_HISTORY;
+    }
+
+    search_thread_t* threads = calloc((size_t)effective.threads, sizeof(search_thread_t));
+    pthread_t helpers[ENGINE_MAX_THREADS];
+    bool started[ENGINE_MAX_THREADS] = {false};
+    if (!threads) {
+        out->best_move = legal[0];
+        return;
+    }
+
+    for (int i = 0; i < effective.threads; i++) {
+        search_thread_t* t = &threads[i];
+        t->id = i;
+        t->shared = &shared;
+        t->pos = root;
+        t->rng = root.hash ^ (uint64_t)shared.start_ms ^ (0x9E3779B97F4A7C15ull * (i + 1));
+        if (!t->rng) t->rng = 1;
+        if (history_len > 0) {
+            memcpy(t->keys, history, (size_t)history_len * sizeof(uint64_t));
+            t->key_count = history_len;
+        }
+        push_key(t, false);
+    }
+
+    for (int i = 1; i < effective.threads; i++) {
+        started[i] = pthread_create(&helpers[i], NULL, search_thread_main, &threads[i]) == 0;
+    }
+    search_thread_main(&threads[0]);
+    for (int i = 1; i < effective.threads; i++) {
+        if (started[i]) pthread_join(helpers[i], NULL);
+    }
+
+    out->best_move = threads[0].best_move ? threads[0].best_move : legal[0];
+    out->score = threads[0].best_score;
+    out->depth = threads[0].depth_done;
+    for (int i = 0; i < effective.threads; i++) out->nodes += threads[i].nodes;
+    out->elapsed_ms = (int)(clock_now_ms() - shared.start_ms);
+
+    free(threads);
+}
+
+// =========================
+// Worker pool
+// =========================
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static engine_job_t* pending[ENGINE_QUEUE_SIZE];
+static int pending_head = 0;
+static int pending_count = 0;
+
+static engine_job_t* finished[ENGINE_QUEUE_SIZE];
+static int finished_head = 0;
+static int finished_count = 0;
+
+static int outstanding = 0;  // Submitted but not yet polled
+static int running_jobs = 0;
+static bool pool_running = false;
+static pthread_t workers[ENGINE_WORKERS];
+static int worker_count = 0;
+static int notify_fd = -1;
+
+static void* worker_main(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (pool_running && pending_count == 0) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        if (!pool_running) {
+            pthread_mutex_unlock(&queue_lock);
+            return NULL;
+        }
+        engine_job_t* job = pending[pending_head];
+        pending_head = (pending_head + 1) % ENGINE_QUEUE_SIZE;
+        pending_count--;
+        running_jobs++;
+        pthread_mutex_unlock(&queue_lock);
+
+        engine_search(&job->position, job->history, job->history_len,
+                      &job->limits, &job->result);
+
+        pthread_mutex_lock(&queue_lock);
+        running_jobs--;
+        finished[(finished_head + finished_count) % ENGINE_QUEUE_SIZE] = job;
+        finished_count++;
+        pthread_mutex_unlock(&queue_lock);
+
+        // Wake the event loop
+        uint64_t one = 1;
+        if (write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("engine eventfd write");
+        }
+    }
+}
+
+bool engine_init(void) {
+    xq_init();
+
+    tt = calloc(TT_SIZE, sizeof(tt_entry_t));
+    if (!tt) return false;
+
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify_fd < 0) {
+        perror("eventfd");
+        free(tt);
+        tt = NULL;
+        return false;
+    }
+
+    atomic_init(&engine_abort, false);
+    pool_running = true;
+    for (int i = 0; i < ENGINE_WORKERS; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) break;
+        worker_count++;
+    }
+    if (worker_count == 0) {
+        engine_shutdown();
+        return false;
+    }
+
+    printf("Engine initialized (%d workers, up to %d threads per search, %u TT entries)\n",
+           worker_count, ENGINE_MAX_THREADS, TT_SIZE);
+    return true;
+}
+
+void engine_shutdown(void) {
+    pthread_mutex_lock(&queue_lock);
+    pool_running = false;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    // Cut running searches short
+    atomic_store(&engine_abort, true);
+    for (int i = 0; i < worker_count; i++) pthread_join(workers[i], NULL);
+    worker_count = 0;
+
+    while (pending_count > 0) {
+        free(pending[pending_head]);
+        pending_head = (pending_head + 1) % ENGINE_QUEUE_SIZE;
+        pending_count--;
+    }
+    while (finished_count > 0) {
+        free(finished[finished_head]);
+        finished_head = (finished_head + 1) % ENGINE_QUEUE_SIZE;
+        finished_count--;
+    }
+    outstanding = 0;
+
+    if (notify_fd >= 0) close(notify_fd);
+    notify_fd = -1;
+    free(tt);
+    tt = NULL;
+}
+
+int engine_get_notify_fd(void) { return notify_fd; }
+
+bool engine_submit(const engine_job_t* job) {
+    engine_job_t* copy = malloc(sizeof(engine_job_t));
+    if (!copy) return false;
+    *copy = *job;
+    memset(&copy->result, 0, sizeof(copy->result));
+
+    pthread_mutex_lock(&queue_lock);
+    if (!pool_running || outstanding >= ENGINE_QUEUE_SIZE) {
+        pthread_mutex_unlock(&queue_lock);
+        free(copy);
+        return false;
+    }
+    pending[(pending_head + pending_count) % ENGINE_QUEUE_SIZE] = copy;
+    pending_count++;
+    outstanding++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    return true;
+}
+
+int engine_poll_results(engine_job_t* out, int max_count) {
+    // Reset the eventfd counter before draining so no wakeup is lost
+    uint64_t counter;
+    if (read(notify_fd, &counter, sizeof(counter)) < 0 && errno != EAGAIN) {
+        perror("engine eventfd read");
+    }
+
+    int count = 0;
+    pthread_mutex_lock(&queue_lock);
+    while (finished_count > 0 && count < max_count) {
+        engine_job_t* job = finished[finished_head];
+        finished_head = (finished_head + 1) % ENGINE_QUEUE_SIZE;
+        finished_count--;
+        outstanding--;
+        out[count++] = *job;
+        free(job);
+    }
+    bool more = finished_count > 0;
+    pthread_mutex_unlock(&queue_lock);
+
+    // Leftovers: make sure the loop comes back for them
+    if (more) {
+        uint64_t one = 1;
+        if (write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("engine eventfd write");
+        }
+    }
+    return count;
+}
+
+int engine_get_backlog(void) {
+    pthread_mutex_lock(&queue_lock);
+    int backlog = pending_count + running_jobs;
+    pthread_mutex_unlock(&queue_lock);
+    return backlog;
+}
+
+// =========================
+// Bots
+// =========================
+
+// Strength ladder: shallow and noisy at the bottom, full search at the top
+static const engine_limits_t bot_levels[BOT_LEVEL_MAX + 1] = {
+    {0, 0, 0, 0},
+    {200, 1, 1, 150},
+    {300, 2, 1, 80},
+    {800, 4, 1, 20},
+    {1500, ENGINE_MAX_PLY - 1, 2, 0},
+    {3000, ENGINE_MAX_PLY - 1, ENGINE_MAX_THREADS, 0},
+};
+
+bool engine_is_bot(int user_id) { return engine_bot_level(user_id) > 0; }
+
+int engine_bot_level(int user_id) {
+    int level = BOT_USER_ID_BASE - user_id;
+    return (level >= BOT_LEVEL_MIN && level <= BOT_LEVEL_MAX) ? level : 0;
+}
+
+int engine_bot_user_id(int level) {
+    if (level < BOT_LEVEL_MIN) level = BOT_LEVEL_MIN;
+    if (level > BOT_LEVEL_MAX) level = BOT_LEVEL_MAX;
+    return BOT_USER_ID_BASE - level;
+}
+
+void engine_bot_limits(int level, engine_limits_t* out) {
+    if (level < BOT_LEVEL_MIN) level = BOT_LEVEL_MIN;
+    if (level > BOT_LEVEL_MAX) level = BOT_LEVEL_MAX;
+    *out = bot_levels[level];
+}
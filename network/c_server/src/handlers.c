@@ -4,20 +4,30 @@
 
 #include "handlers.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "account.h"
+#include "analysis.h"
 #include "broadcast.h"
+#include "clock.h"
 #include "db.h"
+#include "engine.h"
+#include "livelist.h"
 #include "lobby.h"
 #include "match.h"
+#include "matchmaking.h"
+#include "opening.h"
 #include "protocol.h"
+#include "pubsub.h"
+#include "ranking.h"
 #include "rating.h"
 #include "server.h"
 #include "session.h"
+#include "tablebase.h"
 
 // Helper: Escape JSON string (prevent injection)
 static void escape_json_string(const char* src, char* dst, size_t dst_size) {
@@ -70,10 +80,22 @@ static void send_response(server_t* server, client_t* client, int seq, bool succ
     escape_json_string(message, escaped_msg, sizeof(escaped_msg));
 
     if (payload) {
-        snprintf(response, sizeof(response),
-                 "{\"type\":\"%s\",\"seq\":%d,\"success\":%s,\"message\":\"%s\",\"payload\":%s}\n",
-                 success ? "response" : "error", seq,
-                 success ? "true" : "false", escaped_msg, payload);
+        const char* format =
+            "{\"type\":\"%s\",\"seq\":%d,\"success\":%s,\"message\":\"%s\",\"payload\":%s}\n";
+        int len = snprintf(response, sizeof(response), format,
+                           success ? "response" : "error", seq,
+                           success ? "true" : "false", escaped_msg, payload);
+        // A payload that does not fit (a long stored game) is sent from the
+        // heap rather than cut off into invalid JSON
+        if (len >= (int)sizeof(response)) {
+            char* large = malloc((size_t)len + 1);
+            if (!large) return;
+            snprintf(large, (size_t)len + 1, format, success ? "response" : "error", seq,
+                     success ? "true" : "false", escaped_msg, payload);
+            send_to_client(server, client->fd, large);
+            free(large);
+            return;
+        }
     } else {
         snprintf(
             response, sizeof(response),
@@ -85,15 +107,52 @@ static void send_response(server_t* server, client_t* client, int seq, bool succ
     send_to_client(server, client->fd, response);
 }
 
+// Helper: Parse optional time control fields from a request payload
+static time_control_t parse_time_control(const char* payload_json) {
+    return time_control_make(json_get_int(payload_json, "base_ms"),
+                             json_get_int(payload_json, "increment_ms"),
+                             json_get_int(payload_json, "delay_ms"),
+                             json_get_int(payload_json, "move_limit_ms"));
+}
+
+// Helper: Parse an optional "fen" setup into its canonical form. Leaves out
+// empty when absent; false if present but not a legal position.
+static bool parse_start_fen(const char* payload_json, char* out, size_t out_size) {
+    out[0] = '\0';
+    char* fen = json_get_string(payload_json, "fen");
+    if (!fen) return true;
+
+    xq_position_t pos;
+    bool ok = xq_position_from_fen(&pos, fen);
+    if (ok) xq_position_to_fen(&pos, out, out_size);
+    free(fen);
+    return ok;
+}
+
 // Helper: Validate token and get user_id
 static bool validate_token_and_get_user(const char* token, int* out_user_id) {
     if (!token || !out_user_id) {
         return false;
     }
 
-    return session_validate(token, out_user_id);
+    if (!session_validate(token, out_user_id)) {
+        return false;
+    }
+    // Sessions expire SESSION_TIMEOUT after the last authenticated request
+    session_update_activity(token);
+    return true;
 }
 
+// Defined with the engine handlers below
+static bool start_bot_match(server_t* server, client_t* client, int seq,
+                            int user_id, int bot_level,
+                            const time_control_t* time_control,
+                            const char* start_fen);
+static bool adjudicate_match(server_t* server, match_t* match);
+static void store_finished_match(const match_t* match, const char* result,
+                                 const char* reason, int* out_red_rating,
+                                 int* out_black_rating);
+
 // Handler: Register
 void handle_register(server_t* server, client_t* client, message_t* msg) {
     // Parse payload
@@ -123,6 +182,7 @@ void handle_register(server_t* server, client_t* client, message_t* msg) {
         send_response(server, client, msg->seq, false, "Failed to create user", NULL);
         return;
     }
+    account_created(user_id, username);
 
     // Success
     char payload[256];
@@ -162,6 +222,9 @@ void handle_login(server_t* server, client_t* client, message_t* msg) {
         return;
     }
 
+    // Warm the profile cache: the player's games read it from here on
+    account_lookup(user_id, NULL, 0, NULL);
+
     // Create session
     const char* token = session_create(user_id);
     if (!token) {
@@ -229,30 +292,39 @@ void handle_set_ready(server_t* server, client_t* client, message_t* msg) {
     // Get user info
     char username[64];
     int rating;
-    if (!db_get_user_by_id(user_id, username, NULL, &rating, NULL, NULL,
-                           NULL)) {
+    if (!account_lookup(user_id, username, sizeof(username), &rating)) {
         send_response(server, client, msg->seq, false, "User not found", NULL);
         return;
     }
 
-    // Set ready status
+    // Set ready status; the lobby hears about it with the next presence diff
     lobby_set_ready(user_id, username, rating, ready);
 
-    // Broadcast updated ready list
-    char* ready_list = lobby_get_ready_list_json();
-    if (ready_list) {
-        char broadcast_msg[8192];
-        snprintf(broadcast_msg, sizeof(broadcast_msg),
-                 "{\"type\":\"ready_list_update\",\"payload\":%s}\n",
-                 ready_list);
-        broadcast_to_lobby(server, broadcast_msg);
-        free(ready_list);
-    }
-
     send_response(server, client, msg->seq, true, ready ? "Ready set" : "Ready removed",
                   NULL);
 }
 
+// Handler: Get Lobby Snapshot
+// Full ready list; lobby_presence diffs with a higher seq apply on top
+void handle_get_lobby_snapshot(server_t* server, client_t* client, message_t* msg) {
+    int user_id;
+    if (!validate_token_and_get_user(msg->token, &user_id)) {
+        send_response(server, client, msg->seq, false, "Invalid or expired token",
+                      NULL);
+        return;
+    }
+    client->user_id = user_id;
+    client->authenticated = true;
+
+    char* snapshot = lobby_get_presence_snapshot_json();
+    if (!snapshot) {
+        send_response(server, client, msg->seq, false, "Failed to get lobby", NULL);
+        return;
+    }
+    send_response(server, client, msg->seq, true, "Lobby snapshot", snapshot);
+    free(snapshot);
+}
+
 // Handler: Find Match
 void handle_find_match(server_t* server, client_t* client, message_t* msg) {
     // Validate token
@@ -270,140 +342,810 @@ void handle_find_match(server_t* server, client_t* client, message_t* msg) {
 
     // Parse payload
     const char* mode =
-        json_get_string(msg->payload_json, "mode");  // "random" or "rated"
+        json_get_string(msg->payload_json, "mode");  // "random", "rated" or "bot"
     bool rated = (mode && strcmp(mode, "rated") == 0);
+    int bot_level = json_get_int(msg->payload_json, "bot_level");
 
-    // Ensure the requesting player is marked ready (in case client didn't call set_ready)
-    {
-        char username[64];
-        int rating;
-        if (db_get_user_by_id(user_id, username, NULL, &rating, NULL, NULL, NULL)) {
-            lobby_set_ready(user_id, username, rating, true);
-            printf("[Handler] Marked user_id=%d as ready (auto)\n", user_id);
-            // Broadcast updated ready list so other clients see the new player
-            char* ready_list = lobby_get_ready_list_json();
-            if (ready_list) {
-                char broadcast_msg[8192];
-                snprintf(broadcast_msg, sizeof(broadcast_msg),
-                         "{\"type\":\"ready_list_update\",\"payload\":%s}\n",
-                         ready_list);
-                broadcast_to_lobby(server, broadcast_msg);
-                free(ready_list);
-            }
-        } else {
-            printf("[Handler] Warning: failed to lookup user %d before queuing\n", user_id);
+    // Straight into a game against the engine
+    if (mode && strcmp(mode, "bot") == 0) {
+        char start_fen[XQ_FEN_MAX];
+        if (!parse_start_fen(msg->payload_json, start_fen, sizeof(start_fen))) {
+            send_response(server, client, msg->seq, false, "Invalid FEN", NULL);
+            return;
         }
+        time_control_t time_control = parse_time_control(msg->payload_json);
+        start_bot_match(server, client, msg->seq, user_id,
+                        bot_level > 0 ? bot_level : BOT_DEFAULT_LEVEL, &time_control,
+                        start_fen[0] ? start_fen : NULL);
+        return;
     }
 
-    // Find opponent
-    int opponent_id;
-    bool found = false;
-
-    if (rated) {
-        // Get user rating
-        int rating;
-        db_get_user_by_id(user_id, NULL, NULL, &rating, NULL, NULL, NULL);
-        found = lobby_find_rated_match(user_id, rating, 200, &opponent_id);
-    } else {
-        found = lobby_find_random_match(user_id, &opponent_id);
+    // Mark the player ready (in case the client didn't call set_ready) and
+    // queue them; the next pairing pass sends match_found
+    char username[64];
+    int rating;
+    if (!account_lookup(user_id, username, sizeof(username), &rating)) {
+        send_response(server, client, msg->seq, false, "User not found", NULL);
+        return;
     }
+    // Custom start positions get their own (casual) queue
+    char start_fen[XQ_FEN_MAX];
+    if (!parse_start_fen(msg->payload_json, start_fen, sizeof(start_fen))) {
+        send_response(server, client, msg->seq, false, "Invalid FEN", NULL);
+        return;
+    }
+    if (start_fen[0]) rated = false;
+    lobby_set_ready(user_id, username, rating, true);
 
-    if (!found) {
-        // No opponent available right now — respond with queued status. Client
-        // UI should treat this as searching and wait for a subsequent
-        // 'match_found' broadcast when another player becomes available.
-        printf("[Handler] No opponent currently for user_id=%d — player queued\n", user_id);
-        send_response(server, client, msg->seq, true, "Queued for match", "{\"status\":\"queued\"}");
+    time_control_t time_control = parse_time_control(msg->payload_json);
+    if (!mm_enqueue(user_id, rating, rated, &time_control, start_fen, bot_level)) {
+        send_response(server, client, msg->seq, false, "Failed to join queue", NULL);
         return;
     }
 
-    // Create match
-    // Before creating a match ensure both users are currently connected.
-    if (!is_user_connected(server, user_id)) {
-        printf("[Handler] Aborting match: requester user_id=%d not connected\n", user_id);
-        send_response(server, client, msg->seq, false, "You are not connected", NULL);
+    printf("[Handler] Queued user_id=%d (%s, rating %d, %d+%d%s)\n", user_id,
+           rated ? "rated" : "casual", rating, time_control.base_ms / 1000,
+           time_control.increment_ms / 1000, start_fen[0] ? ", custom start" : "");
+    send_response(server, client, msg->seq, true, "Queued for match", "{\"status\":\"queued\"}");
+}
+
+// Start a match for a pair from the matchmaking queue. A player who went
+// away is dropped; the other goes back to the queue with their wait kept.
+static void start_queued_match(server_t* server, const mm_result_t* pair) {
+    const mm_entry_t* red = &pair->red;
+    const mm_entry_t* black = &pair->black;
+    bool red_online = is_user_connected(server, red->user_id);
+    bool black_online = is_user_connected(server, black->user_id);
+
+    if (!red_online || !black_online) {
+        printf("[Handler] Pair %d/%d: a player is not connected, requeueing\n",
+               red->user_id, black->user_id);
+        if (red_online) mm_requeue(red);
+        else lobby_remove_player(red->user_id);
+        if (black_online) mm_requeue(black);
+        else lobby_remove_player(black->user_id);
         return;
     }
-    if (!is_user_connected(server, opponent_id)) {
-        // Opponent disconnected between queue and match - keep requester queued.
-        printf("[Handler] Opponent %d not connected; keeping user %d queued\n", opponent_id, user_id);
-        send_response(server, client, msg->seq, true, "Queued for match", "{\"status\":\"queued\"}");
-        // Remove the disconnected opponent from ready list if present
-        lobby_remove_player(opponent_id);
+
+    const char* start_fen = red->start_fen[0] ? red->start_fen : NULL;
+    char* match_id = match_create_from_fen(red->user_id, black->user_id, red->rated,
+                                           &red->time_control, start_fen);
+    if (!match_id) {
+        mm_requeue(red);
+        mm_requeue(black);
+        return;
+    }
+
+    // Get usernames
+    char red_name[64], black_name[64];
+    account_lookup(red->user_id, red_name, sizeof(red_name), NULL);
+    account_lookup(black->user_id, black_name, sizeof(black_name), NULL);
+
+    char payload_red[512];
+    char payload_black[512];
+    snprintf(payload_red, sizeof(payload_red),
+             "{\"match_id\":\"%s\",\"red_user\":\"%s\",\"black_user\":\"%s\",\"your_color\":\"%s\","
+             "\"start_fen\":\"%s\"}",
+             match_id, red_name, black_name, "red", start_fen ? start_fen : XQ_START_FEN);
+    snprintf(payload_black, sizeof(payload_black),
+             "{\"match_id\":\"%s\",\"red_user\":\"%s\",\"black_user\":\"%s\",\"your_color\":\"%s\","
+             "\"start_fen\":\"%s\"}",
+             match_id, red_name, black_name, "black", start_fen ? start_fen : XQ_START_FEN);
+
+    char notify_red[1024];
+    char notify_black[1024];
+    snprintf(notify_red, sizeof(notify_red), "{\"type\":\"match_found\",\"payload\":%s}\n",
+             payload_red);
+    snprintf(notify_black, sizeof(notify_black), "{\"type\":\"match_found\",\"payload\":%s}\n",
+             payload_black);
+
+    bool sent_red = send_to_user(server, red->user_id, notify_red);
+    bool sent_black = send_to_user(server, black->user_id, notify_black);
+
+    // If sending failed for either side, roll back the match and requeue
+    // any still-connected player
+    if (!sent_red || !sent_black) {
+        printf("[Handler] Warning: match notify failed (red=%d, black=%d). Rolling back match %s\n",
+               sent_red, sent_black, match_id);
+        match_end(match_id, "aborted", "notify_failed");
+        if (is_user_connected(server, red->user_id)) mm_requeue(red);
+        if (is_user_connected(server, black->user_id)) mm_requeue(black);
+        free(match_id);
+        return;
+    }
+
+    // Off the lobby's ready list
+    lobby_remove_player(red->user_id);
+    lobby_remove_player(black->user_id);
+
+    printf("[Handler] Match created: %s (%d) vs %s (%d)\n", red_name, red->rating,
+           black_name, black->rating);
+    free(match_id);
+}
+
+// Pairs and bot fallbacks handed over by the matchmaking thread
+void handlers_process_matchmaking_results(server_t* server) {
+    mm_result_t results[MM_MAX_RESULTS];
+    int count = mm_poll_results(results, MM_MAX_RESULTS);
+    for (int i = 0; i < count; i++) {
+        const mm_result_t* result = &results[i];
+        if (result->kind == MM_RESULT_PAIR) {
+            start_queued_match(server, result);
+            continue;
+        }
+
+        // Waited long enough and opted into a bot
+        const mm_entry_t* entry = &result->red;
+        lobby_remove_player(entry->user_id);
+        if (is_user_connected(server, entry->user_id)) {
+            start_bot_match(server, NULL, 0, entry->user_id, entry->bot_level,
+                            &entry->time_control,
+                            entry->start_fen[0] ? entry->start_fen : NULL);
+        }
+    }
+}
+
+// Handler: Move
+// Build the opponent_move payload for a move already added to the match
+static void format_move_payload(const match_t* match, const move_t* move,
+                                char* buf, size_t size) {
+    snprintf(buf, size,
+             "{\"match_id\":\"%s\",\"from\":{\"row\":%d,\"col\":%d},\"to\":{"
+             "\"row\":%d,\"col\":%d},\"red_time_ms\":%d,\"black_time_ms\":%d,"
+             "\"think_time_ms\":%d}",
+             match->match_id, move->from_row, move->from_col, move->to_row,
+             move->to_col, match->red_time_ms, match->black_time_ms,
+             move->think_time_ms);
+}
+
+// Send opponent_move to the mover's opponent and all spectators
+static void send_opponent_move(server_t* server, match_t* match,
+                               int mover_id, const move_t* move) {
+    char payload[512];
+    format_move_payload(match, move, payload, sizeof(payload));
+
+    char broadcast_msg[1024];
+    snprintf(broadcast_msg, sizeof(broadcast_msg),
+             "{\"type\":\"opponent_move\",\"payload\":%s}\n", payload);
+
+    broadcast_match_event(server, match, mover_id, broadcast_msg);
+}
+
+// Play user_id's queued premove right after the opponent's move was accepted.
+// It is charged zero think time (the clock switched at now_ms) and is dropped
+// if the piece it moves was just captured or the squares are no longer valid.
+static void apply_premove(server_t* server, match_t* match, int user_id,
+                          int64_t now_ms) {
+    premove_t premove;
+    if (!match_take_premove(match, user_id, &premove)) return;
+
+    const char* reason = NULL;
+    const move_t* last = &match->moves[match->move_count - 1];
+    if (last->to_row == premove.from_row && last->to_col == premove.from_col) {
+        reason = "piece_captured";
+    } else if (!match_validate_move(match->match_id, user_id, premove.from_row,
+                                    premove.from_col, premove.to_row,
+                                    premove.to_col)) {
+        reason = "invalid";
+    } else if (match->position_valid &&
+               xq_find_move(&match->position, premove.from_row, premove.from_col,
+                            premove.to_row, premove.to_col) == XQ_NO_MOVE) {
+        // Queued before the reply it now follows: it may ignore a check or
+        // expose a pinned piece in the real position
+        reason = "illegal";
+    }
+
+    int think_ms = 0;
+    if (!reason && !match_charge_clock(match, now_ms, 0, &think_ms)) {
+        // Already flagged - the timeout sweep ends the match
+        reason = "timeout";
+    }
+
+    move_t move = {0};
+    if (!reason) {
+        move.from_row = premove.from_row;
+        move.from_col = premove.from_col;
+        move.to_row = premove.to_row;
+        move.to_col = premove.to_col;
+        move.timestamp = time(NULL);
+        move.think_time_ms = think_ms;
+        move.red_time_ms = match->red_time_ms;
+        move.black_time_ms = match->black_time_ms;
+        if (!match_add_move(match->match_id, &move)) reason = "move_limit";
+    }
+
+    char notify[1024];
+    if (reason) {
+        snprintf(notify, sizeof(notify),
+                 "{\"type\":\"premove_cancelled\",\"payload\":{\"match_id\":\"%s\","
+                 "\"reason\":\"%s\"}}\n",
+                 match->match_id, reason);
+        send_to_user(server, user_id, notify);
+        return;
+    }
+
+    // Confirm to the premover, then deliver it like a normal move
+    char payload[512];
+    format_move_payload(match, &move, payload, sizeof(payload));
+    snprintf(notify, sizeof(notify),
+             "{\"type\":\"premove_applied\",\"payload\":%s}\n", payload);
+    send_to_user(server, user_id, notify);
+    send_opponent_move(server, match, user_id, &move);
+
+    printf("[Handler] Premove: %s (%d,%d)->(%d,%d) [Red:%dms, Black:%dms]\n",
+           match->match_id, move.from_row, move.from_col, move.to_row,
+           move.to_col, match->red_time_ms, match->black_time_ms);
+
+    adjudicate_match(server, match);
+}
+
+// =========================
+// Engine: bots and hints
+// =========================
+
+_Static_assert(ENGINE_MAX_HISTORY >= MAX_MOVES_PER_MATCH,
+               "engine history must hold a full game");
+
+// Display name of a registered user or a bot
+static void get_player_name(int user_id, char* name, size_t size) {
+    int level = engine_bot_level(user_id);
+    if (level > 0) {
+        snprintf(name, size, "Bot Lv.%d", level);
+    } else if (!account_lookup(user_id, name, size, NULL)) {
+        snprintf(name, size, "Player %d", user_id);
+    }
+}
+
+// Load the match's current position into an engine job. Fails if the stored
+// moves do not replay legally (moves are only validated client side).
+static bool prepare_engine_job(const match_t* match, engine_job_t* job) {
+    memset(job, 0, sizeof(*job));
+    job->match_handle = match->handle;
+    job->move_count = match->move_count;
+    return match_replay_position(match, &job->position, job->history,
+                                 &job->history_len);
+}
+
+// Feed a stored game's opening to the explorer (standard start only)
+static void record_opening(const match_t* match, const char* result) {
+    opening_result_t outcome;
+    if (!opening_result_parse(result, &outcome) || !match->position_valid ||
+        strcmp(match->start_fen, XQ_START_FEN) != 0) {
+        return;
+    }
+
+    xq_position_t pos;
+    xq_position_start(&pos);
+    xq_move_t moves[OPENING_MAX_PLY];
+    int count = 0;
+    while (count < match->move_count && count < OPENING_MAX_PLY) {
+        const move_t* move = &match->moves[count];
+        xq_move_t m = xq_find_move(&pos, move->from_row, move->from_col, move->to_row,
+                                   move->to_col);
+        xq_undo_t undo;
+        if (m == XQ_NO_MOVE || !xq_make_move(&pos, m, &undo)) return;
+        moves[count++] = m;
+    }
+
+    int red_rating = 0, black_rating = 0;
+    account_lookup(match->red_user_id, NULL, 0, &red_rating);
+    account_lookup(match->black_user_id, NULL, 0, &black_rating);
+    opening_record_game(moves, count, outcome, red_rating, black_rating);
+}
+
+// Store a finished game and queue it for background analysis (bot games are
+// not stored). A rated game is settled in the same transaction: the new
+// Glicko-2 ratings and W/L/D are worked out from the cached profiles and
+// committed with the match row in one round trip. Sets the new ratings for
+// game_end (0 when unrated or not settled).
+static void store_finished_match(const match_t* match, const char* result,
+                                 const char* reason, int* out_red_rating,
+                                 int* out_black_rating) {
+    *out_red_rating = 0;
+    *out_black_rating = 0;
+    if (engine_is_bot(match->red_user_id) || engine_is_bot(match->black_user_id)) {
+        return;
+    }
+
+    char* moves_json = match_get_moves_json(match);
+    char started[32], ended[32];
+    sprintf(started, "%ld", match->started_at);
+    sprintf(ended, "%ld", time(NULL));
+    bool custom_start = strcmp(match->start_fen, XQ_START_FEN) != 0;
+    const char* start_fen = custom_start ? match->start_fen : NULL;
+
+    double red_score = rating_red_score(result);
+    profile_t red = {0}, black = {0};
+    bool saved;
+
+    if (match->rated && red_score >= 0 && account_get_profile(match->red_user_id, &red) &&
+        account_get_profile(match->black_user_id, &black)) {
+        glicko_t red_glicko = {red.rating, red.rd, red.volatility};
+        glicko_t black_glicko = {black.rating, black.rd, black.volatility};
+        rating_glicko_game(&red_glicko, &black_glicko, red_score, GLICKO_TAU);
+
+        profile_t red_after = red, black_after = black;
+        red_after.rating = (int)lround(red_glicko.rating);
+        red_after.rd = red_glicko.rd;
+        red_after.volatility = red_glicko.volatility;
+        black_after.rating = (int)lround(black_glicko.rating);
+        black_after.rd = black_glicko.rd;
+        black_after.volatility = black_glicko.volatility;
+
+        if (red_score == 1.0) {
+            red_after.wins++;
+            black_after.losses++;
+        } else if (red_score == 0.0) {
+            red_after.losses++;
+            black_after.wins++;
+        } else {
+            red_after.draws++;
+            black_after.draws++;
+        }
+
+        saved = account_settle_match(&red_after, &black_after, match->match_id, result,
+                                     moves_json, started, ended, start_fen);
+        if (saved) {
+            *out_red_rating = red_after.rating;
+            *out_black_rating = black_after.rating;
+            printf("[Rating] %s: Red(%d->%d), Black(%d->%d)\n", reason, red.rating,
+                   red_after.rating, black.rating, black_after.rating);
+        } else {
+            fprintf(stderr, "[Rating] %s: settling %s failed, nothing written\n", reason,
+                    match->match_id);
+        }
+    } else {
+        saved = db_save_match(match->match_id, match->red_user_id, match->black_user_id,
+                              result, moves_json, started, ended, start_fen);
+    }
+    free(moves_json);
+
+    // Analysis rows reference the stored match
+    if (saved) {
+        analysis_submit_match(match);
+        record_opening(match, result);
+    }
+}
+
+// End a match decided by the server (bot games, tablebase adjudication):
+// update ratings if rated, store it unless a bot played, notify everyone
+static void settle_match(server_t* server, match_t* match, const char* result,
+                         const char* reason) {
+    match_end(match->match_id, result, reason);
+
+    // Ratings (if rated) and the stored game, in one transaction
+    int new_red_rating = 0;
+    int new_black_rating = 0;
+    store_finished_match(match, result, reason, &new_red_rating, &new_black_rating);
+
+    char notify[512];
+    snprintf(notify, sizeof(notify),
+             "{\"type\":\"game_end\",\"payload\":{\"match_id\":\"%s\",\"result\":\"%s\","
+             "\"reason\":\"%s\",\"red_rating\":%d,\"black_rating\":%d}}\n",
+             match->match_id, result, reason, new_red_rating, new_black_rating);
+    broadcast_to_match(server, match->match_id, notify);
+}
+
+// End the match if the endgame tablebases already decide it
+static bool adjudicate_match(server_t* server, match_t* match) {
+    const char* result;
+    if (!match_adjudicate(match, &result)) return false;
+
+    printf("[Tablebase] %s adjudicated: %s\n", match->match_id, result);
+    settle_match(server, match, result,
+                 strcmp(result, "draw") == 0 ? "tablebase_draw" : "tablebase");
+    return true;
+}
+
+// Clocks that ran out since the last tick: stored and rated like any other
+// ending
+void handlers_process_timeouts(server_t* server) {
+    match_check_all_timeouts();
+
+    timeout_info_t timeouts[100];
+    int timeout_count = match_get_pending_timeouts(timeouts, 100);
+    for (int i = 0; i < timeout_count; i++) {
+        match_t* match = match_get(timeouts[i].match_id);
+        if (!match || !match->active) continue;
+
+        settle_match(server, match, timeouts[i].result, "timeout");
+        printf("[Server] Broadcast timeout: %s -> %s\n", timeouts[i].match_id,
+               timeouts[i].result);
+    }
+}
+
+// Queue a search if the side to move is a bot
+static void schedule_bot_move(server_t* server, match_t* match) {
+    if (!match->active) return;
+
+    bool red_to_move = strcmp(match->current_turn, "red") == 0;
+    int bot_id = red_to_move ? match->red_user_id : match->black_user_id;
+    int level = engine_bot_level(bot_id);
+    if (level == 0) return;
+
+    engine_job_t job;
+    if (!prepare_engine_job(match, &job)) {
+        printf("[Engine] %s: stored moves do not replay, aborting bot game\n",
+               match->match_id);
+        settle_match(server, match, "aborted", "invalid_position");
         return;
     }
+    job.kind = ENGINE_JOB_BOT_MOVE;
+    job.user_id = bot_id;
+    engine_bot_limits(level, &job.limits);
+
+    // Spend at most a slice of the bot's own clock
+    int remaining = red_to_move ? match->red_time_ms : match->black_time_ms;
+    int budget = remaining / 30 + match->time_control.increment_ms / 2;
+    if (budget < 50) budget = 50;
+    if (job.limits.time_ms > budget) job.limits.time_ms = budget;
+
+    if (!engine_submit(&job)) {
+        printf("[Engine] Queue full, aborting bot game %s\n", match->match_id);
+        settle_match(server, match, "aborted", "engine_busy");
+    }
+}
 
+// Create a game against a bot; the human plays red. From a custom setup with
+// black to move the bot opens.
+static bool start_bot_match(server_t* server, client_t* client, int seq,
+                            int user_id, int bot_level,
+                            const time_control_t* time_control,
+                            const char* start_fen) {
+    lobby_remove_player(user_id);
+
+    int bot_id = engine_bot_user_id(bot_level);
     char* match_id =
-        match_create(user_id, opponent_id, rated, 600000);  // 10 min
+        match_create_from_fen(user_id, bot_id, false, time_control, start_fen);
     if (!match_id) {
-        send_response(server, client, msg->seq, false, "Failed to create match", NULL);
+        if (client) send_response(server, client, seq, false, "Failed to create match", NULL);
+        return false;
+    }
+
+    char user_name[64], bot_name[64];
+    get_player_name(user_id, user_name, sizeof(user_name));
+    get_player_name(bot_id, bot_name, sizeof(bot_name));
+
+    char payload[512];
+    snprintf(payload, sizeof(payload),
+             "{\"match_id\":\"%s\",\"red_user\":\"%s\",\"black_user\":\"%s\","
+             "\"your_color\":\"red\",\"bot_level\":%d,\"start_fen\":\"%s\"}",
+             match_id, user_name, bot_name, engine_bot_level(bot_id),
+             start_fen ? start_fen : XQ_START_FEN);
+    char notify[1024];
+    snprintf(notify, sizeof(notify), "{\"type\":\"match_found\",\"payload\":%s}\n",
+             payload);
+    send_to_user(server, user_id, notify);
+    if (client) send_response(server, client, seq, true, "Match found", payload);
+
+    printf("[Handler] Bot match created: %s vs %s (%s)\n", user_name, bot_name, match_id);
+    match_t* match = match_get(match_id);
+    if (match) schedule_bot_move(server, match);
+    free(match_id);
+    return true;
+}
+
+// Apply a finished bot search to its match
+static void play_bot_move(server_t* server, const engine_job_t* job) {
+    match_t* match = match_get_by_handle(job->match_handle);
+    if (!match || !match->active || match->move_count != job->move_count) return;
+
+    int bot_id = job->user_id;
+    bool bot_is_red = bot_id == match->red_user_id;
+    xq_move_t best = job->result.best_move;
+
+    // No legal move loses, checkmate and stalemate alike
+    if (best == XQ_NO_MOVE) {
+        settle_match(server, match, bot_is_red ? "black_wins" : "red_wins", "checkmate");
         return;
     }
 
-    // Get usernames
-    char user_name[64], opp_name[64];
-    db_get_user_by_id(user_id, user_name, NULL, NULL, NULL, NULL, NULL);
-    db_get_user_by_id(opponent_id, opp_name, NULL, NULL, NULL, NULL, NULL);
-
-        // Notify both players
-        char payload_a[512];
-        char payload_b[512];
-
-        // Payload for the requester (user_id) - your_color = red
-        snprintf(payload_a, sizeof(payload_a),
-             "{\"match_id\":\"%s\",\"red_user\":\"%s\",\"black_user\":\"%s\",\"your_color\":\"%s\"}",
-             match_id, user_name, opp_name, "red");
-
-        // Payload for the opponent - your_color = black
-        snprintf(payload_b, sizeof(payload_b),
-             "{\"match_id\":\"%s\",\"red_user\":\"%s\",\"black_user\":\"%s\",\"your_color\":\"%s\"}",
-             match_id, user_name, opp_name, "black");
-
-        // Build match_found messages
-        char notify_a[1024];
-        char notify_b[1024];
-        snprintf(notify_a, sizeof(notify_a), "{\"type\":\"match_found\",\"payload\":%s}\n", payload_a);
-        snprintf(notify_b, sizeof(notify_b), "{\"type\":\"match_found\",\"payload\":%s}\n", payload_b);
-
-        // Send match_found to both players
-        bool sent_a = send_to_user(server, user_id, notify_a);
-        bool sent_b = send_to_user(server, opponent_id, notify_b);
-
-        // If sending failed for either side, rollback the match and requeue any still-connected player
-        if (!sent_a || !sent_b) {
-            printf("[Handler] Warning: match notify failed (sent_a=%d, sent_b=%d). Rolling back match %s\n", sent_a, sent_b, match_id);
-            // Mark match as ended/aborted
-            match_end(match_id, "aborted", "notify_failed");
-
-            // Requeue connected players (so they remain in ready list)
-            int rating_a = 0, rating_b = 0;
-            db_get_user_by_id(user_id, NULL, NULL, &rating_a, NULL, NULL, NULL);
-            db_get_user_by_id(opponent_id, NULL, NULL, &rating_b, NULL, NULL, NULL);
-
-            if (is_user_connected(server, user_id)) {
-                lobby_set_ready(user_id, user_name, rating_a, true);
+    int64_t now_ms = clock_now_ms();
+    int think_ms = 0;
+    if (!match_charge_clock(match, now_ms, 0, &think_ms)) return;  // The timeout sweep ends it
+
+    move_t move = {0};
+    move.from_row = XQ_ROW(XQ_FROM(best));
+    move.from_col = XQ_COL(XQ_FROM(best));
+    move.to_row = XQ_ROW(XQ_TO(best));
+    move.to_col = XQ_COL(XQ_TO(best));
+    move.timestamp = time(NULL);
+    move.think_time_ms = think_ms;
+    move.red_time_ms = match->red_time_ms;
+    move.black_time_ms = match->black_time_ms;
+    if (!match_add_move(match->match_id, &move)) return;
+
+    send_opponent_move(server, match, bot_id, &move);
+    printf("[Engine] %s: bot (%d,%d)->(%d,%d) depth=%d score=%d nodes=%llu %dms\n",
+           match->match_id, move.from_row, move.from_col, move.to_row, move.to_col,
+           job->result.depth, job->result.score,
+           (unsigned long long)job->result.nodes, job->result.elapsed_ms);
+
+    // The human may have been mated by this move
+    xq_position_t after = job->position;
+    xq_undo_t undo;
+    xq_move_t replies[XQ_MAX_MOVES];
+    if (xq_make_move(&after, best, &undo) && xq_generate_legal(&after, replies) == 0) {
+        settle_match(server, match, bot_is_red ? "red_wins" : "black_wins", "checkmate");
+        return;
+    }
+    if (adjudicate_match(server, match)) return;
+
+    int opponent_id = match_get_opponent_id(match, bot_id);
+    apply_premove(server, match, opponent_id, now_ms);
+    schedule_bot_move(server, match);
+}
+
+// Reply to a deferred get_hint request
+static void send_hint(server_t* server, const engine_job_t* job) {
+    // The requester may have disconnected (or the fd been reused) meanwhile
+    client_t* client = NULL;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        client_t* c = server->clients[i];
+        if (c && c->fd == job->client_fd && c->user_id == job->user_id) {
+            client = c;
+            break;
+        }
+    }
+    if (!client) return;
+
+    match_t* match = match_get_by_handle(job->match_handle);
+    if (!match || match->move_count != job->move_count) {
+        send_response(server, client, job->seq, false, "Position changed", NULL);
+        return;
+    }
+
+    xq_move_t best = job->result.best_move;
+    if (best == XQ_NO_MOVE) {
+        send_response(server, client, job->seq, false, "No legal moves", NULL);
+        return;
+    }
+
+    char payload[512];
+    snprintf(payload, sizeof(payload),
+             "{\"match_id\":\"%s\",\"from_row\":%d,\"from_col\":%d,\"to_row\":%d,"
+             "\"to_col\":%d,\"score\":%d,\"depth\":%d,\"nodes\":%llu,\"elapsed_ms\":%d}",
+             match->match_id, XQ_ROW(XQ_FROM(best)), XQ_COL(XQ_FROM(best)),
+             XQ_ROW(XQ_TO(best)), XQ_COL(XQ_TO(best)), job->result.score,
+             job->result.depth, (unsigned long long)job->result.nodes,
+             job->result.elapsed_ms);
+    send_response(server, client, job->seq, true, "Hint", payload);
+}
+
+// Drain finished engine jobs (called when the engine eventfd is readable)
+void handlers_process_engine_results(server_t* server) {
+    engine_job_t results[4];
+    int count;
+
+    while ((count = engine_poll_results(results, 4)) > 0) {
+        for (int i = 0; i < count; i++) {
+            if (results[i].kind == ENGINE_JOB_BOT_MOVE) {
+                play_bot_move(server, &results[i]);
+            } else {
+                send_hint(server, &results[i]);
             }
-            if (is_user_connected(server, opponent_id)) {
-                lobby_set_ready(opponent_id, opp_name, rating_b, true);
+        }
+    }
+}
+
+// Store finished post-game analyses (called when the analysis eventfd is
+// readable) and tell the players that are still online
+void handlers_process_analysis_results(server_t* server) {
+    static analysis_job_t results[2];
+    int count;
+
+    while ((count = analysis_poll_results(results, 2)) > 0) {
+        for (int i = 0; i < count; i++) {
+            const analysis_job_t* job = &results[i];
+            if (!job->completed) continue;
+
+            char* json = analysis_to_json(job);
+            if (!json) {
+                printf("[Analysis] Could not encode analysis of %s\n", job->match_id);
+                continue;
+            }
+            if (!db_save_match_analysis(job->match_id, job->accuracy[XQ_RED],
+                                        job->accuracy[XQ_BLACK], json)) {
+                printf("[Analysis] Failed to store analysis of %s\n", job->match_id);
             }
+            free(json);
+
+            char notify[512];
+            snprintf(notify, sizeof(notify),
+                     "{\"type\":\"analysis_ready\",\"payload\":{\"match_id\":\"%.63s\","
+                     "\"red_accuracy\":%d,\"black_accuracy\":%d,\"red_blunders\":%d,"
+                     "\"black_blunders\":%d}}\n",
+                     job->match_id, job->accuracy[XQ_RED], job->accuracy[XQ_BLACK],
+                     job->blunders[XQ_RED], job->blunders[XQ_BLACK]);
+            send_to_user(server, job->red_user_id, notify);
+            send_to_user(server, job->black_user_id, notify);
+
+            printf("[Analysis] %s: accuracy red %d / black %d, %d plies in %dms\n",
+                   job->match_id, job->accuracy[XQ_RED], job->accuracy[XQ_BLACK],
+                   job->move_count, job->elapsed_ms);
+        }
+    }
+}
+
+// Handler: Hint (best move for the requester's side, answered asynchronously)
+void handle_get_hint(server_t* server, client_t* client, message_t* msg) {
+    int user_id;
+    if (!validate_token_and_get_user(msg->token, &user_id)) {
+        send_response(server, client, msg->seq, false, "Invalid token", NULL);
+        return;
+    }
+    client->user_id = user_id;
+    client->authenticated = true;
 
-            // Inform requester that they're queued again
-            send_response(server, client, msg->seq, true, "Queued for match", "{\"status\":\"queued\"}");
+    const char* match_id = json_get_string(msg->payload_json, "match_id");
+    if (!match_id) {
+        send_response(server, client, msg->seq, false, "Missing match_id", NULL);
+        return;
+    }
 
-            free(match_id);
-            return;
-        }
+    match_t* match = match_find_by_id(match_id);
+    if (!match || !match->active) {
+        send_response(server, client, msg->seq, false, "Match not found", NULL);
+        return;
+    }
+    if (match->rated) {
+        send_response(server, client, msg->seq, false, "Hints are disabled in rated games", NULL);
+        return;
+    }
+    if (!is_correct_turn(match, user_id)) {
+        send_response(server, client, msg->seq, false, "Not your turn", NULL);
+        return;
+    }
 
-        // Also respond to the requester for the original request seq (backwards compatibility)
-        send_response(server, client, msg->seq, true, "Match found", payload_a);
+    engine_job_t job;
+    if (!prepare_engine_job(match, &job)) {
+        send_response(server, client, msg->seq, false, "Position cannot be analysed", NULL);
+        return;
+    }
+    job.kind = ENGINE_JOB_HINT;
+    job.user_id = user_id;
+    job.client_fd = client->fd;
+    job.seq = msg->seq;
 
-        free(match_id);
-        printf("[Handler] Match created: %s vs %s (sent to user %d: %d, opponent %d: %d)\n",
-             user_name, opp_name, user_id, sent_a, opponent_id, sent_b);
+    int time_ms = json_get_int(msg->payload_json, "time_ms");
+    if (time_ms <= 0) time_ms = HINT_DEFAULT_TIME_MS;
+    if (time_ms > HINT_MAX_TIME_MS) time_ms = HINT_MAX_TIME_MS;
+    job.limits.time_ms = time_ms;
+    job.limits.max_depth = ENGINE_MAX_PLY - 1;
+    job.limits.threads = 2;
+
+    if (!engine_submit(&job)) {
+        send_response(server, client, msg->seq, false, "Engine busy, try again", NULL);
+    }
+    // The reply is sent by handlers_process_engine_results
+}
+
+// Handler: Tablebase probe (exact result and best move for endgame positions)
+void handle_probe_tablebase(server_t* server, client_t* client, message_t* msg) {
+    int user_id;
+    if (!validate_token_and_get_user(msg->token, &user_id)) {
+        send_response(server, client, msg->seq, false, "Invalid token", NULL);
+        return;
+    }
+    client->user_id = user_id;
+    client->authenticated = true;
+
+    const char* match_id = json_get_string(msg->payload_json, "match_id");
+    if (!match_id) {
+        send_response(server, client, msg->seq, false, "Missing match_id", NULL);
+        return;
+    }
+
+    // Finished matches stay available for post-game analysis
+    match_t* match = match_find_by_id(match_id);
+    if (!match) {
+        send_response(server, client, msg->seq, false, "Match not found", NULL);
+        return;
+    }
+    if (match->active && match->rated) {
+        send_response(server, client, msg->seq, false,
+                      "Tablebase is disabled in rated games", NULL);
+        return;
+    }
+
+    xq_position_t pos;
+    if (!match_replay_position(match, &pos, NULL, NULL)) {
+        send_response(server, client, msg->seq, false, "Position cannot be analysed", NULL);
+        return;
+    }
+
+    tb_probe_t probe;
+    xq_move_t best = tablebase_best_move(&pos, &probe);
+    if (!probe.found) {
+        send_response(server, client, msg->seq, false, "Position not in tablebase", NULL);
+        return;
+    }
+
+    const char* outcome = probe.wdl > 0 ? "win" : (probe.wdl < 0 ? "loss" : "draw");
+    char best_json[128] = "null";
+    if (best != XQ_NO_MOVE) {
+        snprintf(best_json, sizeof(best_json),
+                 "{\"from_row\":%d,\"from_col\":%d,\"to_row\":%d,\"to_col\":%d}",
+                 XQ_ROW(XQ_FROM(best)), XQ_COL(XQ_FROM(best)), XQ_ROW(XQ_TO(best)),
+                 XQ_COL(XQ_TO(best)));
+    }
+
+    char payload[512];
+    snprintf(payload, sizeof(payload),
+             "{\"match_id\":\"%s\",\"side_to_move\":\"%s\",\"result\":\"%s\","
+             "\"plies_to_mate\":%d,\"best_move\":%s}",
+             match->match_id, pos.side == XQ_RED ? "red" : "black", outcome, probe.dtm,
+             best_json);
+    send_response(server, client, msg->seq, true, "Tablebase result", payload);
+}
+
+// Opening statistics for a FEN, a match's current position, or the start
+void handle_opening_explorer(server_t* server, client_t* client, message_t* msg) {
+    int user_id;
+    if (!validate_token_and_get_user(msg->token, &user_id)) {
+        send_response(server, client, msg->seq, false, "Invalid token", NULL);
+        return;
+    }
+    client->user_id = user_id;
+    client->authenticated = true;
+
+    xq_position_t pos;
+    char* fen = json_get_string(msg->payload_json, "fen");
+    char* match_id = json_get_string(msg->payload_json, "match_id");
+    const char* error = NULL;
+
+    if (fen) {
+        if (!xq_position_from_fen(&pos, fen)) error = "Invalid FEN";
+    } else if (match_id) {
+        match_t* match = match_find_by_id(match_id);
+        if (!match) {
+            error = "Match not found";
+        } else if (match->active && match->rated) {
+            error = "Opening explorer is disabled in rated games";
+        } else if (!match_replay_position(match, &pos, NULL, NULL)) {
+            error = "Position cannot be analysed";
+        }
+    } else {
+        xq_position_start(&pos);
+    }
+    free(fen);
+    free(match_id);
+    if (error) {
+        send_response(server, client, msg->seq, false, error, NULL);
+        return;
+    }
+
+    opening_reply_t replies[OPENING_MAX_REPLIES];
+    int count = opening_lookup(&pos, replies, OPENING_MAX_REPLIES);
+
+    char position_fen[XQ_FEN_MAX];
+    xq_position_to_fen(&pos, position_fen, sizeof(position_fen));
+    uint32_t total = 0;
+    for (int i = 0; i < count; i++) total += replies[i].stats.games;
+
+    char payload[8192];
+    int len = snprintf(payload, sizeof(payload), "{\"fen\":\"%s\",\"games\":%u,\"moves\":[",
+                       position_fen, total);
+    for (int i = 0; i < count; i++) {
+        const opening_entry_t* s = &replies[i].stats;
+        xq_move_t m = replies[i].move;
+        len += snprintf(payload + len, sizeof(payload) - len,
+                        "%s{\"from_row\":%d,\"from_col\":%d,\"to_row\":%d,\"to_col\":%d,"
+                        "\"games\":%u,\"red_wins\":%u,\"black_wins\":%u,\"draws\":%u,"
+                        "\"avg_rating\":%d}",
+                        i ? "," : "", XQ_ROW(XQ_FROM(m)), XQ_COL(XQ_FROM(m)),
+                        XQ_ROW(XQ_TO(m)), XQ_COL(XQ_TO(m)), s->games, s->red_wins,
+                        s->black_wins, s->draws,
+                        s->rated_games ? (int)(s->rating_sum / s->rated_games) : 0);
+    }
+    snprintf(payload + len, sizeof(payload) - len, "]}");
+    send_response(server, client, msg->seq, true, "Opening statistics", payload);
 }
 
-// Handler: Move
 void handle_move(server_t* server, client_t* client, message_t* msg) {
+    // Stamp arrival before any other work so it is not billed to the mover
+    int64_t received_ms = clock_now_ms();
+
     // Validate token
     int user_id;
     if (!validate_token_and_get_user(msg->token, &user_id)) {
@@ -429,17 +1171,14 @@ void handle_move(server_t* server, client_t* client, message_t* msg) {
         return;
     }
 
-    // NOTE: Move validation is done on client side (JavaScript)
-    // Server trusts client validation for performance
-    // Only check if it's player's turn
     match_t* match = match_find_by_id(match_id);
-    if (!match) {
+    if (!match || !match->active) {
         send_response(server, client, msg->seq, false, "Match not found", NULL);
         return;
     }
 
     // Check if it's player's turn
-    bool is_red_turn = (match->move_count % 2 == 0);
+    bool is_red_turn = strcmp(match->current_turn, "red") == 0;
     bool is_red_player = (match->red_user_id == user_id);
 
     if (is_red_turn != is_red_player) {
@@ -447,24 +1186,22 @@ void handle_move(server_t* server, client_t* client, message_t* msg) {
         return;
     }
 
-    // Update timer before move (deduct time from current player)
-    match_update_timer(match_id);
-    
-    // Check for timeout
-    if (match_check_timeout(match_id)) {
+    // Rejected before the clock is charged: stored, an illegal move would
+    // switch off the position (snapshots, adjudication, analysis, bots) for
+    // the rest of the game
+    if (match->position_valid &&
+        xq_find_move(&match->position, from_row, from_col, to_row, to_col) == XQ_NO_MOVE) {
+        send_response(server, client, msg->seq, false, "Illegal move", NULL);
+        return;
+    }
+
+    // Charge the mover's clock up to the moment this move arrived,
+    // minus a bounded share of its measured round-trip time
+    int lag_comp_ms = clock_lag_compensation_ms(client->rtt_ms);
+    int think_ms = 0;
+    if (!match_charge_clock(match, received_ms, lag_comp_ms, &think_ms)) {
         const char* winner = is_red_player ? "black_wins" : "red_wins";
-        match_end(match_id, winner, "timeout");
-        
-        // Notify both players
-        char timeout_payload[256];
-        snprintf(timeout_payload, sizeof(timeout_payload),
-                 "{\"match_id\":\"%s\",\"result\":\"%s\",\"reason\":\"timeout\"}",
-                 match_id, winner);
-        char timeout_msg[512];
-        snprintf(timeout_msg, sizeof(timeout_msg),
-                 "{\"type\":\"game_end\",\"payload\":%s}\n", timeout_payload);
-        broadcast_to_match(server, match_id, timeout_msg);
-        
+        settle_match(server, match, winner, "timeout");
         send_response(server, client, msg->seq, false, "Time expired", NULL);
         return;
     }
@@ -476,6 +1213,8 @@ void handle_move(server_t* server, client_t* client, message_t* msg) {
     move.to_row = to_row;
     move.to_col = to_col;
     move.timestamp = time(NULL);
+    move.think_time_ms = think_ms;
+    move.lag_comp_ms = lag_comp_ms;
     // Store remaining times in move
     move.red_time_ms = match->red_time_ms;
     move.black_time_ms = match->black_time_ms;
@@ -488,34 +1227,72 @@ void handle_move(server_t* server, client_t* client, message_t* msg) {
     // Success - include timer info in response
     char timer_json[128];
     snprintf(timer_json, sizeof(timer_json),
-             "{\"red_time_ms\":%d,\"black_time_ms\":%d}",
-             match->red_time_ms, match->black_time_ms);
+             "{\"red_time_ms\":%d,\"black_time_ms\":%d,\"think_time_ms\":%d,"
+             "\"lag_comp_ms\":%d}",
+             match->red_time_ms, match->black_time_ms, think_ms, lag_comp_ms);
     send_response(server, client, msg->seq, true, "Move accepted", timer_json);
 
-    // Send move to opponent with timer sync
-    char payload[512];
-    snprintf(payload, sizeof(payload),
-             "{\"match_id\":\"%s\",\"from\":{\"row\":%d,\"col\":%d},\"to\":{"
-             "\"row\":%d,\"col\":%d},\"red_time_ms\":%d,\"black_time_ms\":%d}",
-             match_id, from_row, from_col, to_row, to_col,
-             match->red_time_ms, match->black_time_ms);
+    // Send move to opponent (and spectators) with timer sync
+    send_opponent_move(server, match, user_id, &move);
 
-    char broadcast_msg[1024];
-    snprintf(broadcast_msg, sizeof(broadcast_msg),
-             "{\"type\":\"opponent_move\",\"payload\":%s}\n", payload);
+    printf("[Handler] Move: %s (%d,%d)->(%d,%d) [Red:%dms, Black:%dms]\n", 
+           match_id, from_row, from_col, to_row, to_col,
+           match->red_time_ms, match->black_time_ms);
 
-    // Get opponent user_id
-    int opponent_id = (match->red_user_id == user_id) ? match->black_user_id : match->red_user_id;
-    send_to_user(server, opponent_id, broadcast_msg);
+    if (adjudicate_match(server, match)) return;
 
-    // Also broadcast to spectators
-    for (int i = 0; i < match->spectator_count; i++) {
-        send_to_user(server, match->spectator_ids[i], broadcast_msg);
+    // The opponent may already have answered with a premove
+    int opponent_id = match_get_opponent_id(match, user_id);
+    apply_premove(server, match, opponent_id, received_ms);
+
+    // Against a bot, hand the position to the engine
+    schedule_bot_move(server, match);
+}
+
+// Handler: Premove (queue one conditional move while waiting for the opponent)
+void handle_premove(server_t* server, client_t* client, message_t* msg) {
+    int user_id;
+    if (!validate_token_and_get_user(msg->token, &user_id)) {
+        send_response(server, client, msg->seq, false, "Invalid token", NULL);
+        return;
     }
+    client->user_id = user_id;
+    client->authenticated = true;
 
-    printf("[Handler] Move: %s (%d,%d)->(%d,%d) [Red:%dms, Black:%dms]\n", 
-           match_id, from_row, from_col, to_row, to_col,
-           match->red_time_ms, match->black_time_ms);
+    const char* match_id = json_get_string(msg->payload_json, "match_id");
+    if (!match_id) {
+        send_response(server, client, msg->seq, false, "Missing match_id", NULL);
+        return;
+    }
+
+    match_t* match = match_find_by_id(match_id);
+    if (!match || !match->active) {
+        send_response(server, client, msg->seq, false, "Match not found", NULL);
+        return;
+    }
+    if (user_id != match->red_user_id && user_id != match->black_user_id) {
+        send_response(server, client, msg->seq, false, "Not a player in this match", NULL);
+        return;
+    }
+
+    if (json_get_bool(msg->payload_json, "cancel")) {
+        match_clear_premove(match, user_id);
+        send_response(server, client, msg->seq, true, "Premove cancelled", NULL);
+        return;
+    }
+
+    int from_row = json_get_int(msg->payload_json, "from_row");
+    int from_col = json_get_int(msg->payload_json, "from_col");
+    int to_row = json_get_int(msg->payload_json, "to_row");
+    int to_col = json_get_int(msg->payload_json, "to_col");
+
+    if (!match_set_premove(match, user_id, from_row, from_col, to_row, to_col)) {
+        send_response(server, client, msg->seq, false,
+                      "Premove rejected (your turn or invalid squares)", NULL);
+        return;
+    }
+
+    send_response(server, client, msg->seq, true, "Premove queued", NULL);
 }
 
 void handle_resign(server_t* server, client_t* client, message_t* msg) {
@@ -546,52 +1323,11 @@ void handle_resign(server_t* server, client_t* client, message_t* msg) {
     // Kết thúc trận đấu
     match_end(match_id, result, "resign");
 
-    // Biến để gửi về client
+    // Cập nhật Elo và Stats (chỉ khi đấu Rank) cùng lịch sử trận đấu trong
+    // một transaction (trận với bot không lưu)
     int new_red_rating = 0;
     int new_black_rating = 0;
-
-    // Cập nhật Elo và Stats (Chỉ khi đấu Rank)
-    if (match->rated) {
-        char u1[64], e1[128]; int r1, w1, l1, d1; // Red
-        char u2[64], e2[128]; int r2, w2, l2, d2; // Black
-
-        // Lấy thông tin hiện tại
-        db_get_user_by_id(match->red_user_id, u1, e1, &r1, &w1, &l1, &d1);
-        db_get_user_by_id(match->black_user_id, u2, e2, &r2, &w2, &l2, &d2);
-
-        // Tính toán Elo mới
-        rating_change_t rc = rating_calculate(r1, r2, result, DEFAULT_K_FACTOR);
-        
-        new_red_rating = r1 + rc.red_change;
-        new_black_rating = r2 + rc.black_change;
-
-        // Cập nhật số trận Thắng/Thua
-        if (strcmp(result, "red_wins") == 0) {
-            w1++; // Red thắng
-            l2++; // Black thua
-        } else {
-            l1++; // Red thua
-            w2++; // Black thắng
-        }
-
-        // Lưu vào Database
-        db_update_user_rating(match->red_user_id, new_red_rating);
-        db_update_user_stats(match->red_user_id, w1, l1, d1);
-        
-        db_update_user_rating(match->black_user_id, new_black_rating);
-        db_update_user_stats(match->black_user_id, w2, l2, d2);
-        
-        printf("[Rating] Resign: Red(%d->%d), Black(%d->%d)\n", r1, new_red_rating, r2, new_black_rating);
-    }
-
-    // Lưu lịch sử trận đấu
-    char* moves_json = match_get_moves_json(match);
-    char started[32], ended[32];
-    sprintf(started, "%ld", match->started_at);
-    sprintf(ended, "%ld", time(NULL));
-    db_save_match(match_id, match->red_user_id, match->black_user_id, result,
-                  moves_json, started, ended);
-    free(moves_json);
+    store_finished_match(match, result, "resign", &new_red_rating, &new_black_rating);
 
     // Phản hồi cho người gửi (đã xử lý xong)
     send_response(server, client, msg->seq, true, "Resigned", NULL);
@@ -672,37 +1408,7 @@ void handle_draw_response(server_t* server, client_t* client, message_t* msg) {
 
         int new_red_rating = 0;
         int new_black_rating = 0;
-
-        if (match->rated) {
-            char u1[64], e1[128]; int r1, w1, l1, d1;
-            char u2[64], e2[128]; int r2, w2, l2, d2;
-
-            db_get_user_by_id(match->red_user_id, u1, e1, &r1, &w1, &l1, &d1);
-            db_get_user_by_id(match->black_user_id, u2, e2, &r2, &w2, &l2, &d2);
-
-            rating_change_t rc = rating_calculate(r1, r2, "draw", DEFAULT_K_FACTOR);
-            
-            new_red_rating = r1 + rc.red_change;
-            new_black_rating = r2 + rc.black_change;
-
-            d1++;
-            d2++;
-            db_update_user_rating(match->red_user_id, new_red_rating);
-            db_update_user_stats(match->red_user_id, w1, l1, d1);
-
-            db_update_user_rating(match->black_user_id, new_black_rating);
-            db_update_user_stats(match->black_user_id, w2, l2, d2);
-            
-            printf("[Rating] Draw: Red(%d->%d), Black(%d->%d)\n", r1, new_red_rating, r2, new_black_rating);
-        }
-
-        char* moves_json = match_get_moves_json(match);
-        char started[32], ended[32];
-        sprintf(started, "%ld", match->started_at);
-        sprintf(ended, "%ld", time(NULL));
-        db_save_match(match_id, match->red_user_id, match->black_user_id, "draw",
-                      moves_json, started, ended);
-        free(moves_json);
+        store_finished_match(match, "draw", "agreement", &new_red_rating, &new_black_rating);
 
         char payload[512];
         snprintf(payload, sizeof(payload), 
@@ -739,8 +1445,18 @@ void handle_challenge(server_t* server, client_t* client, message_t* msg) {
         return;
     }
 
+    // Optional custom setup; games from one are never rated
+    char start_fen[XQ_FEN_MAX] = "";
+    if (!parse_start_fen(msg->payload_json, start_fen, sizeof(start_fen))) {
+        send_response(server, client, msg->seq, false, "Invalid FEN", NULL);
+        return;
+    }
+    if (start_fen[0]) rated = false;
+
     // Create challenge
-    char* challenge_id = lobby_create_challenge(user_id, opponent_id, rated);
+    time_control_t time_control = parse_time_control(msg->payload_json);
+    char* challenge_id = lobby_create_challenge(user_id, opponent_id, rated,
+                                                &time_control, start_fen);
     if (!challenge_id) {
         send_response(server, client, msg->seq, false, "Failed to create challenge",
                       NULL);
@@ -784,22 +1500,19 @@ void handle_challenge_response(server_t* server, client_t* client, message_t* ms
     }
 
     if (accept) {
-        if (!lobby_accept_challenge(challenge_id, user_id)) {
+        // Taken out of the registry, so it cannot start a second game
+        challenge_t accepted;
+        if (!lobby_accept_challenge(challenge_id, user_id, &accepted)) {
             send_response(server, client, msg->seq, false, "Failed to accept challenge",
                           NULL);
             return;
         }
-
-        // Get challenge
-        challenge_t* ch = lobby_get_challenge(challenge_id);
-        if (!ch) {
-            send_response(server, client, msg->seq, false, "Challenge not found", NULL);
-            return;
-        }
+        const challenge_t* ch = &accepted;
 
         // Create match
-        char* match_id =
-            match_create(ch->from_user_id, ch->to_user_id, ch->rated, 600000);
+        char* match_id = match_create_from_fen(
+            ch->from_user_id, ch->to_user_id, ch->rated, &ch->time_control,
+            ch->start_fen[0] ? ch->start_fen : NULL);
         if (!match_id) {
             send_response(server, client, msg->seq, false, "Failed to create match",
                           NULL);
@@ -808,7 +1521,8 @@ void handle_challenge_response(server_t* server, client_t* client, message_t* ms
 
         // Notify both
         char payload[512];
-        snprintf(payload, sizeof(payload), "{\"match_id\":\"%s\"}", match_id);
+        snprintf(payload, sizeof(payload), "{\"match_id\":\"%s\",\"start_fen\":\"%s\"}",
+                 match_id, ch->start_fen[0] ? ch->start_fen : XQ_START_FEN);
         char notify[1024];
         snprintf(notify, sizeof(notify),
                  "{\"type\":\"match_start\",\"payload\":%s}\n", payload);
@@ -823,6 +1537,25 @@ void handle_challenge_response(server_t* server, client_t* client, message_t* ms
     }
 }
 
+// Handler: Get Challenges (pending ones the caller sent or received)
+void handle_get_challenges(server_t* server, client_t* client, message_t* msg) {
+    int user_id;
+    if (!validate_token_and_get_user(msg->token, &user_id)) {
+        send_response(server, client, msg->seq, false, "Invalid token", NULL);
+        return;
+    }
+    client->user_id = user_id;
+    client->authenticated = true;
+
+    char* challenges_json = lobby_get_challenges_json(user_id);
+    if (!challenges_json) {
+        send_response(server, client, msg->seq, false, "Failed to get challenges", NULL);
+        return;
+    }
+    send_response(server, client, msg->seq, true, "Challenges", challenges_json);
+    free(challenges_json);
+}
+
 // Handler: Get Match
 void handle_get_match(server_t* server, client_t* client, message_t* msg) {
     // Validate token
@@ -838,15 +1571,19 @@ void handle_get_match(server_t* server, client_t* client, message_t* msg) {
         return;
     }
 
-    char match_json[65536];
-    if (!db_get_match(match_id, match_json, sizeof(match_json))) {
+    char* match_json = db_get_match(match_id);
+    if (!match_json) {
         send_response(server, client, msg->seq, false, "Match not found", NULL);
         return;
     }
 
     send_response(server, client, msg->seq, true, "Match found", match_json);
+    free(match_json);
 }
 
+// Leaderboard page from the in-memory ranking. user_id (default: the
+// caller) is the player whose rank is reported; with "around" the page is
+// centered on that player instead of starting at offset.
 void handle_leaderboard(server_t* server, client_t* client, message_t* msg) {
     if (!msg->payload_json) {
         send_response(server, client, msg->seq, false, "Invalid request payload", NULL);
@@ -855,27 +1592,52 @@ void handle_leaderboard(server_t* server, client_t* client, message_t* msg) {
 
     int limit = json_get_int(msg->payload_json, "limit");
     int offset = json_get_int(msg->payload_json, "offset");
+    int user_id = json_get_int(msg->payload_json, "user_id");
+    bool around = json_get_bool(msg->payload_json, "around");
 
-    if (limit <= 0) limit = 10;
+    if (limit <= 0) limit = RANKING_PAGE_DEFAULT;
+    if (limit > RANKING_PAGE_MAX) limit = RANKING_PAGE_MAX;
     if (offset < 0) offset = 0;
+    if (user_id <= 0 && client->authenticated) user_id = client->user_id;
 
-    size_t buffer_size = 16384;
-    char* leaderboard_json = (char*)malloc(buffer_size);
-    
-    if (!leaderboard_json) {
+    int user_rank = user_id > 0 ? ranking_rank_of(user_id) : 0;
+    if (around) {
+        if (user_rank == 0) {
+            send_response(server, client, msg->seq, false, "Player not ranked", NULL);
+            return;
+        }
+        offset = user_rank - 1 - limit / 2;
+        if (offset < 0) offset = 0;
+    }
+
+    size_t buffer_size = 12288;
+    char* entries_json = (char*)malloc(buffer_size);
+    char* payload = (char*)malloc(buffer_size + 128);
+
+    if (!entries_json || !payload) {
         perror("malloc failed in handle_leaderboard");
         send_response(server, client, msg->seq, false, "Server memory error", NULL);
+        free(entries_json);
+        free(payload);
         return;
     }
 
-    if (!db_get_leaderboard(limit, offset, leaderboard_json, buffer_size)) {
+    if (ranking_page_json(offset + 1, limit, entries_json, buffer_size) < 0) {
         send_response(server, client, msg->seq, false, "Failed to get leaderboard", NULL);
-        free(leaderboard_json);
+        free(entries_json);
+        free(payload);
         return;
     }
 
-    send_response(server, client, msg->seq, true, "Leaderboard", leaderboard_json);
-    free(leaderboard_json);
+    char rank_json[16] = "null";
+    if (user_rank > 0) snprintf(rank_json, sizeof(rank_json), "%d", user_rank);
+    snprintf(payload, buffer_size + 128,
+             "{\"total\":%d,\"offset\":%d,\"user_rank\":%s,\"leaderboard\":%s}",
+             ranking_count(), offset, rank_json, entries_json);
+
+    send_response(server, client, msg->seq, true, "Leaderboard", payload);
+    free(entries_json);
+    free(payload);
 }
 
 // Handler: Join Match (used when reconnecting to associate connection with user)
@@ -911,7 +1673,7 @@ void handle_join_match(server_t* server, client_t* client, message_t* msg) {
     }
 
     // Determine whose turn it is
-    bool is_red_turn = (match->move_count % 2 == 0);
+    bool is_red_turn = strcmp(match->current_turn, "red") == 0;
     const char* current_turn = is_red_turn ? "red" : "black";
     bool is_my_turn = (is_red_turn && match->red_user_id == user_id) ||
                       (!is_red_turn && match->black_user_id == user_id);
@@ -955,47 +1717,114 @@ void handle_join_spectate(server_t* server, client_t* client, message_t* msg) {
         return;
     }
 
-    // Determine whose turn it is
-    bool is_red_turn = (match->move_count % 2 == 0);
-    const char* current_turn = is_red_turn ? "red" : "black";
-
-    // Get match state including all moves
-    char* match_json = match_get_json(match_id);
-    if (!match_json) {
-        send_response(server, client, msg->seq, false, "Failed to get match state", NULL);
-        return;
-    }
-
-    // Add spectator to match
-    if (!match_add_spectator(match_id, user_id)) {
+    // Subscribe this connection to the match topic
+    if (!pubsub_subscribe(match_id, client)) {
         send_response(server, client, msg->seq, false, "Failed to add spectator", NULL);
-        free(match_json);
         return;
     }
 
-    // Return match state for spectator
-    char payload[4096];
+    // Snapshot instead of the full move list: the same size at ply 10 or
+    // 300. Events after it carry event_seq > snapshot.event_seq.
+    char snapshot[2048];
+    match_get_snapshot_json(match, snapshot, sizeof(snapshot));
+
+    char payload[2304];
     snprintf(payload, sizeof(payload),
-             "{\"match_id\":\"%s\",\"move_count\":%d,\"current_turn\":\"%s\",\"is_spectator\":true,\"match_data\":%s}",
-             match_id, match->move_count, current_turn, match_json);
+             "{\"match_id\":\"%s\",\"move_count\":%d,\"current_turn\":\"%s\","
+             "\"is_spectator\":true,\"snapshot\":%s}",
+             match_id, match->move_count, match->current_turn, snapshot);
 
     send_response(server, client, msg->seq, true, "Joined as spectator", payload);
 
-    printf("[Handler] User %d spectating match %s (move_count=%d)\n",
-           user_id, match_id, match->move_count);
+    printf("[Handler] User %d spectating match %s (move_count=%d, event_seq=%u)\n",
+           user_id, match_id, match->move_count, match->event_seq);
+}
+
+// A spectator that fell behind skips the events in between and receives
+// this instead; its event_seq tells the client where the stream resumes
+bool handlers_spectator_snapshot(const char* match_id, char* out, size_t size) {
+    match_t* match = match_find_by_id(match_id);
+    if (!match) return false;
+
+    char snapshot[2048];
+    if (!match_get_snapshot_json(match, snapshot, sizeof(snapshot))) return false;
 
-    free(match_json);
+    int len = snprintf(out, size, "{\"type\":\"match_snapshot\",\"payload\":%s}",
+                       snapshot);
+    return len > 0 && (size_t)len < size;
 }
 
-// Handler: Leave Spectate
-void handle_leave_spectate(server_t* server, client_t* client, message_t* msg) {
-    // Validate token
-    int user_id;
-    if (!validate_token_and_get_user(msg->token, &user_id)) {
-        send_response(server, client, msg->seq, false, "Invalid token", NULL);
+// Handler: Fanout Snapshot
+// Current state of a match for a fanout process (see fanout.h)
+void handle_fanout_snapshot(server_t* server, client_t* client, message_t* msg) {
+    if (!client->fanout) {
+        send_response(server, client, msg->seq, false, "Fanout peers only", NULL);
         return;
     }
 
+    char* match_id = json_get_string(msg->payload_json, "match_id");
+    match_t* match = match_id ? match_find_by_id(match_id) : NULL;
+    free(match_id);
+    if (!match) {
+        send_response(server, client, msg->seq, false, "Match not found", NULL);
+        return;
+    }
+
+    char snapshot[2048];
+    match_get_snapshot_json(match, snapshot, sizeof(snapshot));
+
+    char payload[2304];
+    snprintf(payload, sizeof(payload), "{\"match_id\":\"%s\",\"snapshot\":%s}",
+             match->match_id, snapshot);
+    send_response(server, client, msg->seq, true, "Snapshot", payload);
+}
+
+// Handler: Resync From
+// A client that saw a gap in event_seq asks for everything after from_seq.
+// The missed events are re-sent verbatim from the topic history, then the
+// response; if the history no longer reaches back that far, the response
+// carries a fresh snapshot instead.
+void handle_resync_from(server_t* server, client_t* client, message_t* msg) {
+    char* match_id = json_get_string(msg->payload_json, "match_id");
+    long long from_seq = json_get_int64(msg->payload_json, "from_seq");
+
+    match_t* match = match_id ? match_find_by_id(match_id) : NULL;
+    free(match_id);
+    if (!match) {
+        send_response(server, client, msg->seq, false, "Match not found", NULL);
+        return;
+    }
+
+    char payload[2304];
+    if (from_seq >= 0 && from_seq <= match->event_seq) {
+        int count = 0;
+        if (from_seq < match->event_seq) {
+            count = pubsub_replay(server, match->match_id, client,
+                                  (uint32_t)from_seq);
+        }
+        if (count >= 0) {
+            snprintf(payload, sizeof(payload),
+                     "{\"match_id\":\"%s\",\"mode\":\"delta\",\"from_seq\":%lld,"
+                     "\"event_seq\":%u,\"count\":%d}",
+                     match->match_id, from_seq, match->event_seq, count);
+            send_response(server, client, msg->seq, true, "Resync", payload);
+            return;
+        }
+    }
+
+    char snapshot[2048];
+    match_get_snapshot_json(match, snapshot, sizeof(snapshot));
+    snprintf(payload, sizeof(payload),
+             "{\"match_id\":\"%s\",\"mode\":\"snapshot\",\"event_seq\":%u,"
+             "\"snapshot\":%s}",
+             match->match_id, match->event_seq, snapshot);
+    send_response(server, client, msg->seq, true, "Resync", payload);
+}
+
+// Handler: Leave Spectate
+// Subscriptions belong to the connection, so no token is needed (anonymous
+// spectators can leave too)
+void handle_leave_spectate(server_t* server, client_t* client, message_t* msg) {
     const char* match_id = json_get_string(msg->payload_json, "match_id");
     if (!match_id) {
         send_response(server, client, msg->seq, false, "Missing match_id", NULL);
@@ -1003,7 +1832,7 @@ void handle_leave_spectate(server_t* server, client_t* client, message_t* msg) {
     }
 
     // Remove spectator
-    if (match_remove_spectator(match_id, user_id)) {
+    if (pubsub_unsubscribe(match_id, client)) {
         send_response(server, client, msg->seq, true, "Left spectate mode", NULL);
     } else {
         send_response(server, client, msg->seq, false, "Not spectating this match", NULL);
@@ -1011,8 +1840,55 @@ void handle_leave_spectate(server_t* server, client_t* client, message_t* msg) {
 }
 
 // Handler: Heartbeat
+// The reply carries server_time_ms; a client that echoes it back on its next
+// heartbeat (as "server_time_ms") contributes an RTT sample.
 void handle_heartbeat(server_t* server, client_t* client, message_t* msg) {
-    send_response(server, client, msg->seq, true, "pong", NULL);
+    int64_t now_ms = clock_now_ms();
+    client->last_heartbeat = time(NULL);
+
+    long long echoed = json_get_int64(msg->payload_json, "server_time_ms");
+    if (echoed > 0 && echoed <= now_ms) {
+        client_record_rtt(client, now_ms - echoed);
+    }
+
+    char payload[128];
+    snprintf(payload, sizeof(payload),
+             "{\"server_time_ms\":%lld,\"rtt_ms\":%d}", (long long)now_ms,
+             client->rtt_ms);
+    send_response(server, client, msg->seq, true, "pong", payload);
+}
+
+// Handler: Pong (reply to a server-initiated ping)
+void handle_pong(server_t* server, client_t* client, message_t* msg) {
+    (void)server;
+    int64_t now_ms = clock_now_ms();
+    client->last_heartbeat = time(NULL);
+
+    // Only the outstanding ping counts, so a stale or forged echo cannot
+    // inflate the lag compensation
+    int ping_id = json_get_int(msg->payload_json, "ping_id");
+    if (ping_id > 0 && ping_id == client->ping_id && client->ping_sent_ms > 0) {
+        client_record_rtt(client, now_ms - client->ping_sent_ms);
+        client->ping_sent_ms = 0;
+    }
+}
+
+// Handler: Server stats (connections, matches, per-client RTT)
+void handle_get_server_stats(server_t* server, client_t* client, message_t* msg) {
+    int user_id;
+    if (!validate_token_and_get_user(msg->token, &user_id)) {
+        send_response(server, client, msg->seq, false, "Invalid or expired token", NULL);
+        return;
+    }
+
+    char* stats_json = server_get_stats_json(server, client);
+    if (!stats_json) {
+        send_response(server, client, msg->seq, false, "Failed to get stats", NULL);
+        return;
+    }
+
+    send_response(server, client, msg->seq, true, "Server stats", stats_json);
+    free(stats_json);
 }
 
 // Handler: Chat Message
@@ -1057,7 +1933,7 @@ void handle_chat_message(server_t* server, client_t* client, message_t* msg) {
 
     // Get sender username from database
     char username[64] = {0};
-    if (!db_get_username(user_id, username, sizeof(username))) {
+    if (!account_lookup(user_id, username, sizeof(username), NULL)) {
         strcpy(username, "Unknown");
     }
 
@@ -1110,7 +1986,9 @@ void handle_create_room(server_t* server, client_t* client, message_t* msg) {
     bool rated = json_get_bool(msg->payload_json, "rated");
 
     // Create room
-    char* room_code = lobby_create_room(user_id, room_name, password, rated);
+    time_control_t time_control = parse_time_control(msg->payload_json);
+    char* room_code =
+        lobby_create_room(user_id, room_name, password, rated, &time_control);
     if (!room_code) {
         send_response(server, client, msg->seq, false, "Failed to create room", NULL);
         return;
@@ -1118,7 +1996,7 @@ void handle_create_room(server_t* server, client_t* client, message_t* msg) {
 
     // Get username for response
     char username[64] = {0};
-    db_get_username(user_id, username, sizeof(username));
+    account_lookup(user_id, username, sizeof(username), NULL);
 
     // Success
     char payload[256];
@@ -1172,8 +2050,8 @@ void handle_join_room(server_t* server, client_t* client, message_t* msg) {
     char host_username[64] = {0};
     char guest_username[64] = {0};
     int host_rating = 1500, guest_rating = 1500;
-    db_get_user_by_id(host_id, host_username, NULL, &host_rating, NULL, NULL, NULL);
-    db_get_user_by_id(user_id, guest_username, NULL, &guest_rating, NULL, NULL, NULL);
+    account_lookup(host_id, host_username, sizeof(host_username), &host_rating);
+    account_lookup(user_id, guest_username, sizeof(guest_username), &guest_rating);
 
     // Send success to joiner
     char payload[512];
@@ -1344,9 +2222,10 @@ void handle_start_room_game(server_t* server, client_t* client, message_t* msg)
     int host_id = room->host_user_id;
     int guest_id = room->guest_user_id;
     bool rated = room->rated;
+    time_control_t time_control = room->time_control;
 
-    // Create match (10 minutes = 600000 ms default)
-    char* match_id = match_create(host_id, guest_id, rated, 600000);
+    // Create match with the room's time control (10 minutes by default)
+    char* match_id = match_create(host_id, guest_id, rated, &time_control);
     if (!match_id) {
         send_response(server, client, msg->seq, false, "Failed to create match", NULL);
         return;
@@ -1355,8 +2234,8 @@ void handle_start_room_game(server_t* server, client_t* client, message_t* msg)
     // Get player info
     char host_username[64] = {0}, guest_username[64] = {0};
     int host_rating = 1500, guest_rating = 1500;
-    db_get_user_by_id(host_id, host_username, NULL, &host_rating, NULL, NULL, NULL);
-    db_get_user_by_id(guest_id, guest_username, NULL, &guest_rating, NULL, NULL, NULL);
+    account_lookup(host_id, host_username, sizeof(host_username), &host_rating);
+    account_lookup(guest_id, guest_username, sizeof(guest_username), &guest_rating);
 
     // Send match_found to host (red)
     char host_payload[512];
@@ -1440,7 +2319,7 @@ void handle_rematch_request(server_t* server, client_t* client, message_t* msg)
 
     // Get requester username
     char username[64] = {0};
-    db_get_username(user_id, username, sizeof(username));
+    account_lookup(user_id, username, sizeof(username), NULL);
 
     // Send rematch request to opponent
     client_t* opponent_client = server_get_client_by_user_id(server, opponent_id);
@@ -1509,9 +2388,11 @@ void handle_rematch_response(server_t* server, client_t* client, message_t* msg)
     int new_red = old_match->black_user_id;  // Previous black is now red
     int new_black = old_match->red_user_id;  // Previous red is now black
     bool rated = old_match->rated;
-    int time_ms = old_match->red_time_ms > 0 ? old_match->red_time_ms : 600000;
+    time_control_t time_control = old_match->time_control;
 
-    char* new_match_id = match_create(new_red, new_black, rated, time_ms);
+    // Same setup as the game just played
+    char* new_match_id = match_create_from_fen(new_red, new_black, rated, &time_control,
+                                               old_match->start_fen);
     if (!new_match_id) {
         send_response(server, client, msg->seq, false, "Failed to create rematch", NULL);
         return;
@@ -1520,8 +2401,8 @@ void handle_rematch_response(server_t* server, client_t* client, message_t* msg)
     // Get player info
     char red_username[64] = {0}, black_username[64] = {0};
     int red_rating = 1500, black_rating = 1500;
-    db_get_user_by_id(new_red, red_username, NULL, &red_rating, NULL, NULL, NULL);
-    db_get_user_by_id(new_black, black_username, NULL, &black_rating, NULL, NULL, NULL);
+    account_lookup(new_red, red_username, sizeof(red_username), &red_rating);
+    account_lookup(new_black, black_username, sizeof(black_username), &black_rating);
 
     // Send match_found to new red player (the one who accepted)
     char red_payload[512];
@@ -1599,7 +2480,18 @@ void handle_match_history(server_t* server, client_t* client, message_t* msg) {
 // Spectator Handlers
 // =========================
 
-// Get list of live matches for spectating
+int handlers_player_rating(int user_id) {
+    if (engine_is_bot(user_id)) return 0;
+
+    int rating = 0;
+    if (!account_lookup(user_id, NULL, 0, &rating)) return 0;
+    return rating;
+}
+
+// Get list of live matches for spectating.
+// Filters (all optional): min_rating, max_rating, speed, min_spectators;
+// pagination: cursor, limit. if_version equal to the current version
+// answers "unchanged" without a list.
 void handle_get_live_matches(server_t* server, client_t* client, message_t* msg) {
     // Validate token
     int user_id;
@@ -1610,26 +2502,50 @@ void handle_get_live_matches(server_t* server, client_t* client, message_t* msg)
     client->user_id = user_id;
     client->authenticated = true;
 
-    char* live_matches_json = match_get_live_matches_json();
-    if (!live_matches_json) {
-        send_response(server, client, msg->seq, false, "Failed to get live matches", NULL);
+    uint32_t version = live_version();
+    long long if_version = json_get_int64(msg->payload_json, "if_version");
+    if (if_version == (long long)version) {
+        char payload[64];
+        snprintf(payload, sizeof(payload), "{\"version\":%u,\"unchanged\":true}", version);
+        send_response(server, client, msg->seq, true, "Live matches", payload);
         return;
     }
 
-    char* payload = malloc(strlen(live_matches_json) + 128);
-    if (!payload) {
-        free(live_matches_json);
-        send_response(server, client, msg->seq, false, "Memory allocation failed", NULL);
+    live_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.min_rating = json_get_int(msg->payload_json, "min_rating");
+    query.max_rating = json_get_int(msg->payload_json, "max_rating");
+    query.min_spectators = json_get_int(msg->payload_json, "min_spectators");
+    query.cursor = json_get_int(msg->payload_json, "cursor");
+    query.limit = json_get_int(msg->payload_json, "limit");
+    char* speed = json_get_string(msg->payload_json, "speed");
+    if (speed) snprintf(query.speed, sizeof(query.speed), "%s", speed);
+    bool speed_ok = !speed || (strlen(speed) < sizeof(query.speed) && live_speed_valid(speed));
+    free(speed);
+    if (!speed_ok) {
+        send_response(server, client, msg->seq, false, "Invalid speed", NULL);
         return;
     }
 
-    sprintf(payload, "{\"matches\":%s}", live_matches_json);
-    send_response(server, client, msg->seq, true, "Live matches", payload);
-
-    free(live_matches_json);
-    free(payload);
+    frame_t* page = live_get_page(&query);
+    if (!page) {
+        send_response(server, client, msg->seq, false, "Failed to get live matches", NULL);
+        return;
+    }
 
-    printf("[Handler] Get live matches for user %d\n", user_id);
+    // The page is cached and shared: send the envelope head, then the page
+    // (which closes the envelope) as a second frame
+    char head[128];
+    int head_len = snprintf(head, sizeof(head),
+                            "{\"type\":\"response\",\"seq\":%d,\"success\":true,"
+                            "\"message\":\"Live matches\",\"payload\":",
+                            msg->seq);
+    frame_t* head_frame = frame_create_raw(head, head_len);
+    if (head_frame && client_send_frame(server, client, head_frame)) {
+        client_send_frame(server, client, page);
+    }
+    frame_unref(head_frame);
+    frame_unref(page);
 }
 
 // =========================
@@ -1726,6 +2642,8 @@ void dispatch_handler(server_t* server, client_t* client, message_t* msg) {
         handle_logout(server, client, msg);
     } else if (strcmp(msg->type, "set_ready") == 0) {
         handle_set_ready(server, client, msg);
+    } else if (strcmp(msg->type, "get_lobby_snapshot") == 0) {
+        handle_get_lobby_snapshot(server, client, msg);
     } else if (strcmp(msg->type, "find_match") == 0) {
         handle_find_match(server, client, msg);
     } else if (strcmp(msg->type, "move") == 0) {
@@ -1738,6 +2656,8 @@ void dispatch_handler(server_t* server, client_t* client, message_t* msg) {
         handle_draw_response(server, client, msg);
     } else if (strcmp(msg->type, "challenge") == 0) {
         handle_challenge(server, client, msg);
+    } else if (strcmp(msg->type, "get_challenges") == 0) {
+        handle_get_challenges(server, client, msg);
     } else if (strcmp(msg->type, "challenge_response") == 0) {
         handle_challenge_response(server, client, msg);
     } else if (strcmp(msg->type, "get_match") == 0) {
@@ -1746,8 +2666,20 @@ void dispatch_handler(server_t* server, client_t* client, message_t* msg) {
         handle_join_match(server, client, msg);
     } else if (strcmp(msg->type, "leaderboard") == 0) {
         handle_leaderboard(server, client, msg);
+    } else if (strcmp(msg->type, "get_hint") == 0) {
+        handle_get_hint(server, client, msg);
+    } else if (strcmp(msg->type, "probe_tablebase") == 0) {
+        handle_probe_tablebase(server, client, msg);
+    } else if (strcmp(msg->type, "opening_explorer") == 0) {
+        handle_opening_explorer(server, client, msg);
+    } else if (strcmp(msg->type, "premove") == 0) {
+        handle_premove(server, client, msg);
     } else if (strcmp(msg->type, "heartbeat") == 0) {
         handle_heartbeat(server, client, msg);
+    } else if (strcmp(msg->type, "pong") == 0) {
+        handle_pong(server, client, msg);
+    } else if (strcmp(msg->type, "get_server_stats") == 0) {
+        handle_get_server_stats(server, client, msg);
     } else if (strcmp(msg->type, "chat_message") == 0) {
         handle_chat_message(server, client, msg);
     } else if (strcmp(msg->type, "create_room") == 0) {
@@ -1772,6 +2704,10 @@ void dispatch_handler(server_t* server, client_t* client, message_t* msg) {
         handle_join_spectate(server, client, msg);
     } else if (strcmp(msg->type, "leave_spectate") == 0) {
         handle_leave_spectate(server, client, msg);
+    } else if (strcmp(msg->type, "resync_from") == 0) {
+        handle_resync_from(server, client, msg);
+    } else if (strcmp(msg->type, "fanout_snapshot") == 0) {
+        handle_fanout_snapshot(server, client, msg);
     } else if (strcmp(msg->type, "get_profile") == 0) {
         handle_get_profile(server, client, msg);
     } else if (strcmp(msg->type, "get_timer") == 0) {
@@ -0,0 +1,286 @@
+/*
+ * hashmap.c - Open-addressing hash maps used for in-memory indexes
+ */
+
+#include "hashmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HASHMAP_MIN_CAPACITY 16
+
+// FNV-1a
+uint32_t hash_string(const char* str) {
+    uint32_t h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Fibonacci hashing - spreads sequential ids across the table
+uint32_t hash_int(int key) { return (uint32_t)key * 2654435769u; }
+
+static size_t round_capacity(size_t n) {
+    size_t cap = HASHMAP_MIN_CAPACITY;
+    while (cap < n) cap <<= 1;
+    return cap;
+}
+
+// =========================
+// int_map
+// =========================
+
+static bool int_map_alloc(int_map_t* map, size_t capacity) {
+    map->keys = calloc(capacity, sizeof(int));
+    map->values = calloc(capacity, sizeof(int));
+    map->used = calloc(capacity, sizeof(bool));
+    if (!map->keys || !map->values || !map->used) {
+        free(map->keys);
+        free(map->values);
+        free(map->used);
+        return false;
+    }
+    map->capacity = capacity;
+    map->count = 0;
+    return true;
+}
+
+bool int_map_init(int_map_t* map, size_t initial_capacity) {
+    return int_map_alloc(map, round_capacity(initial_capacity));
+}
+
+void int_map_free(int_map_t* map) {
+    free(map->keys);
+    free(map->values);
+    free(map->used);
+    memset(map, 0, sizeof(*map));
+}
+
+void int_map_clear(int_map_t* map) {
+    memset(map->used, 0, map->capacity * sizeof(bool));
+    map->count = 0;
+}
+
+static bool int_map_grow(int_map_t* map) {
+    int_map_t bigger;
+    if (!int_map_alloc(&bigger, map->capacity * 2)) return false;
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->used[i]) int_map_put(&bigger, map->keys[i], map->values[i]);
+    }
+
+    int_map_free(map);
+    *map = bigger;
+    return true;
+}
+
+bool int_map_put(int_map_t* map, int key, int value) {
+    // Keep load factor <= 0.5 so probe chains stay short
+    if ((map->count + 1) * 2 > map->capacity && !int_map_grow(map)) {
+        return false;
+    }
+
+    size_t mask = map->capacity - 1;
+    size_t i = hash_int(key) & mask;
+    while (map->used[i]) {
+        if (map->keys[i] == key) {
+            map->values[i] = value;
+            return true;
+        }
+        i = (i + 1) & mask;
+    }
+
+    map->used[i] = true;
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->count++;
+    return true;
+}
+
+bool int_map_get(const int_map_t* map, int key, int* out_value) {
+    if (map->capacity == 0) return false;
+
+    size_t mask = map->capacity - 1;
+    size_t i = hash_int(key) & mask;
+    while (map->used[i]) {
+        if (map->keys[i] == key) {
+            if (out_value) *out_value = map->values[i];
+            return true;
+        }
+        i = (i + 1) & mask;
+    }
+    return false;
+}
+
+bool int_map_remove(int_map_t* map, int key) {
+    if (map->capacity == 0) return false;
+
+    size_t mask = map->capacity - 1;
+    size_t i = hash_int(key) & mask;
+    while (map->used[i] && map->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    if (!map->used[i]) return false;
+
+    // Backward-shift deletion: pull later entries of the cluster into the hole
+    size_t hole = i;
+    size_t j = (i + 1) & mask;
+    while (map->used[j]) {
+        size_t home = hash_int(map->keys[j]) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            map->keys[hole] = map->keys[j];
+            map->values[hole] = map->values[j];
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+    map->used[hole] = false;
+    map->count--;
+    return true;
+}
+
+// =========================
+// str_map
+// =========================
+
+static bool str_map_alloc(str_map_t* map, size_t capacity) {
+    map->keys = calloc(capacity, sizeof(char*));
+    map->hashes = calloc(capacity, sizeof(uint32_t));
+    map->values = calloc(capacity, sizeof(int));
+    if (!map->keys || !map->hashes || !map->values) {
+        free(map->keys);
+        free(map->hashes);
+        free(map->values);
+        return false;
+    }
+    map->capacity = capacity;
+    map->count = 0;
+    return true;
+}
+
+bool str_map_init(str_map_t* map, size_t initial_capacity) {
+    return str_map_alloc(map, round_capacity(initial_capacity));
+}
+
+void str_map_clear(str_map_t* map) {
+    for (size_t i = 0; i < map->capacity; i++) {
+        free(map->keys[i]);
+        map->keys[i] = NULL;
+    }
+    map->count = 0;
+}
+
+void str_map_free(str_map_t* map) {
+    if (map->keys) str_map_clear(map);
+    free(map->keys);
+    free(map->hashes);
+    free(map->values);
+    memset(map, 0, sizeof(*map));
+}
+
+// Insert an already-owned key without copying (used while rehashing)
+static void str_map_insert_owned(str_map_t* map, char* key, uint32_t hash,
+                                 int value) {
+    size_t mask = map->capacity - 1;
+    size_t i = hash & mask;
+    while (map->keys[i]) i = (i + 1) & mask;
+    map->keys[i] = key;
+    map->hashes[i] = hash;
+    map->values[i] = value;
+    map->count++;
+}
+
+static bool str_map_grow(str_map_t* map) {
+    str_map_t bigger;
+    if (!str_map_alloc(&bigger, map->capacity * 2)) return false;
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->keys[i]) {
+            str_map_insert_owned(&bigger, map->keys[i], map->hashes[i],
+                                 map->values[i]);
+        }
+    }
+
+    free(map->keys);
+    free(map->hashes);
+    free(map->values);
+    *map = bigger;
+    return true;
+}
+
+bool str_map_put(str_map_t* map, const char* key, int value) {
+    if (!key) return false;
+    if ((map->count + 1) * 2 > map->capacity && !str_map_grow(map)) {
+        return false;
+    }
+
+    uint32_t hash = hash_string(key);
+    size_t mask = map->capacity - 1;
+    size_t i = hash & mask;
+    while (map->keys[i]) {
+        if (map->hashes[i] == hash && strcmp(map->keys[i], key) == 0) {
+            map->values[i] = value;
+            return true;
+        }
+        i = (i + 1) & mask;
+    }
+
+    char* copy = strdup(key);
+    if (!copy) return false;
+
+    map->keys[i] = copy;
+    map->hashes[i] = hash;
+    map->values[i] = value;
+    map->count++;
+    return true;
+}
+
+static bool str_map_find(const str_map_t* map, const char* key,
+                         size_t* out_index) {
+    if (!key || map->capacity == 0) return false;
+
+    uint32_t hash = hash_string(key);
+    size_t mask = map->capacity - 1;
+    size_t i = hash & mask;
+    while (map->keys[i]) {
+        if (map->hashes[i] == hash && strcmp(map->keys[i], key) == 0) {
+            *out_index = i;
+            return true;
+        }
+        i = (i + 1) & mask;
+    }
+    return false;
+}
+
+bool str_map_get(const str_map_t* map, const char* key, int* out_value) {
+    size_t i;
+    if (!str_map_find(map, key, &i)) return false;
+    if (out_value) *out_value = map->values[i];
+    return true;
+}
+
+bool str_map_remove(str_map_t* map, const char* key) {
+    size_t i;
+    if (!str_map_find(map, key, &i)) return false;
+
+    free(map->keys[i]);
+
+    size_t mask = map->capacity - 1;
+    size_t hole = i;
+    size_t j = (i + 1) & mask;
+    while (map->keys[j]) {
+        size_t home = map->hashes[j] & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            map->keys[hole] = map->keys[j];
+            map->hashes[hole] = map->hashes[j];
+            map->values[hole] = map->values[j];
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+    map->keys[hole] = NULL;
+    map->count--;
+    return true;
+}
@@ -0,0 +1,269 @@
+/*
+ * livelist.c - Live match directory and cached listing pages
+ */
+
+#include "../include/livelist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/clock.h"
+#include "../include/pubsub.h"
+
+typedef struct {
+    int handle;
+    const match_t* match;  // Valid while listed: removed before it can be freed
+    int red_rating;
+    int black_rating;
+} live_entry_t;
+
+typedef struct {
+    bool used;
+    live_query_t query;
+    uint32_t version;  // Directory version the page was built at
+    frame_t* page;
+    uint64_t last_used;
+} live_cache_t;
+
+// Active matches, ascending by handle (= creation order)
+static live_entry_t entries[MAX_MATCHES];
+static int entry_count = 0;
+
+static live_cache_t cache[LIVE_CACHE_ENTRIES];
+static uint64_t cache_clock = 0;
+
+static live_rating_fn rating_fn = NULL;
+static uint32_t version = 1;
+static bool soft_dirty = false;  // Counts changed since the last version bump
+static int64_t published_ms = 0;
+static uint64_t published_membership = 0;  // pubsub_membership_changes() then
+static uint64_t rebuild_count = 0;
+
+bool live_init(live_rating_fn rating) {
+    rating_fn = rating;
+    entry_count = 0;
+    memset(cache, 0, sizeof(cache));
+    cache_clock = 0;
+    version = 1;
+    soft_dirty = false;
+    published_ms = clock_now_ms();
+    published_membership = pubsub_membership_changes();
+    rebuild_count = 0;
+    return true;
+}
+
+void live_shutdown(void) {
+    for (int i = 0; i < LIVE_CACHE_ENTRIES; i++) {
+        frame_unref(cache[i].page);
+        cache[i].page = NULL;
+        cache[i].used = false;
+    }
+    entry_count = 0;
+}
+
+static void live_bump(void) {
+    version++;
+    soft_dirty = false;
+    published_ms = clock_now_ms();
+    published_membership = pubsub_membership_changes();
+}
+
+// Publish pending move/spectator count changes, at most every LIVE_REFRESH_MS
+static void live_refresh(void) {
+    if (pubsub_membership_changes() != published_membership) soft_dirty = true;
+    if (soft_dirty && clock_now_ms() - published_ms >= LIVE_REFRESH_MS) {
+        live_bump();
+    }
+}
+
+// First entry with handle >= the given one
+static int live_lower_bound(int handle) {
+    int lo = 0, hi = entry_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (entries[mid].handle < handle) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void live_add(const match_t* match) {
+    if (!match || entry_count >= MAX_MATCHES) return;
+
+    // Handles only grow, so this is an append in practice
+    int pos = live_lower_bound(match->handle);
+    if (pos < entry_count && entries[pos].handle == match->handle) return;
+    memmove(&entries[pos + 1], &entries[pos], (entry_count - pos) * sizeof(entries[0]));
+
+    live_entry_t* entry = &entries[pos];
+    entry->handle = match->handle;
+    entry->match = match;
+    entry->red_rating = rating_fn ? rating_fn(match->red_user_id) : 0;
+    entry->black_rating = rating_fn ? rating_fn(match->black_user_id) : 0;
+    entry_count++;
+    live_bump();
+}
+
+void live_remove(const match_t* match) {
+    if (!match) return;
+
+    int pos = live_lower_bound(match->handle);
+    if (pos >= entry_count || entries[pos].handle != match->handle) return;
+    memmove(&entries[pos], &entries[pos + 1], (entry_count - pos - 1) * sizeof(entries[0]));
+    entry_count--;
+    live_bump();
+}
+
+void live_touch(void) { soft_dirty = true; }
+
+const char* live_speed(const time_control_t* tc) {
+    if (!tc) return "classical";
+    int64_t estimate_ms = (int64_t)tc->base_ms + 40LL * tc->increment_ms;
+    if (estimate_ms < 3 * 60000) return "bullet";
+    if (estimate_ms < 8 * 60000) return "blitz";
+    if (estimate_ms < 25 * 60000) return "rapid";
+    return "classical";
+}
+
+bool live_speed_valid(const char* speed) {
+    return speed && (speed[0] == '\0' || strcmp(speed, "bullet") == 0 ||
+                     strcmp(speed, "blitz") == 0 || strcmp(speed, "rapid") == 0 ||
+                     strcmp(speed, "classical") == 0);
+}
+
+uint32_t live_version(void) {
+    live_refresh();
+    return version;
+}
+
+// Mean of the known ratings, 0 if neither is known
+static int live_entry_rating(const live_entry_t* entry) {
+    int sum = 0, known = 0;
+    if (entry->red_rating > 0) sum += entry->red_rating, known++;
+    if (entry->black_rating > 0) sum += entry->black_rating, known++;
+    return known ? sum / known : 0;
+}
+
+static bool live_entry_matches(const live_entry_t* entry, const live_query_t* query,
+                               int spectators) {
+    if (query->min_rating > 0 || query->max_rating > 0) {
+        int rating = live_entry_rating(entry);
+        if (rating <= 0) return false;
+        if (query->min_rating > 0 && rating < query->min_rating) return false;
+        if (query->max_rating > 0 && rating > query->max_rating) return false;
+    }
+    if (query->speed[0] &&
+        strcmp(live_speed(&entry->match->time_control), query->speed) != 0) {
+        return false;
+    }
+    return spectators >= query->min_spectators;
+}
+
+static frame_t* live_build_page(const live_query_t* query) {
+    size_t cap = 160 + (size_t)query->limit * 480;
+    char* json = malloc(cap);
+    if (!json) return NULL;
+
+    size_t len = snprintf(json, cap, "{\"version\":%u,\"matches\":[", version);
+    int total = 0, emitted = 0, last_handle = 0;
+    bool more = false;
+
+    // Newest first
+    for (int i = entry_count - 1; i >= 0; i--) {
+        const live_entry_t* entry = &entries[i];
+        const match_t* m = entry->match;
+        int spectators = pubsub_subscriber_count(m->match_id);
+        if (!live_entry_matches(entry, query, spectators)) continue;
+
+        total++;
+        if (query->cursor > 0 && entry->handle >= query->cursor) continue;
+        if (emitted == query->limit) {
+            more = true;
+            continue;
+        }
+
+        len += snprintf(json + len, cap - len,
+                        "%s{\"match_id\":\"%s\",\"red_user_id\":%d,\"black_user_id\":%d,"
+                        "\"red_rating\":%d,\"black_rating\":%d,\"move_count\":%d,"
+                        "\"spectator_count\":%d,\"current_turn\":\"%s\",\"speed\":\"%s\","
+                        "\"time_control\":{\"base_ms\":%d,\"increment_ms\":%d},"
+                        "\"started_at\":%ld}",
+                        emitted > 0 ? "," : "", m->match_id, m->red_user_id,
+                        m->black_user_id, entry->red_rating, entry->black_rating,
+                        m->move_count, spectators, m->current_turn,
+                        live_speed(&m->time_control), m->time_control.base_ms,
+                        m->time_control.increment_ms, (long)m->started_at);
+        emitted++;
+        last_handle = entry->handle;
+    }
+
+    // The trailing '}' closes the response envelope
+    if (more) {
+        len += snprintf(json + len, cap - len, "],\"total\":%d,\"next_cursor\":%d}}\n",
+                        total, last_handle);
+    } else {
+        len += snprintf(json + len, cap - len, "],\"total\":%d,\"next_cursor\":null}}\n",
+                        total);
+    }
+
+    frame_t* page = len < cap ? frame_create_raw(json, len) : NULL;
+    free(json);
+    rebuild_count++;
+    return page;
+}
+
+static bool live_query_equal(const live_query_t* a, const live_query_t* b) {
+    return a->min_rating == b->min_rating && a->max_rating == b->max_rating &&
+           a->min_spectators == b->min_spectators && a->cursor == b->cursor &&
+           a->limit == b->limit && strcmp(a->speed, b->speed) == 0;
+}
+
+frame_t* live_get_page(const live_query_t* query) {
+    if (!query || !live_speed_valid(query->speed)) return NULL;
+
+    live_query_t normalized = *query;
+    if (normalized.limit <= 0) normalized.limit = LIVE_PAGE_DEFAULT;
+    if (normalized.limit > LIVE_PAGE_MAX) normalized.limit = LIVE_PAGE_MAX;
+    if (normalized.cursor < 0) normalized.cursor = 0;
+
+    live_refresh();
+
+    // Same query: reuse its page if nothing changed, else rebuild in place.
+    // New query: take a free entry or the least recently used one.
+    live_cache_t* entry = NULL;
+    live_cache_t* victim = &cache[0];
+    for (int i = 0; i < LIVE_CACHE_ENTRIES && !entry; i++) {
+        live_cache_t* c = &cache[i];
+        if (c->used && live_query_equal(&c->query, &normalized)) {
+            entry = c;
+        } else if (!c->used) {
+            if (victim->used) victim = c;
+        } else if (victim->used && c->last_used < victim->last_used) {
+            victim = c;
+        }
+    }
+
+    if (entry && entry->version == version) {
+        entry->last_used = ++cache_clock;
+        frame_ref(entry->page);
+        return entry->page;
+    }
+    if (!entry) entry = victim;
+
+    frame_t* page = live_build_page(&normalized);
+    if (!page) return NULL;
+
+    frame_unref(entry->page);
+    entry->used = true;
+    entry->query = normalized;
+    entry->version = version;
+    entry->page = page;
+    entry->last_used = ++cache_clock;
+    frame_ref(page);
+    return page;
+}
+
+int live_count(void) { return entry_count; }
+
+uint64_t live_rebuild_count(void) { return rebuild_count; }
@@ -10,26 +10,153 @@
 #include <string.h>
 #include <time.h>
 
-#include "db.h"
+#include "hashmap.h"
+#include "matchmaking.h"
 
 static lobby_player_t ready_players[MAX_READY_PLAYERS];
 static int ready_count = 0;
 
-static room_t rooms[MAX_ROOMS];
-static challenge_t challenges[MAX_CHALLENGES];
+// Presence: users whose ready state or rating changed since the last
+// announcement, and what was last announced (user_id -> rating)
+static int presence_dirty[MAX_READY_PLAYERS * 2 + 1];
+static int presence_dirty_count = 0;
+static int_map_t presence_dirty_index;
+static int_map_t presence_published;
+static uint32_t presence_seq = 0;
+static int64_t presence_last_flush_ms = 0;
+
+// Rooms: packed array, code -> index
+static room_t* rooms = NULL;
+static int room_count = 0;
+static int room_capacity = 0;
+static str_map_t room_index;
+static int_map_t host_rooms;             // host_user_id -> room slot
+static uint32_t room_serial = 0;
+
+// Rooms all live LOBBY_ROOM_TTL_MS, so creation order is deadline order:
+// a doubly linked list through the slots, oldest first
+typedef struct {
+    int prev;
+    int next;
+} room_link_t;
+
+static room_link_t* room_links = NULL;
+static int room_expiry_head = -1;
+static int room_expiry_tail = -1;
+
+// Per-user lists link challenges by slot; slots are reused through a free
+// list, so a slot number stays put while the challenge is pending
+enum { CH_INCOMING, CH_OUTGOING, CH_EXPIRY, CH_LIST_COUNT };
+
+typedef struct {
+    int prev;
+    int next;
+} challenge_link_t;
+
+typedef struct {
+    challenge_t challenge;
+    challenge_link_t links[CH_LIST_COUNT];
+} challenge_slot_t;
+
+static challenge_slot_t* challenge_slots = NULL;
+static int challenge_slot_count = 0;     // Slots ever handed out
+static int challenge_slot_capacity = 0;
+static int challenge_free_head = -1;     // Chained through links[CH_EXPIRY].next
+static int challenge_count = 0;
+static str_map_t challenge_index;        // challenge_id -> slot
+static int_map_t incoming_heads;         // user_id -> first slot
+static int_map_t outgoing_heads;
+static int expiry_head = -1;             // Oldest pending
+static int expiry_tail = -1;
+static uint32_t challenge_serial = 0;
 
 // Initialize lobby
 bool lobby_init(void) {
     memset(ready_players, 0, sizeof(ready_players));
-    memset(rooms, 0, sizeof(rooms));
-    memset(challenges, 0, sizeof(challenges));
     ready_count = 0;
+    presence_dirty_count = 0;
+    presence_seq = 0;
+    presence_last_flush_ms = 0;
+    if (!int_map_init(&presence_dirty_index, MAX_READY_PLAYERS * 4) ||
+        !int_map_init(&presence_published, MAX_READY_PLAYERS * 2)) {
+        fprintf(stderr, "Failed to allocate lobby presence maps\n");
+        return false;
+    }
+    if (!str_map_init(&room_index, 128) || !int_map_init(&host_rooms, 128) ||
+        !str_map_init(&challenge_index, 256) ||
+        !int_map_init(&incoming_heads, 256) || !int_map_init(&outgoing_heads, 256)) {
+        fprintf(stderr, "Failed to allocate lobby room/challenge indexes\n");
+        return false;
+    }
+    // Codes and ids differ across restarts
+    room_serial = (uint32_t)rand();
+    challenge_serial = (uint32_t)rand();
     printf("Lobby initialized\n");
     return true;
 }
 
 // Shutdown lobby
-void lobby_shutdown(void) { ready_count = 0; }
+void lobby_shutdown(void) {
+    ready_count = 0;
+    presence_dirty_count = 0;
+    int_map_free(&presence_dirty_index);
+    int_map_free(&presence_published);
+
+    free(rooms);
+    free(room_links);
+    rooms = NULL;
+    room_links = NULL;
+    room_count = room_capacity = 0;
+    room_expiry_head = room_expiry_tail = -1;
+    str_map_free(&room_index);
+    int_map_free(&host_rooms);
+
+    free(challenge_slots);
+    challenge_slots = NULL;
+    challenge_slot_count = challenge_slot_capacity = challenge_count = 0;
+    challenge_free_head = expiry_head = expiry_tail = -1;
+    str_map_free(&challenge_index);
+    int_map_free(&incoming_heads);
+    int_map_free(&outgoing_heads);
+}
+
+static lobby_player_t* lobby_find_ready(int user_id) {
+    for (int i = 0; i < ready_count; i++) {
+        if (ready_players[i].user_id == user_id) return &ready_players[i];
+    }
+    return NULL;
+}
+
+// Drop dirty marks that can no longer produce an event (joined and left
+// again before being announced)
+static void presence_compact(void) {
+    int kept = 0;
+    for (int i = 0; i < presence_dirty_count; i++) {
+        int user_id = presence_dirty[i];
+        int rating;
+        if (lobby_find_ready(user_id) ||
+            int_map_get(&presence_published, user_id, &rating)) {
+            presence_dirty[kept++] = user_id;
+        } else {
+            int_map_remove(&presence_dirty_index, user_id);
+        }
+    }
+    presence_dirty_count = kept;
+}
+
+// Record that a user's presence changed; announced with the next tick
+static void presence_mark(int user_id) {
+    int flag;
+    if (int_map_get(&presence_dirty_index, user_id, &flag)) return;
+
+    // Only ready or announced users are relevant, and there are at most
+    // MAX_READY_PLAYERS of each, so compaction always makes room
+    if (presence_dirty_count == (int)(sizeof(presence_dirty) / sizeof(presence_dirty[0]))) {
+        presence_compact();
+    }
+    presence_dirty[presence_dirty_count++] = user_id;
+    int_map_put(&presence_dirty_index, user_id, 1);
+}
 
 // Set ready status
 void lobby_set_ready(int user_id, const char* username, int rating,
@@ -39,6 +166,7 @@ void lobby_set_ready(int user_id, const char* username, int rating,
         for (int i = 0; i < ready_count; i++) {
             if (ready_players[i].user_id == user_id) {
                 // Already in ready list, update timestamp/rating
+                if (ready_players[i].rating != rating) presence_mark(user_id);
                 ready_players[i].rating = rating;
                 ready_players[i].ready_since = time(NULL);
                 printf("[Lobby] Updated ready player: %s (ID: %d)\n", username, user_id);
@@ -53,6 +181,7 @@ void lobby_set_ready(int user_id, const char* username, int rating,
             ready_players[ready_count].ready = true;
             ready_players[ready_count].ready_since = time(NULL);
             ready_count++;
+            presence_mark(user_id);
             printf("[Lobby] Added ready player: %s (ID: %d). Ready count=%d\n", username, user_id, ready_count);
         } else {
             printf("[Lobby] Ready list full, cannot add: %s (ID: %d)\n", username, user_id);
@@ -65,6 +194,7 @@ void lobby_set_ready(int user_id, const char* username, int rating,
 
 // Remove player from lobby
 void lobby_remove_player(int user_id) {
+    mm_remove(user_id);
     for (int i = 0; i < ready_count; i++) {
         if (ready_players[i].user_id == user_id) {
             // Shift remaining players
@@ -72,285 +202,552 @@ void lobby_remove_player(int user_id) {
                 ready_players[j] = ready_players[j + 1];
             }
             ready_count--;
+            presence_mark(user_id);
             break;
         }
     }
 }
 
-// Get ready list as JSON
-char* lobby_get_ready_list_json(void) {
-    char* json = malloc(8192);
-    if (!json) return NULL;
+int64_t lobby_presence_ms_until_due(int64_t now_ms) {
+    if (presence_dirty_count == 0) return -1;
+    int64_t due_ms = presence_last_flush_ms + LOBBY_PRESENCE_TICK_MS;
+    return due_ms > now_ms ? due_ms - now_ms : 0;
+}
 
-    char* ptr = json;
-    ptr += sprintf(ptr, "[");
+char* lobby_take_presence_event(int64_t now_ms) {
+    if (presence_dirty_count == 0) return NULL;
+    presence_last_flush_ms = now_ms;
+
+    // One pass sorts every dirty user into at most one of the three lists
+    size_t cap = 256 + (size_t)presence_dirty_count * 128;
+    char* joined = malloc(cap);
+    char* left = malloc(cap);
+    char* rated = malloc(cap);
+    char* json = malloc(cap * 3);
+    if (!joined || !left || !rated || !json) {
+        free(joined);
+        free(left);
+        free(rated);
+        free(json);
+        return NULL;
+    }
 
-    for (int i = 0; i < ready_count; i++) {
-        if (i > 0) ptr += sprintf(ptr, ",");
-        ptr +=
-            sprintf(ptr, "{\"user_id\":%d,\"username\":\"%s\",\"rating\":%d}",
-                    ready_players[i].user_id, ready_players[i].username,
-                    ready_players[i].rating);
+    size_t joined_len = 0, left_len = 0, rated_len = 0;
+    joined[0] = left[0] = rated[0] = '\0';
+    int changes = 0;
+
+    for (int i = 0; i < presence_dirty_count; i++) {
+        int user_id = presence_dirty[i];
+        const lobby_player_t* player = lobby_find_ready(user_id);
+        int published_rating;
+        bool published = int_map_get(&presence_published, user_id, &published_rating);
+
+        if (player && !published) {
+            joined_len += snprintf(joined + joined_len, cap - joined_len,
+                                   "%s{\"user_id\":%d,\"username\":\"%s\",\"rating\":%d}",
+                                   joined_len ? "," : "", user_id, player->username,
+                                   player->rating);
+            int_map_put(&presence_published, user_id, player->rating);
+            changes++;
+        } else if (!player && published) {
+            left_len += snprintf(left + left_len, cap - left_len, "%s%d",
+                                 left_len ? "," : "", user_id);
+            int_map_remove(&presence_published, user_id);
+            changes++;
+        } else if (player && player->rating != published_rating) {
+            rated_len += snprintf(rated + rated_len, cap - rated_len,
+                                  "%s{\"user_id\":%d,\"rating\":%d}",
+                                  rated_len ? "," : "", user_id, player->rating);
+            int_map_put(&presence_published, user_id, player->rating);
+            changes++;
+        }
+        int_map_remove(&presence_dirty_index, user_id);
     }
+    presence_dirty_count = 0;
 
-    sprintf(ptr, "]");
+    if (changes > 0) {
+        snprintf(json, cap * 3,
+                 "{\"type\":\"lobby_presence\",\"payload\":{\"seq\":%u,"
+                 "\"joined\":[%s],\"left\":[%s],\"rating\":[%s]}}",
+                 ++presence_seq, joined, left, rated);
+    }
+    free(joined);
+    free(left);
+    free(rated);
+    if (changes == 0) {
+        free(json);
+        return NULL;
+    }
     return json;
 }
 
-// Find random match
-bool lobby_find_random_match(int user_id, int* out_opponent_id) {
-    // Find another ready player (not self)
+char* lobby_get_presence_snapshot_json(void) {
+    size_t cap = 64 + (size_t)ready_count * 128;
+    char* json = malloc(cap);
+    if (!json) return NULL;
+
+    size_t len = snprintf(json, cap, "{\"seq\":%u,\"players\":[", presence_seq);
     for (int i = 0; i < ready_count; i++) {
-        if (ready_players[i].user_id != user_id) {
-            *out_opponent_id = ready_players[i].user_id;
-            // Remove both from ready list
-            lobby_remove_player(user_id);
-            lobby_remove_player(*out_opponent_id);
-            return true;
-        }
+        len += snprintf(json + len, cap - len,
+                        "%s{\"user_id\":%d,\"username\":\"%s\",\"rating\":%d}",
+                        i > 0 ? "," : "", ready_players[i].user_id,
+                        ready_players[i].username, ready_players[i].rating);
     }
-    return false;
+    snprintf(json + len, cap - len, "]}");
+    return json;
 }
 
-// Find rated match (with rating tolerance)
-bool lobby_find_rated_match(int user_id, int rating, int tolerance,
-                            int* out_opponent_id) {
-    int best_opponent = -1;
-    int best_diff = tolerance + 1;
+// Invertible 32-bit mix (lowbias32): distinct counters give distinct codes
+static uint32_t scramble(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
 
-    for (int i = 0; i < ready_count; i++) {
-        if (ready_players[i].user_id != user_id) {
-            int diff = abs(ready_players[i].rating - rating);
-            if (diff <= tolerance && diff < best_diff) {
-                best_diff = diff;
-                best_opponent = ready_players[i].user_id;
-            }
-        }
+// =========================
+// Rooms
+// =========================
+
+static int room_slot(const char* room_code) {
+    int i;
+    if (!room_code || !str_map_get(&room_index, room_code, &i)) return -1;
+    return i;
+}
+
+// Point a slot's expiry neighbours (or the list ends) at it
+static void room_relink(int i) {
+    if (room_links[i].prev >= 0) {
+        room_links[room_links[i].prev].next = i;
+    } else {
+        room_expiry_head = i;
+    }
+    if (room_links[i].next >= 0) {
+        room_links[room_links[i].next].prev = i;
+    } else {
+        room_expiry_tail = i;
     }
+}
 
-    if (best_opponent != -1) {
-        *out_opponent_id = best_opponent;
-        lobby_remove_player(user_id);
-        lobby_remove_player(best_opponent);
-        return true;
+// Remove a room; the last room moves into its slot
+static void room_remove(int i) {
+    str_map_remove(&room_index, rooms[i].room_code);
+    int_map_remove(&host_rooms, rooms[i].host_user_id);
+
+    int prev = room_links[i].prev, next = room_links[i].next;
+    if (prev >= 0) {
+        room_links[prev].next = next;
+    } else {
+        room_expiry_head = next;
+    }
+    if (next >= 0) {
+        room_links[next].prev = prev;
+    } else {
+        room_expiry_tail = prev;
     }
 
-    return false;
+    int last = --room_count;
+    if (i != last) {
+        rooms[i] = rooms[last];
+        room_links[i] = room_links[last];
+        room_relink(i);
+        str_map_put(&room_index, rooms[i].room_code, i);
+        int_map_put(&host_rooms, rooms[i].host_user_id, i);
+    }
 }
 
 // Create room
 char* lobby_create_room(int host_user_id, const char* room_name,
-                        const char* password, bool rated) {
+                        const char* password, bool rated,
+                        const time_control_t* time_control) {
     (void)room_name;  // Reserved for future use
-    
-    // Find empty slot
-    for (int i = 0; i < MAX_ROOMS; i++) {
-        if (!rooms[i].occupied) {
-            sprintf(rooms[i].room_id, "room_%d_%ld", i, time(NULL));
-            sprintf(rooms[i].room_code, "%04X%04X", rand() % 0xFFFF,
-                    rand() % 0xFFFF);
-            rooms[i].host_user_id = host_user_id;
-            if (password) strncpy(rooms[i].password, password, 63);
-            rooms[i].rated = rated;
-            rooms[i].occupied = true;
-            rooms[i].created_at = time(NULL);
-
-            return strdup(rooms[i].room_code);
-        }
+
+    // One room per host: the new one replaces it
+    int old;
+    if (int_map_get(&host_rooms, host_user_id, &old)) room_remove(old);
+
+    if (room_count == room_capacity) {
+        int capacity = room_capacity ? room_capacity * 2 : 64;
+        room_t* grown = realloc(rooms, (size_t)capacity * sizeof(*rooms));
+        if (!grown) return NULL;
+        rooms = grown;
+        room_link_t* grown_links = realloc(room_links, (size_t)capacity * sizeof(*room_links));
+        if (!grown_links) return NULL;
+        room_links = grown_links;
+        room_capacity = capacity;
     }
-    return NULL;
-}
 
-// Cleanup expired challenges
-void lobby_cleanup_expired_challenges(void) {
-    time_t now = time(NULL);
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (challenges[i].challenge_id[0] != '\0' &&
-            now > challenges[i].expires_at) {
-            memset(&challenges[i], 0, sizeof(challenge_t));
-        }
+    int i = room_count;
+    room_t* room = &rooms[i];
+    memset(room, 0, sizeof(*room));
+    uint32_t serial = ++room_serial;
+    snprintf(room->room_id, sizeof(room->room_id), "room_%u", serial);
+    snprintf(room->room_code, sizeof(room->room_code), "%08X", scramble(serial));
+    if (!str_map_put(&room_index, room->room_code, i)) return NULL;
+    if (!int_map_put(&host_rooms, host_user_id, i)) {
+        str_map_remove(&room_index, room->room_code);
+        return NULL;
     }
+
+    room->host_user_id = host_user_id;
+    if (password) snprintf(room->password, sizeof(room->password), "%s", password);
+    room->rated = rated;
+    room->time_control =
+        time_control ? *time_control : time_control_make(DEFAULT_BASE_TIME_MS, 0, 0, 0);
+    room->created_at = time(NULL);
+    room->expires_ms = clock_now_ms() + LOBBY_ROOM_TTL_MS;
+    room_count++;
+
+    // Newest deadline: append
+    room_links[i].prev = room_expiry_tail;
+    room_links[i].next = -1;
+    room_relink(i);
+
+    return strdup(room->room_code);
 }
 
 // Join room
 bool lobby_join_room(const char* room_code, const char* password, int user_id,
                      int* out_host_id) {
-    for (int i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].occupied && strcmp(rooms[i].room_code, room_code) == 0) {
-            // Check password
-            if (rooms[i].password[0] != '\0') {
-                if (!password || strcmp(rooms[i].password, password) != 0) {
-                    return false;  // Wrong password
-                }
-            }
-
-            // Check if room is full
-            if (rooms[i].guest_user_id != 0) {
-                return false;  // Room full
-            }
+    int i = room_slot(room_code);
+    if (i < 0) return false;  // Room not found
 
-            // Join room
-            rooms[i].guest_user_id = user_id;
-            if (out_host_id) {
-                *out_host_id = rooms[i].host_user_id;
-            }
-            return true;
+    // Check password
+    if (rooms[i].password[0] != '\0') {
+        if (!password || strcmp(rooms[i].password, password) != 0) {
+            return false;  // Wrong password
         }
     }
-    return false;  // Room not found
+
+    // Check if room is full
+    if (rooms[i].guest_user_id != 0) {
+        return false;  // Room full
+    }
+
+    // Join room
+    rooms[i].guest_user_id = user_id;
+    if (out_host_id) {
+        *out_host_id = rooms[i].host_user_id;
+    }
+    return true;
 }
 
 // Close room
 bool lobby_close_room(const char* room_code, int user_id) {
-    for (int i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].occupied && strcmp(rooms[i].room_code, room_code) == 0) {
-            // Only host can close
-            if (rooms[i].host_user_id != user_id) {
-                return false;
-            }
-
-            // Clear room
-            memset(&rooms[i], 0, sizeof(room_t));
-            return true;
-        }
-    }
-    return false;
+    int i = room_slot(room_code);
+    // Only host can close
+    if (i < 0 || rooms[i].host_user_id != user_id) return false;
+    room_remove(i);
+    return true;
 }
 
 // Get room by code
 room_t* lobby_get_room(const char* room_code) {
-    for (int i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].occupied && strcmp(rooms[i].room_code, room_code) == 0) {
-            return &rooms[i];
-        }
+    int i = room_slot(room_code);
+    return i >= 0 ? &rooms[i] : NULL;
+}
+
+int lobby_room_count(void) { return room_count; }
+
+int64_t lobby_room_ms_until_expiry(int64_t now_ms) {
+    if (room_expiry_head < 0) return -1;
+    int64_t left = rooms[room_expiry_head].expires_ms - now_ms;
+    return left > 0 ? left : 0;
+}
+
+int lobby_expire_rooms(int64_t now_ms) {
+    int expired = 0;
+    while (room_expiry_head >= 0 && rooms[room_expiry_head].expires_ms <= now_ms) {
+        room_remove(room_expiry_head);
+        expired++;
     }
-    return NULL;
+    return expired;
 }
 
-// Get all rooms as JSON
+// Get rooms as JSON
 char* lobby_get_rooms_json(void) {
-    char* json = malloc(16384);
+    size_t cap = 64 + (size_t)LOBBY_ROOM_LIST_MAX * 256;
+    char* json = malloc(cap);
     if (!json) return NULL;
 
-    char* ptr = json;
-    ptr += sprintf(ptr, "[");
+    size_t len = snprintf(json, cap, "[");
+    int listed = 0;
+    // Rooms still waiting for a guest, then full ones
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < room_count && listed < LOBBY_ROOM_LIST_MAX; i++) {
+            bool has_guest = rooms[i].guest_user_id != 0;
+            if (has_guest != (pass == 1)) continue;
 
-    int first = 1;
-    for (int i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].occupied) {
-            if (!first) ptr += sprintf(ptr, ",");
-            first = 0;
-            
-            // Get host username from DB
+            // Get host username (profile cache)
             char host_username[64] = "Unknown";
-            db_get_user_by_id(rooms[i].host_user_id, host_username, NULL, NULL, NULL, NULL, NULL);
-            
-            ptr += sprintf(ptr, 
-                "{\"room_code\":\"%s\",\"host_id\":%d,\"host_name\":\"%s\","
-                "\"has_password\":%s,\"rated\":%s,\"has_guest\":%s}",
-                rooms[i].room_code,
-                rooms[i].host_user_id,
-                host_username,
-                rooms[i].password[0] != '\0' ? "true" : "false",
-                rooms[i].rated ? "true" : "false",
-                rooms[i].guest_user_id != 0 ? "true" : "false"
-            );
+            account_lookup(rooms[i].host_user_id, host_username, sizeof(host_username), NULL);
+
+            len += snprintf(json + len, cap - len,
+                            "%s{\"room_code\":\"%s\",\"host_id\":%d,\"host_name\":\"%s\","
+                            "\"has_password\":%s,\"rated\":%s,\"has_guest\":%s}",
+                            listed > 0 ? "," : "", rooms[i].room_code,
+                            rooms[i].host_user_id, host_username,
+                            rooms[i].password[0] != '\0' ? "true" : "false",
+                            rooms[i].rated ? "true" : "false", has_guest ? "true" : "false");
+            listed++;
         }
     }
-
-    sprintf(ptr, "]");
+    snprintf(json + len, cap - len, "]");
     return json;
 }
 
 // Leave room (for guest)
 bool lobby_leave_room(const char* room_code, int user_id) {
-    for (int i = 0; i < MAX_ROOMS; i++) {
-        if (rooms[i].occupied && strcmp(rooms[i].room_code, room_code) == 0) {
-            // If guest is leaving
-            if (rooms[i].guest_user_id == user_id) {
-                rooms[i].guest_user_id = 0;
-                return true;
-            }
-            // If host is leaving, close the room
-            if (rooms[i].host_user_id == user_id) {
-                memset(&rooms[i], 0, sizeof(room_t));
-                return true;
-            }
-            return false;
-        }
+    int i = room_slot(room_code);
+    if (i < 0) return false;
+
+    // If guest is leaving
+    if (rooms[i].guest_user_id == user_id) {
+        rooms[i].guest_user_id = 0;
+        return true;
+    }
+    // If host is leaving, close the room
+    if (rooms[i].host_user_id == user_id) {
+        room_remove(i);
+        return true;
     }
     return false;
 }
 
+// =========================
+// Challenges
+// =========================
+
+static int list_head(int list, int user_id) {
+    int head;
+    const int_map_t* heads = list == CH_INCOMING ? &incoming_heads : &outgoing_heads;
+    return int_map_get(heads, user_id, &head) ? head : -1;
+}
+
+static void list_set_head(int list, int user_id, int head) {
+    if (list == CH_EXPIRY) {
+        expiry_head = head;
+        return;
+    }
+    int_map_t* heads = list == CH_INCOMING ? &incoming_heads : &outgoing_heads;
+    if (head >= 0) int_map_put(heads, user_id, head);
+    else int_map_remove(heads, user_id);
+}
+
+static int list_owner(int list, const challenge_t* ch) {
+    return list == CH_INCOMING ? ch->to_user_id : ch->from_user_id;
+}
+
+// Per-user lists push at the front; the expiry list appends
+static void list_link(int list, int s) {
+    challenge_link_t* link = &challenge_slots[s].links[list];
+    if (list == CH_EXPIRY) {
+        link->prev = expiry_tail;
+        link->next = -1;
+        if (expiry_tail >= 0) challenge_slots[expiry_tail].links[CH_EXPIRY].next = s;
+        else expiry_head = s;
+        expiry_tail = s;
+        return;
+    }
+    int owner = list_owner(list, &challenge_slots[s].challenge);
+    int head = list_head(list, owner);
+    link->prev = -1;
+    link->next = head;
+    if (head >= 0) challenge_slots[head].links[list].prev = s;
+    list_set_head(list, owner, s);
+}
+
+static void list_unlink(int list, int s) {
+    challenge_link_t* link = &challenge_slots[s].links[list];
+    if (link->prev >= 0) {
+        challenge_slots[link->prev].links[list].next = link->next;
+    } else {
+        list_set_head(list, list_owner(list, &challenge_slots[s].challenge), link->next);
+    }
+    if (link->next >= 0) {
+        challenge_slots[link->next].links[list].prev = link->prev;
+    } else if (list == CH_EXPIRY) {
+        expiry_tail = link->prev;
+    }
+}
+
+static void challenge_remove(int s) {
+    str_map_remove(&challenge_index, challenge_slots[s].challenge.challenge_id);
+    for (int list = 0; list < CH_LIST_COUNT; list++) list_unlink(list, s);
+    challenge_slots[s].links[CH_EXPIRY].next = challenge_free_head;
+    challenge_free_head = s;
+    challenge_count--;
+}
+
+static int challenge_alloc(void) {
+    if (challenge_free_head >= 0) {
+        int s = challenge_free_head;
+        challenge_free_head = challenge_slots[s].links[CH_EXPIRY].next;
+        return s;
+    }
+    if (challenge_slot_count == challenge_slot_capacity) {
+        int capacity = challenge_slot_capacity ? challenge_slot_capacity * 2 : 128;
+        challenge_slot_t* grown =
+            realloc(challenge_slots, (size_t)capacity * sizeof(*challenge_slots));
+        if (!grown) return -1;
+        challenge_slots = grown;
+        challenge_slot_capacity = capacity;
+    }
+    return challenge_slot_count++;
+}
+
+static int challenge_slot(const char* challenge_id) {
+    int s;
+    if (!challenge_id || !str_map_get(&challenge_index, challenge_id, &s)) return -1;
+    return s;
+}
+
 // Create challenge
-char* lobby_create_challenge(int from_user_id, int to_user_id, bool rated) {
-    // Find empty slot
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (challenges[i].challenge_id[0] == '\0') {
-            sprintf(challenges[i].challenge_id, "ch_%d_%ld", i, time(NULL));
-            challenges[i].from_user_id = from_user_id;
-            challenges[i].to_user_id = to_user_id;
-            challenges[i].rated = rated;
-            challenges[i].status = 0;  // Pending
-            challenges[i].created_at = time(NULL);
-            challenges[i].expires_at = time(NULL) + 60;  // 60 seconds
-
-            return strdup(challenges[i].challenge_id);
-        }
+char* lobby_create_challenge(int from_user_id, int to_user_id, bool rated,
+                             const time_control_t* time_control,
+                             const char* start_fen) {
+    // One pending challenge per opponent, and a cap per sender
+    int sent = 0;
+    for (int s = list_head(CH_OUTGOING, from_user_id); s >= 0;) {
+        int next = challenge_slots[s].links[CH_OUTGOING].next;
+        if (challenge_slots[s].challenge.to_user_id == to_user_id) challenge_remove(s);
+        else sent++;
+        s = next;
     }
-    return NULL;
+    if (sent >= MAX_OUTGOING_CHALLENGES) return NULL;
+
+    int s = challenge_alloc();
+    if (s < 0) return NULL;
+
+    challenge_t* ch = &challenge_slots[s].challenge;
+    memset(ch, 0, sizeof(*ch));
+    snprintf(ch->challenge_id, sizeof(ch->challenge_id), "ch_%08x",
+             scramble(++challenge_serial));
+    if (!str_map_put(&challenge_index, ch->challenge_id, s)) {
+        challenge_slots[s].links[CH_EXPIRY].next = challenge_free_head;
+        challenge_free_head = s;
+        return NULL;
+    }
+    ch->from_user_id = from_user_id;
+    ch->to_user_id = to_user_id;
+    ch->rated = rated;
+    ch->time_control =
+        time_control ? *time_control : time_control_make(DEFAULT_BASE_TIME_MS, 0, 0, 0);
+    snprintf(ch->start_fen, sizeof(ch->start_fen), "%s", start_fen ? start_fen : "");
+    ch->created_at = time(NULL);
+    ch->expires_ms = clock_now_ms() + CHALLENGE_TTL_MS;
+
+    for (int list = 0; list < CH_LIST_COUNT; list++) list_link(list, s);
+    challenge_count++;
+
+    return strdup(ch->challenge_id);
 }
 
 // Get challenge
 challenge_t* lobby_get_challenge(const char* challenge_id) {
-    for (int i = 0; i < MAX_CHALLENGES; i++) {
-        if (strcmp(challenges[i].challenge_id, challenge_id) == 0) {
-            return &challenges[i];
-        }
-    }
-    return NULL;
+    int s = challenge_slot(challenge_id);
+    return s >= 0 ? &challenge_slots[s].challenge : NULL;
 }
 
 // Accept challenge
-bool lobby_accept_challenge(const char* challenge_id, int user_id) {
-    challenge_t* ch = lobby_get_challenge(challenge_id);
-    if (!ch) {
+bool lobby_accept_challenge(const char* challenge_id, int user_id, challenge_t* out) {
+    int s = challenge_slot(challenge_id);
+    if (s < 0) {
         return false;
     }
+    const challenge_t* ch = &challenge_slots[s].challenge;
 
     // Check if user is the recipient
     if (ch->to_user_id != user_id) {
         return false;
     }
 
-    // Check if expired
-    if (time(NULL) > ch->expires_at) {
+    // Check if expired (not yet swept)
+    if (clock_now_ms() >= ch->expires_ms) {
         return false;
     }
 
-    // Accept
-    ch->status = 1;  // Accepted
+    // Accept: a challenge starts one game at most
+    if (out) *out = *ch;
+    challenge_remove(s);
     return true;
 }
 
 // Decline challenge
 bool lobby_decline_challenge(const char* challenge_id, int user_id) {
-    challenge_t* ch = lobby_get_challenge(challenge_id);
-    if (!ch) {
+    int s = challenge_slot(challenge_id);
+    if (s < 0) {
         return false;
     }
 
     // Check if user is the recipient
-    if (ch->to_user_id != user_id) {
+    if (challenge_slots[s].challenge.to_user_id != user_id) {
         return false;
     }
 
-    // Decline and remove
-    ch->status = 2;  // Declined
-    memset(ch, 0, sizeof(challenge_t));
+    challenge_remove(s);
     return true;
 }
 
+void lobby_cancel_user_challenges(int user_id) {
+    int s;
+    while ((s = list_head(CH_OUTGOING, user_id)) >= 0) challenge_remove(s);
+    while ((s = list_head(CH_INCOMING, user_id)) >= 0) challenge_remove(s);
+}
+
+static size_t append_challenges(char* json, size_t cap, size_t len, int list, int user_id,
+                                int64_t now_ms) {
+    int n = 0;
+    for (int s = list_head(list, user_id); s >= 0 && n < CHALLENGE_LIST_MAX && len < cap;
+         s = challenge_slots[s].links[list].next) {
+        const challenge_t* ch = &challenge_slots[s].challenge;
+        int64_t left = ch->expires_ms - now_ms;
+        len += snprintf(json + len, cap - len,
+                        "%s{\"challenge_id\":\"%s\",\"from_user_id\":%d,\"to_user_id\":%d,"
+                        "\"rated\":%s,\"base_ms\":%d,\"increment_ms\":%d,\"start_fen\":\"%s\","
+                        "\"expires_in_ms\":%lld}",
+                        n++ > 0 ? "," : "", ch->challenge_id, ch->from_user_id,
+                        ch->to_user_id, ch->rated ? "true" : "false", ch->time_control.base_ms,
+                        ch->time_control.increment_ms,
+                        ch->start_fen[0] ? ch->start_fen : XQ_START_FEN,
+                        (long long)(left > 0 ? left : 0));
+    }
+    return len;
+}
+
+char* lobby_get_challenges_json(int user_id) {
+    size_t cap = 64 + (size_t)CHALLENGE_LIST_MAX * 2 * (256 + XQ_FEN_MAX);
+    char* json = malloc(cap);
+    if (!json) return NULL;
+
+    int64_t now_ms = clock_now_ms();
+    size_t len = snprintf(json, cap, "{\"incoming\":[");
+    len = append_challenges(json, cap, len, CH_INCOMING, user_id, now_ms);
+    if (len < cap) len += snprintf(json + len, cap - len, "],\"outgoing\":[");
+    if (len < cap) len = append_challenges(json, cap, len, CH_OUTGOING, user_id, now_ms);
+    if (len < cap) snprintf(json + len, cap - len, "]}");
+    return json;
+}
+
+int64_t lobby_challenge_ms_until_expiry(int64_t now_ms) {
+    if (expiry_head < 0) return -1;
+    int64_t left = challenge_slots[expiry_head].challenge.expires_ms - now_ms;
+    return left > 0 ? left : 0;
+}
+
+int lobby_expire_challenges(int64_t now_ms) {
+    int expired = 0;
+    while (expiry_head >= 0 && challenge_slots[expiry_head].challenge.expires_ms <= now_ms) {
+        challenge_remove(expiry_head);
+        expired++;
+    }
+    return expired;
+}
+
+int lobby_challenge_count(void) { return challenge_count; }
+
 // Get ready users list
 int lobby_get_ready_users(int* user_ids, int max_count) {
     int count = 0;
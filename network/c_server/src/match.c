@@ -10,72 +10,341 @@
 #include <string.h>
 #include <time.h>
 
-static match_t matches[MAX_MATCHES];
-static int match_count = 0;
+#include "hashmap.h"
+#include "livelist.h"
+#include "pubsub.h"
+#include "tablebase.h"
+
+// Slot table: active matches plus the finished-match cache. Each match is
+// heap-allocated and freed when it is evicted, so memory tracks the number of
+// live games rather than the number of games played since startup.
+#define MATCH_SLOT_COUNT (MAX_MATCHES + MAX_FINISHED_MATCHES)
+
+static match_t* slots[MATCH_SLOT_COUNT];
+static int free_slots[MATCH_SLOT_COUNT];
+static int free_slot_count = 0;
+static int match_count = 0;  // Active matches
+
+// Finished matches, most recently used first (slot-indexed doubly linked list)
+static int lru_prev[MATCH_SLOT_COUNT];
+static int lru_next[MATCH_SLOT_COUNT];
+static int lru_head = -1;
+static int lru_tail = -1;
+static int finished_count = 0;
+
+// Registry indexes: match_id -> slot, handle -> slot, user_id -> slot of the
+// user's active match
+static str_map_t id_index;
+static int_map_t handle_index;
+static int_map_t user_index;
+
+// Handles come from a monotonic counter; match_id strings are derived from the
+// handle plus the registry start time so they never repeat within a process
+// and do not collide with ids persisted by earlier runs.
+static int next_handle = 0;
+static time_t registry_epoch = 0;
 
 // Pending timeouts to broadcast
 static timeout_info_t pending_timeouts[MAX_MATCHES];
 static int pending_timeout_count = 0;
 
+// Active matches in a min-heap of flag deadlines (monotonic ms), so the
+// event loop looks at the top instead of every slot. A deadline only moves
+// when a clock is charged or the turn passes.
+static int flag_heap[MAX_MATCHES];       // Slots
+static int flag_heap_count = 0;
+static int flag_pos[MATCH_SLOT_COUNT];   // Heap position of a slot, -1 if none
+static int64_t flag_at[MATCH_SLOT_COUNT];
+
 // Initialize match manager
 bool match_init(void) {
-    memset(matches, 0, sizeof(matches));
+    memset(slots, 0, sizeof(slots));
     memset(pending_timeouts, 0, sizeof(pending_timeouts));
     match_count = 0;
+    finished_count = 0;
+    lru_head = lru_tail = -1;
     pending_timeout_count = 0;
+    flag_heap_count = 0;
+    for (int i = 0; i < MATCH_SLOT_COUNT; i++) flag_pos[i] = -1;
+    next_handle = 0;
+    registry_epoch = time(NULL);
+
+    // Hand out low slots first
+    free_slot_count = 0;
+    for (int i = MATCH_SLOT_COUNT - 1; i >= 0; i--) {
+        free_slots[free_slot_count++] = i;
+    }
+
+    if (!str_map_init(&id_index, MATCH_SLOT_COUNT * 2) ||
+        !int_map_init(&handle_index, MATCH_SLOT_COUNT * 2) ||
+        !int_map_init(&user_index, MAX_MATCHES * 4)) {
+        fprintf(stderr, "Failed to allocate match registry\n");
+        return false;
+    }
+
     printf("Match manager initialized\n");
     return true;
 }
 
 // Shutdown
-void match_shutdown(void) { match_count = 0; pending_timeout_count = 0; }
+void match_shutdown(void) {
+    for (int i = 0; i < MATCH_SLOT_COUNT; i++) {
+        free(slots[i]);
+        slots[i] = NULL;
+    }
+    match_count = 0;
+    finished_count = 0;
+    free_slot_count = 0;
+    lru_head = lru_tail = -1;
+    pending_timeout_count = 0;
+    flag_heap_count = 0;
+    str_map_free(&id_index);
+    int_map_free(&handle_index);
+    int_map_free(&user_index);
+}
+
+static int match_slot_of(const match_t* match) {
+    int slot = -1;
+    int_map_get(&handle_index, match->handle, &slot);
+    return slot;
+}
+
+// Drop the per-user index entries that still point at this slot
+static void match_unindex_players(const match_t* match, int slot) {
+    int indexed;
+
+    if (int_map_get(&user_index, match->red_user_id, &indexed) &&
+        indexed == slot) {
+        int_map_remove(&user_index, match->red_user_id);
+    }
+    if (int_map_get(&user_index, match->black_user_id, &indexed) &&
+        indexed == slot) {
+        int_map_remove(&user_index, match->black_user_id);
+    }
+}
+
+// Flag deadline heap
+static void flag_set(int pos, int slot) {
+    flag_heap[pos] = slot;
+    flag_pos[slot] = pos;
+}
+
+static void flag_sift_up(int pos) {
+    int slot = flag_heap[pos];
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (flag_at[flag_heap[parent]] <= flag_at[slot]) break;
+        flag_set(pos, flag_heap[parent]);
+        pos = parent;
+    }
+    flag_set(pos, slot);
+}
+
+static void flag_sift_down(int pos) {
+    int slot = flag_heap[pos];
+    for (;;) {
+        int child = pos * 2 + 1;
+        if (child >= flag_heap_count) break;
+        if (child + 1 < flag_heap_count && flag_at[flag_heap[child + 1]] < flag_at[flag_heap[child]]) {
+            child++;
+        }
+        if (flag_at[slot] <= flag_at[flag_heap[child]]) break;
+        flag_set(pos, flag_heap[child]);
+        pos = child;
+    }
+    flag_set(pos, slot);
+}
+
+static void flag_unschedule(int slot) {
+    int pos = flag_pos[slot];
+    if (pos < 0) return;
+    flag_pos[slot] = -1;
+    int last = --flag_heap_count;
+    if (pos != last) {
+        int moved = flag_heap[last];
+        flag_set(pos, moved);
+        flag_sift_down(pos);
+        flag_sift_up(flag_pos[moved]);
+    }
+}
+
+// (Re)key an active match: the side to move's clock runs down one ms per ms
+// from turn_started_ms, so it flags at a fixed instant until the next charge
+static void flag_schedule(int slot) {
+    const match_t* match = slots[slot];
+    int remaining = strcmp(match->current_turn, "red") == 0 ? match->red_time_ms
+                                                            : match->black_time_ms;
+    flag_at[slot] =
+        match->turn_started_ms + clock_ms_until_flag(&match->time_control, remaining, 0);
+
+    if (flag_pos[slot] < 0) {
+        flag_set(flag_heap_count++, slot);
+        flag_sift_up(flag_pos[slot]);
+    } else {
+        flag_sift_up(flag_pos[slot]);
+        flag_sift_down(flag_pos[slot]);
+    }
+}
+
+// LRU helpers
+static void lru_unlink(int slot) {
+    if (lru_prev[slot] >= 0) lru_next[lru_prev[slot]] = lru_next[slot];
+    else lru_head = lru_next[slot];
+    if (lru_next[slot] >= 0) lru_prev[lru_next[slot]] = lru_prev[slot];
+    else lru_tail = lru_prev[slot];
+}
+
+static void lru_push_front(int slot) {
+    lru_prev[slot] = -1;
+    lru_next[slot] = lru_head;
+    if (lru_head >= 0) lru_prev[lru_head] = slot;
+    lru_head = slot;
+    if (lru_tail < 0) lru_tail = slot;
+}
+
+// Remove a finished match from every index and release its memory
+static void match_evict(int slot) {
+    match_t* match = slots[slot];
+
+    lru_unlink(slot);
+    finished_count--;
+
+    str_map_remove(&id_index, match->match_id);
+    int_map_remove(&handle_index, match->handle);
+    pubsub_close_topic(match->match_id);
+
+    free(match);
+    slots[slot] = NULL;
+    free_slots[free_slot_count++] = slot;
+}
+
+// Move an active match into the finished cache (active -> finished)
+static void match_finish(match_t* match, const char* result,
+                         const char* reason) {
+    int slot = match_slot_of(match);
+
+    match_unindex_players(match, slot);
+    live_remove(match);
+    flag_unschedule(slot);
+    match->active = false;
+    snprintf(match->result, sizeof(match->result), "%s", result);
+    snprintf(match->end_reason, sizeof(match->end_reason), "%s", reason);
+    match_count--;
+
+    lru_push_front(slot);
+    finished_count++;
+
+    // finished -> evicted; the match just finished is at the head and is
+    // never the one evicted, so callers may keep using their pointer.
+    while (finished_count > MAX_FINISHED_MATCHES && lru_tail != slot) {
+        match_evict(lru_tail);
+    }
+}
 
 // Create new match
 char* match_create(int red_user_id, int black_user_id, bool rated,
-                   int time_ms) {
+                   const time_control_t* time_control) {
+    return match_create_from_fen(red_user_id, black_user_id, rated, time_control,
+                                 NULL);
+}
+
+char* match_create_from_fen(int red_user_id, int black_user_id, bool rated,
+                            const time_control_t* time_control,
+                            const char* start_fen) {
     if (match_count >= MAX_MATCHES) {
         return NULL;
     }
 
-    // Find empty slot
-    match_t* match = NULL;
-    for (int i = 0; i < MAX_MATCHES; i++) {
-        if (!matches[i].active && matches[i].match_id[0] == '\0') {
-            match = &matches[i];
-            match_count++;
-            break;
-        }
+    xq_position_t start;
+    if (!start_fen) start_fen = XQ_START_FEN;
+    if (!xq_position_from_fen(&start, start_fen)) return NULL;
+
+    // Active + finished never exceed the slot table, but evict defensively
+    if (free_slot_count == 0 && lru_tail >= 0) {
+        match_evict(lru_tail);
     }
+    if (free_slot_count == 0) return NULL;
 
+    match_t* match = calloc(1, sizeof(match_t));
     if (!match) return NULL;
 
+    int slot = free_slots[--free_slot_count];
+
     // Initialize match
-    sprintf(match->match_id, "match_%d_%ld", match_count, time(NULL));
+    match->handle = ++next_handle;
+    snprintf(match->match_id, sizeof(match->match_id), "match_%ld_%d",
+             (long)registry_epoch, match->handle);
     match->red_user_id = red_user_id;
     match->black_user_id = black_user_id;
-    strcpy(match->current_turn, "red");
+    strcpy(match->current_turn, start.side == XQ_RED ? "red" : "black");
     match->move_count = 0;
+    xq_position_to_fen(&start, match->start_fen, sizeof(match->start_fen));
+    match->position = start;
+    match->position_valid = true;
     match->rated = rated;
-    match->red_time_ms = time_ms;
-    match->black_time_ms = time_ms;
+    match->time_control = time_control
+                              ? *time_control
+                              : time_control_make(DEFAULT_BASE_TIME_MS, 0, 0, 0);
+    match->red_time_ms = match->time_control.base_ms;
+    match->black_time_ms = match->time_control.base_ms;
     match->started_at = time(NULL);
     match->last_move_at = time(NULL);
+    match->turn_started_ms = clock_now_ms();
     match->active = true;
     strcpy(match->result, "ongoing");
 
+    if (!str_map_put(&id_index, match->match_id, slot) ||
+        !int_map_put(&handle_index, match->handle, slot)) {
+        str_map_remove(&id_index, match->match_id);
+        free(match);
+        free_slots[free_slot_count++] = slot;
+        return NULL;
+    }
+    int_map_put(&user_index, red_user_id, slot);
+    int_map_put(&user_index, black_user_id, slot);
+
+    slots[slot] = match;
+    match_count++;
+    live_add(match);
+    flag_schedule(slot);
+
     return strdup(match->match_id);
 }
 
+// Look up a slot; finished matches are refreshed in the LRU
+static match_t* match_touch(int slot) {
+    match_t* match = slots[slot];
+    if (match && !match->active && lru_head != slot) {
+        lru_unlink(slot);
+        lru_push_front(slot);
+    }
+    return match;
+}
+
 // Get match
 match_t* match_get(const char* match_id) {
-    for (int i = 0; i < MAX_MATCHES; i++) {
-        if (strcmp(matches[i].match_id, match_id) == 0) {
-            return &matches[i];
-        }
+    int slot;
+    if (!match_id || !str_map_get(&id_index, match_id, &slot)) {
+        return NULL;
     }
-    return NULL;
+    return match_touch(slot);
 }
 
+// Get match by integer handle
+match_t* match_get_by_handle(int handle) {
+    int slot;
+    if (!int_map_get(&handle_index, handle, &slot)) {
+        return NULL;
+    }
+    return match_touch(slot);
+}
+
+// Number of matches currently in progress
+int match_get_active_count(void) { return match_count; }
+
+// Number of finished matches held for rematch/chat/replay lookups
+int match_get_finished_count(void) { return finished_count; }
+
 // Validate position
 bool is_valid_position(int row, int col) {
     return (row >= 0 && row <= 9 && col >= 0 && col <= 8);
@@ -118,8 +387,21 @@ bool match_add_move(const char* match_id, const move_t* move) {
 
     if (match->move_count >= MAX_MOVES_PER_MATCH) return false;
 
+    // Keep the board in step. Every caller checks legality first (handle_move,
+    // premoves, the engine), so a move that does not replay is not expected;
+    // if one does, only the position is lost, not the game
+    if (match->position_valid) {
+        xq_move_t m = xq_find_move(&match->position, move->from_row, move->from_col,
+                                   move->to_row, move->to_col);
+        xq_undo_t undo;
+        match->position_hashes[match->move_count] = match->position.hash;
+        match->position_valid =
+            m != XQ_NO_MOVE && xq_make_move(&match->position, m, &undo);
+    }
+
     match->moves[match->move_count++] = *move;
     match->last_move_at = time(NULL);
+    live_touch();
 
     // Switch turn
     if (strcmp(match->current_turn, "red") == 0) {
@@ -127,18 +409,112 @@ bool match_add_move(const char* match_id, const move_t* move) {
     } else {
         strcpy(match->current_turn, "red");
     }
+    flag_schedule(match_slot_of(match));
+
+    return true;
+}
+
+bool match_replay_position(const match_t* match, xq_position_t* pos,
+                           uint64_t* history, int* history_len) {
+    if (!match->position_valid) return false;
+
+    *pos = match->position;
+    if (history && history_len) {
+        memcpy(history, match->position_hashes,
+               sizeof(uint64_t) * (size_t)match->move_count);
+        *history_len = match->move_count;
+    }
+    return true;
+}
+
+bool match_adjudicate(const match_t* match, const char** out_result) {
+    if (!match->active || tablebase_count() == 0) return false;
+
+    xq_position_t pos;
+    if (!match_replay_position(match, &pos, NULL, NULL)) return false;
+
+    // Still more material than any table holds. Counted on the board rather
+    // than inferred from the move count: a custom start may already be an
+    // endgame.
+    int pieces = 0;
+    for (int sq = 0; sq < XQ_SQUARES; sq++) {
+        if (pos.board[sq]) pieces++;
+    }
+    if (pieces > 2 + TB_MAX_EXTRA_PIECES) return false;
+
+    tb_probe_t probe;
+    if (!tablebase_probe(&pos, &probe)) return false;
+
+    if (probe.wdl == 0) {
+        *out_result = "draw";
+    } else {
+        // wdl is from the side to move's view
+        bool red_wins = (pos.side == XQ_RED) == (probe.wdl > 0);
+        *out_result = red_wins ? "red_wins" : "black_wins";
+    }
+    return true;
+}
+
+// Premove slot of a player, NULL for non-players
+static premove_t* match_premove_slot(match_t* match, int user_id) {
+    if (user_id == match->red_user_id) return &match->premoves[0];
+    if (user_id == match->black_user_id) return &match->premoves[1];
+    return NULL;
+}
+
+bool match_set_premove(match_t* match, int user_id, int from_row, int from_col,
+                       int to_row, int to_col) {
+    if (!match || !match->active) return false;
+
+    premove_t* premove = match_premove_slot(match, user_id);
+    if (!premove) return false;
+
+    // On your own turn just send the move
+    if (is_correct_turn(match, user_id)) return false;
+
+    if (!is_valid_position(from_row, from_col) ||
+        !is_valid_position(to_row, to_col)) {
+        return false;
+    }
+    if (from_row == to_row && from_col == to_col) return false;
 
+    premove->queued = true;
+    premove->from_row = (char)from_row;
+    premove->from_col = (char)from_col;
+    premove->to_row = (char)to_row;
+    premove->to_col = (char)to_col;
     return true;
 }
 
+bool match_take_premove(match_t* match, int user_id, premove_t* out) {
+    if (!match) return false;
+
+    premove_t* premove = match_premove_slot(match, user_id);
+    if (!premove || !premove->queued) return false;
+
+    if (out) *out = *premove;
+    premove->queued = false;
+    return true;
+}
+
+void match_clear_premove(match_t* match, int user_id) {
+    if (!match) return;
+
+    premove_t* premove = match_premove_slot(match, user_id);
+    if (premove) premove->queued = false;
+}
+
 // End match
 bool match_end(const char* match_id, const char* result, const char* reason) {
     match_t* match = match_get(match_id);
     if (!match) return false;
 
-    match->active = false;
-    strncpy(match->result, result, 15);
-    strncpy(match->end_reason, reason, 31);
+    if (match->active) {
+        match_finish(match, result, reason);
+    } else {
+        snprintf(match->result, sizeof(match->result), "%s", result);
+        snprintf(match->end_reason, sizeof(match->end_reason), "%s", reason);
+    }
 
     return true;
 }
@@ -158,17 +534,34 @@ char* match_get_json(const char* match_id) {
     ptr += sprintf(ptr, "\"black_user_id\":%d,", match->black_user_id);
     ptr += sprintf(ptr, "\"red_time_ms\":%d,", match->red_time_ms);
     ptr += sprintf(ptr, "\"black_time_ms\":%d,", match->black_time_ms);
+    ptr += sprintf(ptr,
+                   "\"time_control\":{\"base_ms\":%d,\"increment_ms\":%d,"
+                   "\"delay_ms\":%d,\"move_limit_ms\":%d},",
+                   match->time_control.base_ms, match->time_control.increment_ms,
+                   match->time_control.delay_ms,
+                   match->time_control.move_limit_ms);
     ptr += sprintf(ptr, "\"result\":\"%s\",", match->result);
+
+    // Snapshot so clients need not replay the move list
+    ptr += sprintf(ptr, "\"start_fen\":\"%s\",", match->start_fen);
+    if (match->position_valid) {
+        char fen[XQ_FEN_MAX];
+        xq_position_to_fen(&match->position, fen, sizeof(fen));
+        ptr += sprintf(ptr, "\"fen\":\"%s\",", fen);
+    } else {
+        ptr += sprintf(ptr, "\"fen\":null,");
+    }
+    ptr += sprintf(ptr, "\"current_turn\":\"%s\",", match->current_turn);
     ptr += sprintf(ptr, "\"moves\":[");
 
     for (int i = 0; i < match->move_count; i++) {
         if (i > 0) ptr += sprintf(ptr, ",");
         ptr += sprintf(ptr,
                        "{\"move_id\":%d,\"from\":{\"row\":%d,\"col\":%d},"
-                       "\"to\":{\"row\":%d,\"col\":%d}}",
+                       "\"to\":{\"row\":%d,\"col\":%d},\"think_time_ms\":%d}",
                        match->moves[i].move_id, match->moves[i].from_row,
                        match->moves[i].from_col, match->moves[i].to_row,
-                       match->moves[i].to_col);
+                       match->moves[i].to_col, match->moves[i].think_time_ms);
     }
 
     sprintf(ptr, "]}");
@@ -181,13 +574,12 @@ match_t* match_find_by_id(const char* match_id) { return match_get(match_id); }
 
 // Find match by user
 match_t* match_find_by_user(int user_id) {
-    for (int i = 0; i < MAX_MATCHES; i++) {
-        if (matches[i].active && (matches[i].red_user_id == user_id ||
-                                  matches[i].black_user_id == user_id)) {
-            return &matches[i];
-        }
+    int slot;
+    if (!int_map_get(&user_index, user_id, &slot) || !slots[slot] ||
+        !slots[slot]->active) {
+        return NULL;
     }
-    return NULL;
+    return slots[slot];
 }
 
 // Check if move causes checkmate (stub - needs full chess logic)
@@ -222,120 +614,44 @@ char* match_get_moves_json(const match_t* match) {
         if (i > 0) ptr += sprintf(ptr, ",");
         ptr += sprintf(ptr,
                        "{\"from\":{\"row\":%d,\"col\":%d},"
-                       "\"to\":{\"row\":%d,\"col\":%d}}",
+                       "\"to\":{\"row\":%d,\"col\":%d},\"think_time_ms\":%d}",
                        match->moves[i].from_row, match->moves[i].from_col,
-                       match->moves[i].to_row, match->moves[i].to_col);
+                       match->moves[i].to_row, match->moves[i].to_col,
+                       match->moves[i].think_time_ms);
     }
 
     sprintf(ptr, "]");
     return json;
 }
 
-// Add spectator to match
-bool match_add_spectator(const char* match_id, int user_id) {
-    match_t* match = match_get(match_id);
-    if (!match || !match->active) return false;
-    
-    // Check if already a spectator
-    for (int i = 0; i < match->spectator_count; i++) {
-        if (match->spectator_ids[i] == user_id) {
-            return true;  // Already spectating
-        }
-    }
-    
-    // Check if room for more spectators
-    if (match->spectator_count >= MAX_SPECTATORS_PER_MATCH) {
-        return false;
-    }
-    
-    // Add spectator
-    match->spectator_ids[match->spectator_count++] = user_id;
-    return true;
+// Remaining time of the side to move, as of now_ms
+static int64_t match_ms_until_flag(const match_t* match, int64_t now_ms) {
+    int remaining = strcmp(match->current_turn, "red") == 0
+                        ? match->red_time_ms
+                        : match->black_time_ms;
+    return clock_ms_until_flag(&match->time_control, remaining,
+                               now_ms - match->turn_started_ms);
 }
 
-// Remove spectator from match
-bool match_remove_spectator(const char* match_id, int user_id) {
-    match_t* match = match_get(match_id);
-    if (!match) return false;
-    
-    for (int i = 0; i < match->spectator_count; i++) {
-        if (match->spectator_ids[i] == user_id) {
-            // Shift remaining spectators
-            for (int j = i; j < match->spectator_count - 1; j++) {
-                match->spectator_ids[j] = match->spectator_ids[j + 1];
-            }
-            match->spectator_count--;
-            return true;
-        }
-    }
-    return false;
-}
+// Charge the mover's clock for the move being made
+bool match_charge_clock(match_t* match, int64_t now_ms, int lag_comp_ms,
+                        int* out_think_ms) {
+    if (!match || !match->active) return false;
 
-// Check if user is spectator
-bool match_is_spectator(const match_t* match, int user_id) {
-    if (!match) return false;
-    
-    for (int i = 0; i < match->spectator_count; i++) {
-        if (match->spectator_ids[i] == user_id) {
-            return true;
-        }
-    }
-    return false;
-}
+    int64_t think_ms = now_ms - match->turn_started_ms - lag_comp_ms;
+    if (think_ms < 0) think_ms = 0;
+    if (out_think_ms) *out_think_ms = (int)think_ms;
 
-// Get list of active matches for spectating
-char* match_get_live_matches_json(void) {
-    char* json = malloc(65536);
-    if (!json) return NULL;
-    
-    char* ptr = json;
-    ptr += sprintf(ptr, "[");
-    
-    int first = 1;
-    for (int i = 0; i < MAX_MATCHES; i++) {
-        if (matches[i].active) {
-            if (!first) ptr += sprintf(ptr, ",");
-            first = 0;
-            
-            ptr += sprintf(ptr, 
-                "{\"match_id\":\"%s\","
-                "\"red_user_id\":%d,"
-                "\"black_user_id\":%d,"
-                "\"move_count\":%d,"
-                "\"spectator_count\":%d,"
-                "\"current_turn\":\"%s\","
-                "\"started_at\":%ld}",
-                matches[i].match_id,
-                matches[i].red_user_id,
-                matches[i].black_user_id,
-                matches[i].move_count,
-                matches[i].spectator_count,
-                matches[i].current_turn,
-                (long)matches[i].started_at);
-        }
+    int* remaining = strcmp(match->current_turn, "red") == 0
+                         ? &match->red_time_ms
+                         : &match->black_time_ms;
+    if (!clock_charge_move(&match->time_control, remaining, think_ms)) {
+        return false;
     }
-    
-    sprintf(ptr, "]");
-    return json;
-}
 
-// Update timer - deduct time from current player since last move
-bool match_update_timer(const char* match_id) {
-    match_t* match = match_get(match_id);
-    if (!match || !match->active) return false;
-    
-    time_t now = time(NULL);
-    int elapsed_ms = (int)((now - match->last_move_at) * 1000);
-    
-    if (strcmp(match->current_turn, "red") == 0) {
-        match->red_time_ms -= elapsed_ms;
-        if (match->red_time_ms < 0) match->red_time_ms = 0;
-    } else {
-        match->black_time_ms -= elapsed_ms;
-        if (match->black_time_ms < 0) match->black_time_ms = 0;
-    }
-    
-    match->last_move_at = now;
+    // Opponent's clock starts at the same instant the mover's stopped
+    match->turn_started_ms = now_ms;
+    flag_schedule(match_slot_of(match));
     return true;
 }
 
@@ -343,97 +659,141 @@ bool match_update_timer(const char* match_id) {
 bool match_check_timeout(const char* match_id) {
     match_t* match = match_get(match_id);
     if (!match || !match->active) return false;
-    
-    time_t now = time(NULL);
-    int elapsed_ms = (int)((now - match->last_move_at) * 1000);
-    
-    if (strcmp(match->current_turn, "red") == 0) {
-        return (match->red_time_ms - elapsed_ms) <= 0;
-    } else {
-        return (match->black_time_ms - elapsed_ms) <= 0;
-    }
+
+    return match_ms_until_flag(match, clock_now_ms()) <= 0;
 }
 
 // Get current timer state as JSON
-char* match_get_timer_json(const char* match_id) {
-    match_t* match = match_get(match_id);
-    if (!match) return NULL;
-    
-    time_t now = time(NULL);
-    int elapsed_ms = (int)((now - match->last_move_at) * 1000);
-    
-    int red_remaining = match->red_time_ms;
-    int black_remaining = match->black_time_ms;
-    
+// Remaining time of both sides as of now (the side to move is still ticking)
+static void match_remaining_clocks(const match_t* match, int* red_remaining,
+                                   int* black_remaining) {
+    *red_remaining = match->red_time_ms;
+    *black_remaining = match->black_time_ms;
+
     // Deduct elapsed time from current player
     if (match->active) {
+        int64_t think_ms = clock_now_ms() - match->turn_started_ms;
         if (strcmp(match->current_turn, "red") == 0) {
-            red_remaining -= elapsed_ms;
-            if (red_remaining < 0) red_remaining = 0;
+            *red_remaining = clock_project_remaining(&match->time_control,
+                                                     *red_remaining, think_ms);
         } else {
-            black_remaining -= elapsed_ms;
-            if (black_remaining < 0) black_remaining = 0;
+            *black_remaining = clock_project_remaining(&match->time_control,
+                                                       *black_remaining, think_ms);
         }
     }
+}
+
+char* match_get_timer_json(const char* match_id) {
+    match_t* match = match_get(match_id);
+    if (!match) return NULL;
+    
+    int red_remaining, black_remaining;
+    match_remaining_clocks(match, &red_remaining, &black_remaining);
     
-    char* json = malloc(256);
+    char* json = malloc(512);
     if (!json) return NULL;
     
-    sprintf(json, 
+    const time_control_t* tc = &match->time_control;
+    snprintf(json, 512,
         "{\"match_id\":\"%s\","
         "\"red_time_ms\":%d,"
         "\"black_time_ms\":%d,"
         "\"current_turn\":\"%s\","
-        "\"active\":%s}",
+        "\"active\":%s,"
+        "\"time_control\":{\"base_ms\":%d,\"increment_ms\":%d,"
+        "\"delay_ms\":%d,\"move_limit_ms\":%d}}",
         match->match_id,
         red_remaining,
         black_remaining,
         match->current_turn,
-        match->active ? "true" : "false");
+        match->active ? "true" : "false",
+        tc->base_ms, tc->increment_ms, tc->delay_ms, tc->move_limit_ms);
     
     return json;
 }
 
-// Check all active matches for timeouts (called periodically)
+// Spectator snapshot
+bool match_get_snapshot_json(const match_t* match, char* out, size_t size) {
+    if (!match || !out) return false;
+
+    int red_remaining, black_remaining;
+    match_remaining_clocks(match, &red_remaining, &black_remaining);
+
+    char fen[XQ_FEN_MAX + 2] = "null";
+    if (match->position_valid) {
+        char board[XQ_FEN_MAX];
+        xq_position_to_fen(&match->position, board, sizeof(board));
+        snprintf(fen, sizeof(fen), "\"%s\"", board);
+    }
+
+    size_t len = snprintf(out, size,
+                          "{\"match_id\":\"%s\",\"event_seq\":%u,"
+                          "\"red_user_id\":%d,\"black_user_id\":%d,"
+                          "\"start_fen\":\"%s\",\"fen\":%s,"
+                          "\"current_turn\":\"%s\",\"move_count\":%d,"
+                          "\"red_time_ms\":%d,\"black_time_ms\":%d,"
+                          "\"active\":%s,\"result\":\"%s\",\"last_moves\":[",
+                          match->match_id, match->event_seq, match->red_user_id,
+                          match->black_user_id, match->start_fen, fen,
+                          match->current_turn, match->move_count, red_remaining,
+                          black_remaining, match->active ? "true" : "false",
+                          match->result);
+
+    int first = match->move_count - MATCH_SNAPSHOT_MOVES;
+    if (first < 0) first = 0;
+    for (int i = first; i < match->move_count && len < size; i++) {
+        const move_t* m = &match->moves[i];
+        len += snprintf(out + len, size - len,
+                        "%s{\"ply\":%d,\"from\":{\"row\":%d,\"col\":%d},"
+                        "\"to\":{\"row\":%d,\"col\":%d},\"think_time_ms\":%d}",
+                        i > first ? "," : "", i + 1, m->from_row, m->from_col,
+                        m->to_row, m->to_col, m->think_time_ms);
+    }
+    if (len < size) len += snprintf(out + len, size - len, "]}");
+
+    return len < size;
+}
+
+// Milliseconds until the earliest active clock runs out (top of the heap)
+int64_t match_ms_until_next_timeout(void) {
+    if (flag_heap_count == 0) return -1;
+    int64_t left = flag_at[flag_heap[0]] - clock_now_ms();
+    return left > 0 ? left : 0;
+}
+
+// Queue every match whose clock has run out (called every loop iteration).
+// Flagged matches stay in the heap until settled, so only the subtree of
+// due deadlines under the top is walked.
 void match_check_all_timeouts(void) {
-    time_t now = time(NULL);
-    
-    for (int i = 0; i < MAX_MATCHES; i++) {
-        if (matches[i].active) {
-            int elapsed_ms = (int)((now - matches[i].last_move_at) * 1000);
-            
-            bool timeout = false;
-            const char* winner;
-            
-            if (strcmp(matches[i].current_turn, "red") == 0) {
-                if (matches[i].red_time_ms - elapsed_ms <= 0) {
-                    timeout = true;
-                    winner = "black_wins";
-                }
-            } else {
-                if (matches[i].black_time_ms - elapsed_ms <= 0) {
-                    timeout = true;
-                    winner = "red_wins";
-                }
+    int64_t now_ms = clock_now_ms();
+    static int due[MAX_MATCHES];
+    int due_count = 0;
+    if (flag_heap_count > 0 && flag_at[flag_heap[0]] <= now_ms) due[due_count++] = 0;
+
+    while (due_count > 0) {
+        int pos = due[--due_count];
+        for (int child = pos * 2 + 1; child <= pos * 2 + 2 && child < flag_heap_count; child++) {
+            if (flag_at[flag_heap[child]] <= now_ms) due[due_count++] = child;
+        }
+
+        match_t* m = slots[flag_heap[pos]];
+        if (match_ms_until_flag(m, now_ms) <= 0) {
+            const char* winner = strcmp(m->current_turn, "red") == 0
+                                     ? "black_wins"
+                                     : "red_wins";
+
+            // Left active: handlers_process_timeouts ends it with match_end
+            // while settling, and picks it up again next tick if it did not
+            // fit this time
+            if (pending_timeout_count < MAX_MATCHES) {
+                timeout_info_t* ti = &pending_timeouts[pending_timeout_count++];
+                snprintf(ti->match_id, sizeof(ti->match_id), "%s", m->match_id);
+                snprintf(ti->result, sizeof(ti->result), "%s", winner);
+                ti->red_user_id = m->red_user_id;
+                ti->black_user_id = m->black_user_id;
             }
             
-            if (timeout) {
-                // Mark match as ended due to timeout
-                matches[i].active = false;
-                strncpy(matches[i].result, winner, sizeof(matches[i].result) - 1);
-                strncpy(matches[i].end_reason, "timeout", sizeof(matches[i].end_reason) - 1);
-                
-                // Add to pending timeouts for broadcasting
-                if (pending_timeout_count < MAX_MATCHES) {
-                    timeout_info_t* ti = &pending_timeouts[pending_timeout_count++];
-                    strncpy(ti->match_id, matches[i].match_id, sizeof(ti->match_id) - 1);
-                    strncpy(ti->result, winner, sizeof(ti->result) - 1);
-                    ti->red_user_id = matches[i].red_user_id;
-                    ti->black_user_id = matches[i].black_user_id;
-                }
-                
-                printf("[Match] Timeout detected: %s -> %s\n", matches[i].match_id, winner);
-            }
+            printf("[Match] Timeout detected: %s -> %s\n", m->match_id, winner);
         }
     }
 }
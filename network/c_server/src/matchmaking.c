@@ -0,0 +1,658 @@
+/*
+ * matchmaking.c - Matchmaking queues paired on a background thread
+ */
+
+#include "../include/matchmaking.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../include/hashmap.h"
+
+typedef enum { MM_CMD_JOIN, MM_CMD_REQUEUE, MM_CMD_LEAVE } mm_command_kind_t;
+
+typedef struct {
+    mm_command_kind_t kind;
+    mm_entry_t entry;  // Only user_id for MM_CMD_LEAVE
+} mm_command_t;
+
+typedef struct {
+    mm_entry_t* entries;  // Ascending by (rating, user_id)
+    int count;
+    int capacity;
+    int_map_t index;  // user_id -> rating (the sort key)
+    char key[160];
+} mm_queue_t;
+
+// Growable arrays shared between the loop and the thread (under mm_lock)
+typedef struct {
+    mm_command_t* items;
+    int count;
+    int capacity;
+} mm_command_list_t;
+
+typedef struct {
+    mm_result_t* items;
+    int head;
+    int count;  // Including the ones before head
+    int capacity;
+} mm_result_list_t;
+
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mm_cond = PTHREAD_COND_INITIALIZER;
+static bool thread_running = false;
+static bool thread_started = false;
+static pthread_t thread;
+static int notify_fd = -1;
+
+static mm_command_list_t inbox;    // Loop -> thread
+static mm_result_list_t outbox;    // Thread -> loop
+
+// Metrics (under mm_lock)
+static int stat_queued = 0;
+static int stat_queues = 0;
+static uint64_t pair_count = 0;
+static uint64_t wait_sum_ms = 0;
+static int gap_samples[MM_GAP_SAMPLES];
+static int gap_next = 0;
+static int gap_filled = 0;
+
+// Event loop only: each queued player's current ticket
+static int_map_t tickets;
+static uint32_t next_ticket = 0;
+
+// Pairing thread only
+static mm_queue_t* queues = NULL;
+static int queue_count = 0;
+static int queue_capacity = 0;
+static str_map_t queue_index;  // key -> queue
+static int_map_t user_queue;   // user_id -> queue
+static int total_queued = 0;
+
+typedef struct {
+    int pairs;
+    int64_t gap;
+    bool paired_last;  // Entry i-1 pairs with i-2
+    bool taken;        // Entry i-1 was emitted by this pass
+} mm_step_t;
+
+static mm_step_t* steps = NULL;
+static int step_capacity = 0;
+
+// =========================
+// Queues (pairing thread)
+// =========================
+
+static void queue_key(const mm_entry_t* entry, char* out, size_t size) {
+    const time_control_t* tc = &entry->time_control;
+    snprintf(out, size, "%d/%d/%d/%d/%c/%s", tc->base_ms, tc->increment_ms, tc->delay_ms,
+             tc->move_limit_ms, entry->rated ? 'r' : 'c', entry->start_fen);
+}
+
+static bool entry_before(const mm_entry_t* e, int rating, int user_id) {
+    return e->rating != rating ? e->rating < rating : e->user_id < user_id;
+}
+
+// First position not ordered before (rating, user_id)
+static int queue_lower_bound(const mm_queue_t* queue, int rating, int user_id) {
+    int lo = 0, hi = queue->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (entry_before(&queue->entries[mid], rating, user_id)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Queue for an entry's key, created on first use; -1 on allocation failure
+static int queue_for(const mm_entry_t* entry) {
+    char key[sizeof(queues[0].key)];
+    queue_key(entry, key, sizeof(key));
+    int q;
+    if (str_map_get(&queue_index, key, &q)) return q;
+
+    if (queue_count == queue_capacity) {
+        int capacity = queue_capacity ? queue_capacity * 2 : 16;
+        mm_queue_t* grown = realloc(queues, (size_t)capacity * sizeof(*grown));
+        if (!grown) return -1;
+        queues = grown;
+        queue_capacity = capacity;
+    }
+    q = queue_count;
+    mm_queue_t* queue = &queues[q];
+    memset(queue, 0, sizeof(*queue));
+    if (!int_map_init(&queue->index, 64)) return -1;
+    if (!str_map_put(&queue_index, key, q)) {
+        int_map_free(&queue->index);
+        return -1;
+    }
+    snprintf(queue->key, sizeof(queue->key), "%s", key);
+    queue_count++;
+    return q;
+}
+
+// Free an empty queue; the last queue moves into its slot
+static void queue_drop(int q) {
+    str_map_remove(&queue_index, queues[q].key);
+    free(queues[q].entries);
+    int_map_free(&queues[q].index);
+
+    int last = --queue_count;
+    if (q == last) return;
+    queues[q] = queues[last];
+    str_map_put(&queue_index, queues[q].key, q);
+    for (int i = 0; i < queues[q].count; i++) {
+        int_map_put(&user_queue, queues[q].entries[i].user_id, q);
+    }
+}
+
+static bool queue_insert(int q, const mm_entry_t* entry) {
+    mm_queue_t* queue = &queues[q];
+    if (queue->count == queue->capacity) {
+        int capacity = queue->capacity ? queue->capacity * 2 : 64;
+        mm_entry_t* grown = realloc(queue->entries, (size_t)capacity * sizeof(*grown));
+        if (!grown) return false;
+        queue->entries = grown;
+        queue->capacity = capacity;
+    }
+    if (!int_map_put(&queue->index, entry->user_id, entry->rating)) return false;
+    if (!int_map_put(&user_queue, entry->user_id, q)) {
+        int_map_remove(&queue->index, entry->user_id);
+        return false;
+    }
+
+    int pos = queue_lower_bound(queue, entry->rating, entry->user_id);
+    memmove(&queue->entries[pos + 1], &queue->entries[pos],
+            (size_t)(queue->count - pos) * sizeof(*entry));
+    queue->entries[pos] = *entry;
+    queue->count++;
+    total_queued++;
+    return true;
+}
+
+// Take a user out of their queue
+static bool queue_take(int user_id, mm_entry_t* out) {
+    int q, rating;
+    if (!int_map_get(&user_queue, user_id, &q)) return false;
+    mm_queue_t* queue = &queues[q];
+    int_map_remove(&user_queue, user_id);
+    if (!int_map_get(&queue->index, user_id, &rating)) return false;
+
+    int pos = queue_lower_bound(queue, rating, user_id);
+    if (out) *out = queue->entries[pos];
+    int_map_remove(&queue->index, user_id);
+    memmove(&queue->entries[pos], &queue->entries[pos + 1],
+            (size_t)(queue->count - pos - 1) * sizeof(queue->entries[0]));
+    queue->count--;
+    total_queued--;
+    return true;
+}
+
+static void apply_command(const mm_command_t* cmd) {
+    mm_entry_t previous;
+    bool was_queued = queue_take(cmd->entry.user_id, &previous);
+    if (cmd->kind == MM_CMD_LEAVE) return;
+
+    mm_entry_t entry = cmd->entry;
+    if (cmd->kind == MM_CMD_JOIN && was_queued) entry.queued_ms = previous.queued_ms;
+    int q = queue_for(&entry);
+    if (q < 0 || !queue_insert(q, &entry)) {
+        fprintf(stderr, "[Matchmaking] Out of memory queueing user %d\n", entry.user_id);
+    }
+}
+
+// =========================
+// Pairing (pairing thread)
+// =========================
+
+int mm_tolerance(int64_t wait_ms) {
+    int64_t tolerance = MM_BASE_TOLERANCE + wait_ms / 1000 * MM_WIDEN_PER_SEC;
+    return tolerance < MM_MAX_TOLERANCE ? (int)tolerance : MM_MAX_TOLERANCE;
+}
+
+static bool mm_compatible(const mm_entry_t* a, const mm_entry_t* b, int64_t now_ms) {
+    if (!a->rated) return true;
+    int64_t first_ms = a->queued_ms < b->queued_ms ? a->queued_ms : b->queued_ms;
+    return b->rating - a->rating <= mm_tolerance(now_ms - first_ms);
+}
+
+// Results of one pass, published in one go
+static mm_result_t* pass_results = NULL;
+static int pass_count = 0;
+static int pass_capacity = 0;
+
+static bool pass_add(const mm_result_t* result) {
+    if (pass_count == pass_capacity) {
+        int capacity = pass_capacity ? pass_capacity * 2 : 64;
+        mm_result_t* grown = realloc(pass_results, (size_t)capacity * sizeof(*grown));
+        if (!grown) return false;
+        pass_results = grown;
+        pass_capacity = capacity;
+    }
+    pass_results[pass_count++] = *result;
+    return true;
+}
+
+// Pair one queue. In rating order, the best pairing of the first i entries
+// either leaves entry i-1 out or pairs it with entry i-2; more pairs win,
+// then the smaller total gap.
+static void pair_queue(mm_queue_t* queue, int64_t now_ms) {
+    int n = queue->count;
+    if (n < 2) return;
+
+    if (n + 1 > step_capacity) {
+        mm_step_t* grown = realloc(steps, (size_t)(n + 1) * sizeof(*grown));
+        if (!grown) return;
+        steps = grown;
+        step_capacity = n + 1;
+    }
+
+    const mm_entry_t* e = queue->entries;
+    steps[0] = (mm_step_t){0};
+    steps[1] = (mm_step_t){0};
+    for (int i = 2; i <= n; i++) {
+        steps[i] = steps[i - 1];
+        steps[i].paired_last = false;
+        steps[i].taken = false;
+        if (!mm_compatible(&e[i - 2], &e[i - 1], now_ms)) continue;
+
+        int pairs = steps[i - 2].pairs + 1;
+        int64_t gap = steps[i - 2].gap + (e[i - 1].rating - e[i - 2].rating);
+        if (pairs > steps[i].pairs || (pairs == steps[i].pairs && gap < steps[i].gap)) {
+            steps[i].pairs = pairs;
+            steps[i].gap = gap;
+            steps[i].paired_last = true;
+        }
+    }
+
+    // Walk the choices back
+    for (int i = n; i >= 2;) {
+        if (!steps[i].paired_last) {
+            i--;
+            continue;
+        }
+        const mm_entry_t* a = &e[i - 2];
+        const mm_entry_t* b = &e[i - 1];
+        bool a_first = a->queued_ms < b->queued_ms ||
+                       (a->queued_ms == b->queued_ms && a->user_id < b->user_id);
+        mm_result_t result = {.kind = MM_RESULT_PAIR,
+                              .red = a_first ? *a : *b,
+                              .black = a_first ? *b : *a};
+        if (!pass_add(&result)) break;
+        steps[i - 1].taken = steps[i].taken = true;  // Entries i-2 and i-1
+        i -= 2;
+    }
+
+    // Compact the queue (steps[k + 1].taken marks entry k)
+    int kept = 0;
+    for (int k = 0; k < n; k++) {
+        if (steps[k + 1].taken) {
+            int_map_remove(&queue->index, e[k].user_id);
+            int_map_remove(&user_queue, e[k].user_id);
+            total_queued--;
+        } else {
+            queue->entries[kept++] = queue->entries[k];
+        }
+    }
+    queue->count = kept;
+}
+
+// Players who opted into a bot and waited long enough
+static void take_bot_fallbacks(mm_queue_t* queue, int64_t now_ms) {
+    int kept = 0;
+    for (int k = 0; k < queue->count; k++) {
+        const mm_entry_t* entry = &queue->entries[k];
+        if (entry->bot_level > 0 &&
+            now_ms - entry->queued_ms >= BOT_FALLBACK_WAIT_SEC * 1000LL) {
+            mm_result_t result = {.kind = MM_RESULT_BOT, .red = *entry};
+            if (pass_add(&result)) {
+                int_map_remove(&queue->index, entry->user_id);
+                int_map_remove(&user_queue, entry->user_id);
+                total_queued--;
+                continue;
+            }
+        }
+        queue->entries[kept++] = queue->entries[k];
+    }
+    queue->count = kept;
+}
+
+static void record_gap_locked(const mm_result_t* result, int64_t now_ms) {
+    pair_count++;
+    wait_sum_ms += (uint64_t)(now_ms - result->red.queued_ms) +
+                   (uint64_t)(now_ms - result->black.queued_ms);
+    gap_samples[gap_next] = abs(result->red.rating - result->black.rating);
+    gap_next = (gap_next + 1) % MM_GAP_SAMPLES;
+    if (gap_filled < MM_GAP_SAMPLES) gap_filled++;
+}
+
+// Hand the pass's results to the event loop
+static void publish_pass(int64_t now_ms) {
+    pthread_mutex_lock(&mm_lock);
+    bool ok = true;
+    if (outbox.count + pass_count > outbox.capacity) {
+        int capacity = outbox.capacity ? outbox.capacity : 64;
+        while (capacity < outbox.count + pass_count) capacity *= 2;
+        mm_result_t* grown = realloc(outbox.items, (size_t)capacity * sizeof(*grown));
+        if (grown) {
+            outbox.items = grown;
+            outbox.capacity = capacity;
+        } else {
+            ok = false;
+        }
+    }
+    if (ok && pass_count > 0) {
+        memcpy(&outbox.items[outbox.count], pass_results, (size_t)pass_count * sizeof(*pass_results));
+        outbox.count += pass_count;
+        for (int i = 0; i < pass_count; i++) {
+            if (pass_results[i].kind == MM_RESULT_PAIR) record_gap_locked(&pass_results[i], now_ms);
+        }
+    }
+    stat_queued = total_queued;
+    stat_queues = queue_count;
+    pthread_mutex_unlock(&mm_lock);
+
+    if (!ok) {
+        // Nothing is lost: the players go back to their queues
+        for (int i = 0; i < pass_count; i++) {
+            mm_command_t cmd = {.kind = MM_CMD_REQUEUE, .entry = pass_results[i].red};
+            apply_command(&cmd);
+            if (pass_results[i].kind == MM_RESULT_PAIR) {
+                cmd.entry = pass_results[i].black;
+                apply_command(&cmd);
+            }
+        }
+    } else if (pass_count > 0) {
+        uint64_t one = 1;
+        if (write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("matchmaking eventfd write");
+        }
+    }
+    pass_count = 0;
+}
+
+static void run_pass(int64_t now_ms) {
+    for (int q = 0; q < queue_count; q++) {
+        pair_queue(&queues[q], now_ms);
+        take_bot_fallbacks(&queues[q], now_ms);
+    }
+    for (int q = queue_count - 1; q >= 0; q--) {
+        if (queues[q].count == 0) queue_drop(q);
+    }
+}
+
+static void* mm_thread_main(void* arg) {
+    (void)arg;
+    mm_command_list_t work = {0};
+    int64_t next_pass_ms = clock_now_ms() + MM_TICK_MS;
+
+    pthread_mutex_lock(&mm_lock);
+    while (thread_running) {
+        // Sleep until there are commands, or until the next pass if
+        // anyone is waiting
+        while (thread_running && inbox.count == 0) {
+            if (total_queued == 0) {
+                pthread_cond_wait(&mm_cond, &mm_lock);
+                continue;
+            }
+            int64_t wait_ms = next_pass_ms - clock_now_ms();
+            if (wait_ms <= 0) break;
+
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += wait_ms / 1000;
+            until.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&mm_cond, &mm_lock, &until);
+        }
+        if (!thread_running) break;
+
+        // Swap the inbox out so the loop never waits on a pass
+        mm_command_list_t pending = inbox;
+        inbox = work;
+        inbox.count = 0;
+        work = pending;
+        pthread_mutex_unlock(&mm_lock);
+
+        for (int i = 0; i < work.count; i++) apply_command(&work.items[i]);
+        work.count = 0;
+
+        int64_t now_ms = clock_now_ms();
+        if (now_ms >= next_pass_ms) {
+            run_pass(now_ms);
+            next_pass_ms = now_ms + MM_TICK_MS;
+        }
+        publish_pass(now_ms);
+
+        pthread_mutex_lock(&mm_lock);
+    }
+    pthread_mutex_unlock(&mm_lock);
+    free(work.items);
+    return NULL;
+}
+
+// =========================
+// Event loop side
+// =========================
+
+bool mm_init(void) {
+    memset(&inbox, 0, sizeof(inbox));
+    memset(&outbox, 0, sizeof(outbox));
+    queues = NULL;
+    queue_count = queue_capacity = 0;
+    total_queued = 0;
+    pair_count = wait_sum_ms = 0;
+    gap_next = gap_filled = 0;
+    stat_queued = stat_queues = 0;
+
+    if (!int_map_init(&tickets, 256) || !int_map_init(&user_queue, 256) ||
+        !str_map_init(&queue_index, 32)) {
+        fprintf(stderr, "Failed to allocate matchmaking maps\n");
+        return false;
+    }
+
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify_fd < 0) {
+        perror("eventfd");
+        return false;
+    }
+
+    thread_running = true;
+    if (pthread_create(&thread, NULL, mm_thread_main, NULL) != 0) {
+        thread_running = false;
+        mm_shutdown();
+        return false;
+    }
+    thread_started = true;
+    printf("Matchmaking initialized (pairing every %dms)\n", MM_TICK_MS);
+    return true;
+}
+
+void mm_shutdown(void) {
+    pthread_mutex_lock(&mm_lock);
+    thread_running = false;
+    pthread_cond_broadcast(&mm_cond);
+    pthread_mutex_unlock(&mm_lock);
+    if (thread_started) pthread_join(thread, NULL);
+    thread_started = false;
+
+    for (int q = 0; q < queue_count; q++) {
+        free(queues[q].entries);
+        int_map_free(&queues[q].index);
+    }
+    free(queues);
+    queues = NULL;
+    queue_count = queue_capacity = 0;
+    total_queued = 0;
+    free(inbox.items);
+    free(outbox.items);
+    memset(&inbox, 0, sizeof(inbox));
+    memset(&outbox, 0, sizeof(outbox));
+    free(pass_results);
+    pass_results = NULL;
+    pass_count = pass_capacity = 0;
+    free(steps);
+    steps = NULL;
+    step_capacity = 0;
+
+    int_map_free(&tickets);
+    int_map_free(&user_queue);
+    str_map_free(&queue_index);
+    if (notify_fd >= 0) close(notify_fd);
+    notify_fd = -1;
+}
+
+int mm_get_notify_fd(void) { return notify_fd; }
+
+static bool post_command(const mm_command_t* cmd) {
+    pthread_mutex_lock(&mm_lock);
+    if (inbox.count == inbox.capacity) {
+        int capacity = inbox.capacity ? inbox.capacity * 2 : 64;
+        mm_command_t* grown = realloc(inbox.items, (size_t)capacity * sizeof(*grown));
+        if (!grown) {
+            pthread_mutex_unlock(&mm_lock);
+            return false;
+        }
+        inbox.items = grown;
+        inbox.capacity = capacity;
+    }
+    inbox.items[inbox.count++] = *cmd;
+    pthread_cond_signal(&mm_cond);
+    pthread_mutex_unlock(&mm_lock);
+    return true;
+}
+
+// Post a join with a fresh ticket
+static bool post_join(mm_command_kind_t kind, mm_entry_t* entry) {
+    next_ticket = next_ticket == UINT32_MAX ? 1 : next_ticket + 1;
+    entry->ticket = next_ticket;
+    if (!int_map_put(&tickets, entry->user_id, (int)entry->ticket)) return false;
+
+    mm_command_t cmd = {.kind = kind, .entry = *entry};
+    if (!post_command(&cmd)) {
+        int_map_remove(&tickets, entry->user_id);
+        return false;
+    }
+    return true;
+}
+
+bool mm_enqueue(int user_id, int rating, bool rated, const time_control_t* time_control,
+                const char* start_fen, int bot_level) {
+    mm_entry_t entry = {0};
+    entry.user_id = user_id;
+    entry.rating = rating;
+    entry.queued_ms = clock_now_ms();  // Kept from the earlier join, if any
+    entry.bot_level = bot_level;
+    entry.time_control = time_control ? *time_control
+                                      : time_control_make(DEFAULT_BASE_TIME_MS, 0, 0, 0);
+    if (start_fen && start_fen[0]) {
+        snprintf(entry.start_fen, sizeof(entry.start_fen), "%s", start_fen);
+        rated = false;
+    }
+    entry.rated = rated;
+    return post_join(MM_CMD_JOIN, &entry);
+}
+
+bool mm_requeue(const mm_entry_t* entry) {
+    if (!entry) return false;
+    mm_entry_t copy = *entry;
+    return post_join(MM_CMD_REQUEUE, &copy);
+}
+
+void mm_remove(int user_id) {
+    int ticket;
+    if (!int_map_get(&tickets, user_id, &ticket)) return;
+    int_map_remove(&tickets, user_id);
+    mm_command_t cmd = {.kind = MM_CMD_LEAVE, .entry = {.user_id = user_id}};
+    post_command(&cmd);
+}
+
+// Is this still the player's current join? Consumes the ticket if so.
+static bool claim_ticket(const mm_entry_t* entry) {
+    int ticket;
+    if (!int_map_get(&tickets, entry->user_id, &ticket) || (uint32_t)ticket != entry->ticket) {
+        return false;
+    }
+    int_map_remove(&tickets, entry->user_id);
+    return true;
+}
+
+int mm_poll_results(mm_result_t* out, int max_count) {
+    // Reset the eventfd counter before draining so no wakeup is lost
+    uint64_t counter;
+    if (read(notify_fd, &counter, sizeof(counter)) < 0 && errno != EAGAIN) {
+        perror("matchmaking eventfd read");
+    }
+
+    mm_result_t taken[MM_MAX_RESULTS];
+    int taken_count = 0;
+    pthread_mutex_lock(&mm_lock);
+    while (outbox.head < outbox.count && taken_count < max_count &&
+           taken_count < MM_MAX_RESULTS) {
+        taken[taken_count++] = outbox.items[outbox.head++];
+    }
+    bool more = outbox.head < outbox.count;
+    if (!more) outbox.head = outbox.count = 0;
+    pthread_mutex_unlock(&mm_lock);
+
+    int count = 0;
+    for (int i = 0; i < taken_count; i++) {
+        const mm_result_t* result = &taken[i];
+        bool red_current = claim_ticket(&result->red);
+        if (result->kind == MM_RESULT_BOT) {
+            if (red_current) out[count++] = *result;
+            continue;
+        }
+        bool black_current = claim_ticket(&result->black);
+        if (red_current && black_current) {
+            out[count++] = *result;
+        } else if (red_current) {
+            mm_requeue(&result->red);
+        } else if (black_current) {
+            mm_requeue(&result->black);
+        }
+    }
+
+    // Leftovers: make sure the loop comes back for them
+    if (more) {
+        uint64_t one = 1;
+        if (write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            perror("matchmaking eventfd write");
+        }
+    }
+    return count;
+}
+
+static int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+void mm_get_stats(mm_stats_t* out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+
+    int sorted[MM_GAP_SAMPLES];
+    pthread_mutex_lock(&mm_lock);
+    out->queued = stat_queued;
+    out->queues = stat_queues;
+    out->pairs = pair_count;
+    out->avg_wait_ms = pair_count ? (int64_t)(wait_sum_ms / (pair_count * 2)) : 0;
+    int n = gap_filled;
+    memcpy(sorted, gap_samples, (size_t)n * sizeof(int));
+    pthread_mutex_unlock(&mm_lock);
+
+    if (n == 0) return;
+    qsort(sorted, n, sizeof(int), compare_ints);
+    out->gap_p50 = sorted[(n - 1) * 50 / 100];
+    out->gap_p90 = sorted[(n - 1) * 90 / 100];
+    out->gap_p99 = sorted[(n - 1) * 99 / 100];
+}
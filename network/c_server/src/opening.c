@@ -0,0 +1,481 @@
+/*
+ * opening.c - Opening explorer index
+ *
+ * File layout: header | opening_entry_t[entry_count], sorted by (hash, move).
+ * A position's moves are contiguous, so a lookup is one binary search over
+ * the map plus a probe of the pending table for each legal move. Merging
+ * streams the old file and the sorted pending entries into a new file,
+ * which replaces the old one with rename().
+ *
+ * The server merges on a background thread: the full pending table is
+ * handed over as `merging` and a fresh one takes new games, so lookups keep
+ * reading the old map, merging and pending until the event loop adopts the
+ * new file in opening_poll. The worker only reads the map and merging.
+ */
+
+#include "opening.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OPENING_MAGIC "XQOI\x01"
+
+typedef struct {
+    char magic[8];
+    uint64_t entry_count;
+    uint64_t game_count;
+} opening_file_header_t;
+
+static char index_path[512];
+static void* index_map = NULL;
+static size_t index_map_size = 0;
+static const opening_entry_t* index_entries = NULL;
+static size_t index_count = 0;
+static uint64_t index_games = 0;
+static opening_table_t pending;
+static size_t flush_at = OPENING_DELTA_MAX;  // Backs off after a failed merge
+
+enum { MERGE_IDLE, MERGE_RUNNING, MERGE_DONE };
+static opening_table_t merging;  // Owned by the worker while running
+static pthread_t merge_thread;
+static atomic_int merge_state = MERGE_IDLE;
+static bool merge_ok = false;  // Published by the store to merge_state
+
+// =========================
+// Accumulator
+// =========================
+
+static size_t slot_of(uint64_t hash, uint16_t move, size_t capacity) {
+    uint64_t h = hash ^ ((uint64_t)move * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 29;
+    return (size_t)h & (capacity - 1);
+}
+
+// Occupied slots have games > 0
+static opening_entry_t* table_find(const opening_table_t* table, uint64_t hash,
+                                   uint16_t move, bool* found) {
+    size_t i = slot_of(hash, move, table->capacity);
+    for (;;) {
+        opening_entry_t* slot = &table->slots[i];
+        if (slot->games == 0) {
+            *found = false;
+            return slot;
+        }
+        if (slot->hash == hash && slot->move == move) {
+            *found = true;
+            return slot;
+        }
+        i = (i + 1) & (table->capacity - 1);
+    }
+}
+
+bool opening_table_init(opening_table_t* table, size_t capacity) {
+    size_t cap = 1024;
+    while (cap < capacity) cap <<= 1;
+    table->slots = calloc(cap, sizeof(opening_entry_t));
+    table->capacity = table->slots ? cap : 0;
+    table->count = 0;
+    table->games = 0;
+    return table->slots != NULL;
+}
+
+void opening_table_free(opening_table_t* table) {
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+void opening_table_clear(opening_table_t* table) {
+    memset(table->slots, 0, table->capacity * sizeof(opening_entry_t));
+    table->count = 0;
+    table->games = 0;
+}
+
+static bool table_grow(opening_table_t* table) {
+    opening_table_t bigger;
+    if (!opening_table_init(&bigger, table->capacity * 2)) return false;
+    for (size_t i = 0; i < table->capacity; i++) {
+        const opening_entry_t* e = &table->slots[i];
+        if (e->games == 0) continue;
+        bool found;
+        *table_find(&bigger, e->hash, e->move, &found) = *e;
+    }
+    bigger.count = table->count;
+    bigger.games = table->games;
+    free(table->slots);
+    *table = bigger;
+    return true;
+}
+
+// Add src's counters into the (hash, move) slot
+static bool table_add(opening_table_t* table, const opening_entry_t* src) {
+    // Keep the load factor under 70%
+    if ((table->count + 1) * 10 > table->capacity * 7 && !table_grow(table)) return false;
+
+    bool found;
+    opening_entry_t* e = table_find(table, src->hash, src->move, &found);
+    if (!found) {
+        memset(e, 0, sizeof(*e));
+        e->hash = src->hash;
+        e->move = src->move;
+        table->count++;
+    }
+    e->games += src->games;
+    e->red_wins += src->red_wins;
+    e->black_wins += src->black_wins;
+    e->draws += src->draws;
+    e->rated_games += src->rated_games;
+    e->rating_sum += src->rating_sum;
+    return true;
+}
+
+bool opening_table_add_game(opening_table_t* table, const xq_move_t* moves, int move_count,
+                            opening_result_t result, int red_rating, int black_rating) {
+    xq_position_t pos;
+    xq_position_start(&pos);
+
+    opening_entry_t one;
+    memset(&one, 0, sizeof(one));
+    one.games = 1;
+    one.red_wins = result == OPENING_RED_WIN;
+    one.black_wins = result == OPENING_BLACK_WIN;
+    one.draws = result == OPENING_DRAW;
+
+    for (int i = 0; i < move_count && i < OPENING_MAX_PLY; i++) {
+        int rating = pos.side == XQ_RED ? red_rating : black_rating;
+        one.hash = pos.hash;
+        one.move = moves[i];
+        one.rated_games = rating > 0;
+        one.rating_sum = rating > 0 ? (uint64_t)rating : 0;
+        if (!table_add(table, &one)) return false;
+
+        xq_undo_t undo;
+        if (!xq_make_move(&pos, moves[i], &undo)) break;  // Callers pass legal moves
+    }
+    table->games++;
+    return true;
+}
+
+bool opening_table_merge(opening_table_t* into, const opening_table_t* from) {
+    for (size_t i = 0; i < from->capacity; i++) {
+        if (from->slots[i].games && !table_add(into, &from->slots[i])) return false;
+    }
+    into->games += from->games;
+    return true;
+}
+
+bool opening_result_parse(const char* result, opening_result_t* out) {
+    if (!result) return false;
+    if (strcmp(result, "red_wins") == 0 || strcmp(result, "red_win") == 0) {
+        *out = OPENING_RED_WIN;
+    } else if (strcmp(result, "black_wins") == 0 || strcmp(result, "black_win") == 0) {
+        *out = OPENING_BLACK_WIN;
+    } else if (strcmp(result, "draw") == 0) {
+        *out = OPENING_DRAW;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// =========================
+// File
+// =========================
+
+static int compare_entries(const void* a, const void* b) {
+    const opening_entry_t* x = a;
+    const opening_entry_t* y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return (int)x->move - (int)y->move;
+}
+
+static void add_counts(opening_entry_t* into, const opening_entry_t* from) {
+    into->games += from->games;
+    into->red_wins += from->red_wins;
+    into->black_wins += from->black_wins;
+    into->draws += from->draws;
+    into->rated_games += from->rated_games;
+    into->rating_sum += from->rating_sum;
+}
+
+bool opening_write_file(const char* path, const opening_entry_t* base, size_t base_count,
+                        uint64_t base_games, const opening_table_t* table) {
+    // Sorted copy of the table
+    size_t extra_count = 0;
+    opening_entry_t* extra = NULL;
+    if (table && table->count > 0) {
+        extra = malloc(table->count * sizeof(opening_entry_t));
+        if (!extra) return false;
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->slots[i].games) extra[extra_count++] = table->slots[i];
+        }
+        qsort(extra, extra_count, sizeof(opening_entry_t), compare_entries);
+    }
+
+    char tmp_path[600];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) {
+        free(extra);
+        return false;
+    }
+
+    opening_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OPENING_MAGIC, sizeof(OPENING_MAGIC) - 1);
+    header.game_count = base_games + (table ? table->games : 0);
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    // Two-way merge; equal keys are summed
+    size_t i = 0, j = 0;
+    uint64_t written = 0;
+    while (ok && (i < base_count || j < extra_count)) {
+        opening_entry_t e;
+        if (j >= extra_count || (i < base_count && compare_entries(&base[i], &extra[j]) < 0)) {
+            e = base[i++];
+        } else if (i >= base_count || compare_entries(&extra[j], &base[i]) < 0) {
+            e = extra[j++];
+        } else {
+            e = base[i++];
+            add_counts(&e, &extra[j++]);
+        }
+        ok = fwrite(&e, sizeof(e), 1, f) == 1;
+        written++;
+    }
+    free(extra);
+
+    // Entry count goes in last, once known
+    header.entry_count = written;
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    if (ok) ok = rename(tmp_path, path) == 0;
+    if (!ok) remove(tmp_path);
+    return ok;
+}
+
+static void unmap_index(void) {
+    if (index_map) munmap(index_map, index_map_size);
+    index_map = NULL;
+    index_map_size = 0;
+    index_entries = NULL;
+    index_count = 0;
+    index_games = 0;
+}
+
+static bool map_index(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(opening_file_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const opening_file_header_t* header = map;
+    if (memcmp(header->magic, OPENING_MAGIC, sizeof(OPENING_MAGIC) - 1) != 0 ||
+        header->entry_count > (size - sizeof(*header)) / sizeof(opening_entry_t)) {
+        munmap(map, size);
+        return false;
+    }
+
+    index_map = map;
+    index_map_size = size;
+    index_entries = (const opening_entry_t*)((const uint8_t*)map + sizeof(*header));
+    index_count = (size_t)header->entry_count;
+    index_games = header->game_count;
+    madvise(map, size, MADV_RANDOM);
+    return true;
+}
+
+// =========================
+// Server side
+// =========================
+
+bool opening_init(const char* path) {
+    snprintf(index_path, sizeof(index_path), "%s", path);
+    if (!opening_table_init(&pending, OPENING_DELTA_MAX * 2)) return false;
+
+    if (map_index(path)) {
+        printf("[OPENING] Loaded %zu entries from %llu games (%s)\n", index_count,
+               (unsigned long long)index_games, path);
+    } else {
+        printf("[OPENING] No index at %s, starting empty\n", path);
+    }
+    return true;
+}
+
+static void* merge_main(void* arg) {
+    (void)arg;
+    merge_ok = opening_write_file(index_path, index_entries, index_count, index_games,
+                                  &merging);
+    atomic_store(&merge_state, MERGE_DONE);
+    return NULL;
+}
+
+// Hand the pending games to a merge thread; new games go to a fresh table
+static bool merge_start(void) {
+    opening_table_t fresh;
+    if (!opening_table_init(&fresh, OPENING_DELTA_MAX * 2)) return false;
+    merging = pending;
+    pending = fresh;
+
+    atomic_store(&merge_state, MERGE_RUNNING);
+    if (pthread_create(&merge_thread, NULL, merge_main, NULL) != 0) {
+        atomic_store(&merge_state, MERGE_IDLE);
+        opening_table_free(&pending);
+        pending = merging;
+        memset(&merging, 0, sizeof(merging));
+        return false;
+    }
+    return true;
+}
+
+// Wait for the merge thread and adopt its file, or take its games back
+static bool merge_finish(void) {
+    pthread_join(merge_thread, NULL);
+    atomic_store(&merge_state, MERGE_IDLE);
+
+    if (!merge_ok) {
+        printf("[OPENING] Failed to write %s\n", index_path);
+        // Back into pending for the next attempt
+        if (!opening_table_merge(&pending, &merging)) {
+            printf("[OPENING] Out of memory, dropped %llu games\n",
+                   (unsigned long long)merging.games);
+        }
+        opening_table_free(&merging);
+        flush_at = pending.count * 2;
+        return false;
+    }
+    flush_at = OPENING_DELTA_MAX;
+    // The old map stays valid until unmapped, even though the file was replaced
+    unmap_index();
+    opening_table_free(&merging);
+    if (!map_index(index_path)) {
+        printf("[OPENING] Failed to map %s after merge\n", index_path);
+        return false;
+    }
+    return true;
+}
+
+void opening_poll(void) {
+    if (atomic_load(&merge_state) == MERGE_DONE) merge_finish();
+}
+
+bool opening_flush(void) {
+    if (atomic_load(&merge_state) != MERGE_IDLE) merge_finish();
+    if (pending.count == 0) return true;
+
+    if (!opening_write_file(index_path, index_entries, index_count, index_games, &pending)) {
+        printf("[OPENING] Failed to write %s\n", index_path);
+        flush_at = pending.count * 2;
+        return false;
+    }
+    flush_at = OPENING_DELTA_MAX;
+    // The old map stays valid until unmapped, even though the file was replaced
+    unmap_index();
+    opening_table_clear(&pending);
+    if (!map_index(index_path)) {
+        printf("[OPENING] Failed to map %s after merge\n", index_path);
+        return false;
+    }
+    return true;
+}
+
+void opening_shutdown(void) {
+    opening_flush();
+    unmap_index();
+    opening_table_free(&pending);
+}
+
+bool opening_record_game(const xq_move_t* moves, int move_count, opening_result_t result,
+                         int red_rating, int black_rating) {
+    if (!pending.slots) return false;
+    if (!opening_table_add_game(&pending, moves, move_count, result, red_rating,
+                                black_rating)) {
+        return false;
+    }
+    if (pending.count >= flush_at && atomic_load(&merge_state) == MERGE_IDLE &&
+        !merge_start()) {
+        flush_at = pending.count * 2;
+    }
+    return true;
+}
+
+// First entry with this hash, or index_count
+static size_t lower_bound(uint64_t hash) {
+    size_t lo = 0, hi = index_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index_entries[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int compare_replies(const void* a, const void* b) {
+    const opening_reply_t* x = a;
+    const opening_reply_t* y = b;
+    if (x->stats.games != y->stats.games) return x->stats.games > y->stats.games ? -1 : 1;
+    return (int)x->move - (int)y->move;
+}
+
+int opening_lookup(xq_position_t* pos, opening_reply_t* out, int max_count) {
+    // Only legal moves are reported, which also screens out hash collisions.
+    // Legality is checked last, for the few moves that were ever played.
+    xq_move_t legal[XQ_MAX_MOVES];
+    int legal_count = xq_generate_moves(pos, legal, false);
+    opening_reply_t replies[XQ_MAX_MOVES];
+    memset(replies, 0, (size_t)legal_count * sizeof(opening_reply_t));
+    for (int i = 0; i < legal_count; i++) replies[i].move = legal[i];
+
+    for (size_t e = lower_bound(pos->hash); e < index_count && index_entries[e].hash == pos->hash;
+         e++) {
+        for (int i = 0; i < legal_count; i++) {
+            if (legal[i] == index_entries[e].move) {
+                add_counts(&replies[i].stats, &index_entries[e]);
+                break;
+            }
+        }
+    }
+    // Games being merged are still counted from their table
+    const opening_table_t* tables[] = {&pending, &merging};
+    for (int t = 0; t < 2; t++) {
+        if (tables[t]->count == 0) continue;
+        for (int i = 0; i < legal_count; i++) {
+            bool found;
+            const opening_entry_t* e = table_find(tables[t], pos->hash, legal[i], &found);
+            if (found) add_counts(&replies[i].stats, e);
+        }
+    }
+
+    int count = 0;
+    for (int i = 0; i < legal_count; i++) {
+        xq_undo_t undo;
+        if (replies[i].stats.games == 0 || !xq_make_move(pos, legal[i], &undo)) continue;
+        xq_unmake_move(pos, &undo);
+        replies[count++] = replies[i];
+    }
+    qsort(replies, (size_t)count, sizeof(opening_reply_t), compare_replies);
+    if (count > max_count) count = max_count;
+    memcpy(out, replies, (size_t)count * sizeof(opening_reply_t));
+    return count;
+}
+
+uint64_t opening_game_count(void) { return index_games + merging.games + pending.games; }
+
+size_t opening_entry_count(void) { return index_count + merging.count + pending.count; }
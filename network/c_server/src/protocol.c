@@ -53,6 +53,21 @@ int json_get_int(const char* json, const char* key) {
     return atoi(pos);
 }
 
+long long json_get_int64(const char* json, const char* key) {
+    if (!json || !key) return 0;
+
+    char search[256];
+    snprintf(search, sizeof(search), "\"%s\":", key);
+
+    const char* pos = strstr(json, search);
+    if (!pos) return 0;
+
+    pos += strlen(search);
+    while (*pos && isspace(*pos)) pos++;
+
+    return atoll(pos);
+}
+
 bool json_get_bool(const char* json, const char* key) {
     if (!json || !key) return false;
     
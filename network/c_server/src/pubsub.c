@@ -0,0 +1,350 @@
+/*
+ * pubsub.c - Topic subscriptions and shared-frame fanout
+ */
+
+#include "../include/pubsub.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/clock.h"
+#include "../include/hashmap.h"
+
+typedef struct ps_topic ps_topic_t;
+
+// One (topic, client) pair, on two intrusive lists
+typedef struct ps_subscription {
+    ps_topic_t* topic;
+    client_t* client;
+    struct ps_subscription* topic_prev;
+    struct ps_subscription* topic_next;
+    struct ps_subscription* client_prev;
+    struct ps_subscription* client_next;
+    // Latest-state mode: frames are skipped until the client's queue drains
+    bool lagging;
+    int64_t lagging_since_ms;
+    struct ps_subscription* lag_prev;  // Lagging list, oldest first
+    struct ps_subscription* lag_next;
+} ps_subscription_t;
+
+struct ps_topic {
+    char name[PUBSUB_TOPIC_MAX];
+    int index;  // Position in topics[]
+    int subscriber_count;
+    ps_subscription_t* subscribers;
+    // Last PUBSUB_HISTORY sequenced frames (ring, oldest at history_head)
+    frame_t* history[PUBSUB_HISTORY];
+    uint32_t history_seq[PUBSUB_HISTORY];
+    int history_head;
+    int history_count;
+};
+
+// Live topics, densely packed; name_index maps a name to its position
+static ps_topic_t** topics = NULL;
+static int topic_count = 0;
+static int topic_capacity = 0;
+static str_map_t name_index;
+
+// Every lagging subscription, in the order they fell behind
+static ps_subscription_t* lag_head = NULL;
+static ps_subscription_t* lag_tail = NULL;
+
+static pubsub_snapshot_fn snapshot_fn = NULL;
+static uint64_t coalesced_count = 0;
+static uint64_t evicted_count = 0;
+static uint64_t membership_changes = 0;
+
+bool pubsub_init(pubsub_snapshot_fn snapshot) {
+    topics = NULL;
+    topic_count = 0;
+    topic_capacity = 0;
+    lag_head = lag_tail = NULL;
+    snapshot_fn = snapshot;
+    coalesced_count = 0;
+    evicted_count = 0;
+    if (!str_map_init(&name_index, 64)) {
+        fprintf(stderr, "Failed to allocate pubsub topic index\n");
+        return false;
+    }
+    return true;
+}
+
+void pubsub_shutdown(void) {
+    while (topic_count > 0) {
+        pubsub_close_topic(topics[topic_count - 1]->name);
+    }
+    free(topics);
+    topics = NULL;
+    topic_capacity = 0;
+    str_map_free(&name_index);
+}
+
+static ps_topic_t* topic_find(const char* name) {
+    int index;
+    if (!name || !str_map_get(&name_index, name, &index)) return NULL;
+    return topics[index];
+}
+
+static ps_topic_t* topic_get_or_create(const char* name) {
+    ps_topic_t* topic = topic_find(name);
+    if (topic) return topic;
+    if (strlen(name) >= PUBSUB_TOPIC_MAX) return NULL;
+
+    if (topic_count == topic_capacity) {
+        int capacity = topic_capacity ? topic_capacity * 2 : 64;
+        ps_topic_t** grown = realloc(topics, capacity * sizeof(*grown));
+        if (!grown) return NULL;
+        topics = grown;
+        topic_capacity = capacity;
+    }
+
+    topic = calloc(1, sizeof(*topic));
+    if (!topic) return NULL;
+    snprintf(topic->name, sizeof(topic->name), "%s", name);
+    topic->index = topic_count;
+    if (!str_map_put(&name_index, topic->name, topic->index)) {
+        free(topic);
+        return NULL;
+    }
+    topics[topic_count++] = topic;
+    return topic;
+}
+
+// Remove an empty topic, moving the last one into its place
+static void topic_destroy(ps_topic_t* topic) {
+    str_map_remove(&name_index, topic->name);
+
+    ps_topic_t* last = topics[--topic_count];
+    if (last != topic) {
+        last->index = topic->index;
+        topics[last->index] = last;
+        str_map_put(&name_index, last->name, last->index);
+    }
+    for (int i = 0; i < topic->history_count; i++) {
+        frame_unref(topic->history[(topic->history_head + i) % PUBSUB_HISTORY]);
+    }
+    free(topic);
+}
+
+static ps_subscription_t* subscription_find(const ps_topic_t* topic,
+                                            const client_t* client) {
+    // A client holds at most PUBSUB_MAX_TOPICS_PER_CLIENT subscriptions
+    for (ps_subscription_t* sub = client->subscriptions; sub; sub = sub->client_next) {
+        if (sub->topic == topic) return sub;
+    }
+    return NULL;
+}
+
+static void lag_start(ps_subscription_t* sub) {
+    sub->lagging = true;
+    sub->lagging_since_ms = clock_now_ms();
+    sub->lag_next = NULL;
+    sub->lag_prev = lag_tail;
+    if (lag_tail) lag_tail->lag_next = sub;
+    else lag_head = sub;
+    lag_tail = sub;
+    coalesced_count++;
+}
+
+static void lag_stop(ps_subscription_t* sub) {
+    if (sub->lag_prev) sub->lag_prev->lag_next = sub->lag_next;
+    else lag_head = sub->lag_next;
+    if (sub->lag_next) sub->lag_next->lag_prev = sub->lag_prev;
+    else lag_tail = sub->lag_prev;
+    sub->lag_prev = sub->lag_next = NULL;
+    sub->lagging = false;
+}
+
+static void subscription_remove(ps_subscription_t* sub) {
+    ps_topic_t* topic = sub->topic;
+    client_t* client = sub->client;
+
+    if (sub->lagging) lag_stop(sub);
+
+    if (sub->topic_prev) sub->topic_prev->topic_next = sub->topic_next;
+    else topic->subscribers = sub->topic_next;
+    if (sub->topic_next) sub->topic_next->topic_prev = sub->topic_prev;
+
+    if (sub->client_prev) sub->client_prev->client_next = sub->client_next;
+    else client->subscriptions = sub->client_next;
+    if (sub->client_next) sub->client_next->client_prev = sub->client_prev;
+
+    topic->subscriber_count--;
+    client->subscription_count--;
+    membership_changes++;
+    free(sub);
+
+    if (topic->subscriber_count == 0) topic_destroy(topic);
+}
+
+bool pubsub_subscribe(const char* topic_name, client_t* client) {
+    if (!topic_name || !client) return false;
+
+    ps_topic_t* topic = topic_find(topic_name);
+    if (topic && subscription_find(topic, client)) return true;
+    if (client->subscription_count >= PUBSUB_MAX_TOPICS_PER_CLIENT) return false;
+
+    if (!topic) topic = topic_get_or_create(topic_name);
+    if (!topic) return false;
+
+    ps_subscription_t* sub = calloc(1, sizeof(*sub));
+    if (!sub) {
+        if (topic->subscriber_count == 0) topic_destroy(topic);
+        return false;
+    }
+    sub->topic = topic;
+    sub->client = client;
+
+    sub->topic_next = topic->subscribers;
+    if (topic->subscribers) topic->subscribers->topic_prev = sub;
+    topic->subscribers = sub;
+    topic->subscriber_count++;
+
+    sub->client_next = client->subscriptions;
+    if (client->subscriptions) client->subscriptions->client_prev = sub;
+    client->subscriptions = sub;
+    client->subscription_count++;
+    membership_changes++;
+
+    return true;
+}
+
+bool pubsub_unsubscribe(const char* topic_name, client_t* client) {
+    if (!client) return false;
+
+    ps_topic_t* topic = topic_find(topic_name);
+    if (!topic) return false;
+
+    ps_subscription_t* sub = subscription_find(topic, client);
+    if (!sub) return false;
+
+    subscription_remove(sub);
+    return true;
+}
+
+void pubsub_unsubscribe_all(client_t* client) {
+    if (!client) return;
+    while (client->subscriptions) {
+        subscription_remove(client->subscriptions);
+    }
+}
+
+static void topic_record(ps_topic_t* topic, uint32_t seq, frame_t* frame) {
+    int slot;
+    if (topic->history_count == PUBSUB_HISTORY) {
+        slot = topic->history_head;
+        frame_unref(topic->history[slot]);
+        topic->history_head = (topic->history_head + 1) % PUBSUB_HISTORY;
+    } else {
+        slot = (topic->history_head + topic->history_count++) % PUBSUB_HISTORY;
+    }
+    frame_ref(frame);
+    topic->history[slot] = frame;
+    topic->history_seq[slot] = seq;
+}
+
+int pubsub_publish(server_t* server, const char* topic_name, uint32_t seq,
+                   const char* message) {
+    if (!server || !message) return 0;
+
+    // Nobody to deliver to or replay for: the topic only exists while
+    // someone is subscribed
+    ps_topic_t* topic = topic_find(topic_name);
+    if (!topic) return 0;
+
+    frame_t* frame = frame_create(message, strlen(message));
+    if (!frame) return 0;
+    if (seq > 0) topic_record(topic, seq, frame);
+
+    int delivered = 0;
+    for (ps_subscription_t* sub = topic->subscribers; sub; sub = sub->topic_next) {
+        if (sub->lagging) continue;  // Caught up by a snapshot later
+        if (sub->client->outq_bytes >= PUBSUB_LAG_BYTES) {
+            lag_start(sub);
+            printf("[PubSub] fd %d lagging on %s (%zu bytes queued)\n",
+                   sub->client->fd, topic->name, sub->client->outq_bytes);
+            continue;
+        }
+        if (client_send_frame(server, sub->client, frame)) delivered++;
+    }
+    frame_unref(frame);
+
+    return delivered;
+}
+
+int pubsub_replay(server_t* server, const char* topic_name, client_t* client,
+                  uint32_t after_seq) {
+    ps_topic_t* topic = topic_find(topic_name);
+    if (!topic || topic->history_count == 0) return -1;
+
+    // Recorded seqs are consecutive, so the history covers after_seq if its
+    // oldest frame is at most one past it
+    uint32_t oldest = topic->history_seq[topic->history_head];
+    if (after_seq + 1 < oldest) return -1;
+
+    int sent = 0;
+    for (int i = 0; i < topic->history_count; i++) {
+        int slot = (topic->history_head + i) % PUBSUB_HISTORY;
+        if (topic->history_seq[slot] <= after_seq) continue;
+        if (!client_send_frame(server, client, topic->history[slot])) return -1;
+        sent++;
+    }
+    return sent;
+}
+
+void pubsub_close_topic(const char* topic_name) {
+    ps_topic_t* topic = topic_find(topic_name);
+    if (!topic) return;
+
+    // The last removal destroys the topic
+    int remaining = topic->subscriber_count;
+    while (remaining-- > 0) {
+        subscription_remove(topic->subscribers);
+    }
+}
+
+void pubsub_client_drained(server_t* server, client_t* client) {
+    for (ps_subscription_t* sub = client->subscriptions; sub; sub = sub->client_next) {
+        if (!sub->lagging) continue;
+        lag_stop(sub);
+
+        // One frame with the latest state replaces everything skipped
+        char snapshot[4096];
+        if (snapshot_fn && snapshot_fn(sub->topic->name, snapshot, sizeof(snapshot))) {
+            client_send(server, client, snapshot);
+        }
+    }
+}
+
+void pubsub_evict_stalled(server_t* server, int64_t now_ms) {
+    while (lag_head && now_ms - lag_head->lagging_since_ms >= PUBSUB_EVICT_MS) {
+        ps_subscription_t* sub = lag_head;
+        client_t* client = sub->client;
+
+        char notice[160];
+        snprintf(notice, sizeof(notice),
+                 "{\"type\":\"spectate_ended\",\"payload\":{\"match_id\":\"%s\","
+                 "\"reason\":\"slow_consumer\"}}",
+                 sub->topic->name);
+        printf("[PubSub] Evicting fd %d from %s (stalled %lld ms)\n", client->fd,
+               sub->topic->name, (long long)(now_ms - sub->lagging_since_ms));
+
+        subscription_remove(sub);
+        evicted_count++;
+        client_send(server, client, notice);
+    }
+}
+
+int pubsub_subscriber_count(const char* topic_name) {
+    ps_topic_t* topic = topic_find(topic_name);
+    return topic ? topic->subscriber_count : 0;
+}
+
+int pubsub_topic_count(void) { return topic_count; }
+
+uint64_t pubsub_coalesced_count(void) { return coalesced_count; }
+
+uint64_t pubsub_evicted_count(void) { return evicted_count; }
+
+uint64_t pubsub_membership_changes(void) { return membership_changes; }
@@ -0,0 +1,274 @@
+/*
+ * ranking.c - Order-statistic leaderboard (treap with subtree sizes)
+ */
+
+#include "../include/ranking.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/db.h"
+#include "../include/hashmap.h"
+#include "../include/rating.h"
+
+typedef struct {
+    profile_t profile;
+    int key;            // Conservative rating: the order of the board
+    uint32_t priority;  // Heap order: parents above children
+    int size;           // Nodes in this subtree
+    int left;           // Better ranked (-1 = none)
+    int right;          // Worse ranked
+} rank_node_t;
+
+// Nodes live in one growable array and link by index; users are never
+// removed, so there is no free list.
+static rank_node_t* nodes = NULL;
+static int node_count = 0;
+static int node_capacity = 0;
+static int root = -1;
+static int_map_t user_index;  // user_id -> node
+
+// murmur3 finalizer: priorities independent of the key order
+static uint32_t node_priority(int user_id) {
+    uint32_t h = (uint32_t)user_id;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Does a rank above b? Higher key first, then lower user_id.
+static bool ranks_before(int a_key, int a_user, int b_key, int b_user) {
+    return a_key != b_key ? a_key > b_key : a_user < b_user;
+}
+
+static int profile_key(const profile_t* profile) {
+    return rating_conservative(profile->rating, profile->rd);
+}
+
+static int subtree_size(int t) { return t >= 0 ? nodes[t].size : 0; }
+
+static void update_size(int t) {
+    nodes[t].size = 1 + subtree_size(nodes[t].left) + subtree_size(nodes[t].right);
+}
+
+// Split t into nodes ranked before (key, user_id) and the rest
+static void split(int t, int key, int user_id, int* out_left, int* out_right) {
+    if (t < 0) {
+        *out_left = *out_right = -1;
+        return;
+    }
+    if (ranks_before(nodes[t].key, nodes[t].profile.user_id, key, user_id)) {
+        split(nodes[t].right, key, user_id, &nodes[t].right, out_right);
+        *out_left = t;
+    } else {
+        split(nodes[t].left, key, user_id, out_left, &nodes[t].left);
+        *out_right = t;
+    }
+    update_size(t);
+}
+
+// Join two treaps where every node of a ranks before every node of b
+static int merge(int a, int b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    if (nodes[a].priority > nodes[b].priority) {
+        nodes[a].right = merge(nodes[a].right, b);
+        update_size(a);
+        return a;
+    }
+    nodes[b].left = merge(a, nodes[b].left);
+    update_size(b);
+    return b;
+}
+
+static void tree_insert(int n) {
+    int left, right;
+    split(root, nodes[n].key, nodes[n].profile.user_id, &left, &right);
+    root = merge(merge(left, n), right);
+}
+
+// Unlink node n (still indexed by user_id)
+static void tree_remove(int n) {
+    int left, right;
+    split(root, nodes[n].key, nodes[n].profile.user_id, &left, &right);
+    // n is the best ranked node of the right part; every node on the way
+    // down to it loses one from its size
+    int parent = -1, t = right;
+    while (nodes[t].left >= 0) {
+        nodes[t].size--;
+        parent = t;
+        t = nodes[t].left;
+    }
+    if (parent < 0) right = nodes[t].right;
+    else nodes[parent].left = nodes[t].right;
+    root = merge(left, right);
+}
+
+static int ranking_node(int user_id) {
+    int n;
+    return int_map_get(&user_index, user_id, &n) ? n : -1;
+}
+
+bool ranking_put(const profile_t* profile) {
+    if (!profile || profile->user_id <= 0) return false;
+
+    int key = profile_key(profile);
+    int n = ranking_node(profile->user_id);
+    if (n >= 0) {
+        if (nodes[n].key != key) {
+            tree_remove(n);
+            nodes[n].profile = *profile;
+            nodes[n].key = key;
+            nodes[n].left = nodes[n].right = -1;
+            nodes[n].size = 1;
+            tree_insert(n);
+        } else {
+            nodes[n].profile = *profile;
+        }
+        return true;
+    }
+
+    if (node_count == node_capacity) {
+        int capacity = node_capacity ? node_capacity * 2 : 1024;
+        rank_node_t* grown = realloc(nodes, (size_t)capacity * sizeof(*nodes));
+        if (!grown) return false;
+        nodes = grown;
+        node_capacity = capacity;
+    }
+    n = node_count;
+    if (!int_map_put(&user_index, profile->user_id, n)) return false;
+    node_count++;
+
+    nodes[n].profile = *profile;
+    nodes[n].key = key;
+    nodes[n].priority = node_priority(profile->user_id);
+    nodes[n].size = 1;
+    nodes[n].left = nodes[n].right = -1;
+    tree_insert(n);
+    return true;
+}
+
+void ranking_set_rating(int user_id, int rating) {
+    int n = ranking_node(user_id);
+    if (n < 0) return;
+    profile_t profile = nodes[n].profile;
+    profile.rating = rating;
+    ranking_put(&profile);
+}
+
+void ranking_set_stats(int user_id, int wins, int losses, int draws) {
+    int n = ranking_node(user_id);
+    if (n < 0) return;
+    nodes[n].profile.wins = wins;
+    nodes[n].profile.losses = losses;
+    nodes[n].profile.draws = draws;
+}
+
+static bool ranking_load_row(int user_id, const char* username, int rating, double rd,
+                             int wins, int losses, int draws, void* ctx) {
+    bool* loaded = ctx;
+    profile_t profile = {.user_id = user_id,
+                         .rating = rating,
+                         .rd = rd,
+                         .wins = wins,
+                         .losses = losses,
+                         .draws = draws};
+    snprintf(profile.username, sizeof(profile.username), "%s", username);
+    *loaded = ranking_put(&profile);
+    return *loaded;
+}
+
+bool ranking_init(void) {
+    if (!int_map_init(&user_index, 2048)) return false;
+    node_count = 0;
+    root = -1;
+
+    bool loaded = true;
+    if (!db_scan_users(ranking_load_row, &loaded) || !loaded) {
+        fprintf(stderr, "[Ranking] Failed to load users\n");
+        ranking_shutdown();
+        return false;
+    }
+    printf("[Ranking] Loaded %d players\n", node_count);
+    return true;
+}
+
+void ranking_shutdown(void) {
+    free(nodes);
+    nodes = NULL;
+    node_count = node_capacity = 0;
+    root = -1;
+    int_map_free(&user_index);
+}
+
+int ranking_count(void) { return node_count; }
+
+int ranking_rank_of(int user_id) {
+    int n = ranking_node(user_id);
+    if (n < 0) return 0;
+
+    int before = 0;
+    int t = root;
+    while (t >= 0 && t != n) {
+        if (ranks_before(nodes[t].key, nodes[t].profile.user_id, nodes[n].key,
+                         nodes[n].profile.user_id)) {
+            before += subtree_size(nodes[t].left) + 1;
+            t = nodes[t].right;
+        } else {
+            t = nodes[t].left;
+        }
+    }
+    return t == n ? before + subtree_size(nodes[n].left) + 1 : 0;
+}
+
+// Node at a 0-based position, -1 if out of range
+static int select_node(int index) {
+    int t = root;
+    while (t >= 0) {
+        int left = subtree_size(nodes[t].left);
+        if (index < left) {
+            t = nodes[t].left;
+        } else if (index == left) {
+            return t;
+        } else {
+            index -= left + 1;
+            t = nodes[t].right;
+        }
+    }
+    return -1;
+}
+
+bool ranking_at(int rank, profile_t* out) {
+    int n = select_node(rank - 1);
+    if (n < 0 || !out) return false;
+    *out = nodes[n].profile;
+    return true;
+}
+
+int ranking_page_json(int first, int limit, char* out_json, size_t json_size) {
+    if (!out_json || json_size < 3) return -1;
+    if (first < 1) first = 1;
+
+    size_t len = snprintf(out_json, json_size, "[");
+    int written = 0;
+    for (int rank = first; written < limit && rank <= node_count; rank++) {
+        const profile_t* p = &nodes[select_node(rank - 1)].profile;
+        len += snprintf(out_json + len, json_size - len,
+                        "%s{\"rank\":%d,\"user_id\":%d,\"username\":\"%s\",\"rating\":%d,"
+                        "\"rd\":%d,\"provisional\":%s,\"wins\":%d,\"losses\":%d,"
+                        "\"draws\":%d}",
+                        written > 0 ? "," : "", rank, p->user_id, p->username, p->rating,
+                        (int)lround(p->rd), p->rd > GLICKO_PROVISIONAL_RD ? "true" : "false",
+                        p->wins, p->losses, p->draws);
+        if (len >= json_size) return -1;
+        written++;
+    }
+    len += snprintf(out_json + len, json_size - len, "]");
+    return len < json_size ? written : -1;
+}
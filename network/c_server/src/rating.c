@@ -1,40 +1,212 @@
 /*
- * rating.c - Elo rating calculation
+ * rating.c - Glicko-2 rating calculation (live games and batch periods)
  */
 
 #include "rating.h"
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
-// Expected score (probability of winning)
-double rating_expected_score(int rating_a, int rating_b) {
-    return 1.0 / (1.0 + pow(10.0, (rating_b - rating_a) / 400.0));
+// Glicko-2 works on its own scale: mu = (r - 1500) / 173.7178
+#define GLICKO_CENTER 1500.0
+#define GLICKO_SCALE 173.7178
+#define GLICKO_EPSILON 0.000001  // Volatility iteration tolerance
+
+glicko_t rating_glicko_new(void) {
+    return (glicko_t){DEFAULT_RATING, GLICKO_DEFAULT_RD, GLICKO_DEFAULT_VOLATILITY};
+}
+
+double rating_red_score(const char* result) {
+    if (strcmp(result, "red_wins") == 0) return 1.0;
+    if (strcmp(result, "black_wins") == 0) return 0.0;
+    if (strcmp(result, "draw") == 0) return 0.5;
+    return -1.0;
+}
+
+int rating_conservative(double rating, double rd) { return (int)lround(rating - 2.0 * rd); }
+
+// Weight of a game against an opponent of deviation phi
+static double glicko_g(double phi) { return 1.0 / sqrt(1.0 + 3.0 * phi * phi / (M_PI * M_PI)); }
+
+static double glicko_expected(double mu, double mu_opponent, double g_opponent) {
+    return 1.0 / (1.0 + exp(-g_opponent * (mu - mu_opponent)));
 }
 
-// Calculate rating changes
-rating_change_t rating_calculate(int red_rating, int black_rating,
-                                 const char* result, int k_factor) {
-    rating_change_t change = {0, 0};
+double rating_expected_score(const glicko_t* a, const glicko_t* b) {
+    return glicko_expected((a->rating - GLICKO_CENTER) / GLICKO_SCALE,
+                           (b->rating - GLICKO_CENTER) / GLICKO_SCALE,
+                           glicko_g(b->rd / GLICKO_SCALE));
+}
 
-    double red_expected = rating_expected_score(red_rating, black_rating);
-    double black_expected = 1.0 - red_expected;
+// New volatility (Glickman's step 5, Illinois variant of regula falsi)
+static double glicko_volatility(double phi, double sigma, double v, double delta,
+                                double tau) {
+    double a = log(sigma * sigma);
+    double phi2 = phi * phi;
+    double delta2 = delta * delta;
+    double tau2 = tau * tau;
 
-    double red_score, black_score;
+#define GLICKO_F(x)                                                              \
+    (exp(x) * (delta2 - phi2 - v - exp(x)) /                                     \
+         (2.0 * (phi2 + v + exp(x)) * (phi2 + v + exp(x))) - ((x) - a) / tau2)
+
+    double lo = a;
+    double hi;
+    if (delta2 > phi2 + v) {
+        hi = log(delta2 - phi2 - v);
+    } else {
+        int k = 1;
+        while (GLICKO_F(a - k * tau) < 0 && k < 64) k++;
+        hi = a - k * tau;
+    }
 
-    if (strcmp(result, "red_wins") == 0) {
-        red_score = 1.0;
-        black_score = 0.0;
-    } else if (strcmp(result, "black_wins") == 0) {
-        red_score = 0.0;
-        black_score = 1.0;
-    } else {  // draw
-        red_score = 0.5;
-        black_score = 0.5;
+    double f_lo = GLICKO_F(lo);
+    double f_hi = GLICKO_F(hi);
+    for (int i = 0; i < 100 && fabs(hi - lo) > GLICKO_EPSILON; i++) {
+        double c = lo + (lo - hi) * f_lo / (f_hi - f_lo);
+        double f_c = GLICKO_F(c);
+        if (f_c * f_hi <= 0) {
+            lo = hi;
+            f_lo = f_hi;
+        } else {
+            f_lo /= 2.0;
+        }
+        hi = c;
+        f_hi = f_c;
     }
+#undef GLICKO_F
 
-    change.red_change = (int)round(k_factor * (red_score - red_expected));
-    change.black_change = (int)round(k_factor * (black_score - black_expected));
+    return exp(lo / 2.0);
+}
+
+// Steps 3-8 for a player who played this period: v_inv and score_sum are
+// the sums over their games of g^2 E (1 - E) and g (s - E)
+static void glicko_update(double* mu, double* phi, double* sigma, double v_inv,
+                          double score_sum, double tau) {
+    double v = 1.0 / v_inv;
+    double sigma_new = glicko_volatility(*phi, *sigma, v, v * score_sum, tau);
+    double phi_star2 = *phi * *phi + sigma_new * sigma_new;
+    double phi_new = 1.0 / sqrt(1.0 / phi_star2 + v_inv);
+
+    *mu += phi_new * phi_new * score_sum;
+    *phi = phi_new;
+    *sigma = sigma_new;
+}
+
+// A player who sat the period out only becomes less certain, up to a new
+// player's deviation
+static double glicko_idle_phi(double phi, double sigma) {
+    double grown = sqrt(phi * phi + sigma * sigma);
+    double cap = GLICKO_DEFAULT_RD / GLICKO_SCALE;
+    return grown < cap ? grown : cap;
+}
+
+void rating_glicko_game(glicko_t* red, glicko_t* black, double red_score, double tau) {
+    double mu[2] = {(red->rating - GLICKO_CENTER) / GLICKO_SCALE,
+                    (black->rating - GLICKO_CENTER) / GLICKO_SCALE};
+    double phi[2] = {red->rd / GLICKO_SCALE, black->rd / GLICKO_SCALE};
+    double sigma[2] = {red->volatility, black->volatility};
+    double score[2] = {red_score, 1.0 - red_score};
+    double g[2] = {glicko_g(phi[0]), glicko_g(phi[1])};
+
+    // Both sides against the other's pre-game values
+    double v_inv[2], score_sum[2];
+    for (int i = 0; i < 2; i++) {
+        int o = 1 - i;
+        double e = glicko_expected(mu[i], mu[o], g[o]);
+        v_inv[i] = g[o] * g[o] * e * (1.0 - e);
+        score_sum[i] = g[o] * (score[i] - e);
+    }
 
-    return change;
+    glicko_t* players[2] = {red, black};
+    for (int i = 0; i < 2; i++) {
+        glicko_update(&mu[i], &phi[i], &sigma[i], v_inv[i], score_sum[i], tau);
+        players[i]->rating = mu[i] * GLICKO_SCALE + GLICKO_CENTER;
+        players[i]->rd = phi[i] * GLICKO_SCALE;
+        players[i]->volatility = sigma[i];
+    }
+}
+
+// =========================
+// Batch periods
+// =========================
+
+bool rating_batch_init(rating_batch_t* batch, int count, double rating, double rd,
+                       double volatility) {
+    memset(batch, 0, sizeof(*batch));
+    size_t n = count > 0 ? (size_t)count : 1;
+    double** arrays[] = {&batch->rating, &batch->rd,    &batch->volatility,
+                         &batch->mu,     &batch->phi,   &batch->g,
+                         &batch->v_inv,  &batch->score_sum};
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++) {
+        *arrays[a] = malloc(n * sizeof(double));
+        if (!*arrays[a]) {
+            rating_batch_free(batch);
+            return false;
+        }
+    }
+    batch->count = count;
+    for (int i = 0; i < count; i++) {
+        batch->rating[i] = rating;
+        batch->rd[i] = rd;
+        batch->volatility[i] = volatility;
+    }
+    return true;
+}
+
+void rating_batch_free(rating_batch_t* batch) {
+    free(batch->rating);
+    free(batch->rd);
+    free(batch->volatility);
+    free(batch->mu);
+    free(batch->phi);
+    free(batch->g);
+    free(batch->v_inv);
+    free(batch->score_sum);
+    memset(batch, 0, sizeof(*batch));
+}
+
+void rating_batch_period(rating_batch_t* batch, const int* red, const int* black,
+                         const double* red_score, int game_count, double tau) {
+    int n = batch->count;
+    double* restrict mu = batch->mu;
+    double* restrict phi = batch->phi;
+    double* restrict g = batch->g;
+    double* restrict v_inv = batch->v_inv;
+    double* restrict score_sum = batch->score_sum;
+
+    // To the Glicko-2 scale, and each player's weight as an opponent
+    for (int i = 0; i < n; i++) {
+        mu[i] = (batch->rating[i] - GLICKO_CENTER) / GLICKO_SCALE;
+        phi[i] = batch->rd[i] / GLICKO_SCALE;
+        g[i] = 1.0 / sqrt(1.0 + 3.0 * phi[i] * phi[i] / (M_PI * M_PI));
+        v_inv[i] = 0.0;
+        score_sum[i] = 0.0;
+    }
+
+    // Every game adds to both players' sums
+    for (int k = 0; k < game_count; k++) {
+        int r = red[k], b = black[k];
+        double e_red = 1.0 / (1.0 + exp(-g[b] * (mu[r] - mu[b])));
+        double e_black = 1.0 / (1.0 + exp(-g[r] * (mu[b] - mu[r])));
+        v_inv[r] += g[b] * g[b] * e_red * (1.0 - e_red);
+        score_sum[r] += g[b] * (red_score[k] - e_red);
+        v_inv[b] += g[r] * g[r] * e_black * (1.0 - e_black);
+        score_sum[b] += g[r] * (1.0 - red_score[k] - e_black);
+    }
+
+    // Players who sat the period out: deviation only
+    for (int i = 0; i < n; i++) {
+        if (v_inv[i] == 0.0) phi[i] = glicko_idle_phi(phi[i], batch->volatility[i]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (v_inv[i] > 0.0) {
+            glicko_update(&mu[i], &phi[i], &batch->volatility[i], v_inv[i], score_sum[i],
+                          tau);
+        }
+        batch->rating[i] = mu[i] * GLICKO_SCALE + GLICKO_CENTER;
+        batch->rd[i] = phi[i] * GLICKO_SCALE;
+    }
 }
@@ -15,19 +15,36 @@
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "../include/account.h"
+#include "../include/analysis.h"
 #include "../include/broadcast.h"
+#include "../include/clock.h"
 #include "../include/db.h"
+#include "../include/engine.h"
 #include "../include/handlers.h"
+#include "../include/livelist.h"
 #include "../include/lobby.h"
 #include "../include/match.h"
+#include "../include/matchmaking.h"
+#include "../include/opening.h"
 #include "../include/protocol.h"
+#include "../include/pubsub.h"
+#include "../include/ranking.h"
 #include "../include/session.h"
+#include "../include/tablebase.h"
 
 static server_t g_server;
 
+// epoll tags for the worker pools' eventfds (clients use their client_t*)
+static int engine_event_tag;
+static int analysis_event_tag;
+static int mm_event_tag;
+static int fanout_listen_tag;
+
 // Signal handler for graceful shutdown
 static void signal_handler(int sig) {
     if (sig == SIGINT || sig == SIGTERM) {
@@ -43,9 +60,45 @@ static int set_nonblocking(int fd) {
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
+// Listen for fanout processes on FANOUT_SOCKET_PATH (owner-only). The
+// server runs without it if the socket cannot be created.
+static void fanout_listen_init(server_t* server) {
+    server->fanout_listen_fd = -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket fanout");
+        return;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", FANOUT_SOCKET_PATH);
+    unlink(FANOUT_SOCKET_PATH);  // Left over from an unclean exit
+
+    mode_t old_mask = umask(0077);
+    int bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &fanout_listen_tag;
+    if (bound < 0 || listen(fd, FANOUT_MAX_PEERS) < 0 || set_nonblocking(fd) < 0 ||
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("fanout listen");
+        close(fd);
+        return;
+    }
+
+    server->fanout_listen_fd = fd;
+    printf("Fanout socket: %s\n", FANOUT_SOCKET_PATH);
+}
+
 // Initialize server
 int server_init(server_t* server, int port) {
     memset(server, 0, sizeof(server_t));
+    server->fanout_listen_fd = -1;
 
     // Create listening socket
     server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -111,6 +164,34 @@ int server_init(server_t* server, int port) {
         return -1;
     }
 
+    // Engine results wake the loop through an eventfd (level-triggered)
+    ev.events = EPOLLIN;
+    ev.data.ptr = &engine_event_tag;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, engine_get_notify_fd(), &ev) < 0) {
+        perror("epoll_ctl engine");
+        close(server->epoll_fd);
+        close(server->listen_fd);
+        return -1;
+    }
+
+    ev.data.ptr = &analysis_event_tag;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, analysis_get_notify_fd(), &ev) < 0) {
+        perror("epoll_ctl analysis");
+        close(server->epoll_fd);
+        close(server->listen_fd);
+        return -1;
+    }
+
+    ev.data.ptr = &mm_event_tag;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, mm_get_notify_fd(), &ev) < 0) {
+        perror("epoll_ctl matchmaking");
+        close(server->epoll_fd);
+        close(server->listen_fd);
+        return -1;
+    }
+
+    fanout_listen_init(server);
+
     server->running = true;
     printf("Server initialized on port %d\n", port);
     printf("Listening on 0.0.0.0:%d\n", port);
@@ -123,9 +204,19 @@ client_t* client_create(int fd) {
     client_t* client = calloc(1, sizeof(client_t));
     if (!client) return NULL;
 
+    client->outq = malloc(CLIENT_OUTQ_MAX * sizeof(frame_t*));
+    if (!client->outq) {
+        free(client);
+        return NULL;
+    }
+    client->outq_capacity = CLIENT_OUTQ_MAX;
+
     client->fd = fd;
     client->authenticated = false;
     client->last_heartbeat = time(NULL);
+    client->rtt_ms = -1;
+    client->rtt_min_ms = -1;
+    client->rtt_last_ms = -1;
 
     return client;
 }
@@ -139,6 +230,13 @@ void client_destroy(client_t* client) {
         free(client->session_token);
     }
 
+    while (client->outq_count > 0) {
+        frame_unref(client->outq[client->outq_head]);
+        client->outq_head = (client->outq_head + 1) % client->outq_capacity;
+        client->outq_count--;
+    }
+    free(client->outq);
+
     if (client->fd >= 0) {
         close(client->fd);
     }
@@ -156,6 +254,19 @@ void client_disconnect(server_t* server, client_t* client) {
     // Remove from lobby if present
     if (client->authenticated) {
         lobby_remove_player(client->user_id);
+        lobby_cancel_user_challenges(client->user_id);
+    }
+
+    // Drop spectator subscriptions
+    pubsub_unsubscribe_all(client);
+
+    if (client->fanout) {
+        for (int i = 0; i < server->fanout_count; i++) {
+            if (server->fanout_peers[i] == client) {
+                server->fanout_peers[i] = server->fanout_peers[--server->fanout_count];
+                break;
+            }
+        }
     }
 
     // Remove from epoll
@@ -186,23 +297,256 @@ client_t* server_get_client_by_user_id(server_t* server, int user_id) {
     return NULL;
 }
 
+// Record one RTT sample (EWMA with 1/8 gain, as TCP's SRTT)
+void client_record_rtt(client_t* client, int64_t sample_ms) {
+    if (!client || sample_ms < 0 || sample_ms > RTT_SAMPLE_MAX_MS) return;
+
+    int sample = (int)sample_ms;
+    client->rtt_last_ms = sample;
+    if (client->rtt_samples == 0) {
+        client->rtt_ms = sample;
+        client->rtt_min_ms = sample;
+    } else {
+        client->rtt_ms += (sample - client->rtt_ms) / 8;
+        if (sample < client->rtt_min_ms) client->rtt_min_ms = sample;
+    }
+    client->rtt_samples++;
+}
+
+// Send a ping to every authenticated client; the client echoes ping_id and
+// server_time_ms back in a "pong" message
+void server_send_pings(server_t* server) {
+    int64_t now_ms = clock_now_ms();
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        client_t* client = server->clients[i];
+        if (!client || !client->authenticated) continue;
+
+        client->ping_id++;
+        if (client->ping_id <= 0) client->ping_id = 1;
+        client->ping_sent_ms = now_ms;
+
+        char ping[160];
+        snprintf(ping, sizeof(ping),
+                 "{\"type\":\"ping\",\"payload\":{\"ping_id\":%d,"
+                 "\"server_time_ms\":%lld,\"rtt_ms\":%d}}",
+                 client->ping_id, (long long)now_ms, client->rtt_ms);
+        client_send(server, client, ping);
+    }
+}
+
+// Share of profile reads served without a database query
+static double profile_hit_rate(void) {
+    uint64_t hits = account_cache_hits();
+    uint64_t total = hits + account_cache_misses();
+    return total ? (double)hits / (double)total : 0.0;
+}
+
+// Server stats as JSON: aggregate counters, plus the caller's own RTT and
+// lag compensation (other connections' fds, users and RTTs are not shown)
+char* server_get_stats_json(server_t* server, const client_t* self) {
+    size_t cap = 1280;
+    char* json = malloc(cap);
+    if (!json) return NULL;
+
+    mm_stats_t mm;
+    mm_get_stats(&mm);
+
+    size_t len = snprintf(json, cap,
+                          "{\"client_count\":%d,\"active_matches\":%d,"
+                          "\"finished_matches\":%d,\"engine_backlog\":%d,"
+                          "\"analysis_backlog\":%d,\"analysis_completed\":%llu,"
+                          "\"analysis_dropped\":%llu,\"opening_games\":%llu,"
+                          "\"spectator_topics\":%d,\"spectators_coalesced\":%llu,"
+                          "\"spectators_evicted\":%llu,\"fanout_peers\":%d,"
+                          "\"live_list_version\":%u,\"live_list_rebuilds\":%llu,"
+                          "\"profile_cache_size\":%d,\"profile_cache_hits\":%llu,"
+                          "\"profile_cache_misses\":%llu,\"profile_cache_hit_rate\":%.3f,"
+                          "\"ranked_players\":%d,\"mm_queued\":%d,\"mm_queues\":%d,\"mm_pairs\":%llu,"
+                          "\"mm_avg_wait_ms\":%lld,\"mm_gap_p50\":%d,\"mm_gap_p90\":%d,"
+                          "\"mm_gap_p99\":%d,\"lobby_rooms\":%d,\"lobby_challenges\":%d,"
+                          "\"sessions\":%d,",
+                          server->client_count, match_get_active_count(),
+                          match_get_finished_count(), engine_get_backlog(),
+                          analysis_get_backlog(),
+                          (unsigned long long)analysis_get_completed(),
+                          (unsigned long long)analysis_get_dropped(),
+                          (unsigned long long)opening_game_count(),
+                          pubsub_topic_count(),
+                          (unsigned long long)pubsub_coalesced_count(),
+                          (unsigned long long)pubsub_evicted_count(),
+                          server->fanout_count, live_version(),
+                          (unsigned long long)live_rebuild_count(), account_cache_count(),
+                          (unsigned long long)account_cache_hits(),
+                          (unsigned long long)account_cache_misses(), profile_hit_rate(),
+                          ranking_count(), mm.queued, mm.queues, (unsigned long long)mm.pairs,
+                          (long long)mm.avg_wait_ms, mm.gap_p50, mm.gap_p90, mm.gap_p99,
+                          lobby_room_count(), lobby_challenge_count(), session_active_count());
+
+    if (len < cap) {
+        snprintf(json + len, cap - len,
+                 "\"self\":{\"rtt_ms\":%d,\"rtt_min_ms\":%d,\"rtt_last_ms\":%d,"
+                 "\"rtt_samples\":%d,\"lag_comp_ms\":%d,\"queued_bytes\":%zu}}",
+                 self->rtt_ms, self->rtt_min_ms, self->rtt_last_ms, self->rtt_samples,
+                 clock_lag_compensation_ms(self->rtt_ms), self->outq_bytes);
+    }
+
+    return json;
+}
+
+// Build a frame from one message, newline-terminated
+frame_t* frame_create(const char* data, size_t len) {
+    bool has_newline = len > 0 && data[len - 1] == '\n';
+    frame_t* frame = malloc(sizeof(frame_t) + len + 2);
+    if (!frame) return NULL;
+
+    frame->refcount = 1;
+    memcpy(frame->data, data, len);
+    if (!has_newline) frame->data[len++] = '\n';
+    frame->data[len] = '\0';
+    frame->len = len;
+    return frame;
+}
+
+frame_t* frame_create_raw(const char* data, size_t len) {
+    frame_t* frame = malloc(sizeof(frame_t) + len + 1);
+    if (!frame) return NULL;
+
+    frame->refcount = 1;
+    memcpy(frame->data, data, len);
+    frame->data[len] = '\0';
+    frame->len = len;
+    return frame;
+}
+
+void frame_ref(frame_t* frame) { frame->refcount++; }
+
+void frame_unref(frame_t* frame) {
+    if (frame && --frame->refcount == 0) free(frame);
+}
+
+static void client_set_events(server_t* server, client_t* client,
+                              uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = client;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+// Double a full send ring, unwrapping it so the head is slot 0
+static bool client_outq_grow(client_t* client) {
+    int capacity = client->outq_capacity * 2;
+    frame_t** grown = malloc((size_t)capacity * sizeof(frame_t*));
+    if (!grown) return false;
+    for (int i = 0; i < client->outq_count; i++) {
+        grown[i] = client->outq[(client->outq_head + i) % client->outq_capacity];
+    }
+    free(client->outq);
+    client->outq = grown;
+    client->outq_capacity = capacity;
+    client->outq_head = 0;
+    return true;
+}
+
+// Send a frame, keeping per-client order: anything already queued goes first
+bool client_send_frame(server_t* server, client_t* client, frame_t* frame) {
+    if (!server || !client || !frame || client->closing) return false;
+
+    size_t sent = 0;
+    if (client->outq_count == 0) {
+        ssize_t n = send(client->fd, frame->data, frame->len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // The socket is dead; EPOLLERR/EPOLLHUP disconnects it
+                perror("send");
+                return false;
+            }
+            n = 0;
+        }
+        if ((size_t)n == frame->len) return true;
+        sent = (size_t)n;
+    } else if (client->outq_count >= (client->fanout ? FANOUT_OUTQ_MAX : CLIENT_OUTQ_MAX) ||
+               client->outq_bytes + frame->len >
+                   (client->fanout ? FANOUT_OUTQ_MAX_BYTES : CLIENT_OUTQ_MAX_BYTES) ||
+               (client->outq_count == client->outq_capacity && !client_outq_grow(client))) {
+        // Skipping a message would break in-order delivery, so drop the
+        // connection instead; the hangup reaches the loop as EPOLLHUP
+        // (callers may be iterating over clients and cannot free it here)
+        fprintf(stderr, "Send queue full for client fd=%d (%d frames, %zu bytes), closing\n",
+                client->fd, client->outq_count, client->outq_bytes);
+        shutdown(client->fd, SHUT_RDWR);
+        client->closing = true;
+        return false;
+    }
+
+    int tail = (client->outq_head + client->outq_count) % client->outq_capacity;
+    frame_ref(frame);
+    client->outq[tail] = frame;
+    if (client->outq_count++ == 0) {
+        client->outq_offset = sent;
+        client_set_events(server, client, EPOLLIN | EPOLLOUT | EPOLLET);
+    }
+    client->outq_bytes += frame->len - sent;
+    return true;
+}
+
 // Send JSON message to client
-int client_send(client_t* client, const char* json) {
+int client_send(server_t* server, client_t* client, const char* json) {
     if (!client || !json) return -1;
 
-    size_t len = strlen(json);
-    if (len >= MAX_MESSAGE_SIZE - client->send_len - 2) {
-        fprintf(stderr, "Send buffer full for client fd=%d\n", client->fd);
-        return -1;
+    frame_t* frame = frame_create(json, strlen(json));
+    if (!frame) return -1;
+
+    bool ok = client_send_frame(server, client, frame);
+    frame_unref(frame);
+    return ok ? 0 : -1;
+}
+
+// Register an accepted socket as a client; closes it and returns NULL on
+// failure
+static client_t* server_add_client(server_t* server, int client_fd) {
+    // Check client limit
+    if (server->client_count >= MAX_CLIENTS) {
+        printf("Max clients reached, rejecting connection\n");
+        close(client_fd);
+        return NULL;
+    }
+
+    // Set non-blocking
+    if (set_nonblocking(client_fd) < 0) {
+        perror("set_nonblocking client");
+        close(client_fd);
+        return NULL;
     }
 
-    // Append message + newline to send buffer
-    memcpy(client->send_buffer + client->send_len, json, len);
-    client->send_len += len;
-    client->send_buffer[client->send_len++] = '\n';
-    client->send_buffer[client->send_len] = '\0';
+    // Create client
+    client_t* client = client_create(client_fd);
+    if (!client) {
+        close(client_fd);
+        return NULL;
+    }
 
-    return 0;
+    // Add to client list
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (server->clients[i] == NULL) {
+            server->clients[i] = client;
+            server->client_count++;
+            break;
+        }
+    }
+
+    // Add to epoll
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;  // Edge-triggered
+    ev.data.ptr = client;
+
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+        perror("epoll_ctl add client");
+        client_disconnect(server, client);
+        return NULL;
+    }
+
+    return client;
 }
 
 // Handle new connection
@@ -222,55 +566,42 @@ void handle_new_connection(server_t* server) {
             break;
         }
 
-        // Check client limit
-        if (server->client_count >= MAX_CLIENTS) {
-            printf("Max clients reached, rejecting connection\n");
-            close(client_fd);
-            continue;
-        }
+        if (!server_add_client(server, client_fd)) continue;
 
-        // Set non-blocking
-        if (set_nonblocking(client_fd) < 0) {
-            perror("set_nonblocking client");
-            close(client_fd);
-            continue;
+        printf("New connection from %s:%d (fd=%d)\n",
+               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port),
+               client_fd);
+    }
+}
+
+// Handle a fanout process connecting on the Unix socket
+void handle_fanout_connection(server_t* server) {
+    while (1) {
+        int client_fd = accept(server->fanout_listen_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept fanout");
+            break;
         }
 
-        // Create client
-        client_t* client = client_create(client_fd);
-        if (!client) {
+        if (server->fanout_count >= FANOUT_MAX_PEERS) {
+            printf("Max fanout peers reached, rejecting connection\n");
             close(client_fd);
             continue;
         }
 
-        // Add to client list
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (server->clients[i] == NULL) {
-                server->clients[i] = client;
-                server->client_count++;
-                break;
-            }
-        }
-
-        // Add to epoll
-        struct epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;  // Edge-triggered
-        ev.data.ptr = client;
-
-        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
-            perror("epoll_ctl add client");
-            client_disconnect(server, client);
-            continue;
-        }
+        client_t* client = server_add_client(server, client_fd);
+        if (!client) continue;
 
-        printf("New connection from %s:%d (fd=%d)\n",
-               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port),
-               client_fd);
+        client->fanout = true;
+        server->fanout_peers[server->fanout_count++] = client;
+        printf("Fanout process connected (fd=%d, peers=%d)\n", client_fd,
+               server->fanout_count);
     }
 }
 
 // Handle client read
-void handle_client_read(server_t* server, client_t* client) {
+// Returns false if the client was disconnected.
+bool handle_client_read(server_t* server, client_t* client) {
     while (1) {
         ssize_t n = recv(client->fd, client->recv_buffer + client->recv_len,
                          MAX_MESSAGE_SIZE - client->recv_len - 1, 0);
@@ -282,13 +613,13 @@ void handle_client_read(server_t* server, client_t* client) {
             }
             perror("recv");
             client_disconnect(server, client);
-            return;
+            return false;
         }
 
         if (n == 0) {
             // Connection closed
             client_disconnect(server, client);
-            return;
+            return false;
         }
 
         client->recv_len += n;
@@ -321,41 +652,48 @@ void handle_client_read(server_t* server, client_t* client) {
             fprintf(stderr, "Client recv buffer overflow (fd=%d)\n",
                     client->fd);
             client_disconnect(server, client);
-            return;
+            return false;
         }
     }
+    return true;
 }
 
-// Handle client write
-void handle_client_write(server_t* server, client_t* client) {
-    while (client->send_len > client->send_offset) {
-        ssize_t n = send(client->fd, client->send_buffer + client->send_offset,
-                         client->send_len - client->send_offset, 0);
+// Handle client write: flush queued frames.
+// Returns false if the client was disconnected.
+bool handle_client_write(server_t* server, client_t* client) {
+    while (client->outq_count > 0) {
+        frame_t* frame = client->outq[client->outq_head];
+        ssize_t n = send(client->fd, frame->data + client->outq_offset,
+                         frame->len - client->outq_offset, MSG_NOSIGNAL);
 
         if (n < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 // Can't send more now
-                break;
+                return true;
             }
             perror("send");
             client_disconnect(server, client);
-            return;
+            return false;
         }
 
-        client->send_offset += n;
+        client->outq_offset += n;
+        client->outq_bytes -= n;
+        if (client->outq_offset < frame->len) continue;
+
+        frame_unref(frame);
+        client->outq_head = (client->outq_head + 1) % client->outq_capacity;
+        client->outq_count--;
+        client->outq_offset = 0;
     }
 
-    // Reset buffer if all sent
-    if (client->send_offset >= client->send_len) {
-        client->send_len = 0;
-        client->send_offset = 0;
+    // Spectator streams that fell behind resume with a snapshot
+    pubsub_client_drained(server, client);
 
-        // Remove EPOLLOUT if no more data to send
-        struct epoll_event ev;
-        ev.events = EPOLLIN | EPOLLET;
-        ev.data.ptr = client;
-        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+    // Remove EPOLLOUT if no more data to send
+    if (client->outq_count == 0) {
+        client_set_events(server, client, EPOLLIN | EPOLLET);
     }
+    return true;
 }
 
 // Process received message
@@ -365,7 +703,7 @@ void process_message(server_t* server, client_t* client, const char* json) {
         fprintf(stderr, "Failed to parse message from client fd=%d: %s\n",
                 client->fd, json);
         char* err = create_error(0, "PARSE_ERROR", "Invalid JSON", false);
-        client_send(client, err);
+        client_send(server, client, err);
         free(err);
         return;
     }
@@ -386,8 +724,27 @@ void server_run(server_t* server) {
     printf("Server running...\n");
 
     while (server->running) {
-        int nfds = epoll_wait(server->epoll_fd, events, MAX_EVENTS,
-                              1000);  // 1s timeout
+        // Wake up at the next clock flag so timeouts fire on time, but at
+        // least once a second for periodic housekeeping
+        int wait_ms = 1000;
+        int64_t next_flag_ms = match_ms_until_next_timeout();
+        if (next_flag_ms >= 0 && next_flag_ms < wait_ms) {
+            wait_ms = (int)next_flag_ms;
+        }
+        int64_t presence_ms = lobby_presence_ms_until_due(clock_now_ms());
+        if (presence_ms >= 0 && presence_ms < wait_ms) {
+            wait_ms = (int)presence_ms;
+        }
+        int64_t challenge_ms = lobby_challenge_ms_until_expiry(clock_now_ms());
+        if (challenge_ms >= 0 && challenge_ms < wait_ms) {
+            wait_ms = (int)challenge_ms;
+        }
+        int64_t room_ms = lobby_room_ms_until_expiry(clock_now_ms());
+        if (room_ms >= 0 && room_ms < wait_ms) {
+            wait_ms = (int)room_ms;
+        }
+
+        int nfds = epoll_wait(server->epoll_fd, events, MAX_EVENTS, wait_ms);
 
         if (nfds < 0) {
             if (errno == EINTR) continue;  // Interrupted by signal
@@ -399,16 +756,30 @@ void server_run(server_t* server) {
             if (events[i].data.ptr == NULL) {
                 // Listen socket - new connection
                 handle_new_connection(server);
+            } else if (events[i].data.ptr == &fanout_listen_tag) {
+                // Spectator fan-out process
+                handle_fanout_connection(server);
+            } else if (events[i].data.ptr == &engine_event_tag) {
+                // Bot moves and hints finished by the engine workers
+                handlers_process_engine_results(server);
+            } else if (events[i].data.ptr == &analysis_event_tag) {
+                // Post-game analyses ready to store
+                handlers_process_analysis_results(server);
+            } else if (events[i].data.ptr == &mm_event_tag) {
+                // Pairs and bot fallbacks from the matchmaking thread
+                handlers_process_matchmaking_results(server);
             } else {
                 // Client socket
                 client_t* client = (client_t*)events[i].data.ptr;
 
-                if (events[i].events & EPOLLIN) {
-                    handle_client_read(server, client);
+                if ((events[i].events & EPOLLIN) &&
+                    !handle_client_read(server, client)) {
+                    continue;
                 }
 
-                if (events[i].events & EPOLLOUT) {
-                    handle_client_write(server, client);
+                if ((events[i].events & EPOLLOUT) &&
+                    !handle_client_write(server, client)) {
+                    continue;
                 }
 
                 if (events[i].events & (EPOLLERR | EPOLLHUP)) {
@@ -419,40 +790,53 @@ void server_run(server_t* server) {
 
         // Periodic cleanup
         static time_t last_cleanup = 0;
-        static time_t last_timeout_check = 0;
         time_t now = time(NULL);
         
-        // Check timeouts every 5 seconds
-        if (now - last_timeout_check >= 5) {
-            match_check_all_timeouts();
-            
-            // Broadcast any pending timeouts
-            timeout_info_t timeouts[100];
-            int timeout_count = match_get_pending_timeouts(timeouts, 100);
-            
-            for (int i = 0; i < timeout_count; i++) {
-                char payload[256];
-                snprintf(payload, sizeof(payload),
-                         "{\"match_id\":\"%s\",\"result\":\"%s\",\"reason\":\"timeout\"}",
-                         timeouts[i].match_id, timeouts[i].result);
-                char notify[512];
-                snprintf(notify, sizeof(notify),
-                         "{\"type\":\"game_end\",\"payload\":%s}\n", payload);
-                
-                // Send to both players
-                send_to_user(server, timeouts[i].red_user_id, notify);
-                send_to_user(server, timeouts[i].black_user_id, notify);
-                
-                printf("[Server] Broadcast timeout: %s -> %s\n", 
-                       timeouts[i].match_id, timeouts[i].result);
+        // Settle flagged clocks every iteration (the epoll timeout tracks the
+        // next flag)
+        handlers_process_timeouts(server);
+        
+        // Opening index merged in the background, ready to swap in
+        opening_poll();
+
+        // Challenges past their deadline (only the oldest are looked at)
+        lobby_expire_challenges(clock_now_ms());
+
+        // Rooms whose game never started, likewise; the lobby sees them go
+        if (lobby_expire_rooms(clock_now_ms()) > 0) {
+            char* rooms_json = lobby_get_rooms_json();
+            if (rooms_json) {
+                char rooms_msg[16384];
+                snprintf(rooms_msg, sizeof(rooms_msg),
+                         "{\"type\":\"rooms_update\",\"payload\":%s}\n", rooms_json);
+                broadcast_to_lobby(server, rooms_msg);
+                free(rooms_json);
             }
-            
-            last_timeout_check = now;
+        }
+
+        // Ready-list changes since the last tick, as one diff
+        if (lobby_presence_ms_until_due(clock_now_ms()) == 0) {
+            char* presence = lobby_take_presence_event(clock_now_ms());
+            if (presence) {
+                broadcast_to_lobby(server, presence);
+                free(presence);
+            }
+        }
+
+        static time_t last_evict_check = 0;
+        if (now != last_evict_check) {
+            pubsub_evict_stalled(server, clock_now_ms());
+            last_evict_check = now;
+        }
+
+        static time_t last_ping = 0;
+        if (now - last_ping >= PING_INTERVAL_SEC) {
+            server_send_pings(server);
+            last_ping = now;
         }
         
         if (now - last_cleanup > 60) {  // Every minute
             session_cleanup_expired();
-            lobby_cleanup_expired_challenges();
             last_cleanup = now;
         }
     }
@@ -477,9 +861,23 @@ void server_shutdown(server_t* server) {
         close(server->listen_fd);
     }
 
+    if (server->fanout_listen_fd >= 0) {
+        close(server->fanout_listen_fd);
+        unlink(FANOUT_SOCKET_PATH);
+    }
+
+    analysis_shutdown();  // Its workers search with the engine
+    engine_shutdown();
+    tablebase_shutdown();
+    opening_shutdown();  // Merges games recorded since the last merge
     lobby_shutdown();
+    mm_shutdown();
     match_shutdown();
+    live_shutdown();
+    pubsub_shutdown();
     session_shutdown();
+    ranking_shutdown();
+    account_cache_shutdown();
     db_shutdown();
 
     printf("Server shut down complete.\n");
@@ -510,6 +908,16 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (!account_cache_init()) {
+        fprintf(stderr, "Failed to initialize profile cache\n");
+        return 1;
+    }
+
+    if (!ranking_init()) {
+        fprintf(stderr, "Failed to load leaderboard\n");
+        return 1;
+    }
+
     if (!session_init()) {
         fprintf(stderr, "Failed to initialize session manager\n");
         return 1;
@@ -520,11 +928,44 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (!mm_init()) {
+        fprintf(stderr, "Failed to initialize matchmaking\n");
+        return 1;
+    }
+
+    if (!live_init(handlers_player_rating)) {
+        fprintf(stderr, "Failed to initialize live match list\n");
+        return 1;
+    }
+
     if (!match_init()) {
         fprintf(stderr, "Failed to initialize match manager\n");
         return 1;
     }
 
+    if (!pubsub_init(handlers_spectator_snapshot)) {
+        fprintf(stderr, "Failed to initialize spectator topics\n");
+        return 1;
+    }
+
+    if (!engine_init()) {
+        fprintf(stderr, "Failed to initialize engine\n");
+        return 1;
+    }
+
+    if (!analysis_init()) {
+        fprintf(stderr, "Failed to initialize analysis workers\n");
+        return 1;
+    }
+
+    // Optional: adjudication and analysis work without tables, just less
+    tablebase_init(TABLEBASE_DIR);
+
+    if (!opening_init(OPENING_INDEX_PATH)) {
+        fprintf(stderr, "Failed to initialize opening explorer\n");
+        return 1;
+    }
+
     // Setup signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
@@ -5,125 +5,222 @@
 
 #include "session.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/random.h>
 #include <time.h>
 
-#define MAX_SESSIONS 1000
+#include "hashmap.h"
 
-static session_t* sessions[MAX_SESSIONS];
+typedef struct {
+    session_t session;
+    time_t expiry_key;  // Heap order; never later than the real expiry
+    int heap_pos;
+} session_slot_t;
+
+// Sessions: packed array, token -> index. The expiry heap holds slot
+// indices, soonest expiry_key on top.
+static session_slot_t* slots = NULL;
 static int session_count = 0;
+static int session_capacity = 0;
+static str_map_t session_index;
+static int* expiry_heap = NULL;
+
+static time_t session_expiry(const session_t* session) {
+    return session->last_activity + SESSION_TIMEOUT;
+}
 
-// Generate random token
-static void generate_token(char* token) {
-    const char charset[] = "0123456789abcdef";
-    for (int i = 0; i < 64; i++) {
-        token[i] = charset[rand() % 16];
+// 32 bytes from the kernel CSPRNG, as 64 hex characters
+static bool generate_token(char* token) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char bytes[32];
+    size_t got = 0;
+    while (got < sizeof(bytes)) {
+        ssize_t n = getrandom(bytes + got, sizeof(bytes) - got, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("getrandom");
+            return false;
+        }
+        got += (size_t)n;
+    }
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        token[i * 2] = hex[bytes[i] >> 4];
+        token[i * 2 + 1] = hex[bytes[i] & 0xf];
     }
     token[64] = '\0';
+    return true;
+}
+
+// =========================
+// Expiry heap
+// =========================
+
+static void heap_set(int pos, int slot) {
+    expiry_heap[pos] = slot;
+    slots[slot].heap_pos = pos;
+}
+
+static void heap_sift_up(int pos) {
+    int slot = expiry_heap[pos];
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (slots[expiry_heap[parent]].expiry_key <= slots[slot].expiry_key) break;
+        heap_set(pos, expiry_heap[parent]);
+        pos = parent;
+    }
+    heap_set(pos, slot);
+}
+
+static void heap_sift_down(int pos) {
+    int slot = expiry_heap[pos];
+    for (;;) {
+        int child = pos * 2 + 1;
+        if (child >= session_count) break;
+        if (child + 1 < session_count &&
+            slots[expiry_heap[child + 1]].expiry_key < slots[expiry_heap[child]].expiry_key) {
+            child++;
+        }
+        if (slots[slot].expiry_key <= slots[expiry_heap[child]].expiry_key) break;
+        heap_set(pos, expiry_heap[child]);
+        pos = child;
+    }
+    heap_set(pos, slot);
+}
+
+// =========================
+// Slots
+// =========================
+
+static bool session_reserve(void) {
+    if (session_count < session_capacity) return true;
+
+    int capacity = session_capacity ? session_capacity * 2 : SESSION_INITIAL_CAPACITY;
+    session_slot_t* grown = realloc(slots, (size_t)capacity * sizeof(*slots));
+    if (!grown) return false;
+    slots = grown;
+    int* grown_heap = realloc(expiry_heap, (size_t)capacity * sizeof(int));
+    if (!grown_heap) return false;
+    expiry_heap = grown_heap;
+    session_capacity = capacity;
+    return true;
+}
+
+static int session_find(const char* token) {
+    int slot;
+    return token && str_map_get(&session_index, token, &slot) ? slot : -1;
+}
+
+// Unlink a slot from the index and the heap, then keep both packed: the
+// last heap entry fills the hole in the heap, the last slot the hole in
+// the array
+static void session_remove(int slot) {
+    str_map_remove(&session_index, slots[slot].session.token);
+
+    int pos = slots[slot].heap_pos;
+    int last = --session_count;
+    if (pos != last) {
+        int moved = expiry_heap[last];
+        heap_set(pos, moved);
+        heap_sift_down(pos);
+        heap_sift_up(slots[moved].heap_pos);
+    }
+
+    if (slot != last) {
+        slots[slot] = slots[last];
+        str_map_put(&session_index, slots[slot].session.token, slot);
+        expiry_heap[slots[slot].heap_pos] = slot;
+    }
 }
 
 // Initialize session manager
 bool session_init(void) {
-    memset(sessions, 0, sizeof(sessions));
+    if (!str_map_init(&session_index, SESSION_INITIAL_CAPACITY * 2)) return false;
+    session_count = 0;
+    if (!session_reserve()) return false;
+    // Tokens do not use it; lobby_init (called after this) seeds its room
+    // and challenge serials from rand()
     srand(time(NULL));
     return true;
 }
 
 // Create new session
 char* session_create(int user_id) {
-    if (session_count >= MAX_SESSIONS) {
-        session_cleanup_expired();
-        if (session_count >= MAX_SESSIONS) {
-            return NULL;
-        }
-    }
+    if (!session_reserve()) return NULL;
+
+    char token[65];
+    if (!generate_token(token)) return NULL;
+    char* token_copy = strdup(token);
+    if (!token_copy) return NULL;
 
-    session_t* session = calloc(1, sizeof(session_t));
-    if (!session) return NULL;
+    int slot = session_count;
+    if (!str_map_put(&session_index, token, slot)) {
+        free(token_copy);
+        return NULL;
+    }
+    session_count++;
 
-    generate_token(session->token);
+    session_t* session = &slots[slot].session;
+    memcpy(session->token, token, sizeof(session->token));
     session->user_id = user_id;
     session->created_at = time(NULL);
-    session->last_activity = time(NULL);
-
-    // Add to sessions array
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sessions[i] == NULL) {
-            sessions[i] = session;
-            session_count++;
-            break;
-        }
-    }
+    session->last_activity = session->created_at;
+    slots[slot].expiry_key = session_expiry(session);
+    expiry_heap[slot] = slot;
+    slots[slot].heap_pos = slot;
+    heap_sift_up(slot);
 
-    char* token_copy = strdup(session->token);
     return token_copy;
 }
 
 // Validate session
 bool session_validate(const char* token, int* out_user_id) {
-    if (!token) return false;
+    int slot = session_find(token);
+    if (slot < 0) return false;
 
-    time_t now = time(NULL);
-
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sessions[i] && strcmp(sessions[i]->token, token) == 0) {
-            // Check timeout
-            if (now - sessions[i]->last_activity > SESSION_TIMEOUT) {
-                session_destroy(token);
-                return false;
-            }
-
-            if (out_user_id) {
-                *out_user_id = sessions[i]->user_id;
-            }
-            return true;
-        }
+    if (time(NULL) > session_expiry(&slots[slot].session)) {
+        session_remove(slot);
+        return false;
     }
-
-    return false;
+    if (out_user_id) {
+        *out_user_id = slots[slot].session.user_id;
+    }
+    return true;
 }
 
-// Update activity
+// Update activity. The heap key stays behind; session_cleanup_expired
+// catches up when the stale key reaches the top.
 void session_update_activity(const char* token) {
-    if (!token) return;
-
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sessions[i] && strcmp(sessions[i]->token, token) == 0) {
-            sessions[i]->last_activity = time(NULL);
-            return;
-        }
-    }
+    int slot = session_find(token);
+    if (slot >= 0) slots[slot].session.last_activity = time(NULL);
 }
 
 // Destroy session
 void session_destroy(const char* token) {
-    if (!token) return;
-
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sessions[i] && strcmp(sessions[i]->token, token) == 0) {
-            free(sessions[i]);
-            sessions[i] = NULL;
-            session_count--;
-            return;
-        }
-    }
+    int slot = session_find(token);
+    if (slot >= 0) session_remove(slot);
 }
 
-// Cleanup expired sessions
+// Cleanup expired sessions: only the sessions whose heap key has passed
+// are looked at
 void session_cleanup_expired(void) {
     time_t now = time(NULL);
     int cleaned = 0;
 
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sessions[i]) {
-            if (now - sessions[i]->last_activity > SESSION_TIMEOUT) {
-                free(sessions[i]);
-                sessions[i] = NULL;
-                session_count--;
-                cleaned++;
-            }
+    while (session_count > 0) {
+        int slot = expiry_heap[0];
+        if (slots[slot].expiry_key >= now) break;
+
+        time_t expiry = session_expiry(&slots[slot].session);
+        if (expiry < now) {
+            session_remove(slot);
+            cleaned++;
+        } else {
+            // Active since it was keyed: move it to its real place
+            slots[slot].expiry_key = expiry;
+            heap_sift_down(0);
         }
     }
 
@@ -132,13 +229,14 @@ void session_cleanup_expired(void) {
     }
 }
 
+int session_active_count(void) { return session_count; }
+
 // Shutdown session manager
 void session_shutdown(void) {
-    for (int i = 0; i < MAX_SESSIONS; i++) {
-        if (sessions[i]) {
-            free(sessions[i]);
-            sessions[i] = NULL;
-        }
-    }
-    session_count = 0;
+    str_map_free(&session_index);
+    free(slots);
+    free(expiry_heap);
+    slots = NULL;
+    expiry_heap = NULL;
+    session_count = session_capacity = 0;
 }
@@ -0,0 +1,539 @@
+/*
+ * tablebase.c - Endgame tablebase indexing, compressed file format and probes
+ *
+ * Tables are produced offline by tools/tbgen.c. Each file is:
+ *   header | uint32 block offsets[block_count + 1] | RLE data
+ * where each block covers TB_BLOCK_SIZE consecutive indices encoded as
+ * (run length - 1, value) byte pairs. Probing maps the file read-only and
+ * decodes a single block, so resident memory is whatever the kernel pages in.
+ */
+
+#include "tablebase.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TB_MAGIC "XQTB\x01"
+
+typedef struct {
+    char magic[8];
+    char material[16];
+    uint64_t entry_count;
+    uint32_t block_size;
+    uint32_t block_count;
+} tb_file_header_t;
+
+typedef struct {
+    tb_layout_t layout;
+    const uint8_t* map;
+    size_t map_size;
+    const uint32_t* offsets;
+    const uint8_t* data;
+    uint32_t block_size;
+    uint32_t block_count;
+} tb_table_t;
+
+static tb_table_t tables[TB_MAX_TABLES];
+static int table_count = 0;
+
+// Piece letters by type; H/N and E/B are both accepted when parsing
+static const char piece_letter[8] = {'?', 'K', 'A', 'E', 'H', 'R', 'C', 'P'};
+
+// Canonical order of non-king pieces in names and index slots
+static const int piece_order[6] = {XQ_CHARIOT, XQ_HORSE,   XQ_CANNON,
+                                   XQ_PAWN,    XQ_ADVISOR, XQ_ELEPHANT};
+
+// =========================
+// Square domains
+// =========================
+
+// Squares each piece can legally stand on, per side and type
+static uint8_t domain_squares[2][8][XQ_SQUARES];
+static int domain_size[2][8];
+static int8_t domain_index[2][8][XQ_SQUARES];
+static pthread_once_t domain_once = PTHREAD_ONCE_INIT;
+
+static void domain_fill(void) {
+    for (int side = 0; side < 2; side++) {
+        for (int type = XQ_KING; type <= XQ_PAWN; type++) {
+            int n = 0;
+            for (int sq = 0; sq < XQ_SQUARES; sq++) {
+                if (xq_square_allowed(side, type, sq)) {
+                    domain_index[side][type][sq] = (int8_t)n;
+                    domain_squares[side][type][n++] = (uint8_t)sq;
+                } else {
+                    domain_index[side][type][sq] = -1;
+                }
+            }
+            domain_size[side][type] = n;
+        }
+    }
+}
+
+// =========================
+// Material
+// =========================
+
+static int letter_type(char c) {
+    switch (c) {
+        case 'K': return XQ_KING;
+        case 'A': return XQ_ADVISOR;
+        case 'E': case 'B': return XQ_ELEPHANT;
+        case 'H': case 'N': return XQ_HORSE;
+        case 'R': return XQ_CHARIOT;
+        case 'C': return XQ_CANNON;
+        case 'P': return XQ_PAWN;
+        default: return XQ_EMPTY;
+    }
+}
+
+// counts[side][type] for non-king pieces; false on malformed names
+static bool parse_material(const char* material, int counts[2][8]) {
+    memset(counts, 0, sizeof(int) * 2 * 8);
+    int side = -1;
+    for (const char* p = material; *p; p++) {
+        int type = letter_type(*p);
+        if (type == XQ_EMPTY) return false;
+        if (type == XQ_KING) {
+            if (++side > XQ_BLACK) return false;
+            continue;
+        }
+        if (side < 0) return false;
+        counts[side][type]++;
+    }
+    return side == XQ_BLACK;
+}
+
+static void format_material(int counts[2][8], char* out, size_t size) {
+    size_t len = 0;
+    for (int side = 0; side < 2 && len + 1 < size; side++) {
+        out[len++] = 'K';
+        for (int i = 0; i < 6; i++) {
+            int type = piece_order[i];
+            for (int k = 0; k < counts[side][type] && len + 1 < size; k++) {
+                out[len++] = piece_letter[type];
+            }
+        }
+    }
+    out[len] = '\0';
+}
+
+void tb_material_of(const xq_position_t* pos, char* out, size_t size) {
+    int counts[2][8] = {{0}};
+    for (int sq = 0; sq < XQ_SQUARES; sq++) {
+        uint8_t piece = pos->board[sq];
+        if (piece && XQ_TYPE(piece) != XQ_KING) {
+            counts[XQ_SIDE(piece)][XQ_TYPE(piece)]++;
+        }
+    }
+    format_material(counts, out, size);
+}
+
+void tb_material_mirror(const char* material, char* out, size_t size) {
+    int counts[2][8];
+    if (!parse_material(material, counts)) {
+        snprintf(out, size, "%s", material);
+        return;
+    }
+    for (int type = 0; type < 8; type++) {
+        int tmp = counts[0][type];
+        counts[0][type] = counts[1][type];
+        counts[1][type] = tmp;
+    }
+    format_material(counts, out, size);
+}
+
+bool tb_material_has_attackers(const char* material) {
+    int counts[2][8];
+    if (!parse_material(material, counts)) return false;
+    for (int side = 0; side < 2; side++) {
+        if (counts[side][XQ_HORSE] || counts[side][XQ_CHARIOT] ||
+            counts[side][XQ_CANNON] || counts[side][XQ_PAWN]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Swap colours and flip the board so red becomes black
+void tb_position_mirror(const xq_position_t* pos, xq_position_t* out) {
+    memset(out->board, 0, sizeof(out->board));
+    for (int sq = 0; sq < XQ_SQUARES; sq++) {
+        uint8_t piece = pos->board[sq];
+        if (!piece) continue;
+        int flipped = XQ_SQ(XQ_ROWS - 1 - XQ_ROW(sq), XQ_COL(sq));
+        out->board[flipped] = XQ_PIECE(XQ_SIDE(piece) ^ 1, XQ_TYPE(piece));
+    }
+    for (int side = 0; side < 2; side++) {
+        int ksq = pos->king_sq[side];
+        out->king_sq[side ^ 1] = XQ_SQ(XQ_ROWS - 1 - XQ_ROW(ksq), XQ_COL(ksq));
+    }
+    out->side = pos->side ^ 1;
+    out->hash = xq_compute_hash(out);
+}
+
+// =========================
+// Indexing
+// =========================
+
+bool tb_layout_from_material(const char* material, tb_layout_t* layout) {
+    int counts[2][8];
+    pthread_once(&domain_once, domain_fill);
+    if (!parse_material(material, counts)) return false;
+
+    memset(layout, 0, sizeof(*layout));
+    format_material(counts, layout->material, sizeof(layout->material));
+
+    layout->slot_side[0] = XQ_RED;
+    layout->slot_type[0] = XQ_KING;
+    layout->slot_side[1] = XQ_BLACK;
+    layout->slot_type[1] = XQ_KING;
+    layout->slot_count = 2;
+    for (int side = 0; side < 2; side++) {
+        for (int i = 0; i < 6; i++) {
+            int type = piece_order[i];
+            for (int k = 0; k < counts[side][type]; k++) {
+                if (layout->slot_count >= 2 + TB_MAX_EXTRA_PIECES) return false;
+                layout->slot_side[layout->slot_count] = side;
+                layout->slot_type[layout->slot_count] = type;
+                layout->slot_count++;
+            }
+        }
+    }
+
+    uint64_t size = 2;
+    for (int s = 0; s < layout->slot_count; s++) {
+        size *= (uint64_t)domain_size[layout->slot_side[s]][layout->slot_type[s]];
+    }
+    if (size > TB_MAX_ENTRIES) return false;
+    layout->size = (uint32_t)size;
+    return true;
+}
+
+// Index -> position. False for indices that are not legal positions:
+// overlapping pieces, identical pieces out of order, or the side that
+// just moved left in check.
+bool tb_decode(const tb_layout_t* layout, uint32_t index, xq_position_t* pos) {
+    memset(pos->board, 0, sizeof(pos->board));
+    pos->side = (int)(index % 2);
+    index /= 2;
+
+    int prev_d = -1;
+    for (int s = 0; s < layout->slot_count; s++) {
+        int side = layout->slot_side[s];
+        int type = layout->slot_type[s];
+        int n = domain_size[side][type];
+        int d = (int)(index % (uint32_t)n);
+        index /= (uint32_t)n;
+
+        // Identical pieces are stored once, in ascending square order
+        if (s > 0 && side == layout->slot_side[s - 1] &&
+            type == layout->slot_type[s - 1] && d <= prev_d) {
+            return false;
+        }
+        prev_d = d;
+
+        int sq = domain_squares[side][type][d];
+        if (pos->board[sq]) return false;
+        pos->board[sq] = XQ_PIECE(side, type);
+        if (type == XQ_KING) pos->king_sq[side] = sq;
+    }
+
+    if (xq_in_check(pos, pos->side ^ 1)) return false;
+    pos->hash = xq_compute_hash(pos);
+    return true;
+}
+
+bool tb_encode(const tb_layout_t* layout, const xq_position_t* pos,
+               uint32_t* out_index) {
+    int next_slot[2][8];
+    int slot_d[2 + TB_MAX_EXTRA_PIECES];
+    int filled = 0;
+
+    // First slot of each (side, type); identical pieces follow it
+    for (int side = 0; side < 2; side++) {
+        for (int type = 0; type < 8; type++) next_slot[side][type] = -1;
+    }
+    for (int s = layout->slot_count - 1; s >= 0; s--) {
+        next_slot[layout->slot_side[s]][layout->slot_type[s]] = s;
+    }
+
+    // Ascending squares give ascending domain indices
+    for (int sq = 0; sq < XQ_SQUARES; sq++) {
+        uint8_t piece = pos->board[sq];
+        if (!piece) continue;
+        int side = XQ_SIDE(piece);
+        int type = XQ_TYPE(piece);
+        int s = next_slot[side][type];
+        if (s < 0 || s >= layout->slot_count || layout->slot_side[s] != side ||
+            layout->slot_type[s] != type) {
+            return false;  // Different material
+        }
+        int d = domain_index[side][type][sq];
+        if (d < 0) return false;
+        slot_d[s] = d;
+        next_slot[side][type] = s + 1;
+        filled++;
+    }
+    if (filled != layout->slot_count) return false;
+
+    uint32_t index = 0;
+    for (int s = layout->slot_count - 1; s >= 0; s--) {
+        index = index * (uint32_t)domain_size[layout->slot_side[s]][layout->slot_type[s]] +
+                (uint32_t)slot_d[s];
+    }
+    *out_index = index * 2 + (uint32_t)pos->side;
+    return true;
+}
+
+// =========================
+// File format
+// =========================
+
+bool tb_write_file(const char* path, const tb_layout_t* layout,
+                   const uint8_t* values) {
+    uint32_t block_count = (layout->size + TB_BLOCK_SIZE - 1) / TB_BLOCK_SIZE;
+    uint32_t* offsets = malloc(sizeof(uint32_t) * (block_count + 1));
+    // Worst case one pair per entry
+    uint8_t* data = malloc((size_t)layout->size * 2);
+    if (!offsets || !data) {
+        free(offsets);
+        free(data);
+        return false;
+    }
+
+    uint32_t len = 0;
+    for (uint32_t b = 0; b < block_count; b++) {
+        offsets[b] = len;
+        uint32_t i = b * TB_BLOCK_SIZE;
+        uint32_t end = i + TB_BLOCK_SIZE;
+        if (end > layout->size) end = layout->size;
+        while (i < end) {
+            // Illegal entries are never reached from real games, so they
+            // extend whatever run they sit in
+            uint8_t value = values[i];
+            for (uint32_t k = i; k < end && value == TB_ILLEGAL; k++) value = values[k];
+            uint32_t run = 1;
+            while (i + run < end && run < 256 &&
+                   (values[i + run] == value || values[i + run] == TB_ILLEGAL)) {
+                run++;
+            }
+            data[len++] = (uint8_t)(run - 1);
+            data[len++] = value;
+            i += run;
+        }
+    }
+    offsets[block_count] = len;
+
+    tb_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TB_MAGIC, sizeof(TB_MAGIC) - 1);
+    snprintf(header.material, sizeof(header.material), "%s", layout->material);
+    header.entry_count = layout->size;
+    header.block_size = TB_BLOCK_SIZE;
+    header.block_count = block_count;
+
+    bool ok = false;
+    FILE* f = fopen(path, "wb");
+    if (f) {
+        ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(offsets, sizeof(uint32_t), block_count + 1, f) == block_count + 1 &&
+             fwrite(data, 1, len, f) == len;
+        ok = (fclose(f) == 0) && ok;
+    }
+
+    free(offsets);
+    free(data);
+    return ok;
+}
+
+static const tb_table_t* find_table(const char* material) {
+    for (int i = 0; i < table_count; i++) {
+        if (strcmp(tables[i].layout.material, material) == 0) return &tables[i];
+    }
+    return NULL;
+}
+
+bool tablebase_load_file(const char* path) {
+    if (table_count >= TB_MAX_TABLES) return false;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(tb_file_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const tb_file_header_t* header = map;
+    tb_table_t table;
+    memset(&table, 0, sizeof(table));
+
+    char material[sizeof(header->material) + 1];
+    memcpy(material, header->material, sizeof(header->material));
+    material[sizeof(header->material)] = '\0';
+
+    size_t offsets_size = sizeof(uint32_t) * ((size_t)header->block_count + 1);
+    bool valid = memcmp(header->magic, TB_MAGIC, sizeof(TB_MAGIC) - 1) == 0 &&
+                 tb_layout_from_material(material, &table.layout) &&
+                 header->entry_count == table.layout.size &&
+                 header->block_size > 0 &&
+                 header->block_count ==
+                     (table.layout.size + header->block_size - 1) / header->block_size &&
+                 sizeof(*header) + offsets_size <= size;
+    if (valid) {
+        table.offsets = (const uint32_t*)((const uint8_t*)map + sizeof(*header));
+        table.data = (const uint8_t*)map + sizeof(*header) + offsets_size;
+        valid = table.offsets[header->block_count] <= size - sizeof(*header) - offsets_size;
+    }
+    if (!valid || find_table(table.layout.material)) {
+        munmap(map, size);
+        return false;
+    }
+
+    table.map = map;
+    table.map_size = size;
+    table.block_size = header->block_size;
+    table.block_count = header->block_count;
+    madvise(map, size, MADV_RANDOM);
+    tables[table_count++] = table;
+    return true;
+}
+
+int tablebase_init(const char* dir) {
+    DIR* d = opendir(dir);
+    if (!d) {
+        printf("[TABLEBASE] No tablebase directory '%s'\n", dir);
+        return 0;
+    }
+
+    struct dirent* entry;
+    size_t ext_len = strlen(TABLEBASE_EXT);
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= ext_len || strcmp(entry->d_name + len - ext_len, TABLEBASE_EXT) != 0) {
+            continue;
+        }
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (!tablebase_load_file(path)) {
+            printf("[TABLEBASE] Skipping invalid table %s\n", path);
+        }
+    }
+    closedir(d);
+
+    printf("[TABLEBASE] Loaded %d tables from %s\n", table_count, dir);
+    return table_count;
+}
+
+void tablebase_shutdown(void) {
+    for (int i = 0; i < table_count; i++) {
+        munmap((void*)tables[i].map, tables[i].map_size);
+    }
+    memset(tables, 0, sizeof(tables));
+    table_count = 0;
+}
+
+int tablebase_count(void) { return table_count; }
+
+// =========================
+// Probing
+// =========================
+
+static uint8_t table_value(const tb_table_t* table, uint32_t index) {
+    uint32_t block = index / table->block_size;
+    uint32_t skip = index % table->block_size;
+    const uint8_t* p = table->data + table->offsets[block];
+    const uint8_t* end = table->data + table->offsets[block + 1];
+
+    while (p + 1 < end) {
+        uint32_t run = (uint32_t)p[0] + 1;
+        if (skip < run) return p[1];
+        skip -= run;
+        p += 2;
+    }
+    return TB_ILLEGAL;
+}
+
+bool tablebase_probe(const xq_position_t* pos, tb_probe_t* out) {
+    char material[32];
+    tb_material_of(pos, material, sizeof(material));
+    memset(out, 0, sizeof(*out));
+
+    // Nobody can mate: dead draw, no table needed
+    if (!tb_material_has_attackers(material)) {
+        out->found = true;
+        return true;
+    }
+
+    const tb_table_t* table = find_table(material);
+    xq_position_t mirrored;
+    const xq_position_t* lookup = pos;
+    if (!table) {
+        // Stored with colours the other way round
+        char swapped[32];
+        tb_material_mirror(material, swapped, sizeof(swapped));
+        table = find_table(swapped);
+        if (!table) return false;
+        tb_position_mirror(pos, &mirrored);
+        lookup = &mirrored;
+    }
+
+    uint32_t index;
+    if (!tb_encode(&table->layout, lookup, &index)) return false;
+
+    uint8_t value = table_value(table, index);
+    if (value == TB_ILLEGAL) return false;
+
+    out->found = true;
+    if (value != TB_DRAW) {
+        out->dtm = value - 1;
+        out->wdl = (out->dtm % 2) ? 1 : -1;
+    }
+    return true;
+}
+
+// Rank a child position from the parent's view; higher is better
+static int child_score(const tb_probe_t* child) {
+    if (child->wdl < 0) return 1000 - child->dtm;  // Fastest win for us
+    if (child->wdl > 0) return -1000 + child->dtm; // Slowest loss
+    return 0;
+}
+
+xq_move_t tablebase_best_move(xq_position_t* pos, tb_probe_t* out) {
+    xq_move_t moves[XQ_MAX_MOVES];
+    xq_move_t best = XQ_NO_MOVE;
+    int best_score = -100000;
+
+    if (!tablebase_probe(pos, out)) return XQ_NO_MOVE;
+
+    int count = xq_generate_legal(pos, moves);
+    for (int i = 0; i < count; i++) {
+        xq_undo_t undo;
+        tb_probe_t child;
+        if (!xq_make_move(pos, moves[i], &undo)) continue;
+        bool found = tablebase_probe(pos, &child);
+        xq_unmake_move(pos, &undo);
+        if (!found) continue;
+
+        int score = child_score(&child);
+        if (score > best_score) {
+            best_score = score;
+            best = moves[i];
+        }
+    }
+    return best;
+}
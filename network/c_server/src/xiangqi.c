@@ -0,0 +1,500 @@
+/*
+ * xiangqi.c - Board model, move generation and Zobrist hashing
+ */
+
+#include "xiangqi.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint64_t zobrist_piece[16][XQ_SQUARES];
+static uint64_t zobrist_side;
+static pthread_once_t zobrist_once = PTHREAD_ONCE_INIT;
+
+// splitmix64 - fixed seed so hashes are stable across runs
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static void zobrist_fill(void) {
+    uint64_t state = 0x58514E47ull;  // "XQNG"
+    for (int p = 0; p < 16; p++) {
+        for (int sq = 0; sq < XQ_SQUARES; sq++) {
+            zobrist_piece[p][sq] = splitmix64(&state);
+        }
+    }
+    zobrist_side = splitmix64(&state);
+}
+
+void xq_init(void) { pthread_once(&zobrist_once, zobrist_fill); }
+
+uint64_t xq_compute_hash(const xq_position_t* pos) {
+    uint64_t h = 0;
+    for (int sq = 0; sq < XQ_SQUARES; sq++) {
+        if (pos->board[sq]) h ^= zobrist_piece[pos->board[sq]][sq];
+    }
+    if (pos->side == XQ_BLACK) h ^= zobrist_side;
+    return h;
+}
+
+void xq_position_start(xq_position_t* pos) {
+    static const uint8_t back_rank[XQ_COLS] = {
+        XQ_CHARIOT, XQ_HORSE,    XQ_ELEPHANT, XQ_ADVISOR, XQ_KING,
+        XQ_ADVISOR, XQ_ELEPHANT, XQ_HORSE,    XQ_CHARIOT};
+
+    xq_init();
+    memset(pos, 0, sizeof(*pos));
+
+    for (int col = 0; col < XQ_COLS; col++) {
+        pos->board[XQ_SQ(0, col)] = XQ_PIECE(XQ_BLACK, back_rank[col]);
+        pos->board[XQ_SQ(9, col)] = XQ_PIECE(XQ_RED, back_rank[col]);
+    }
+    for (int col = 1; col < XQ_COLS; col += 6) {
+        pos->board[XQ_SQ(2, col)] = XQ_PIECE(XQ_BLACK, XQ_CANNON);
+        pos->board[XQ_SQ(7, col)] = XQ_PIECE(XQ_RED, XQ_CANNON);
+    }
+    for (int col = 0; col < XQ_COLS; col += 2) {
+        pos->board[XQ_SQ(3, col)] = XQ_PIECE(XQ_BLACK, XQ_PAWN);
+        pos->board[XQ_SQ(6, col)] = XQ_PIECE(XQ_RED, XQ_PAWN);
+    }
+
+    pos->side = XQ_RED;
+    pos->king_sq[XQ_RED] = XQ_SQ(9, 4);
+    pos->king_sq[XQ_BLACK] = XQ_SQ(0, 4);
+    pos->hash = xq_compute_hash(pos);
+}
+
+// =========================
+// Geometry
+// =========================
+
+static bool on_board(int row, int col) {
+    return row >= 0 && row < XQ_ROWS && col >= 0 && col < XQ_COLS;
+}
+
+static bool in_palace(int side, int row, int col) {
+    if (col < 3 || col > 5) return false;
+    return side == XQ_RED ? (row >= 7 && row <= 9) : (row >= 0 && row <= 2);
+}
+
+static bool on_own_half(int side, int row) {
+    return side == XQ_RED ? row >= 5 : row <= 4;
+}
+
+// Row step of a pawn moving forward
+static int forward(int side) { return side == XQ_RED ? -1 : 1; }
+
+static const int orth_dr[4] = {-1, 1, 0, 0};
+static const int orth_dc[4] = {0, 0, -1, 1};
+static const int diag_dr[4] = {-1, -1, 1, 1};
+static const int diag_dc[4] = {-1, 1, -1, 1};
+
+// Horse jumps: (dr, dc) plus the leg square that must be empty
+static const int horse_dr[8] = {-2, -2, 2, 2, -1, 1, -1, 1};
+static const int horse_dc[8] = {-1, 1, -1, 1, -2, -2, 2, 2};
+static const int horse_leg_dr[8] = {-1, -1, 1, 1, 0, 0, 0, 0};
+static const int horse_leg_dc[8] = {0, 0, 0, 0, -1, -1, 1, 1};
+
+// =========================
+// Move generation
+// =========================
+
+typedef struct {
+    xq_move_t* moves;
+    int count;
+    bool captures_only;
+} move_list_t;
+
+// Add from->to unless it lands on an own piece (or is quiet in captures_only)
+static void add_move(const xq_position_t* pos, move_list_t* list, int side,
+                     int from, int row, int col) {
+    int to = XQ_SQ(row, col);
+    uint8_t target = pos->board[to];
+    if (target) {
+        if (XQ_SIDE(target) == side) return;
+    } else if (list->captures_only) {
+        return;
+    }
+    list->moves[list->count++] = XQ_MOVE(from, to);
+}
+
+static void gen_piece(const xq_position_t* pos, move_list_t* list, int from) {
+    uint8_t piece = pos->board[from];
+    int side = XQ_SIDE(piece);
+    int row = XQ_ROW(from);
+    int col = XQ_COL(from);
+
+    switch (XQ_TYPE(piece)) {
+        case XQ_KING:
+            for (int d = 0; d < 4; d++) {
+                int r = row + orth_dr[d], c = col + orth_dc[d];
+                if (in_palace(side, r, c)) add_move(pos, list, side, from, r, c);
+            }
+            break;
+
+        case XQ_ADVISOR:
+            for (int d = 0; d < 4; d++) {
+                int r = row + diag_dr[d], c = col + diag_dc[d];
+                if (in_palace(side, r, c)) add_move(pos, list, side, from, r, c);
+            }
+            break;
+
+        case XQ_ELEPHANT:
+            for (int d = 0; d < 4; d++) {
+                int r = row + 2 * diag_dr[d], c = col + 2 * diag_dc[d];
+                if (!on_board(r, c) || !on_own_half(side, r)) continue;
+                // Blocked "elephant eye"
+                if (pos->board[XQ_SQ(row + diag_dr[d], col + diag_dc[d])]) continue;
+                add_move(pos, list, side, from, r, c);
+            }
+            break;
+
+        case XQ_HORSE:
+            for (int d = 0; d < 8; d++) {
+                int r = row + horse_dr[d], c = col + horse_dc[d];
+                if (!on_board(r, c)) continue;
+                // Hobbled horse
+                if (pos->board[XQ_SQ(row + horse_leg_dr[d], col + horse_leg_dc[d])]) {
+                    continue;
+                }
+                add_move(pos, list, side, from, r, c);
+            }
+            break;
+
+        case XQ_CHARIOT:
+            for (int d = 0; d < 4; d++) {
+                int r = row + orth_dr[d], c = col + orth_dc[d];
+                while (on_board(r, c)) {
+                    add_move(pos, list, side, from, r, c);
+                    if (pos->board[XQ_SQ(r, c)]) break;
+                    r += orth_dr[d];
+                    c += orth_dc[d];
+                }
+            }
+            break;
+
+        case XQ_CANNON:
+            for (int d = 0; d < 4; d++) {
+                int r = row + orth_dr[d], c = col + orth_dc[d];
+                // Slide like a chariot up to the screen...
+                while (on_board(r, c) && !pos->board[XQ_SQ(r, c)]) {
+                    if (!list->captures_only) {
+                        list->moves[list->count++] = XQ_MOVE(from, XQ_SQ(r, c));
+                    }
+                    r += orth_dr[d];
+                    c += orth_dc[d];
+                }
+                // ...then capture the first piece beyond it
+                r += orth_dr[d];
+                c += orth_dc[d];
+                while (on_board(r, c)) {
+                    uint8_t target = pos->board[XQ_SQ(r, c)];
+                    if (target) {
+                        if (XQ_SIDE(target) != side) {
+                            list->moves[list->count++] = XQ_MOVE(from, XQ_SQ(r, c));
+                        }
+                        break;
+                    }
+                    r += orth_dr[d];
+                    c += orth_dc[d];
+                }
+            }
+            break;
+
+        case XQ_PAWN: {
+            int r = row + forward(side);
+            if (on_board(r, col)) add_move(pos, list, side, from, r, col);
+            // Sideways once across the river
+            if (!on_own_half(side, row)) {
+                if (col > 0) add_move(pos, list, side, from, row, col - 1);
+                if (col < XQ_COLS - 1) add_move(pos, list, side, from, row, col + 1);
+            }
+            break;
+        }
+    }
+}
+
+int xq_generate_moves(const xq_position_t* pos, xq_move_t* moves,
+                      bool captures_only) {
+    move_list_t list = {moves, 0, captures_only};
+    for (int sq = 0; sq < XQ_SQUARES; sq++) {
+        uint8_t piece = pos->board[sq];
+        if (piece && XQ_SIDE(piece) == pos->side) gen_piece(pos, &list, sq);
+    }
+    return list.count;
+}
+
+// =========================
+// Check detection
+// =========================
+
+bool xq_in_check(const xq_position_t* pos, int side) {
+    int enemy = side ^ 1;
+    int ksq = pos->king_sq[side];
+    int row = XQ_ROW(ksq);
+    int col = XQ_COL(ksq);
+
+    // Chariots, cannons and the facing king along the four rays
+    for (int d = 0; d < 4; d++) {
+        int r = row + orth_dr[d], c = col + orth_dc[d];
+        int screens = 0;
+        while (on_board(r, c)) {
+            uint8_t piece = pos->board[XQ_SQ(r, c)];
+            if (piece) {
+                if (screens == 0) {
+                    if (XQ_SIDE(piece) == enemy &&
+                        (XQ_TYPE(piece) == XQ_CHARIOT ||
+                         (XQ_TYPE(piece) == XQ_KING && orth_dc[d] == 0))) {
+                        return true;
+                    }
+                } else {
+                    if (XQ_SIDE(piece) == enemy && XQ_TYPE(piece) == XQ_CANNON) {
+                        return true;
+                    }
+                    break;
+                }
+                screens++;
+            }
+            r += orth_dr[d];
+            c += orth_dc[d];
+        }
+    }
+
+    // Horses: reverse each jump; the leg sits next to the horse
+    for (int d = 0; d < 8; d++) {
+        int hr = row - horse_dr[d], hc = col - horse_dc[d];
+        if (!on_board(hr, hc)) continue;
+        if (pos->board[XQ_SQ(hr, hc)] != XQ_PIECE(enemy, XQ_HORSE)) continue;
+        if (!pos->board[XQ_SQ(hr + horse_leg_dr[d], hc + horse_leg_dc[d])]) {
+            return true;
+        }
+    }
+
+    // Pawns: from in front of the king, or beside it once across the river
+    uint8_t pawn = XQ_PIECE(enemy, XQ_PAWN);
+    int pr = row - forward(enemy);
+    if (on_board(pr, col) && pos->board[XQ_SQ(pr, col)] == pawn) return true;
+    if (!on_own_half(enemy, row)) {
+        if (col > 0 && pos->board[XQ_SQ(row, col - 1)] == pawn) return true;
+        if (col < XQ_COLS - 1 && pos->board[XQ_SQ(row, col + 1)] == pawn) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// =========================
+// Make / unmake
+// =========================
+
+bool xq_make_move(xq_position_t* pos, xq_move_t move, xq_undo_t* undo) {
+    int from = XQ_FROM(move);
+    int to = XQ_TO(move);
+    uint8_t piece = pos->board[from];
+    uint8_t captured = pos->board[to];
+    int side = pos->side;
+
+    undo->move = move;
+    undo->captured = captured;
+    undo->hash = pos->hash;
+
+    pos->board[to] = piece;
+    pos->board[from] = XQ_EMPTY;
+    if (XQ_TYPE(piece) == XQ_KING) pos->king_sq[side] = to;
+
+    if (xq_in_check(pos, side)) {
+        pos->board[from] = piece;
+        pos->board[to] = captured;
+        if (XQ_TYPE(piece) == XQ_KING) pos->king_sq[side] = from;
+        return false;
+    }
+
+    pos->hash ^= zobrist_piece[piece][from] ^ zobrist_piece[piece][to] ^ zobrist_side;
+    if (captured) pos->hash ^= zobrist_piece[captured][to];
+    pos->side = side ^ 1;
+    return true;
+}
+
+void xq_unmake_move(xq_position_t* pos, const xq_undo_t* undo) {
+    int from = XQ_FROM(undo->move);
+    int to = XQ_TO(undo->move);
+    uint8_t piece = pos->board[to];
+
+    pos->side ^= 1;
+    pos->board[from] = piece;
+    pos->board[to] = undo->captured;
+    if (XQ_TYPE(piece) == XQ_KING) pos->king_sq[pos->side] = from;
+    pos->hash = undo->hash;
+}
+
+void xq_make_null(xq_position_t* pos) {
+    pos->side ^= 1;
+    pos->hash ^= zobrist_side;
+}
+
+void xq_unmake_null(xq_position_t* pos) { xq_make_null(pos); }
+
+int xq_generate_legal(xq_position_t* pos, xq_move_t* moves) {
+    xq_move_t pseudo[XQ_MAX_MOVES];
+    int n = xq_generate_moves(pos, pseudo, false);
+    int count = 0;
+
+    for (int i = 0; i < n; i++) {
+        xq_undo_t undo;
+        if (xq_make_move(pos, pseudo[i], &undo)) {
+            xq_unmake_move(pos, &undo);
+            moves[count++] = pseudo[i];
+        }
+    }
+    return count;
+}
+
+xq_move_t xq_find_move(xq_position_t* pos, int from_row, int from_col,
+                       int to_row, int to_col) {
+    if (!on_board(from_row, from_col) || !on_board(to_row, to_col)) {
+        return XQ_NO_MOVE;
+    }
+
+    uint8_t piece = pos->board[XQ_SQ(from_row, from_col)];
+    if (piece == XQ_EMPTY || XQ_SIDE(piece) != pos->side) return XQ_NO_MOVE;
+
+    // Match against the pseudo-legal list, then test only that move
+    xq_move_t wanted = XQ_MOVE(XQ_SQ(from_row, from_col), XQ_SQ(to_row, to_col));
+    xq_move_t moves[XQ_MAX_MOVES];
+    int n = xq_generate_moves(pos, moves, false);
+    for (int i = 0; i < n; i++) {
+        if (moves[i] != wanted) continue;
+        xq_undo_t undo;
+        if (!xq_make_move(pos, wanted, &undo)) return XQ_NO_MOVE;
+        xq_unmake_move(pos, &undo);
+        return wanted;
+    }
+    return XQ_NO_MOVE;
+}
+
+// =========================
+// Setups and FEN
+// =========================
+
+// FEN letter per piece type (upper case = red)
+static const char fen_letter[8] = {'?', 'k', 'a', 'b', 'n', 'r', 'c', 'p'};
+
+// Pieces each side starts with, by type
+static const int start_count[8] = {0, 1, 2, 2, 2, 2, 2, 5};
+
+bool xq_square_allowed(int side, int type, int sq) {
+    int row = XQ_ROW(sq);
+    int col = XQ_COL(sq);
+    // Rows counted from the side's own back rank
+    int rel = side == XQ_RED ? XQ_ROWS - 1 - row : row;
+
+    switch (type) {
+        case XQ_KING:
+            return rel <= 2 && col >= 3 && col <= 5;
+        case XQ_ADVISOR:
+            return rel <= 2 && col >= 3 && col <= 5 && (rel + col) % 2 == 1;
+        case XQ_ELEPHANT:
+            return rel <= 4 && rel % 2 == 0 && col % 2 == 0 &&
+                   (rel / 2 + col / 2) % 2 == 1;
+        case XQ_PAWN:
+            // Before the river only on the starting files
+            return rel >= 5 || ((rel == 3 || rel == 4) && col % 2 == 0);
+        case XQ_HORSE:
+        case XQ_CHARIOT:
+        case XQ_CANNON:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int fen_piece_type(char c) {
+    switch (c) {
+        case 'k': return XQ_KING;
+        case 'a': return XQ_ADVISOR;
+        case 'b': case 'e': return XQ_ELEPHANT;
+        case 'n': case 'h': return XQ_HORSE;
+        case 'r': return XQ_CHARIOT;
+        case 'c': return XQ_CANNON;
+        case 'p': return XQ_PAWN;
+        default: return XQ_EMPTY;
+    }
+}
+
+bool xq_position_from_fen(xq_position_t* pos, const char* fen) {
+    int counts[2][8] = {{0}};
+    int row = 0, col = 0;
+    const char* p = fen;
+
+    xq_init();
+    memset(pos, 0, sizeof(*pos));
+
+    for (; *p && *p != ' '; p++) {
+        if (*p == '/') {
+            if (col != XQ_COLS || ++row >= XQ_ROWS) return false;
+            col = 0;
+        } else if (*p >= '1' && *p <= '9') {
+            col += *p - '0';
+            if (col > XQ_COLS) return false;
+        } else {
+            int side = (*p >= 'A' && *p <= 'Z') ? XQ_RED : XQ_BLACK;
+            int type = fen_piece_type((char)(side == XQ_RED ? *p - 'A' + 'a' : *p));
+            if (type == XQ_EMPTY || col >= XQ_COLS) return false;
+
+            int sq = XQ_SQ(row, col);
+            if (!xq_square_allowed(side, type, sq)) return false;
+            if (++counts[side][type] > start_count[type]) return false;
+            pos->board[sq] = XQ_PIECE(side, type);
+            if (type == XQ_KING) pos->king_sq[side] = sq;
+            col++;
+        }
+    }
+    if (row != XQ_ROWS - 1 || col != XQ_COLS) return false;
+    if (counts[XQ_RED][XQ_KING] != 1 || counts[XQ_BLACK][XQ_KING] != 1) return false;
+
+    while (*p == ' ') p++;
+    if (*p == 'w' || *p == 'r' || *p == '\0') {
+        pos->side = XQ_RED;
+    } else if (*p == 'b') {
+        pos->side = XQ_BLACK;
+    } else {
+        return false;
+    }
+
+    // The side that just moved cannot have left its king attacked
+    if (xq_in_check(pos, pos->side ^ 1)) return false;
+
+    pos->hash = xq_compute_hash(pos);
+    return true;
+}
+
+void xq_position_to_fen(const xq_position_t* pos, char* out, size_t size) {
+    char buf[XQ_FEN_MAX];
+    size_t len = 0;
+
+    for (int row = 0; row < XQ_ROWS; row++) {
+        int empty = 0;
+        for (int col = 0; col < XQ_COLS; col++) {
+            uint8_t piece = pos->board[XQ_SQ(row, col)];
+            if (!piece) {
+                empty++;
+                continue;
+            }
+            if (empty) buf[len++] = (char)('0' + empty);
+            empty = 0;
+            char c = fen_letter[XQ_TYPE(piece)];
+            buf[len++] = XQ_SIDE(piece) == XQ_RED ? (char)(c - 'a' + 'A') : c;
+        }
+        if (empty) buf[len++] = (char)('0' + empty);
+        if (row < XQ_ROWS - 1) buf[len++] = '/';
+    }
+    buf[len] = '\0';
+
+    // No castling or en passant in Xiangqi; move counters are not tracked
+    snprintf(out, size, "%s %c - - 0 1", buf, pos->side == XQ_RED ? 'w' : 'b');
+}
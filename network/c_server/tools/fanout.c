@@ -0,0 +1,1197 @@
+/*
+ * fanout.c - Spectator fan-out server
+ *
+ * Usage: fanout [-p port] [-t threads] [-s socket]
+ *
+ * Holds the spectator connections so the game server only serves players.
+ * One upstream connection to the game server's FANOUT_SOCKET_PATH carries
+ * every match event (see fanout.h); the reader (main) thread turns each
+ * event into one shared frame and hands it to every I/O thread. An I/O
+ * thread owns its spectators outright - its own epoll, topics, send queues
+ * and pending requests - so the only things crossing threads are the
+ * immutable frames and the inbox lists.
+ *
+ * Spectators speak the subset of the game protocol that concerns them:
+ * join_spectate, leave_spectate, resync_from and heartbeat. Delivery follows
+ * the game server's policy (pubsub.h): a short per-topic history serves
+ * resync_from, a connection with FO_LAG_BYTES queued skips events until it
+ * drains and then gets one match_snapshot, and one stuck for FO_EVICT_MS is
+ * unsubscribed.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fanout.h"
+#include "hashmap.h"
+#include "protocol.h"
+
+#define FO_MAX_THREADS 16
+#define FO_DEFAULT_THREADS 4
+#define FO_TOPIC_MAX 64             // Match id length, including NUL
+#define FO_TOPICS_PER_CLIENT 8
+#define FO_HISTORY 32               // Events kept per topic for resync_from
+#define FO_RECV_MAX 4096            // Spectator requests are small
+#define FO_OUTQ_MAX 256             // Frames waiting per connection
+#define FO_OUTQ_MAX_BYTES (1024 * 1024)
+#define FO_LAG_BYTES (64 * 1024)    // Queued bytes that switch to latest-state mode
+#define FO_EVICT_MS 30000
+#define FO_MAX_PENDING 1024         // Upstream requests in flight per thread
+#define FO_UPSTREAM_BUFFER (256 * 1024)
+
+// Request ids carry the thread and pending slot: gen | thread | slot
+#define REQ_SLOT_BITS 10
+#define REQ_THREAD_BITS 4
+#define REQ_GEN_MASK 0x1FFFF
+
+typedef struct {
+    atomic_int refcount;
+    size_t len;
+    char data[];
+} frame_t;
+
+typedef enum { ITEM_EVENT, ITEM_REPLY, ITEM_UPSTREAM_LOST } item_kind_t;
+
+// Reader -> I/O thread message
+typedef struct item {
+    item_kind_t kind;
+    char topic[FO_TOPIC_MAX];  // ITEM_EVENT
+    uint32_t seq;              // ITEM_EVENT: event_seq
+    frame_t* frame;            // ITEM_EVENT: one reference for this thread
+    int req;                   // ITEM_REPLY
+    bool ok;
+    char* body;                // ITEM_REPLY: response payload, may be NULL
+    uint64_t epoch;            // ITEM_UPSTREAM_LOST: connection that was lost
+    struct item* next;
+} item_t;
+
+struct client;
+struct topic;
+
+typedef struct sub {
+    struct topic* topic;
+    struct client* client;
+    struct sub* topic_prev;
+    struct sub* topic_next;
+    struct sub* client_next;
+    bool lagging;
+    int64_t lagging_since_ms;
+    struct sub* lag_prev;  // Thread's lagging list, oldest first
+    struct sub* lag_next;
+} sub_t;
+
+typedef struct topic {
+    char name[FO_TOPIC_MAX];
+    int index;  // Position in worker_t.topics
+    sub_t* subs;
+    int sub_count;
+    frame_t* history[FO_HISTORY];  // Ring, oldest at history_head
+    uint32_t history_seq[FO_HISTORY];
+    int history_head;
+    int history_count;
+    uint32_t last_seq;      // Newest event seen (0 = none since creation)
+    bool catchup_pending;   // Snapshot for lagging subscribers requested
+} topic_t;
+
+typedef struct client {
+    int fd;
+    char recv_buffer[FO_RECV_MAX];
+    size_t recv_len;
+    frame_t* outq[FO_OUTQ_MAX];
+    int outq_head;
+    int outq_count;
+    size_t outq_offset;
+    size_t outq_bytes;
+    sub_t* subs;
+    int sub_count;
+    int pending;  // Upstream requests still to be answered
+    bool closing;
+} client_t;
+
+typedef enum { REQ_JOIN, REQ_RESYNC, REQ_CATCHUP } req_kind_t;
+
+typedef struct {
+    bool used;
+    uint32_t gen;
+    req_kind_t kind;
+    client_t* client;  // NULL for REQ_CATCHUP
+    int client_seq;
+    uint64_t epoch;
+    char topic[FO_TOPIC_MAX];
+} pending_t;
+
+typedef struct {
+    int index;
+    pthread_t thread;
+    int epoll_fd;
+    int event_fd;
+    pthread_mutex_t lock;
+    item_t* inbox_head;
+    item_t* inbox_tail;
+    // Below: owned by the thread
+    str_map_t topic_index;
+    topic_t** topics;
+    int topic_count;
+    int topic_capacity;
+    pending_t pending[FO_MAX_PENDING];
+    sub_t* lag_head;
+    sub_t* lag_tail;
+    int client_count;
+} worker_t;
+
+static worker_t workers[FO_MAX_THREADS];
+static int worker_count = FO_DEFAULT_THREADS;
+static int listen_fd = -1;
+static volatile sig_atomic_t running = 1;
+
+// Upstream connection; writes come from every I/O thread
+static pthread_mutex_t upstream_lock = PTHREAD_MUTEX_INITIALIZER;
+static int upstream_fd = -1;
+static uint64_t upstream_epoch = 0;  // Bumped on every (re)connect
+
+// epoll tags (clients use their client_t*)
+static int listen_tag;
+static int inbox_tag;
+
+static void signal_handler(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// =========================
+// Frames
+// =========================
+
+static frame_t* frame_create(const char* data, size_t len, int refs) {
+    bool has_newline = len > 0 && data[len - 1] == '\n';
+    frame_t* frame = malloc(sizeof(frame_t) + len + 2);
+    if (!frame) return NULL;
+
+    atomic_init(&frame->refcount, refs);
+    memcpy(frame->data, data, len);
+    if (!has_newline) frame->data[len++] = '\n';
+    frame->data[len] = '\0';
+    frame->len = len;
+    return frame;
+}
+
+static void frame_ref(frame_t* frame) {
+    atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+}
+
+static void frame_unref(frame_t* frame) {
+    if (frame && atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_acq_rel) == 1) {
+        free(frame);
+    }
+}
+
+// =========================
+// Upstream
+// =========================
+
+// Returns the epoch the request went out on, 0 if the game server is down
+static uint64_t upstream_send(const char* line) {
+    size_t len = strlen(line);
+    uint64_t epoch = 0;
+
+    pthread_mutex_lock(&upstream_lock);
+    if (upstream_fd >= 0) {
+        size_t sent = 0;
+        while (sent < len) {
+            ssize_t n = send(upstream_fd, line + sent, len - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            sent += n;
+        }
+        // A short write leaves the stream broken; the reader notices the
+        // hangup and reconnects
+        if (sent == len) epoch = upstream_epoch;
+        else shutdown(upstream_fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&upstream_lock);
+    return epoch;
+}
+
+static void worker_post(worker_t* w, item_t* item) {
+    item->next = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->inbox_tail) w->inbox_tail->next = item;
+    else w->inbox_head = item;
+    w->inbox_tail = item;
+    pthread_mutex_unlock(&w->lock);
+
+    uint64_t one = 1;
+    if (write(w->event_fd, &one, sizeof(one)) < 0) perror("write eventfd");
+}
+
+// The JSON value that runs from after key to the end of the line's object
+static const char* tail_value(const char* line, const char* key, size_t* out_len) {
+    const char* p = strstr(line, key);
+    if (!p) return NULL;
+    p += strlen(key);
+    const char* end = strrchr(p, '}');
+    if (!end || end <= p) return NULL;
+    *out_len = (size_t)(end - p);
+    return p;
+}
+
+static void handle_upstream_line(const char* line) {
+    char* type = json_get_string(line, "type");
+    if (!type) return;
+
+    if (strcmp(type, "match_event") == 0) {
+        char* match_id = json_get_string(line, "match_id");
+        uint32_t seq = (uint32_t)json_get_int64(line, "event_seq");
+        size_t len;
+        const char* message = tail_value(line, "\"message\":", &len);
+
+        frame_t* frame = message && match_id && strlen(match_id) < FO_TOPIC_MAX
+                             ? frame_create(message, len, worker_count)
+                             : NULL;
+        for (int i = 0; frame && i < worker_count; i++) {
+            item_t* item = calloc(1, sizeof(*item));
+            if (!item) {
+                frame_unref(frame);
+                continue;
+            }
+            item->kind = ITEM_EVENT;
+            snprintf(item->topic, sizeof(item->topic), "%s", match_id);
+            item->seq = seq;
+            item->frame = frame;
+            worker_post(&workers[i], item);
+        }
+        free(match_id);
+    } else if (strcmp(type, "response") == 0 || strcmp(type, "error") == 0) {
+        int req = json_get_int(line, "seq");
+        int thread = (req >> REQ_SLOT_BITS) & ((1 << REQ_THREAD_BITS) - 1);
+        if (req > 0 && thread < worker_count) {
+            item_t* item = calloc(1, sizeof(*item));
+            if (item) {
+                item->kind = ITEM_REPLY;
+                item->req = req;
+                item->ok = strcmp(type, "response") == 0;
+                size_t len;
+                const char* payload = tail_value(line, "\"payload\":", &len);
+                if (payload) item->body = strndup(payload, len);
+                worker_post(&workers[thread], item);
+            }
+        }
+    }
+
+    free(type);
+}
+
+static int upstream_connect(const char* path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Main thread: keep the upstream connected and route what it sends
+static void upstream_run(const char* path) {
+    char* buffer = malloc(FO_UPSTREAM_BUFFER);
+    if (!buffer) return;
+
+    while (running) {
+        int fd = upstream_connect(path);
+        if (fd < 0) {
+            sleep(1);
+            continue;
+        }
+
+        pthread_mutex_lock(&upstream_lock);
+        upstream_fd = fd;
+        uint64_t epoch = ++upstream_epoch;
+        pthread_mutex_unlock(&upstream_lock);
+        printf("[Fanout] Connected to game server (%s)\n", path);
+
+        size_t used = 0;
+        while (running) {
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            int ready = poll(&pfd, 1, 1000);
+            if (ready < 0 && errno != EINTR) break;
+            if (ready <= 0) continue;
+
+            ssize_t n = recv(fd, buffer + used, FO_UPSTREAM_BUFFER - used - 1, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            used += n;
+            buffer[used] = '\0';
+
+            char* line = buffer;
+            char* newline;
+            while ((newline = strchr(line, '\n')) != NULL) {
+                *newline = '\0';
+                if (*line) handle_upstream_line(line);
+                line = newline + 1;
+            }
+            used -= line - buffer;
+            memmove(buffer, line, used);
+
+            if (used >= FO_UPSTREAM_BUFFER - 1) {
+                fprintf(stderr, "[Fanout] Upstream line too long, reconnecting\n");
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&upstream_lock);
+        close(fd);
+        upstream_fd = -1;
+        pthread_mutex_unlock(&upstream_lock);
+
+        if (!running) break;
+        printf("[Fanout] Lost the game server, dropping its spectators\n");
+        for (int i = 0; i < worker_count; i++) {
+            item_t* item = calloc(1, sizeof(*item));
+            if (!item) continue;
+            item->kind = ITEM_UPSTREAM_LOST;
+            item->epoch = epoch;
+            worker_post(&workers[i], item);
+        }
+    }
+
+    free(buffer);
+}
+
+// =========================
+// Spectator connections (I/O thread)
+// =========================
+
+static void client_set_events(worker_t* w, client_t* c, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// Same contract as the game server's client_send_frame: in order or not at
+// all (a full queue shuts the connection down)
+static bool client_send_frame(worker_t* w, client_t* c, frame_t* frame) {
+    if (c->closing) return false;
+
+    size_t sent = 0;
+    if (c->outq_count == 0) {
+        ssize_t n = send(c->fd, frame->data, frame->len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            n = 0;
+        }
+        if ((size_t)n == frame->len) return true;
+        sent = (size_t)n;
+    } else if (c->outq_count >= FO_OUTQ_MAX ||
+               c->outq_bytes + frame->len > FO_OUTQ_MAX_BYTES) {
+        shutdown(c->fd, SHUT_RDWR);
+        c->closing = true;
+        return false;
+    }
+
+    int tail = (c->outq_head + c->outq_count) % FO_OUTQ_MAX;
+    frame_ref(frame);
+    c->outq[tail] = frame;
+    if (c->outq_count++ == 0) {
+        c->outq_offset = sent;
+        client_set_events(w, c, EPOLLIN | EPOLLOUT | EPOLLET);
+    }
+    c->outq_bytes += frame->len - sent;
+    return true;
+}
+
+static void client_send(worker_t* w, client_t* c, const char* json) {
+    frame_t* frame = frame_create(json, strlen(json), 1);
+    if (!frame) return;
+    client_send_frame(w, c, frame);
+    frame_unref(frame);
+}
+
+static void send_response(worker_t* w, client_t* c, int seq, bool success,
+                          const char* message, const char* payload) {
+    size_t cap = 256 + (payload ? strlen(payload) : 0);
+    char* response = malloc(cap);
+    if (!response) return;
+
+    if (payload) {
+        snprintf(response, cap,
+                 "{\"type\":\"%s\",\"seq\":%d,\"success\":%s,\"message\":\"%s\",\"payload\":%s}",
+                 success ? "response" : "error", seq, success ? "true" : "false",
+                 message, payload);
+    } else {
+        snprintf(response, cap, "{\"type\":\"%s\",\"seq\":%d,\"success\":%s,\"message\":\"%s\"}",
+                 success ? "response" : "error", seq, success ? "true" : "false",
+                 message);
+    }
+    client_send(w, c, response);
+    free(response);
+}
+
+// =========================
+// Topics (I/O thread)
+// =========================
+
+static topic_t* topic_find(worker_t* w, const char* name) {
+    int index;
+    if (!str_map_get(&w->topic_index, name, &index)) return NULL;
+    return w->topics[index];
+}
+
+static topic_t* topic_get_or_create(worker_t* w, const char* name) {
+    topic_t* topic = topic_find(w, name);
+    if (topic) return topic;
+
+    if (w->topic_count == w->topic_capacity) {
+        int capacity = w->topic_capacity ? w->topic_capacity * 2 : 64;
+        topic_t** grown = realloc(w->topics, capacity * sizeof(*grown));
+        if (!grown) return NULL;
+        w->topics = grown;
+        w->topic_capacity = capacity;
+    }
+
+    topic = calloc(1, sizeof(*topic));
+    if (!topic) return NULL;
+    snprintf(topic->name, sizeof(topic->name), "%s", name);
+    topic->index = w->topic_count;
+    if (!str_map_put(&w->topic_index, topic->name, topic->index)) {
+        free(topic);
+        return NULL;
+    }
+    w->topics[w->topic_count++] = topic;
+    return topic;
+}
+
+static void topic_destroy(worker_t* w, topic_t* topic) {
+    str_map_remove(&w->topic_index, topic->name);
+
+    topic_t* last = w->topics[--w->topic_count];
+    if (last != topic) {
+        last->index = topic->index;
+        w->topics[last->index] = last;
+        str_map_put(&w->topic_index, last->name, last->index);
+    }
+    for (int i = 0; i < topic->history_count; i++) {
+        frame_unref(topic->history[(topic->history_head + i) % FO_HISTORY]);
+    }
+    free(topic);
+}
+
+static void lag_start(worker_t* w, sub_t* sub) {
+    sub->lagging = true;
+    sub->lagging_since_ms = now_ms();
+    sub->lag_next = NULL;
+    sub->lag_prev = w->lag_tail;
+    if (w->lag_tail) w->lag_tail->lag_next = sub;
+    else w->lag_head = sub;
+    w->lag_tail = sub;
+}
+
+static void lag_stop(worker_t* w, sub_t* sub) {
+    if (sub->lag_prev) sub->lag_prev->lag_next = sub->lag_next;
+    else w->lag_head = sub->lag_next;
+    if (sub->lag_next) sub->lag_next->lag_prev = sub->lag_prev;
+    else w->lag_tail = sub->lag_prev;
+    sub->lag_prev = sub->lag_next = NULL;
+    sub->lagging = false;
+}
+
+static sub_t* sub_find(client_t* c, const topic_t* topic) {
+    for (sub_t* sub = c->subs; sub; sub = sub->client_next) {
+        if (sub->topic == topic) return sub;
+    }
+    return NULL;
+}
+
+static bool subscribe(worker_t* w, client_t* c, const char* name) {
+    topic_t* topic = topic_get_or_create(w, name);
+    if (!topic) return false;
+    if (sub_find(c, topic)) return true;
+
+    sub_t* sub = calloc(1, sizeof(*sub));
+    if (!sub) {
+        if (topic->sub_count == 0) topic_destroy(w, topic);
+        return false;
+    }
+    sub->topic = topic;
+    sub->client = c;
+    sub->topic_next = topic->subs;
+    if (topic->subs) topic->subs->topic_prev = sub;
+    topic->subs = sub;
+    topic->sub_count++;
+    sub->client_next = c->subs;
+    c->subs = sub;
+    c->sub_count++;
+    return true;
+}
+
+static void sub_remove(worker_t* w, sub_t* sub) {
+    topic_t* topic = sub->topic;
+    client_t* c = sub->client;
+
+    if (sub->lagging) lag_stop(w, sub);
+
+    if (sub->topic_prev) sub->topic_prev->topic_next = sub->topic_next;
+    else topic->subs = sub->topic_next;
+    if (sub->topic_next) sub->topic_next->topic_prev = sub->topic_prev;
+
+    // A client has at most FO_TOPICS_PER_CLIENT subscriptions
+    for (sub_t** link = &c->subs; *link; link = &(*link)->client_next) {
+        if (*link == sub) {
+            *link = sub->client_next;
+            break;
+        }
+    }
+
+    topic->sub_count--;
+    c->sub_count--;
+    free(sub);
+
+    if (topic->sub_count == 0) topic_destroy(w, topic);
+}
+
+static void topic_record(topic_t* topic, uint32_t seq, frame_t* frame) {
+    int slot;
+    if (topic->history_count == FO_HISTORY) {
+        slot = topic->history_head;
+        frame_unref(topic->history[slot]);
+        topic->history_head = (topic->history_head + 1) % FO_HISTORY;
+    } else {
+        slot = (topic->history_head + topic->history_count++) % FO_HISTORY;
+    }
+    frame_ref(frame);
+    topic->history[slot] = frame;
+    topic->history_seq[slot] = seq;
+    topic->last_seq = seq;
+}
+
+// Frames after after_seq from the history; -1 if it does not reach back
+static int topic_replay(worker_t* w, topic_t* topic, client_t* c, uint32_t after_seq) {
+    if (topic->history_count == 0) return -1;
+    if (after_seq + 1 < topic->history_seq[topic->history_head]) return -1;
+
+    int sent = 0;
+    for (int i = 0; i < topic->history_count; i++) {
+        int slot = (topic->history_head + i) % FO_HISTORY;
+        if (topic->history_seq[slot] <= after_seq) continue;
+        if (!client_send_frame(w, c, topic->history[slot])) return -1;
+        sent++;
+    }
+    return sent;
+}
+
+// =========================
+// Upstream requests (I/O thread)
+// =========================
+
+static int pending_open(worker_t* w, req_kind_t kind, client_t* c, int client_seq,
+                        const char* topic) {
+    for (int slot = 0; slot < FO_MAX_PENDING; slot++) {
+        pending_t* p = &w->pending[slot];
+        if (p->used) continue;
+
+        p->used = true;
+        p->gen = (p->gen + 1) & REQ_GEN_MASK;
+        if (p->gen == 0) p->gen = 1;
+        p->kind = kind;
+        p->client = c;
+        p->client_seq = client_seq;
+        snprintf(p->topic, sizeof(p->topic), "%s", topic);
+        if (c) c->pending++;
+
+        int req = (int)(p->gen << (REQ_SLOT_BITS + REQ_THREAD_BITS)) |
+                  (w->index << REQ_SLOT_BITS) | slot;
+        char line[192];
+        snprintf(line, sizeof(line),
+                 "{\"type\":\"fanout_snapshot\",\"seq\":%d,\"payload\":{\"match_id\":\"%s\"}}\n",
+                 req, topic);
+        p->epoch = upstream_send(line);
+        if (p->epoch == 0) {
+            p->used = false;
+            if (c) c->pending--;
+            return -1;
+        }
+        return req;
+    }
+    return -1;
+}
+
+static pending_t* pending_take(worker_t* w, int req) {
+    int slot = req & ((1 << REQ_SLOT_BITS) - 1);
+    uint32_t gen = ((uint32_t)req >> (REQ_SLOT_BITS + REQ_THREAD_BITS)) & REQ_GEN_MASK;
+    pending_t* p = &w->pending[slot];
+    if (!p->used || p->gen != gen) return NULL;
+    p->used = false;
+    if (p->client) p->client->pending--;
+    return p;
+}
+
+// Lagging subscribers whose queues drained ask for one snapshot per topic
+static void request_catchup(worker_t* w, topic_t* topic) {
+    if (topic->catchup_pending) return;
+    if (pending_open(w, REQ_CATCHUP, NULL, 0, topic->name) >= 0) {
+        topic->catchup_pending = true;
+    }
+}
+
+static void deliver_catchup(worker_t* w, topic_t* topic, const char* snapshot) {
+    char* message = malloc(strlen(snapshot) + 64);
+    if (!message) return;
+    sprintf(message, "{\"type\":\"match_snapshot\",\"payload\":%s}", snapshot);
+    frame_t* frame = frame_create(message, strlen(message), 1);
+    free(message);
+    if (!frame) return;
+
+    for (sub_t* sub = topic->subs; sub; sub = sub->topic_next) {
+        if (!sub->lagging || sub->client->outq_count > 0) continue;
+        lag_stop(w, sub);
+        client_send_frame(w, sub->client, frame);
+    }
+    frame_unref(frame);
+}
+
+// =========================
+// Spectator requests (I/O thread)
+// =========================
+
+static bool valid_match_id(const char* id) {
+    size_t len = id ? strlen(id) : 0;
+    if (len == 0 || len >= FO_TOPIC_MAX) return false;
+    for (size_t i = 0; i < len; i++) {
+        char ch = id[i];
+        if (!(ch == '_' || ch == '-' || (ch >= '0' && ch <= '9') ||
+              (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void handle_join(worker_t* w, client_t* c, message_t* msg) {
+    char* match_id = json_get_string(msg->payload_json, "match_id");
+    if (!valid_match_id(match_id)) {
+        send_response(w, c, msg->seq, false, "Missing match_id", NULL);
+    } else if (c->sub_count >= FO_TOPICS_PER_CLIENT) {
+        send_response(w, c, msg->seq, false, "Failed to add spectator", NULL);
+    } else if (pending_open(w, REQ_JOIN, c, msg->seq, match_id) < 0) {
+        send_response(w, c, msg->seq, false, "Game server unavailable", NULL);
+    }
+    free(match_id);
+}
+
+static void handle_leave(worker_t* w, client_t* c, message_t* msg) {
+    char* match_id = json_get_string(msg->payload_json, "match_id");
+    topic_t* topic = match_id ? topic_find(w, match_id) : NULL;
+    sub_t* sub = topic ? sub_find(c, topic) : NULL;
+    free(match_id);
+
+    if (sub) {
+        sub_remove(w, sub);
+        send_response(w, c, msg->seq, true, "Left spectate mode", NULL);
+    } else {
+        send_response(w, c, msg->seq, false, "Not spectating this match", NULL);
+    }
+}
+
+static void handle_resync(worker_t* w, client_t* c, message_t* msg) {
+    char* match_id = json_get_string(msg->payload_json, "match_id");
+    long long from_seq = json_get_int64(msg->payload_json, "from_seq");
+    if (!valid_match_id(match_id)) {
+        send_response(w, c, msg->seq, false, "Match not found", NULL);
+        free(match_id);
+        return;
+    }
+
+    topic_t* topic = topic_find(w, match_id);
+    if (topic && topic->last_seq > 0 && from_seq >= 0 && from_seq <= topic->last_seq) {
+        int count = 0;
+        if (from_seq < topic->last_seq) {
+            count = topic_replay(w, topic, c, (uint32_t)from_seq);
+        }
+        if (count >= 0) {
+            char payload[192];
+            snprintf(payload, sizeof(payload),
+                     "{\"match_id\":\"%s\",\"mode\":\"delta\",\"from_seq\":%lld,"
+                     "\"event_seq\":%u,\"count\":%d}",
+                     match_id, from_seq, topic->last_seq, count);
+            send_response(w, c, msg->seq, true, "Resync", payload);
+            free(match_id);
+            return;
+        }
+    }
+
+    if (pending_open(w, REQ_RESYNC, c, msg->seq, match_id) < 0) {
+        send_response(w, c, msg->seq, false, "Game server unavailable", NULL);
+    }
+    free(match_id);
+}
+
+static void process_request(worker_t* w, client_t* c, const char* json) {
+    message_t* msg = parse_message(json);
+    if (!msg || !msg->type) {
+        send_response(w, c, 0, false, "Invalid JSON", NULL);
+        if (msg) free_message(msg);
+        return;
+    }
+
+    if (strcmp(msg->type, "join_spectate") == 0) {
+        handle_join(w, c, msg);
+    } else if (strcmp(msg->type, "leave_spectate") == 0) {
+        handle_leave(w, c, msg);
+    } else if (strcmp(msg->type, "resync_from") == 0) {
+        handle_resync(w, c, msg);
+    } else if (strcmp(msg->type, "heartbeat") == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        char payload[64];
+        snprintf(payload, sizeof(payload), "{\"server_time_ms\":%lld}",
+                 (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+        send_response(w, c, msg->seq, true, "pong", payload);
+    } else {
+        send_response(w, c, msg->seq, false, "Not available on the spectator server", NULL);
+    }
+
+    free_message(msg);
+}
+
+// =========================
+// Inbox (I/O thread)
+// =========================
+
+static void process_event(worker_t* w, item_t* item) {
+    topic_t* topic = topic_find(w, item->topic);
+    if (topic) {
+        topic_record(topic, item->seq, item->frame);
+        for (sub_t* sub = topic->subs; sub; sub = sub->topic_next) {
+            if (sub->lagging) continue;  // Caught up by a snapshot later
+            if (sub->client->outq_bytes >= FO_LAG_BYTES) {
+                lag_start(w, sub);
+                continue;
+            }
+            client_send_frame(w, sub->client, item->frame);
+        }
+    }
+    frame_unref(item->frame);
+}
+
+static void process_reply(worker_t* w, item_t* item) {
+    pending_t* p = pending_take(w, item->req);
+    if (!p) return;  // Its client left in the meantime
+
+    const char* snapshot = NULL;
+    size_t len = 0;
+    if (item->ok && item->body) snapshot = tail_value(item->body, "\"snapshot\":", &len);
+    char* snap = snapshot ? strndup(snapshot, len) : NULL;
+
+    if (p->kind == REQ_CATCHUP) {
+        topic_t* topic = topic_find(w, p->topic);
+        if (topic) {
+            topic->catchup_pending = false;
+            if (snap) deliver_catchup(w, topic, snap);
+        }
+    } else if (!snap) {
+        send_response(w, p->client, p->client_seq, false, "Match not found", NULL);
+    } else {
+        size_t cap = strlen(snap) + 256;
+        char* payload = malloc(cap);
+        if (payload && p->kind == REQ_JOIN) {
+            snprintf(payload, cap, "{\"match_id\":\"%s\",\"is_spectator\":true,\"snapshot\":%s}",
+                     p->topic, snap);
+            // Subscribed before replying: the next event on the stream is
+            // the first one the snapshot does not include
+            if (subscribe(w, p->client, p->topic)) {
+                send_response(w, p->client, p->client_seq, true, "Joined as spectator", payload);
+            } else {
+                send_response(w, p->client, p->client_seq, false, "Failed to add spectator", NULL);
+            }
+        } else if (payload) {
+            snprintf(payload, cap,
+                     "{\"match_id\":\"%s\",\"mode\":\"snapshot\",\"event_seq\":%lld,\"snapshot\":%s}",
+                     p->topic, json_get_int64(snap, "event_seq"), snap);
+            send_response(w, p->client, p->client_seq, true, "Resync", payload);
+        }
+        free(payload);
+    }
+    free(snap);
+}
+
+// The game server went away: its matches can no longer be followed here
+static void process_upstream_lost(worker_t* w, uint64_t epoch) {
+    const char* notice_fmt =
+        "{\"type\":\"spectate_ended\",\"payload\":{\"match_id\":\"%s\",\"reason\":\"upstream_lost\"}}";
+
+    while (w->topic_count > 0) {
+        topic_t* topic = w->topics[w->topic_count - 1];
+        char notice[160];
+        snprintf(notice, sizeof(notice), notice_fmt, topic->name);
+
+        int remaining = topic->sub_count;
+        while (remaining-- > 0) {
+            client_t* c = topic->subs->client;
+            sub_remove(w, topic->subs);  // The last one destroys the topic
+            client_send(w, c, notice);
+        }
+    }
+
+    // Requests sent on the lost connection will never be answered
+    for (int slot = 0; slot < FO_MAX_PENDING; slot++) {
+        pending_t* p = &w->pending[slot];
+        if (!p->used || p->epoch > epoch) continue;
+        p->used = false;
+        if (p->client) {
+            p->client->pending--;
+            send_response(w, p->client, p->client_seq, false, "Game server unavailable", NULL);
+        }
+    }
+}
+
+static void drain_inbox(worker_t* w) {
+    uint64_t count;
+    if (read(w->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("read eventfd");
+    }
+
+    pthread_mutex_lock(&w->lock);
+    item_t* item = w->inbox_head;
+    w->inbox_head = w->inbox_tail = NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    while (item) {
+        item_t* next = item->next;
+        switch (item->kind) {
+            case ITEM_EVENT:
+                process_event(w, item);
+                break;
+            case ITEM_REPLY:
+                process_reply(w, item);
+                break;
+            case ITEM_UPSTREAM_LOST:
+                process_upstream_lost(w, item->epoch);
+                break;
+        }
+        free(item->body);
+        free(item);
+        item = next;
+    }
+}
+
+// =========================
+// Connection I/O (I/O thread)
+// =========================
+
+static void client_close(worker_t* w, client_t* c) {
+    while (c->subs) sub_remove(w, c->subs);
+
+    if (c->pending > 0) {
+        for (int slot = 0; slot < FO_MAX_PENDING; slot++) {
+            if (w->pending[slot].used && w->pending[slot].client == c) {
+                w->pending[slot].used = false;
+            }
+        }
+    }
+
+    while (c->outq_count > 0) {
+        frame_unref(c->outq[c->outq_head]);
+        c->outq_head = (c->outq_head + 1) % FO_OUTQ_MAX;
+        c->outq_count--;
+    }
+
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c);
+    w->client_count--;
+}
+
+static void accept_clients(worker_t* w) {
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) break;  // EAGAIN: another thread took it, or none left
+
+        client_t* c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        w->client_count++;
+    }
+}
+
+// Returns false if the client was closed
+static bool client_read(worker_t* w, client_t* c) {
+    while (1) {
+        ssize_t n = recv(c->fd, c->recv_buffer + c->recv_len,
+                         FO_RECV_MAX - c->recv_len - 1, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            client_close(w, c);
+            return false;
+        }
+        if (n == 0) {
+            client_close(w, c);
+            return false;
+        }
+
+        c->recv_len += n;
+        c->recv_buffer[c->recv_len] = '\0';
+
+        char* line = c->recv_buffer;
+        char* newline;
+        while ((newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            if (*line) process_request(w, c, line);
+            line = newline + 1;
+        }
+        c->recv_len -= line - c->recv_buffer;
+        memmove(c->recv_buffer, line, c->recv_len);
+
+        if (c->recv_len >= FO_RECV_MAX - 1) {
+            client_close(w, c);
+            return false;
+        }
+    }
+}
+
+static bool client_write(worker_t* w, client_t* c) {
+    while (c->outq_count > 0) {
+        frame_t* frame = c->outq[c->outq_head];
+        ssize_t n = send(c->fd, frame->data + c->outq_offset,
+                         frame->len - c->outq_offset, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            client_close(w, c);
+            return false;
+        }
+
+        c->outq_offset += n;
+        c->outq_bytes -= n;
+        if (c->outq_offset < frame->len) continue;
+
+        frame_unref(frame);
+        c->outq_head = (c->outq_head + 1) % FO_OUTQ_MAX;
+        c->outq_count--;
+        c->outq_offset = 0;
+    }
+
+    for (sub_t* sub = c->subs; sub; sub = sub->client_next) {
+        if (sub->lagging) request_catchup(w, sub->topic);
+    }
+
+    if (c->outq_count == 0) client_set_events(w, c, EPOLLIN | EPOLLET);
+    return true;
+}
+
+static void evict_stalled(worker_t* w) {
+    int64_t now = now_ms();
+    while (w->lag_head && now - w->lag_head->lagging_since_ms >= FO_EVICT_MS) {
+        sub_t* sub = w->lag_head;
+        client_t* c = sub->client;
+        char notice[160];
+        snprintf(notice, sizeof(notice),
+                 "{\"type\":\"spectate_ended\",\"payload\":{\"match_id\":\"%s\","
+                 "\"reason\":\"slow_consumer\"}}",
+                 sub->topic->name);
+        sub_remove(w, sub);
+        client_send(w, c, notice);
+    }
+}
+
+static void* worker_main(void* arg) {
+    worker_t* w = arg;
+    struct epoll_event events[256];
+    time_t last_sweep = 0;
+
+    while (running) {
+        int nfds = epoll_wait(w->epoll_fd, events, 256, 1000);
+        if (nfds < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.ptr == &listen_tag) {
+                accept_clients(w);
+            } else if (events[i].data.ptr == &inbox_tag) {
+                drain_inbox(w);
+            } else {
+                client_t* c = events[i].data.ptr;
+                if ((events[i].events & EPOLLIN) && !client_read(w, c)) continue;
+                if ((events[i].events & EPOLLOUT) && !client_write(w, c)) continue;
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) client_close(w, c);
+            }
+        }
+
+        time_t now = time(NULL);
+        if (now != last_sweep) {
+            evict_stalled(w);
+            last_sweep = now;
+        }
+    }
+    return NULL;
+}
+
+static bool worker_init(worker_t* w, int index) {
+    memset(w, 0, sizeof(*w));
+    w->index = index;
+    w->epoll_fd = epoll_create1(0);
+    w->event_fd = eventfd(0, EFD_NONBLOCK);
+    pthread_mutex_init(&w->lock, NULL);
+    if (w->epoll_fd < 0 || w->event_fd < 0 || !str_map_init(&w->topic_index, 64)) {
+        return false;
+    }
+
+    // Every thread waits on the listen socket; EPOLLEXCLUSIVE wakes one
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &listen_tag;
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) return false;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &inbox_tag;
+    return epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->event_fd, &ev) == 0;
+}
+
+static void worker_free(worker_t* w) {
+    for (int i = 0; i < FO_MAX_PENDING; i++) w->pending[i].used = false;
+    while (w->topic_count > 0) {
+        topic_t* topic = w->topics[w->topic_count - 1];
+        while (topic->sub_count > 1) sub_remove(w, topic->subs);
+        sub_remove(w, topic->subs);
+    }
+    free(w->topics);
+    str_map_free(&w->topic_index);
+
+    item_t* item = w->inbox_head;
+    while (item) {
+        item_t* next = item->next;
+        if (item->kind == ITEM_EVENT) frame_unref(item->frame);
+        free(item->body);
+        free(item);
+        item = next;
+    }
+    close(w->event_fd);
+    close(w->epoll_fd);
+    pthread_mutex_destroy(&w->lock);
+}
+
+static int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 512) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-p port] [-t threads] [-s socket]\n", prog);
+    fprintf(stderr, "  -p port     spectator port (default %d)\n", FANOUT_DEFAULT_PORT);
+    fprintf(stderr, "  -t threads  I/O threads (default %d, max %d)\n", FO_DEFAULT_THREADS,
+            FO_MAX_THREADS);
+    fprintf(stderr, "  -s socket   game server event socket (default %s)\n",
+            FANOUT_SOCKET_PATH);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    int port = FANOUT_DEFAULT_PORT;
+    const char* socket_path = FANOUT_SOCKET_PATH;
+
+    while ((opt = getopt(argc, argv, "p:t:s:")) != -1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 't':
+                worker_count = atoi(optarg);
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (port <= 0 || port > 65535 || worker_count < 1 || worker_count > FO_MAX_THREADS) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    listen_fd = listen_on(port);
+    if (listen_fd < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        if (!worker_init(&workers[i], i)) {
+            fprintf(stderr, "Failed to initialize I/O thread %d\n", i);
+            return 1;
+        }
+    }
+    for (int i = 0; i < worker_count; i++) {
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    printf("[Fanout] Serving spectators on port %d with %d I/O threads\n", port,
+           worker_count);
+
+    upstream_run(socket_path);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        worker_free(&workers[i]);
+    }
+    close(listen_fd);
+    printf("[Fanout] Shut down\n");
+    return 0;
+}
@@ -0,0 +1,636 @@
+/*
+ * gamecheck.c - Re-validate the stored match archive and gather statistics
+ *
+ * Usage: gamecheck [-t threads] [-o flagged.tsv] [-x index] -d CONNECTION_STRING
+ *        gamecheck [-t threads] [-o flagged.tsv] [-x index] [FILE]
+ *
+ * Games come either straight from the Matches table over ODBC (-d) or from
+ * a bcp character-mode export read from FILE or stdin:
+ *   bcp "SELECT match_id, result, start_fen, moves_json FROM XiangqiDB.dbo.Matches"
+ *       queryout games.tsv -c -S localhost -U sa -P ...
+ * (tab-separated, one game per line, an empty start_fen is the standard
+ * start; red and black ratings may follow as two more columns).
+ *
+ * The reader packs rows into batches; worker threads replay every move
+ * through the rules in xiangqi.c, flag corrupt lists, illegal moves and
+ * stored results contradicted by the final position (mate on the board),
+ * and keep per-thread statistics that are merged at the end. Flagged games
+ * are written as "match_id<TAB>problem<TAB>ply<TAB>stored<TAB>recomputed".
+ *
+ * With -x the valid games from the standard start are also folded into a
+ * fresh opening explorer index (see opening.h), one table per worker.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "opening.h"
+#include "xiangqi.h"
+
+#define GAMECHECK_MAX_THREADS 64
+#define BATCH_BYTES (1 << 20)  // Rows per batch until this much text
+#define BATCH_MAX_ROWS 4096
+#define LENGTH_BUCKET 20       // Plies per histogram bucket
+#define LENGTH_BUCKETS 16      // The last one is open-ended
+
+typedef enum { RESULT_RED, RESULT_BLACK, RESULT_DRAW, RESULT_ABORTED, RESULT_OTHER } result_t;
+static const char* result_names[] = {"red_wins", "black_wins", "draw", "aborted", "other"};
+
+typedef enum { PROBLEM_NONE, PROBLEM_CORRUPT, PROBLEM_BAD_START, PROBLEM_ILLEGAL,
+               PROBLEM_RESULT } problem_t;
+static const char* problem_names[] = {"ok", "corrupt_moves", "bad_start_fen",
+                                      "illegal_move", "result_mismatch"};
+
+// Rows are stored back to back as ROW_FIELDS NUL-terminated fields:
+// match_id, result, start_fen, moves_json, red_rating, black_rating
+#define ROW_FIELDS 6
+
+typedef struct {
+    char* text;
+    size_t used;
+    int rows;
+} batch_t;
+
+typedef struct {
+    uint64_t games;
+    uint64_t problems[5];
+    uint64_t stored[5];       // Stored result split (valid games)
+    uint64_t checkmates;      // Final position: side to move is mated
+    uint64_t stalemates;      // Final position: side to move has no move
+    uint64_t dead_draws;      // Final position: no attacking piece left
+    uint64_t lengths[LENGTH_BUCKETS];
+    uint64_t total_plies;
+    int max_plies;
+    uint64_t captures[2][8];  // [side captured][piece type]
+    uint64_t checks;
+    uint64_t custom_starts;
+} stats_t;
+
+typedef struct {
+    stats_t stats;
+    opening_table_t openings;  // Only with -x
+} worker_t;
+
+// Reader -> workers queue; batches are recycled through a free list so
+// memory stays bounded whatever the archive size
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static batch_t** full_batches;
+static batch_t** free_batches;
+static int full_head, full_count, free_count, queue_cap;
+static bool reading_done;
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* flagged_out;
+static int thread_count = 1;
+static bool build_openings = false;
+
+// =========================
+// Queue
+// =========================
+
+static batch_t* take_free_batch(void) {
+    pthread_mutex_lock(&queue_lock);
+    while (free_count == 0) pthread_cond_wait(&queue_cond, &queue_lock);
+    batch_t* batch = free_batches[--free_count];
+    pthread_mutex_unlock(&queue_lock);
+    batch->used = 0;
+    batch->rows = 0;
+    return batch;
+}
+
+static void push_full_batch(batch_t* batch) {
+    pthread_mutex_lock(&queue_lock);
+    full_batches[(full_head + full_count) % queue_cap] = batch;
+    full_count++;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// NULL once the reader is done and the queue is drained
+static batch_t* take_full_batch(void) {
+    pthread_mutex_lock(&queue_lock);
+    while (full_count == 0 && !reading_done) pthread_cond_wait(&queue_cond, &queue_lock);
+    batch_t* batch = NULL;
+    if (full_count > 0) {
+        batch = full_batches[full_head];
+        full_head = (full_head + 1) % queue_cap;
+        full_count--;
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return batch;
+}
+
+static void release_batch(batch_t* batch) {
+    pthread_mutex_lock(&queue_lock);
+    free_batches[free_count++] = batch;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// =========================
+// Reading
+// =========================
+
+typedef struct {
+    batch_t* batch;
+    uint64_t rows;
+} reader_t;
+
+static bool append_field(batch_t* batch, const char* field, size_t len) {
+    if (batch->used + len + 1 > BATCH_BYTES) return false;
+    memcpy(batch->text + batch->used, field, len);
+    batch->text[batch->used + len] = '\0';
+    batch->used += len + 1;
+    return true;
+}
+
+static bool fits(const batch_t* batch, size_t bytes) {
+    return batch->rows < BATCH_MAX_ROWS && batch->used + bytes <= BATCH_BYTES;
+}
+
+static bool add_row(const char* match_id, const char* result, const char* start_fen,
+                    const char* moves_json, int red_rating, int black_rating, void* ctx) {
+    reader_t* reader = ctx;
+    char ratings[2][16];
+    snprintf(ratings[0], sizeof(ratings[0]), "%d", red_rating);
+    snprintf(ratings[1], sizeof(ratings[1]), "%d", black_rating);
+    size_t lens[ROW_FIELDS] = {strlen(match_id), strlen(result), strlen(start_fen),
+                               strlen(moves_json), strlen(ratings[0]), strlen(ratings[1])};
+    size_t bytes = ROW_FIELDS;
+    for (int i = 0; i < ROW_FIELDS; i++) bytes += lens[i];
+
+    if (!fits(reader->batch, bytes) && reader->batch->rows > 0) {
+        push_full_batch(reader->batch);
+        reader->batch = take_free_batch();
+    }
+    if (bytes > BATCH_BYTES) {
+        // Larger than a whole batch: no real game is, report it as corrupt
+        moves_json = "";
+        lens[3] = 0;
+    }
+
+    batch_t* batch = reader->batch;
+    append_field(batch, match_id, lens[0]);
+    append_field(batch, result, lens[1]);
+    append_field(batch, start_fen, lens[2]);
+    append_field(batch, moves_json, lens[3]);
+    append_field(batch, ratings[0], lens[4]);
+    append_field(batch, ratings[1], lens[5]);
+    batch->rows++;
+    reader->rows++;
+    return true;
+}
+
+static bool read_export(FILE* in, reader_t* reader) {
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &cap, in)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0) continue;
+
+        // match_id \t result \t start_fen \t moves_json [\t red_rating \t black_rating]
+        char* fields[ROW_FIELDS] = {line, "", "", "", "0", "0"};
+        char* p = line;
+        for (int i = 1; i < ROW_FIELDS && p; i++) {
+            p = strchr(p, '\t');
+            if (p) {
+                *p++ = '\0';
+                fields[i] = p;
+            }
+        }
+        add_row(fields[0], fields[1], fields[2], fields[3], atoi(fields[4]), atoi(fields[5]),
+                reader);
+    }
+
+    free(line);
+    return !ferror(in);
+}
+
+// =========================
+// Validation
+// =========================
+
+static result_t parse_result(const char* result) {
+    // The schema spells wins without the "s"
+    if (strcmp(result, "red_wins") == 0 || strcmp(result, "red_win") == 0) return RESULT_RED;
+    if (strcmp(result, "black_wins") == 0 || strcmp(result, "black_win") == 0) {
+        return RESULT_BLACK;
+    }
+    if (strcmp(result, "draw") == 0) return RESULT_DRAW;
+    if (strcmp(result, "aborted") == 0) return RESULT_ABORTED;
+    return RESULT_OTHER;
+}
+
+// Read the integer after "key": at or after *p
+static bool read_int_field(const char** p, const char* key, int* out) {
+    const char* at = strstr(*p, key);
+    if (!at) return false;
+    at += strlen(key);
+    while (*at == ' ') at++;
+
+    char* end;
+    long value = strtol(at, &end, 10);
+    if (end == at) return false;
+    *out = (int)value;
+    *p = end;
+    return true;
+}
+
+// Next move of a match_get_moves_json list. 1 = move read, 0 = end of the
+// list, -1 = malformed.
+static int next_move(const char** p, int* fr, int* fc, int* tr, int* tc) {
+    const char* at = *p;
+    while (*at == ' ' || *at == ',') at++;
+    if (*at == ']') return 0;
+    if (*at != '{') return -1;
+
+    const char* from = strstr(at, "\"from\"");
+    if (!from) return -1;
+    if (!read_int_field(&from, "\"row\":", fr) || !read_int_field(&from, "\"col\":", fc)) {
+        return -1;
+    }
+    const char* to = strstr(from, "\"to\"");
+    if (!to) return -1;
+    if (!read_int_field(&to, "\"row\":", tr) || !read_int_field(&to, "\"col\":", tc)) {
+        return -1;
+    }
+
+    // Skip the rest of the object (other fields are flat numbers)
+    const char* close = strstr(to, "}");  // Closes "to"
+    if (!close) return -1;
+    close = strchr(close + 1, '}');        // Closes the move
+    if (!close) return -1;
+    *p = close + 1;
+    return 1;
+}
+
+static bool has_attackers(const xq_position_t* pos) {
+    for (int sq = 0; sq < XQ_SQUARES; sq++) {
+        int type = XQ_TYPE(pos->board[sq]);
+        if (type == XQ_HORSE || type == XQ_CHARIOT || type == XQ_CANNON || type == XQ_PAWN) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void flag_game(const char* match_id, problem_t problem, int ply, const char* stored,
+                      const char* recomputed) {
+    pthread_mutex_lock(&output_lock);
+    fprintf(flagged_out, "%s\t%s\t%d\t%s\t%s\n", match_id, problem_names[problem], ply,
+            stored, recomputed);
+    pthread_mutex_unlock(&output_lock);
+}
+
+static void check_game(worker_t* worker, const char* match_id, const char* result,
+                       const char* start_fen, const char* moves_json, int red_rating,
+                       int black_rating) {
+    stats_t* stats = &worker->stats;
+    stats->games++;
+
+    xq_position_t pos;
+    if (start_fen[0]) stats->custom_starts++;
+    if (!xq_position_from_fen(&pos, start_fen[0] ? start_fen : XQ_START_FEN)) {
+        stats->problems[PROBLEM_BAD_START]++;
+        flag_game(match_id, PROBLEM_BAD_START, 0, result, "-");
+        return;
+    }
+
+    // Replay; captures are only counted once the whole game checks out
+    uint64_t captures[2][8] = {{0}};
+    uint64_t checks = 0;
+    int plies = 0;
+    xq_move_t opening[OPENING_MAX_PLY];
+    const char* p = moves_json;
+    while (*p == ' ') p++;
+    if (*p++ != '[') {
+        stats->problems[PROBLEM_CORRUPT]++;
+        flag_game(match_id, PROBLEM_CORRUPT, 0, result, "-");
+        return;
+    }
+
+    for (;;) {
+        int fr, fc, tr, tc;
+        int status = next_move(&p, &fr, &fc, &tr, &tc);
+        if (status == 0) break;
+        if (status < 0) {
+            stats->problems[PROBLEM_CORRUPT]++;
+            flag_game(match_id, PROBLEM_CORRUPT, plies, result, "-");
+            return;
+        }
+
+        xq_move_t move = XQ_NO_MOVE;
+        if (fr >= 0 && fr < XQ_ROWS && fc >= 0 && fc < XQ_COLS && tr >= 0 && tr < XQ_ROWS &&
+            tc >= 0 && tc < XQ_COLS) {
+            move = xq_find_move(&pos, fr, fc, tr, tc);
+        }
+        xq_undo_t undo;
+        if (move == XQ_NO_MOVE || !xq_make_move(&pos, move, &undo)) {
+            stats->problems[PROBLEM_ILLEGAL]++;
+            flag_game(match_id, PROBLEM_ILLEGAL, plies, result, "-");
+            return;
+        }
+        if (plies < OPENING_MAX_PLY) opening[plies] = move;
+        plies++;
+
+        if (undo.captured != XQ_EMPTY) {
+            captures[XQ_SIDE(undo.captured)][XQ_TYPE(undo.captured)]++;
+        }
+        if (xq_in_check(&pos, pos.side)) checks++;
+    }
+
+    // What the final position says on its own
+    result_t stored = parse_result(result);
+    result_t board = RESULT_OTHER;
+    xq_move_t legal[XQ_MAX_MOVES];
+    bool in_check = xq_in_check(&pos, pos.side);
+    if (xq_generate_legal(&pos, legal) == 0) {
+        // No legal move loses, checkmate and stalemate alike
+        board = pos.side == XQ_RED ? RESULT_BLACK : RESULT_RED;
+        if (in_check) {
+            stats->checkmates++;
+        } else {
+            stats->stalemates++;
+        }
+    } else if (!has_attackers(&pos)) {
+        board = RESULT_DRAW;
+        stats->dead_draws++;
+    }
+
+    // A win for the mated side, or a game left unfinished after mate, is
+    // wrong; a decided game against bare kings is allowed (flag falls)
+    if (board == RESULT_RED || board == RESULT_BLACK) {
+        if (stored != board) {
+            stats->problems[PROBLEM_RESULT]++;
+            flag_game(match_id, PROBLEM_RESULT, plies, result, result_names[board]);
+            return;
+        }
+    }
+
+    stats->problems[PROBLEM_NONE]++;
+    stats->stored[stored]++;
+    stats->lengths[plies / LENGTH_BUCKET < LENGTH_BUCKETS ? plies / LENGTH_BUCKET
+                                                          : LENGTH_BUCKETS - 1]++;
+    stats->total_plies += (uint64_t)plies;
+    if (plies > stats->max_plies) stats->max_plies = plies;
+    stats->checks += checks;
+    for (int side = 0; side < 2; side++) {
+        for (int type = 0; type < 8; type++) stats->captures[side][type] += captures[side][type];
+    }
+
+    opening_result_t outcome;
+    if (build_openings && !start_fen[0] && opening_result_parse(result, &outcome)) {
+        if (!opening_table_add_game(&worker->openings, opening, plies, outcome, red_rating,
+                                    black_rating)) {
+            fprintf(stderr, "Out of memory for the opening index\n");
+            exit(2);
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    worker_t* worker = arg;
+    batch_t* batch;
+
+    while ((batch = take_full_batch()) != NULL) {
+        const char* row = batch->text;
+        for (int i = 0; i < batch->rows; i++) {
+            const char* fields[ROW_FIELDS];
+            for (int f = 0; f < ROW_FIELDS; f++) {
+                fields[f] = row;
+                row += strlen(row) + 1;
+            }
+            check_game(worker, fields[0], fields[1], fields[2], fields[3], atoi(fields[4]),
+                       atoi(fields[5]));
+        }
+        release_batch(batch);
+    }
+    return NULL;
+}
+
+// =========================
+// Report
+// =========================
+
+static void merge_stats(stats_t* total, const stats_t* part) {
+    total->games += part->games;
+    for (int i = 0; i < 5; i++) {
+        total->problems[i] += part->problems[i];
+        total->stored[i] += part->stored[i];
+    }
+    total->checkmates += part->checkmates;
+    total->stalemates += part->stalemates;
+    total->dead_draws += part->dead_draws;
+    for (int i = 0; i < LENGTH_BUCKETS; i++) total->lengths[i] += part->lengths[i];
+    total->total_plies += part->total_plies;
+    if (part->max_plies > total->max_plies) total->max_plies = part->max_plies;
+    for (int side = 0; side < 2; side++) {
+        for (int type = 0; type < 8; type++) {
+            total->captures[side][type] += part->captures[side][type];
+        }
+    }
+    total->checks += part->checks;
+    total->custom_starts += part->custom_starts;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+static void print_report(const stats_t* s, double seconds) {
+    static const char* piece_names[8] = {"", "king", "advisor", "elephant", "horse",
+                                         "chariot", "cannon", "pawn"};
+    uint64_t valid = s->problems[PROBLEM_NONE];
+
+    printf("\nGames checked:     %llu in %.1fs (%.0f games/s, %d threads)\n",
+           (unsigned long long)s->games, seconds, seconds > 0 ? s->games / seconds : 0.0,
+           thread_count);
+    printf("Custom starts:     %llu\n", (unsigned long long)s->custom_starts);
+    for (int i = 0; i < 5; i++) {
+        printf("  %-17s %llu (%.2f%%)\n", problem_names[i],
+               (unsigned long long)s->problems[i], percent(s->problems[i], s->games));
+    }
+
+    printf("\nStored results (valid games):\n");
+    for (int i = 0; i < 5; i++) {
+        printf("  %-17s %llu (%.2f%%)\n", result_names[i], (unsigned long long)s->stored[i],
+               percent(s->stored[i], valid));
+    }
+    printf("Final position: %llu checkmates, %llu stalemates, %llu without attackers\n",
+           (unsigned long long)s->checkmates, (unsigned long long)s->stalemates,
+           (unsigned long long)s->dead_draws);
+
+    printf("\nLength (plies): mean %.1f, max %d\n",
+           valid ? (double)s->total_plies / (double)valid : 0.0, s->max_plies);
+    for (int i = 0; i < LENGTH_BUCKETS; i++) {
+        if (i == LENGTH_BUCKETS - 1) {
+            printf("  %3d+     ", i * LENGTH_BUCKET);
+        } else {
+            printf("  %3d-%-3d  ", i * LENGTH_BUCKET, (i + 1) * LENGTH_BUCKET - 1);
+        }
+        printf("%10llu (%.2f%%)\n", (unsigned long long)s->lengths[i],
+               percent(s->lengths[i], valid));
+    }
+
+    printf("\nCaptures per game (red pieces lost / black pieces lost):\n");
+    for (int type = XQ_ADVISOR; type <= XQ_PAWN; type++) {
+        printf("  %-9s %.2f / %.2f\n", piece_names[type],
+               valid ? (double)s->captures[XQ_RED][type] / (double)valid : 0.0,
+               valid ? (double)s->captures[XQ_BLACK][type] / (double)valid : 0.0);
+    }
+    printf("Checks per game: %.2f\n", valid ? (double)s->checks / (double)valid : 0.0);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    const char* connection = NULL;
+    const char* flagged_path = NULL;
+    const char* index_path = NULL;
+    thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "d:o:t:x:")) != -1) {
+        switch (opt) {
+            case 'd':
+                connection = optarg;
+                break;
+            case 'o':
+                flagged_path = optarg;
+                break;
+            case 't':
+                thread_count = atoi(optarg);
+                break;
+            case 'x':
+                index_path = optarg;
+                build_openings = true;
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-t threads] [-o flagged.tsv] [-x index] "
+                        "(-d CONNECTION | [FILE])\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > GAMECHECK_MAX_THREADS) thread_count = GAMECHECK_MAX_THREADS;
+
+    FILE* in = stdin;
+    if (!connection && optind < argc && strcmp(argv[optind], "-") != 0) {
+        in = fopen(argv[optind], "r");
+        if (!in) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+    flagged_out = stdout;
+    if (flagged_path) {
+        flagged_out = fopen(flagged_path, "w");
+        if (!flagged_out) {
+            perror(flagged_path);
+            return 1;
+        }
+    }
+    if (connection && !db_init(connection)) {
+        fprintf(stderr, "Cannot connect to the database\n");
+        return 1;
+    }
+
+    xq_init();
+
+    // Two batches per worker keeps everyone busy while the reader fills one
+    queue_cap = thread_count * 2 + 1;
+    full_batches = calloc((size_t)queue_cap, sizeof(batch_t*));
+    free_batches = calloc((size_t)queue_cap, sizeof(batch_t*));
+    batch_t* batches = calloc((size_t)queue_cap, sizeof(batch_t));
+    worker_t* workers = calloc((size_t)thread_count, sizeof(worker_t));
+    pthread_t* threads = calloc((size_t)thread_count, sizeof(pthread_t));
+    if (!full_batches || !free_batches || !batches || !workers || !threads) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < thread_count && build_openings; i++) {
+        if (!opening_table_init(&workers[i].openings, 1 << 16)) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < queue_cap; i++) {
+        batches[i].text = malloc(BATCH_BYTES);
+        if (!batches[i].text) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        free_batches[free_count++] = &batches[i];
+    }
+
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    for (int i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+
+    reader_t reader = {take_free_batch(), 0};
+    bool read_ok = connection ? db_scan_matches(add_row, &reader) : read_export(in, &reader);
+    if (reader.batch->rows > 0) {
+        push_full_batch(reader.batch);
+    } else {
+        release_batch(reader.batch);
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    reading_done = true;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    stats_t total = {0};
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+        merge_stats(&total, &workers[i].stats);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double seconds = (double)(finished.tv_sec - started.tv_sec) +
+                     (double)(finished.tv_nsec - started.tv_nsec) / 1e9;
+
+    if (!read_ok) fprintf(stderr, "Input ended with an error after %llu games\n",
+                          (unsigned long long)reader.rows);
+    if (flagged_out != stdout) fclose(flagged_out);
+    print_report(&total, seconds);
+
+    if (build_openings) {
+        for (int i = 1; i < thread_count; i++) {
+            if (!opening_table_merge(&workers[0].openings, &workers[i].openings)) {
+                fprintf(stderr, "Out of memory for the opening index\n");
+                return 2;
+            }
+            opening_table_free(&workers[i].openings);
+        }
+        if (!opening_write_file(index_path, NULL, 0, 0, &workers[0].openings)) {
+            perror(index_path);
+            return 2;
+        }
+        printf("\nOpening index: %zu entries from %llu games written to %s\n",
+               workers[0].openings.count, (unsigned long long)workers[0].openings.games,
+               index_path);
+        opening_table_free(&workers[0].openings);
+    }
+
+    if (connection) db_shutdown();
+    if (in != stdin) fclose(in);
+    for (int i = 0; i < queue_cap; i++) free(batches[i].text);
+    free(batches);
+    free(full_batches);
+    free(free_batches);
+    free(workers);
+    free(threads);
+
+    uint64_t flagged = total.games - total.problems[PROBLEM_NONE];
+    return !read_ok ? 2 : flagged ? 1 : 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * ratingreplay.c - Recompute every Glicko-2 rating from the rated match archive
+ *
+ * Usage: ratingreplay [-p days] [-t tau] [-n top] [-w] -d CONNECTION_STRING
+ *        ratingreplay [-p days] [-t tau] [-n top] [FILE]
+ *
+ * Rated results come either straight from the Matches table over ODBC (-d)
+ * or from a bcp character-mode export read from FILE or stdin:
+ *   bcp "SELECT red_user_id, black_user_id, result, ended_at FROM
+ *        XiangqiDB.dbo.Matches WHERE rated = 1" queryout results.tsv -c ...
+ * (tab-separated, one game per line, ended_at in epoch seconds).
+ *
+ * Every player starts from scratch and the games are replayed in rating
+ * periods of -p days (default 7) through the batch API in rating.c, which
+ * keeps players in parallel arrays so each period is a few linear passes.
+ * Before each period the games in it are predicted from the ratings so
+ * far; the mean log-loss of those predictions is the number to compare
+ * when tuning the period length and tau (-t, default GLICKO_TAU).
+ *
+ * -w writes the recomputed rating, deviation and volatility back to the
+ * Users table. Run it with the server stopped: the server's profile cache
+ * and leaderboard are loaded at startup.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+#include "hashmap.h"
+#include "rating.h"
+
+#define REPLAY_DEFAULT_PERIOD_DAYS 7
+#define REPLAY_DEFAULT_TOP 10
+
+typedef struct {
+    long long ended_at;
+    int red;    // Player index
+    int black;
+    double red_score;
+} game_t;
+
+typedef struct {
+    int_map_t index;  // user_id -> player index
+    int* user_ids;    // player index -> user_id
+    int players;
+    int player_cap;
+    game_t* games;
+    int count;
+    int cap;
+    long long skipped;  // Undecided or unreadable rows
+} archive_t;
+
+static int player_index(archive_t* a, int user_id) {
+    int index;
+    if (int_map_get(&a->index, user_id, &index)) return index;
+
+    if (a->players == a->player_cap) {
+        int cap = a->player_cap ? a->player_cap * 2 : 1024;
+        int* grown = realloc(a->user_ids, (size_t)cap * sizeof(int));
+        if (!grown) return -1;
+        a->user_ids = grown;
+        a->player_cap = cap;
+    }
+    index = a->players;
+    if (!int_map_put(&a->index, user_id, index)) return -1;
+    a->user_ids[a->players++] = user_id;
+    return index;
+}
+
+static bool add_result(int red_user_id, int black_user_id, const char* result,
+                       long long ended_at, void* ctx) {
+    archive_t* a = ctx;
+    double red_score = rating_red_score(result);
+    if (red_score < 0 || red_user_id == black_user_id) {
+        a->skipped++;
+        return true;
+    }
+
+    if (a->count == a->cap) {
+        int cap = a->cap ? a->cap * 2 : 1 << 16;
+        game_t* grown = realloc(a->games, (size_t)cap * sizeof(game_t));
+        if (!grown) return false;
+        a->games = grown;
+        a->cap = cap;
+    }
+    int red = player_index(a, red_user_id);
+    int black = player_index(a, black_user_id);
+    if (red < 0 || black < 0) return false;
+
+    a->games[a->count++] = (game_t){ended_at, red, black, red_score};
+    return true;
+}
+
+static bool read_export(FILE* in, archive_t* a) {
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    bool ok = true;
+
+    while (ok && (len = getline(&line, &cap, in)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0) continue;
+
+        // red_user_id \t black_user_id \t result \t ended_at
+        char result[17];
+        int red, black;
+        long long ended;
+        if (sscanf(line, "%d\t%d\t%16[^\t]\t%lld", &red, &black, result, &ended) != 4) {
+            a->skipped++;
+            continue;
+        }
+        ok = add_result(red, black, result, ended, a);
+    }
+
+    free(line);
+    return ok && !ferror(in);
+}
+
+// Oldest first; the database already sends them so, an export may not
+static int compare_games(const void* x, const void* y) {
+    const game_t* a = x;
+    const game_t* b = y;
+    return (a->ended_at > b->ended_at) - (a->ended_at < b->ended_at);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int compare_conservative(const void* x, const void* y, void* ctx) {
+    const rating_batch_t* batch = ctx;
+    int a = *(const int*)x, b = *(const int*)y;
+    int ka = rating_conservative(batch->rating[a], batch->rd[a]);
+    int kb = rating_conservative(batch->rating[b], batch->rd[b]);
+    return (kb > ka) - (kb < ka);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    const char* connection = NULL;
+    int period_days = REPLAY_DEFAULT_PERIOD_DAYS;
+    double tau = GLICKO_TAU;
+    int top = REPLAY_DEFAULT_TOP;
+    bool write_back = false;
+
+    while ((opt = getopt(argc, argv, "d:p:t:n:w")) != -1) {
+        switch (opt) {
+            case 'd':
+                connection = optarg;
+                break;
+            case 'p':
+                period_days = atoi(optarg);
+                break;
+            case 't':
+                tau = atof(optarg);
+                break;
+            case 'n':
+                top = atoi(optarg);
+                break;
+            case 'w':
+                write_back = true;
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-p days] [-t tau] [-n top] [-w] (-d CONNECTION | [FILE])\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (period_days < 1) period_days = 1;
+    if (tau <= 0) tau = GLICKO_TAU;
+    if (write_back && !connection) {
+        fprintf(stderr, "-w needs a database connection (-d)\n");
+        return 1;
+    }
+
+    FILE* in = stdin;
+    if (!connection && optind < argc && strcmp(argv[optind], "-") != 0) {
+        in = fopen(argv[optind], "r");
+        if (!in) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+    if (connection && !db_init(connection)) {
+        fprintf(stderr, "Cannot connect to the database\n");
+        return 1;
+    }
+
+    archive_t archive = {0};
+    if (!int_map_init(&archive.index, 4096)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    double read_started = now_seconds();
+    bool read_ok = connection ? db_scan_rated_results(add_result, &archive)
+                              : read_export(in, &archive);
+    if (!read_ok) {
+        fprintf(stderr, "Input ended with an error after %d games\n", archive.count);
+        return 2;
+    }
+    qsort(archive.games, (size_t)archive.count, sizeof(game_t), compare_games);
+    double read_seconds = now_seconds() - read_started;
+
+    // Games of a period as parallel arrays, refilled per period
+    int* red = malloc((size_t)(archive.count + 1) * sizeof(int));
+    int* black = malloc((size_t)(archive.count + 1) * sizeof(int));
+    double* red_score = malloc((size_t)(archive.count + 1) * sizeof(double));
+    rating_batch_t batch;
+    if (!red || !black || !red_score ||
+        !rating_batch_init(&batch, archive.players, DEFAULT_RATING, GLICKO_DEFAULT_RD,
+                           GLICKO_DEFAULT_VOLATILITY)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    long long period_seconds = (long long)period_days * 86400;
+    double log_loss = 0;
+    int periods = 0;
+    double rate_seconds = 0;
+
+    for (int first = 0; first < archive.count;) {
+        long long period = archive.games[first].ended_at / period_seconds;
+        int n = 0;
+        for (int k = first; k < archive.count; k++) {
+            const game_t* g = &archive.games[k];
+            if (g->ended_at / period_seconds != period) break;
+            red[n] = g->red;
+            black[n] = g->black;
+            red_score[n] = g->red_score;
+
+            // Predicted from the ratings before the period
+            glicko_t r = {batch.rating[g->red], batch.rd[g->red], batch.volatility[g->red]};
+            glicko_t b = {batch.rating[g->black], batch.rd[g->black],
+                          batch.volatility[g->black]};
+            double p = rating_expected_score(&r, &b);
+            p = fmin(fmax(p, 1e-9), 1.0 - 1e-9);
+            log_loss -= g->red_score * log(p) + (1.0 - g->red_score) * log(1.0 - p);
+            n++;
+        }
+
+        double started = now_seconds();
+        rating_batch_period(&batch, red, black, red_score, n, tau);
+        rate_seconds += now_seconds() - started;
+
+        first += n;
+        periods++;
+    }
+
+    printf("Rated games:  %d (%lld rows skipped), %d players, read in %.1fs\n",
+           archive.count, archive.skipped, archive.players, read_seconds);
+    printf("Replay:       %d periods of %d days, tau %.2f, rated in %.3fs\n", periods,
+           period_days, tau, rate_seconds);
+    printf("Log-loss:     %.4f per game (0.6931 = coin flip)\n",
+           archive.count ? log_loss / archive.count : 0.0);
+
+    int* order = malloc((size_t)(archive.players + 1) * sizeof(int));
+    if (order && top > 0) {
+        for (int i = 0; i < archive.players; i++) order[i] = i;
+        qsort_r(order, (size_t)archive.players, sizeof(int), compare_conservative, &batch);
+        printf("\nTop %d (rating - 2 RD):\n", top < archive.players ? top : archive.players);
+        for (int i = 0; i < top && i < archive.players; i++) {
+            int p = order[i];
+            printf("  %3d. user %-8d %5d  %6.1f  RD %5.1f  vol %.4f%s\n", i + 1,
+                   archive.user_ids[p], rating_conservative(batch.rating[p], batch.rd[p]),
+                   batch.rating[p], batch.rd[p], batch.volatility[p],
+                   batch.rd[p] > GLICKO_PROVISIONAL_RD ? "  (provisional)" : "");
+        }
+    }
+    free(order);
+
+    int failed = 0;
+    if (write_back) {
+        for (int i = 0; i < archive.players; i++) {
+            if (!db_update_user_glicko(archive.user_ids[i], (int)lround(batch.rating[i]),
+                                       batch.rd[i], batch.volatility[i])) {
+                failed++;
+            }
+        }
+        printf("\nWrote %d players (%d failed)\n", archive.players - failed, failed);
+    }
+
+    if (connection) db_shutdown();
+    if (in != stdin) fclose(in);
+    rating_batch_free(&batch);
+    free(red);
+    free(black);
+    free(red_score);
+    free(archive.games);
+    free(archive.user_ids);
+    int_map_free(&archive.index);
+    return failed ? 2 : 0;
+}
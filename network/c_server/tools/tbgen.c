@@ -0,0 +1,502 @@
+/*
+ * tbgen.c - Endgame tablebase generator (retrograde analysis)
+ *
+ * Usage: tbgen [-o dir] [-t threads] [MATERIAL ...]
+ *
+ * For each material set the generator:
+ *   1. makes sure every table reachable by a capture exists (recursively),
+ *   2. scores each position's captures against those tables and counts its
+ *      quiet moves,
+ *   3. works backwards level by level: positions lost in n plies make their
+ *      predecessors won in n+1; positions won in n plies decrement their
+ *      predecessors' quiet move counters, and a counter reaching zero with
+ *      no escape means a loss.
+ * Each level is split across worker threads; shared state is updated with
+ * atomics, so levels only need a join between passes.
+ * Positions never resolved are draws (neither side can force mate).
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tablebase.h"
+#include "xiangqi.h"
+
+#define TBGEN_MAX_THREADS 64
+#define FLAG_ESCAPE 1  // A capture reaches a drawn position
+
+static const char* default_sets[] = {
+    "KRK",   "KHK",   "KCK",   "KPK",   "KRKA",  "KRKE",  "KHKA",  "KHKE",
+    "KCKA",  "KCKE",  "KPKA",  "KPKE",  "KRKH",  "KRKC",  "KRKP",  "KHKP",
+    "KCKP",  "KPKP",  "KRKR",  "KHKH",  "KRHK",  "KRCK",  "KRPK",  "KHPK",
+    "KCPK",  "KPPK",  "KRRK",  "KHHK",  "KRKAA", "KRKEE", "KRKAE", "KHPKA",
+    "KHPKE", "KCPKA", "KPPKA", "KRPKA", "KRPKE", "KRHKA", "KRCKA",
+};
+
+typedef struct {
+    tb_layout_t layout;
+    _Atomic uint8_t* value;      // 1 + dtm once known, 0 while unknown
+    _Atomic uint8_t* remaining;  // Quiet moves not yet refuted
+    uint8_t* cap_win;            // 1 + dtm of the fastest winning capture
+    uint8_t* cap_loss;           // 1 + dtm of the slowest losing capture
+    uint8_t* flags;
+    atomic_int max_value;        // Highest value assigned or pending
+    atomic_ullong missing;       // Captures into tables we could not probe
+} tb_gen_t;
+
+typedef enum { PASS_INIT, PASS_CAPTURE_WINS, PASS_RETRO } pass_kind_t;
+
+typedef struct {
+    tb_gen_t* gen;
+    pass_kind_t kind;
+    int level;  // Plies to mate of the positions being expanded
+    uint32_t begin;
+    uint32_t end;
+    uint64_t assigned;
+} pass_arg_t;
+
+static const char* out_dir = TABLEBASE_DIR;
+static int thread_count = 1;
+
+static void update_max(atomic_int* max, int value) {
+    int cur = atomic_load(max);
+    while (value > cur && !atomic_compare_exchange_weak(max, &cur, value)) {
+    }
+}
+
+// =========================
+// Per-position work
+// =========================
+
+static void init_position(tb_gen_t* gen, uint32_t index) {
+    xq_position_t pos;
+    if (!tb_decode(&gen->layout, index, &pos)) {
+        atomic_store_explicit(&gen->value[index], TB_ILLEGAL, memory_order_relaxed);
+        return;
+    }
+
+    xq_move_t moves[XQ_MAX_MOVES];
+    int n = xq_generate_moves(&pos, moves, false);
+    int legal = 0, quiet = 0;
+    int cap_win = 0, cap_loss = 0;
+    uint8_t flags = 0;
+
+    for (int i = 0; i < n; i++) {
+        bool capture = pos.board[XQ_TO(moves[i])] != XQ_EMPTY;
+        xq_undo_t undo;
+        if (!xq_make_move(&pos, moves[i], &undo)) continue;
+        legal++;
+        if (!capture) {
+            quiet++;
+        } else {
+            tb_probe_t child;
+            if (!tablebase_probe(&pos, &child)) {
+                atomic_fetch_add(&gen->missing, 1);
+                flags |= FLAG_ESCAPE;
+            } else if (child.wdl < 0) {
+                int v = child.dtm + 2;
+                if (cap_win == 0 || v < cap_win) cap_win = v;
+            } else if (child.wdl > 0) {
+                int v = child.dtm + 2;
+                if (v > cap_loss) cap_loss = v;
+            } else {
+                flags |= FLAG_ESCAPE;
+            }
+        }
+        xq_unmake_move(&pos, &undo);
+    }
+
+    if (cap_win > TB_MAX_DTM + 1) cap_win = 0;
+    gen->cap_win[index] = (uint8_t)cap_win;
+    gen->cap_loss[index] = (uint8_t)(cap_loss > TB_MAX_DTM + 1 ? TB_MAX_DTM + 1 : cap_loss);
+    gen->flags[index] = flags;
+    atomic_store_explicit(&gen->remaining[index], (uint8_t)quiet, memory_order_relaxed);
+
+    int value = 0;
+    if (legal == 0) {
+        value = 1;  // Checkmated or stalemated: both lose in Xiangqi
+    } else if (quiet == 0 && cap_win == 0 && !(flags & FLAG_ESCAPE)) {
+        value = cap_loss;  // Every move is a capture into a lost ending
+    }
+    if (value) {
+        atomic_store_explicit(&gen->value[index], (uint8_t)value, memory_order_relaxed);
+    }
+    update_max(&gen->max_value, value > cap_win ? value : cap_win);
+}
+
+// Called for each predecessor Q of a position decided at `level` plies
+static bool resolve_predecessor(tb_gen_t* gen, uint32_t q, int level) {
+    uint8_t zero = 0;
+    if (atomic_load_explicit(&gen->value[q], memory_order_relaxed) != 0) return false;
+
+    if (level % 2 == 0) {
+        // Successor is lost for its mover, so Q wins by moving there
+        uint8_t value = (uint8_t)(level + 2);
+        if (level + 1 > TB_MAX_DTM) return false;
+        if (!atomic_compare_exchange_strong(&gen->value[q], &zero, value)) return false;
+        update_max(&gen->max_value, value);
+        return true;
+    }
+
+    // Successor is won for its mover: one fewer way out for Q
+    if (atomic_fetch_sub(&gen->remaining[q], 1) != 1) return false;
+    if (gen->cap_win[q] || (gen->flags[q] & FLAG_ESCAPE)) return false;
+
+    int dtm = level + 1;
+    if (gen->cap_loss[q] && gen->cap_loss[q] - 1 > dtm) dtm = gen->cap_loss[q] - 1;
+    if (dtm > TB_MAX_DTM) return false;
+    if (!atomic_compare_exchange_strong(&gen->value[q], &zero, (uint8_t)(dtm + 1))) {
+        return false;
+    }
+    update_max(&gen->max_value, dtm + 1);
+    return true;
+}
+
+// Same geometry as xiangqi.c, walked backwards
+static const int orth_dr[4] = {-1, 1, 0, 0};
+static const int orth_dc[4] = {0, 0, -1, 1};
+static const int diag_dr[4] = {-1, -1, 1, 1};
+static const int diag_dc[4] = {-1, 1, -1, 1};
+static const int horse_dr[8] = {-2, -2, 2, 2, -1, 1, -1, 1};
+static const int horse_dc[8] = {-1, 1, -1, 1, -2, -2, 2, 2};
+static const int horse_leg_dr[8] = {-1, -1, 1, 1, 0, 0, 0, 0};
+static const int horse_leg_dc[8] = {0, 0, 0, 0, -1, -1, 1, 1};
+
+// Row step of a pawn moving forward
+static int pawn_forward(int side) { return side == XQ_RED ? -1 : 1; }
+
+// Un-move every piece of the side that just moved; quiet moves only, since
+// captures lead out of this table
+static uint64_t expand_position(tb_gen_t* gen, uint32_t index, int level) {
+    xq_position_t pos;
+    uint64_t assigned = 0;
+    if (!tb_decode(&gen->layout, index, &pos)) return 0;
+
+    int mover = pos.side ^ 1;
+    for (int to = 0; to < XQ_SQUARES; to++) {
+        uint8_t piece = pos.board[to];
+        if (!piece || XQ_SIDE(piece) != mover) continue;
+
+        int type = XQ_TYPE(piece);
+        int row = XQ_ROW(to), col = XQ_COL(to);
+        int from_list[32];
+        int count = 0;
+
+#define ON_BOARD(r, c) ((r) >= 0 && (r) < XQ_ROWS && (c) >= 0 && (c) < XQ_COLS)
+#define EMPTY_AT(r, c) (pos.board[XQ_SQ(r, c)] == XQ_EMPTY)
+
+        switch (type) {
+            case XQ_KING:
+                for (int d = 0; d < 4; d++) {
+                    int r = row + orth_dr[d], c = col + orth_dc[d];
+                    if (ON_BOARD(r, c) && EMPTY_AT(r, c)) from_list[count++] = XQ_SQ(r, c);
+                }
+                break;
+            case XQ_ADVISOR:
+                for (int d = 0; d < 4; d++) {
+                    int r = row + diag_dr[d], c = col + diag_dc[d];
+                    if (ON_BOARD(r, c) && EMPTY_AT(r, c)) from_list[count++] = XQ_SQ(r, c);
+                }
+                break;
+            case XQ_ELEPHANT:
+                for (int d = 0; d < 4; d++) {
+                    int r = row + 2 * diag_dr[d], c = col + 2 * diag_dc[d];
+                    if (ON_BOARD(r, c) && EMPTY_AT(r, c) &&
+                        EMPTY_AT(row + diag_dr[d], col + diag_dc[d])) {
+                        from_list[count++] = XQ_SQ(r, c);
+                    }
+                }
+                break;
+            case XQ_HORSE:
+                for (int d = 0; d < 8; d++) {
+                    int r = row - horse_dr[d], c = col - horse_dc[d];
+                    if (ON_BOARD(r, c) && EMPTY_AT(r, c) &&
+                        EMPTY_AT(r + horse_leg_dr[d], c + horse_leg_dc[d])) {
+                        from_list[count++] = XQ_SQ(r, c);
+                    }
+                }
+                break;
+            case XQ_CHARIOT:
+            case XQ_CANNON:
+                for (int d = 0; d < 4; d++) {
+                    int r = row + orth_dr[d], c = col + orth_dc[d];
+                    while (ON_BOARD(r, c) && EMPTY_AT(r, c)) {
+                        from_list[count++] = XQ_SQ(r, c);
+                        r += orth_dr[d];
+                        c += orth_dc[d];
+                    }
+                }
+                break;
+            case XQ_PAWN: {
+                int r = row - pawn_forward(mover);
+                if (ON_BOARD(r, col) && EMPTY_AT(r, col)) from_list[count++] = XQ_SQ(r, col);
+                // Sideways steps only happen across the river
+                bool crossed = mover == XQ_RED ? row <= 4 : row >= 5;
+                if (crossed) {
+                    if (col > 0 && EMPTY_AT(row, col - 1)) from_list[count++] = XQ_SQ(row, col - 1);
+                    if (col < XQ_COLS - 1 && EMPTY_AT(row, col + 1)) {
+                        from_list[count++] = XQ_SQ(row, col + 1);
+                    }
+                }
+                break;
+            }
+        }
+
+#undef ON_BOARD
+#undef EMPTY_AT
+
+        for (int i = 0; i < count; i++) {
+            int from = from_list[i];
+            if (!xq_square_allowed(mover, type, from)) continue;
+
+            pos.board[from] = piece;
+            pos.board[to] = XQ_EMPTY;
+            if (type == XQ_KING) pos.king_sq[mover] = from;
+            pos.side = mover;
+
+            uint32_t q;
+            // The side now not to move must not be in check
+            if (!xq_in_check(&pos, mover ^ 1) && tb_encode(&gen->layout, &pos, &q)) {
+                if (resolve_predecessor(gen, q, level)) assigned++;
+            }
+
+            pos.side = mover ^ 1;
+            if (type == XQ_KING) pos.king_sq[mover] = to;
+            pos.board[to] = piece;
+            pos.board[from] = XQ_EMPTY;
+        }
+    }
+    return assigned;
+}
+
+// =========================
+// Threaded passes
+// =========================
+
+static void* pass_worker(void* arg) {
+    pass_arg_t* pass = arg;
+    tb_gen_t* gen = pass->gen;
+    uint8_t target = (uint8_t)(pass->level + 1);
+
+    for (uint32_t i = pass->begin; i < pass->end; i++) {
+        switch (pass->kind) {
+            case PASS_INIT:
+                init_position(gen, i);
+                break;
+            case PASS_CAPTURE_WINS:
+                if (gen->cap_win[i] == target &&
+                    atomic_load_explicit(&gen->value[i], memory_order_relaxed) == 0) {
+                    atomic_store_explicit(&gen->value[i], target, memory_order_relaxed);
+                    pass->assigned++;
+                }
+                break;
+            case PASS_RETRO:
+                if (atomic_load_explicit(&gen->value[i], memory_order_relaxed) == target) {
+                    pass->assigned += expand_position(gen, i, pass->level);
+                }
+                break;
+        }
+    }
+    return NULL;
+}
+
+static uint64_t run_pass(tb_gen_t* gen, pass_kind_t kind, int level) {
+    pthread_t threads[TBGEN_MAX_THREADS];
+    pass_arg_t args[TBGEN_MAX_THREADS];
+    uint32_t chunk = (gen->layout.size + (uint32_t)thread_count - 1) / (uint32_t)thread_count;
+    uint64_t assigned = 0;
+
+    for (int t = 0; t < thread_count; t++) {
+        uint32_t begin = (uint32_t)t * chunk;
+        uint32_t end = begin + chunk;
+        if (begin > gen->layout.size) begin = gen->layout.size;
+        if (end > gen->layout.size) end = gen->layout.size;
+        args[t] = (pass_arg_t){gen, kind, level, begin, end, 0};
+        pthread_create(&threads[t], NULL, pass_worker, &args[t]);
+    }
+    for (int t = 0; t < thread_count; t++) {
+        pthread_join(threads[t], NULL);
+        assigned += args[t].assigned;
+    }
+    return assigned;
+}
+
+// =========================
+// Driver
+// =========================
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void table_path(const char* material, char* out, size_t size) {
+    snprintf(out, size, "%s/%s%s", out_dir, material, TABLEBASE_EXT);
+}
+
+static bool generate(const char* material);
+
+// Material set already available (as is or colour-swapped)
+static bool have_table(const char* material) {
+    char swapped[32], path[512];
+    tb_material_mirror(material, swapped, sizeof(swapped));
+    table_path(material, path, sizeof(path));
+    if (access(path, R_OK) == 0) return true;
+    table_path(swapped, path, sizeof(path));
+    return access(path, R_OK) == 0;
+}
+
+// Generate every table a capture from `layout` can lead to
+static bool generate_children(const tb_layout_t* layout) {
+    for (int s = 2; s < layout->slot_count; s++) {
+        // Same piece twice gives the same child
+        if (layout->slot_side[s] == layout->slot_side[s - 1] &&
+            layout->slot_type[s] == layout->slot_type[s - 1]) {
+            continue;
+        }
+        xq_position_t dummy;
+        memset(&dummy, 0, sizeof(dummy));
+        // Build the child material from a board with one piece fewer
+        int sq = 0;
+        for (int k = 0; k < layout->slot_count; k++) {
+            if (k == s) continue;
+            dummy.board[sq++] = XQ_PIECE(layout->slot_side[k], layout->slot_type[k]);
+        }
+        char child[32];
+        tb_material_of(&dummy, child, sizeof(child));
+        if (tb_material_has_attackers(child) && !have_table(child) && !generate(child)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool generate(const char* material) {
+    tb_gen_t gen;
+    char path[512];
+
+    memset(&gen, 0, sizeof(gen));
+    if (!tb_layout_from_material(material, &gen.layout)) {
+        fprintf(stderr, "Unsupported material '%s' (at most %d pieces besides kings, "
+                        "%u positions)\n",
+                material, TB_MAX_EXTRA_PIECES, TB_MAX_ENTRIES);
+        return false;
+    }
+    if (!tb_material_has_attackers(gen.layout.material)) {
+        printf("%s: dead draw, no table needed\n", gen.layout.material);
+        return true;
+    }
+    if (have_table(gen.layout.material)) {
+        printf("%s: already generated\n", gen.layout.material);
+        return true;
+    }
+    if (!generate_children(&gen.layout)) return false;
+
+    uint32_t n = gen.layout.size;
+    gen.value = calloc(n, sizeof(*gen.value));
+    gen.remaining = calloc(n, sizeof(*gen.remaining));
+    gen.cap_win = calloc(n, 1);
+    gen.cap_loss = calloc(n, 1);
+    gen.flags = calloc(n, 1);
+    atomic_init(&gen.max_value, 0);
+    atomic_init(&gen.missing, 0);
+
+    bool ok = gen.value && gen.remaining && gen.cap_win && gen.cap_loss && gen.flags;
+    if (ok) {
+        double start = now_sec();
+        run_pass(&gen, PASS_INIT, 0);
+
+        int level = 0;
+        for (; level < TB_MAX_DTM && level + 1 <= atomic_load(&gen.max_value); level++) {
+            if (level % 2 == 1) run_pass(&gen, PASS_CAPTURE_WINS, level);
+            run_pass(&gen, PASS_RETRO, level);
+        }
+
+        uint64_t wins = 0, losses = 0, draws = 0;
+        int longest = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            uint8_t v = atomic_load_explicit(&gen.value[i], memory_order_relaxed);
+            if (v == TB_ILLEGAL) continue;
+            if (v == TB_DRAW) {
+                draws++;
+                continue;
+            }
+            if (v - 1 > longest) longest = v - 1;
+            if ((v - 1) % 2) wins++;
+            else losses++;
+        }
+
+        table_path(gen.layout.material, path, sizeof(path));
+        // The values array doubles as the output table once generation is done
+        ok = tb_write_file(path, &gen.layout, (const uint8_t*)gen.value) &&
+             tablebase_load_file(path);
+
+        struct stat st;
+        long size = stat(path, &st) == 0 ? (long)st.st_size : 0;
+        printf("%s: %u entries, %llu win / %llu loss / %llu draw, longest mate %d plies, "
+               "%ld bytes, %.2fs%s\n",
+               gen.layout.material, n, (unsigned long long)wins,
+               (unsigned long long)losses, (unsigned long long)draws, longest, size,
+               now_sec() - start, ok ? "" : " (write failed)");
+        if (atomic_load(&gen.missing)) {
+            printf("%s: %llu captures into missing tables were scored as draws\n",
+                   gen.layout.material, (unsigned long long)atomic_load(&gen.missing));
+        }
+    }
+
+    free(gen.value);
+    free(gen.remaining);
+    free(gen.cap_win);
+    free(gen.cap_loss);
+    free(gen.flags);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "o:t:")) != -1) {
+        switch (opt) {
+            case 'o':
+                out_dir = optarg;
+                break;
+            case 't':
+                thread_count = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-o dir] [-t threads] [MATERIAL ...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > TBGEN_MAX_THREADS) thread_count = TBGEN_MAX_THREADS;
+
+    xq_init();
+    mkdir(out_dir, 0755);
+    tablebase_init(out_dir);
+
+    const char** sets = default_sets;
+    int set_count = (int)(sizeof(default_sets) / sizeof(default_sets[0]));
+    if (optind < argc) {
+        sets = (const char**)&argv[optind];
+        set_count = argc - optind;
+    }
+
+    printf("Generating %d material sets into %s with %d threads\n", set_count, out_dir,
+           thread_count);
+    int failed = 0;
+    for (int i = 0; i < set_count; i++) {
+        if (!generate(sets[i])) failed++;
+    }
+
+    tablebase_shutdown();
+    return failed ? 1 : 0;
+}
@@ -15,6 +15,10 @@ CREATE TABLE Users (
     email NVARCHAR(128) UNIQUE NOT NULL,
     password_hash NVARCHAR(128) NOT NULL,
     rating INT DEFAULT 1200,
+    -- Glicko-2: how uncertain the rating is and how erratic the player's
+    -- results are. The leaderboard ranks by rating - 2 * rating_rd.
+    rating_rd FLOAT NOT NULL DEFAULT 350,
+    rating_volatility FLOAT NOT NULL DEFAULT 0.06,
     wins INT DEFAULT 0,
     losses INT DEFAULT 0,
     draws INT DEFAULT 0,
@@ -29,10 +33,16 @@ CREATE TABLE Matches (
     match_id NVARCHAR(64) PRIMARY KEY,
     red_user_id INT NOT NULL,
     black_user_id INT NOT NULL,
-    result NVARCHAR(16) CHECK (result IN ('red_win', 'black_win', 'draw', 'ongoing')),
+    -- Values the server writes; a rated game's row is inserted in the same
+    -- transaction as the rating update, so a rejected value undoes both
+    result NVARCHAR(16) CONSTRAINT CK_Matches_Result
+        CHECK (result IN ('red_wins', 'black_wins', 'draw', 'aborted',
+                          'red_win', 'black_win', 'ongoing')),
     moves_json NVARCHAR(MAX),
+    start_fen NVARCHAR(100) NULL,  -- NULL = standard start
     started_at NVARCHAR(32),
     ended_at NVARCHAR(32),
+    rated BIT NOT NULL DEFAULT 0,  -- Set with the rating update; replayed by ratingreplay
     FOREIGN KEY (red_user_id) REFERENCES Users(user_id),
     FOREIGN KEY (black_user_id) REFERENCES Users(user_id),
     INDEX IX_Matches_Users (red_user_id, black_user_id),
@@ -40,6 +50,19 @@ CREATE TABLE Matches (
 );
 GO
 
+-- Post-game analysis (written by the server's background analysis workers).
+-- Guarded so the script can be re-run on a database that predates it.
+IF OBJECT_ID('MatchAnalysis', 'U') IS NULL
+CREATE TABLE MatchAnalysis (
+    match_id NVARCHAR(64) PRIMARY KEY,
+    red_accuracy INT,
+    black_accuracy INT,
+    annotations_json NVARCHAR(MAX),
+    analyzed_at DATETIME DEFAULT GETDATE(),
+    FOREIGN KEY (match_id) REFERENCES Matches(match_id)
+);
+GO
+
 -- Sessions table (optional - for persistent sessions)
 CREATE TABLE Sessions (
     session_token NVARCHAR(64) PRIMARY KEY,
@@ -52,6 +75,43 @@ CREATE TABLE Sessions (
 );
 GO
 
+-- Upgrades for a database created by an older version of this script.
+-- Each step checks first, so re-running them is harmless.
+IF COL_LENGTH('Matches', 'start_fen') IS NULL
+    ALTER TABLE Matches ADD start_fen NVARCHAR(100) NULL;
+GO
+
+-- The result CHECK was unnamed and narrower: drop it and add the named one
+IF OBJECT_ID('CK_Matches_Result', 'C') IS NULL
+BEGIN
+    DECLARE @drop NVARCHAR(MAX) = N'';
+    SELECT @drop += N'ALTER TABLE Matches DROP CONSTRAINT ' + QUOTENAME(cc.name) + N';'
+    FROM sys.check_constraints cc
+    JOIN sys.columns c ON c.object_id = cc.parent_object_id
+                      AND c.column_id = cc.parent_column_id
+    WHERE cc.parent_object_id = OBJECT_ID('Matches') AND c.name = 'result';
+    EXEC sp_executesql @drop;
+
+    ALTER TABLE Matches ADD CONSTRAINT CK_Matches_Result
+        CHECK (result IN ('red_wins', 'black_wins', 'draw', 'aborted',
+                          'red_win', 'black_win', 'ongoing'));
+END
+GO
+
+-- Glicko-2: existing players start at a new player's deviation
+IF COL_LENGTH('Users', 'rating_rd') IS NULL
+    ALTER TABLE Users ADD rating_rd FLOAT NOT NULL DEFAULT 350;
+GO
+
+IF COL_LENGTH('Users', 'rating_volatility') IS NULL
+    ALTER TABLE Users ADD rating_volatility FLOAT NOT NULL DEFAULT 0.06;
+GO
+
+-- Games stored before this column are left out of ratingreplay
+IF COL_LENGTH('Matches', 'rated') IS NULL
+    ALTER TABLE Matches ADD rated BIT NOT NULL DEFAULT 0;
+GO
+
 INSERT INTO Users (username, email, password_hash, rating, wins, losses, draws)
 VALUES ('testuser', 'test@example.com', 'd91da15b07b01fb413e31be527f05b9563b0515652b0515672b0bcb1ca2a6185', 1200, 0, 0, 0);
 -- Pass: test123 of testUser
@@ -40,6 +40,8 @@ class NetworkGameController extends GameController {
         this.isMyTurn = false;
         this.isSpectator = false; // Spectator mode flag
         this.pendingBoardContainerId = boardContainerId;
+        this.readyPlayers = new Map(); // user_id -> { user_id, username, rating }
+        this.lobbySeq = 0;             // seq of the last lobby_presence applied
 
         // Callbacks
         this.onMatchFound = null;
@@ -49,6 +51,7 @@ class NetworkGameController extends GameController {
         this.onChatMessage = null;
         this.onDrawOffer = null;       // Callback khi nhận lời mời hòa
         this.onChallengeReceived = null; // Callback khi nhận thách đấu
+        this.onReadyListChanged = null;  // Callback khi ready list thay đổi
     }
     
     /**
@@ -95,7 +98,7 @@ class NetworkGameController extends GameController {
         });
 
         this.network.on("chat_message", (msg) => this.handleChatMessage(msg.payload));
-        this.network.on("ready_list_update", (msg) => this.handleReadyListUpdate(msg.payload));
+        this.network.on("lobby_presence", (msg) => this.handleLobbyPresence(msg.payload));
     }
 
     // Register new user
@@ -148,7 +151,24 @@ class NetworkGameController extends GameController {
     }
 
     // Set ready status
-    async setReady(ready = true) { return this.network.setReady(ready); }
+    async setReady(ready = true) {
+        const response = await this.network.setReady(ready);
+        if (ready) await this.refreshLobby();
+        return response;
+    }
+
+    // Reload the whole ready list (on entering the lobby or after a gap)
+    async refreshLobby() {
+        try {
+            const response = await this.network.getLobbySnapshot();
+            const snapshot = response.payload;
+            this.readyPlayers = new Map(snapshot.players.map((p) => [p.user_id, p]));
+            this.lobbySeq = snapshot.seq;
+            this.notifyReadyListChanged();
+        } catch (error) {
+            console.error("[NetworkGame] Lobby snapshot failed:", error);
+        }
+    }
 
     // Join/rejoin a match (used when reconnecting to game.html)
     // This sends a message to server so it associates this connection with user_id
@@ -414,11 +434,10 @@ class NetworkGameController extends GameController {
         }
     }
 
-    // Get leaderboard
-    async getLeaderboard(limit = 10, offset = 0) {
+    // Get leaderboard (options: { around, user_id })
+    async getLeaderboard(limit = 10, offset = 0, options = {}) {
         try {
-            const response = await this.network.getLeaderboard(limit, offset);
-            return response.payload;
+            return await this.network.getLeaderboard(limit, offset, options);
         } catch (error) {
             console.error("[NetworkGame] Get leaderboard failed:", error);
             throw error;
@@ -437,9 +456,31 @@ class NetworkGameController extends GameController {
     }
 
     // Handle ready list update
-    handleReadyListUpdate(payload) {
-        console.log("[NetworkGame] Ready players:", payload);
-        // UI can display this list
+    // Apply a ready-list diff; a gap in seq means one was missed
+    handleLobbyPresence(payload) {
+        if (payload.seq <= this.lobbySeq) return;
+        if (payload.seq !== this.lobbySeq + 1) {
+            this.refreshLobby();
+            return;
+        }
+
+        payload.joined.forEach((p) => this.readyPlayers.set(p.user_id, p));
+        payload.left.forEach((userId) => this.readyPlayers.delete(userId));
+        payload.rating.forEach((r) => {
+            const player = this.readyPlayers.get(r.user_id);
+            if (player) player.rating = r.rating;
+        });
+        this.lobbySeq = payload.seq;
+        this.notifyReadyListChanged();
+    }
+
+    notifyReadyListChanged() {
+        const players = Array.from(this.readyPlayers.values());
+        if (this.onReadyListChanged) {
+            this.onReadyListChanged(players);
+        } else {
+            console.log("[NetworkGame] Ready players:", players);
+        }
     }
 
     // Send challenge
@@ -151,6 +151,19 @@ class NetworkBridge {
 
             
 
+            // Answer server RTT probes right away so the measured round trip
+            // is not inflated by the rest of the message handling
+            if (message.type === 'ping' && message.payload) {
+                try {
+                    this.send('pong', {
+                        ping_id: message.payload.ping_id,
+                        server_time_ms: message.payload.server_time_ms,
+                    });
+                } catch (e) {}
+                this.emit('ping', message);
+                return;
+            }
+
             // Store session token (server may put token at top-level or inside payload)
             if (message.token) {
                 this.sessionToken = message.token;
@@ -439,19 +452,37 @@ class NetworkBridge {
     }
 
     /**
-     * Find match
+     * Get the full ready list; lobby_presence events with a higher seq
+     * apply on top of it
+     */
+    getLobbySnapshot() {
+        return this.sendAndWait("get_lobby_snapshot", {}, "get_lobby_snapshot");
+    }
+
+    /**
+     * Find match (options: baseMs / incrementMs pick the time control queue,
+     * fen queues for a custom start position, always unrated)
      */
-    async findMatch(matchType = "random", ratingTolerance = 100, timeout = 60000) {
+    async findMatch(matchType = "random", ratingTolerance = 100, timeout = 60000, botLevel = 0,
+                    options = {}) {
         // Send a matchmaking request and wait for a later unsolicited `match_found` event.
         // Some servers immediately reply "No opponent found" but will later emit
         // a `match_found` event when an opponent becomes available. Treat the
         // immediate response as an acknowledgement and wait for the event instead
         // of rejecting the promise.
         try {
-            this.send("find_match", {
-                mode: matchType === 'rated' ? 'rated' : 'random',
+            // botLevel > 0: play a bot of that level if nobody is found in time
+            // ("bot" mode starts the bot game right away)
+            const mode = matchType === 'rated' || matchType === 'bot' ? matchType : 'random';
+            const payload = {
+                mode,
                 rating_tolerance: ratingTolerance,
-            });
+                bot_level: botLevel,
+            };
+            if (options.baseMs) payload.base_ms = options.baseMs;
+            if (options.incrementMs) payload.increment_ms = options.incrementMs;
+            if (options.fen) payload.fen = options.fen;
+            this.send("find_match", payload);
         } catch (err) {
             return Promise.reject(err);
         }
@@ -486,6 +517,50 @@ class NetworkBridge {
         });
     }
 
+    /**
+     * Ask the server engine for the best move (unrated games only)
+     */
+    getHint(matchId, timeMs = 1000) {
+        return this.sendAndWait("get_hint", { match_id: matchId, time_ms: timeMs }, null, timeMs + 10000);
+    }
+
+    /**
+     * Exact endgame result and best move from the server tablebases
+     */
+    probeTablebase(matchId) {
+        return this.sendAndWait("probe_tablebase", { match_id: matchId });
+    }
+
+    /**
+     * Opening statistics for a FEN (or a match's current position; start position if neither)
+     */
+    openingExplorer(fen = null, matchId = null) {
+        const payload = {};
+        if (fen) payload.fen = fen;
+        else if (matchId) payload.match_id = matchId;
+        return this.sendAndWait("opening_explorer", payload);
+    }
+
+    /**
+     * Queue a premove, played by the server as soon as the opponent moves
+     */
+    sendPremove(matchId, fromRow, fromCol, toRow, toCol) {
+        return this.send("premove", {
+            match_id: matchId,
+            from_row: fromRow,
+            from_col: fromCol,
+            to_row: toRow,
+            to_col: toCol,
+        });
+    }
+
+    /**
+     * Cancel the queued premove
+     */
+    cancelPremove(matchId) {
+        return this.send("premove", { match_id: matchId, cancel: true });
+    }
+
     /**
      * Resign
      */
@@ -511,18 +586,20 @@ class NetworkBridge {
     }
 
     /**
-     * Get leaderboard
+     * Get leaderboard page: { total, offset, user_rank, leaderboard }.
+     * options.around centers the page on options.user_id (default: self).
      */
-    async getLeaderboard(limit = 10, offset = 0) {
+    async getLeaderboard(limit = 10, offset = 0, options = {}) {
         const response = await this.sendAndWait(
             "leaderboard",
             {
                 limit,
                 offset,
+                ...options,
             },
             "leaderboard"
         );
-        return response.payload.leaderboard || [];
+        return response.payload;
     }
 
     /**
@@ -539,13 +616,15 @@ class NetworkBridge {
     }
 
     /**
-     * Send challenge
+     * Send challenge (fen: optional custom start position, always unrated)
      */
-    sendChallenge(opponentId, timeLimit = 600) {
-        return this.send("challenge", {
+    sendChallenge(opponentId, timeLimit = 600, fen = null) {
+        const payload = {
             opponent_id: opponentId,
             time_limit: timeLimit,
-        });
+        };
+        if (fen) payload.fen = fen;
+        return this.send("challenge", payload);
     }
 
     /**
@@ -558,6 +637,13 @@ class NetworkBridge {
         });
     }
 
+    /**
+     * Pending challenges: { incoming: [...], outgoing: [...] }, newest first
+     */
+    getChallenges() {
+        return this.sendAndWait("get_challenges", {}, "get_challenges");
+    }
+
     /**
      * Send heartbeat
      */
@@ -665,10 +751,14 @@ class NetworkBridge {
     // =========================
 
     /**
-     * Get list of live matches for spectating
+     * Get list of live matches for spectating, newest first
+     * @param {Object} [options] - Optional filters and paging:
+     *   min_rating, max_rating, speed ("bullet"|"blitz"|"rapid"|"classical"),
+     *   min_spectators, cursor (next_cursor of the previous page), limit,
+     *   if_version (answer is { unchanged: true } if the list has not changed)
      */
-    getLiveMatches() {
-        return this.sendAndWait("get_live_matches", {}, "get_live_matches");
+    getLiveMatches(options = {}) {
+        return this.sendAndWait("get_live_matches", options, "get_live_matches");
     }
 
     /**
@@ -691,6 +781,20 @@ class NetworkBridge {
         }, "leave_spectate");
     }
 
+    /**
+     * Ask for the match events after fromSeq (after a gap in event_seq).
+     * Missed events are re-delivered first; the response is either
+     * { mode: "delta", count } or { mode: "snapshot", snapshot }.
+     * @param {string} matchId - The match being watched
+     * @param {number} fromSeq - Last event_seq received in order
+     */
+    resyncFrom(matchId, fromSeq) {
+        return this.sendAndWait("resync_from", {
+            match_id: matchId,
+            from_seq: fromSeq
+        }, "resync_from");
+    }
+
     // =========================
     // Profile Functions
     // =========================